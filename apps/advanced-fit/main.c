@@ -6,134 +6,8 @@
 #include <levmar.h>
 #include <io.h>
 #include <color-converter.h>
-
-typedef struct {
-    size_t n_patches;
-    size_t n_exposures;
-
-    // 3 * n_patches array
-    // -------------------
-    // reference_patches(idx_patch, idx_color)
-    //     = reference_patches[3 * idx_patch + idx_color]
-    const float* reference_patches;
-
-    // 3 * n_patches * n_exposures array
-    // ---------------------------------
-    // measured_patches(idx_exposure, idx_patch, idx_color)
-    //     = measured_patches[3 * (idx_patch * n_exposures + idx_exposure) + idx_color]
-    const float* measured_patches;
-
-    // n_patches * n_exposures array
-    // -----------------------------
-    // select_patch(idx_exposure, idx_patch)
-    //     = select_patch[idx_patch * n_exposures + idx_exposure]
-    const int* select_patch;
-
-    //const float *weigth_patch; // FUTURE
-} fit_params;
-
-
-void measure(float* pParameters, float* pMeasurements, int n_parameters, int n_measurements, void* pUserParam)
-{
-    (void)n_parameters;
-    (void)n_measurements;
-
-    const fit_params* info = (fit_params*)pUserParam;
-
-    float tristim_mea_corrected[3];
-    float lab_ref[3];
-    float lab_mea[3];
-
-    // First 9 parameters are the matrix components
-    const float* optimized_matrix = &pParameters[0];
-
-    // Next ones are exposition correction
-    size_t measurement_idx = 0;
-
-    // For each patch, we try to minimize the Delta_E_2000 between reference and measurement
-    for (size_t patch_idx = 0; patch_idx < info->n_patches; patch_idx++) {
-        const float* tristim_ref = &(info->reference_patches[3 * patch_idx]);
-        const size_t offset      = patch_idx * info->n_exposures;
-
-        for (size_t exposure_idx = 0; exposure_idx < info->n_exposures; exposure_idx++) {
-            if (info->select_patch[offset + exposure_idx] != 0) {
-                const float* tristim_mea = &(info->measured_patches[3 * (offset + exposure_idx)]);
-
-                // Apply the correction matrix which is optimized by levmar
-                //matmul(optimized_matrix, tristim_mea_exposed, tristim_mea_corrected);
-                tristim_mea_corrected[0] = optimized_matrix[3 * exposure_idx + 6] * tristim_mea[0]
-                                           + optimized_matrix[0] * tristim_mea[1]
-                                           + optimized_matrix[1] * tristim_mea[2];
-                tristim_mea_corrected[1] = optimized_matrix[2] * tristim_mea[0]
-                                           + optimized_matrix[3 * exposure_idx + 7] * tristim_mea[1]
-                                           + optimized_matrix[3] * tristim_mea[2];
-                tristim_mea_corrected[2] = optimized_matrix[4] * tristim_mea[0] + optimized_matrix[5] * tristim_mea[1]
-                                           + optimized_matrix[3 * exposure_idx + 8] * tristim_mea[2];
-
-                // Transform colorspaces to Lab*
-                XYZ_to_Lab(tristim_ref, lab_ref);
-                XYZ_to_Lab(tristim_mea_corrected, lab_mea);
-
-                // The error is the Delta_E_2000 between reference and corrected Lab* values
-                pMeasurements[measurement_idx++] = deltaE_2000(lab_ref, lab_mea);
-            }
-        }
-    }
-}
-
-
-int load_list_file(const char* filename, char*** listfile, size_t* n_elem)
-{
-    FILE*  fin      = fopen(filename, "r");
-    char** filelist = NULL;
-
-    if (fin == NULL) {
-        fprintf(stderr, "Cannot open file %s", filename);
-        return -1;
-    }
-
-    while (!feof(fin)) {
-        (*n_elem)++;
-        char** filelist_temp = (char**)realloc(filelist, (*n_elem) * sizeof(char*));
-
-        if (filelist_temp == NULL) {
-            fprintf(stderr, "Memory allocation error\n");
-            for (size_t i = 0; i < *n_elem; i++) {
-                free(filelist[i]);
-            }
-
-            free(filelist);
-            fclose(fin);
-            return -1;
-        }
-
-        filelist = filelist_temp;
-
-        filelist[(*n_elem) - 1] = (char*)calloc(1024, sizeof(char));
-        char* currEelement      = filelist[(*n_elem) - 1];
-
-        if (currEelement == NULL) {
-            fprintf(stderr, "Memory allocation error\n");
-            for (size_t i = 0; i < *n_elem; i++) {
-                free(filelist[i]);
-            }
-
-            free(filelist);
-            fclose(fin);
-
-            return -1;
-        }
-
-        fscanf(fin, "%s\n", currEelement);
-    }
-
-    fclose(fin);
-
-    *listfile = filelist;
-
-    return 0;
-}
-
+#include <fitting.h>
+#include <patches.h>
 
 int load_patches_files(const char* filename, size_t* n_files, size_t n_patches, float** values, int** selected_patches)
 {
@@ -150,11 +24,6 @@ int load_patches_files(const char* filename, size_t* n_files, size_t n_patches,
 
     if (ret != 0) {
         fprintf(stderr, "Could not read file list %s\n", filename);
-        for (size_t i = 0; i < *n_files; i++) {
-            free(filelist[i]);
-        }
-
-        free(filelist);
         return -1;
     }
 
@@ -182,11 +51,7 @@ int load_patches_files(const char* filename, size_t* n_files, size_t n_patches,
         }
 
         if (error) {
-            for (size_t i = 0; i < *n_files; i++) {
-                free(filelist[i]);
-            }
-
-            free(filelist);
+            free_list_file(filelist, *n_files);
             free(current_values);
             free(*values);
             free(*selected_patches);
@@ -209,13 +74,78 @@ int load_patches_files(const char* filename, size_t* n_files, size_t n_patches,
     }
 
 
-    for (size_t i = 0; i < *n_files; i++) {
-        free(filelist[i]);
+    free_list_file(filelist, *n_files);
+
+    return 0;
+}
+
+
+// Weights of the patches from the statistics files written by
+// extract-patches, in the order of load_patches_files. Clipped patches are
+// unselected
+int load_statistics_files(
+  const char* filename, size_t n_files, size_t n_patches, float** weights, int* selected_patches)
+{
+    size_t n_statistics_files = 0;
+    char** filelist           = NULL;
+
+    int ret = load_list_file(filename, &filelist, &n_statistics_files);
+
+    if (ret != 0 || n_statistics_files != n_files) {
+        fprintf(stderr, "Could not read statistics file list %s\n", filename);
+
+        free_list_file(filelist, n_statistics_files);
+        return -1;
     }
 
-    free(filelist);
+    float*  means     = (float*)calloc(3 * n_files * n_patches, sizeof(float));
+    float*  variances = (float*)calloc(3 * n_files * n_patches, sizeof(float));
+    size_t* n_pixels  = (size_t*)calloc(n_files * n_patches, sizeof(size_t));
 
-    return 0;
+    *weights = (float*)calloc(n_files * n_patches, sizeof(float));
+
+    for (size_t i = 0; i < n_files && ret == 0; i++) {
+        PatchStatistics* statistics = NULL;
+        size_t           size       = 0;
+
+        ret = load_patch_statistics(filelist[i], &statistics, &size);
+
+        if (ret != 0 || size != n_patches) {
+            fprintf(stderr, "Could not read statistics file %s\n", filelist[i]);
+            ret = -1;
+        } else {
+            for (size_t p = 0; p < n_patches; p++) {
+                const size_t idx = p * n_files + i;
+
+                for (int c = 0; c < 3; c++) {
+                    means[3 * idx + c]     = statistics[p].mean[c];
+                    variances[3 * idx + c] = statistics[p].variance[c];
+                }
+
+                n_pixels[idx] = statistics[p].n_pixels;
+
+                if (statistics[p].n_clipped > FIT_MAX_CLIPPED_FRACTION * statistics[p].n_pixels) {
+                    selected_patches[idx] = 0;
+                }
+            }
+        }
+
+        free(statistics);
+    }
+
+    if (ret == 0) {
+        fit_patch_weights(means, variances, n_pixels, n_files * n_patches, *weights);
+    } else {
+        free(*weights);
+        *weights = NULL;
+    }
+
+    free_list_file(filelist, n_files);
+    free(means);
+    free(variances);
+    free(n_pixels);
+
+    return ret;
 }
 
 
@@ -226,7 +156,11 @@ int main(int argc, char* argv[])
         printf(
           "Usage:\n"
           "------\n"
-          "extract-matrix <data_xyz_ref> <list_data_measured> <output_matrix> <output_exposure>\n");
+          "extract-matrix <data_xyz_ref> <list_data_measured> <output_matrix> <output_exposure> "
+          "[list_data_statistics]\n"
+          "With the statistics written by extract-patches for each measured file, patches\n"
+          "are weighted by the inverse of the relative variance of their mean and clipped\n"
+          "patches are left out.\n");
 
         return 0;
     }
@@ -235,10 +169,12 @@ int main(int argc, char* argv[])
     const char* filename_patches_measured_list = argv[2];
     const char* filename_output_matrix         = argv[3];
     const char* filename_output_exposure       = argv[4];
+    const char* filename_statistics_list       = (argc > 5) ? argv[5] : NULL;
 
     float* macbeth_patches_reference_xyz = NULL;
     float* macbeth_patches_measured      = NULL;
     int*   selected_patches              = NULL;
+    float* weights                       = NULL;
     float* mul_values                    = NULL;
     size_t n_patches                     = 0;
     size_t n_exposures                   = 0;
@@ -262,39 +198,22 @@ int main(int argc, char* argv[])
         goto error;
     }
 
-    mul_values = (float*)calloc(3 * n_exposures, sizeof(float));
-
-    size_t n_measurements = 0;
+    if (filename_statistics_list != NULL) {
+        err = load_statistics_files(filename_statistics_list, n_exposures, n_patches, &weights, selected_patches);
 
-    // Renormalize patch values
-    for (size_t idx_expo = 0; idx_expo < n_exposures; idx_expo++) {
-        float max = 0;
-        for (size_t idx_patch = 0; idx_patch < n_patches; idx_patch++) {
-            if (selected_patches[idx_patch * n_exposures + idx_expo]) {
-                for (int c = 0; c < 3; c++) {
-                    // max = fmaxf(max, macbeth_patches_measured[3 * (idx_patch * n_exposures + idx_expo) + c]);
-
-                    ++n_measurements;
-                }
-            }
+        if (err != 0) {
+            fprintf(stderr, "Could not load patches statistics files\n");
+            goto error;
         }
-
-        //   for (int c = 0; c < 3; c++)
-        //   {
-        //     mul_values[3 * idx_expo + c] = max;
-        //   }
-
-        //   for (size_t idx_patch = 0; idx_patch < n_patches; idx_patch++)
-        //   {
-        //     for (int c = 0; c < 3; c++)
-        //     {
-        //       macbeth_patches_measured[3 * (idx_patch * n_exposures + idx_expo) + c] /= max;
-        //     }
-        //   }
     }
 
-    fit_params u_params
-      = {n_patches, n_exposures, macbeth_patches_reference_xyz, macbeth_patches_measured, selected_patches};
+    mul_values = (float*)calloc(3 * n_exposures, sizeof(float));
+
+    FitPatches u_params
+      = {n_patches, n_exposures, macbeth_patches_reference_xyz, macbeth_patches_measured, selected_patches, weights};
+
+    // One Delta E per selected patch and exposure
+    const size_t n_measurements = fit_n_measurements(&u_params);
 
     size_t n_params = 6 + 3 * n_exposures;
     optim_params    = (float*)calloc(n_params, sizeof(float));
@@ -319,7 +238,18 @@ int main(int argc, char* argv[])
 
     float fit_info[9];
 
-    slevmar_dif(measure, optim_params, NULL, n_params, n_measurements, 1000, NULL, fit_info, NULL, NULL, &u_params);
+    slevmar_dif(
+      fit_residuals_exposures,
+      optim_params,
+      NULL,
+      n_params,
+      n_measurements,
+      1000,
+      NULL,
+      fit_info,
+      NULL,
+      NULL,
+      &u_params);
 
     printf("||e||_2 at initial p:             %f\n", fit_info[0]);
     printf("||e||_2 at etimated p:            %f\n", fit_info[1]);
@@ -383,6 +313,7 @@ error:
     free(macbeth_patches_reference_xyz);
     free(macbeth_patches_measured);
     free(selected_patches);
+    free(weights);
     free(mul_values);
     free(optim_params);
 
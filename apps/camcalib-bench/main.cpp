@@ -0,0 +1,1178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <image.h>
+#include <synthetic.h>
+#include <levmar.h>
+#include <color-converter.h>
+#include <fitting.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#    include <omp.h>
+#endif
+
+#ifndef _WIN32
+#    include <unistd.h>
+#endif
+
+struct BenchOptions {
+    std::vector<std::pair<size_t, size_t>> sizes;
+    std::vector<int>                       threads;
+    int                                    warmup;
+    int                                    repetitions;
+    std::string                            filter;
+    std::string                            tmp_dir;
+};
+
+struct BenchResult {
+    std::string name;
+    size_t      width;
+    size_t      height;
+    int         threads;
+    int         warmup;
+    int         repetitions;
+    double      median_ms;
+    double      p95_ms;
+    double      mb_per_s;
+};
+
+
+static int max_threads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+
+static void set_threads(int n_threads)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(n_threads);
+#else
+    (void)n_threads;
+#endif
+}
+
+
+static std::string host_name()
+{
+#ifndef _WIN32
+    char name[256] = {0};
+
+    if (gethostname(name, sizeof(name) - 1) == 0) {
+        return name;
+    }
+#endif
+    return "unknown";
+}
+
+
+/**
+ * Times a benchmark: warmup runs are discarded, then the median and the 95th
+ * percentile of the repetitions are reported. The throughput is computed
+ * from the number of bytes read and written by one run.
+ *
+ * fn returns 0 if the run succeeded. A failing run (e.g. an image format
+ * not compiled in) skips the benchmark.
+ */
+template<typename Fn>
+static void run_benchmark(
+  const BenchOptions&       options,
+  const std::string&        name,
+  size_t                    width,
+  size_t                    height,
+  int                       threads,
+  double                    bytes,
+  Fn                        fn,
+  std::vector<BenchResult>& results)
+{
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+        return;
+    }
+
+    set_threads(threads);
+
+    for (int i = 0; i < options.warmup; i++) {
+        if (fn() != 0) {
+            std::cerr << "Skipping " << name << ": run failed" << std::endl;
+            return;
+        }
+    }
+
+    std::vector<double> times_ms;
+
+    for (int i = 0; i < options.repetitions; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        const int  err   = fn();
+        const auto end   = std::chrono::steady_clock::now();
+
+        if (err != 0) {
+            std::cerr << "Skipping " << name << ": run failed" << std::endl;
+            return;
+        }
+
+        times_ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    std::sort(times_ms.begin(), times_ms.end());
+
+    const size_t n   = times_ms.size();
+    const size_t p95 = std::min(n - 1, (size_t)ceil(0.95 * n) - 1);
+
+    BenchResult r;
+    r.name        = name;
+    r.width       = width;
+    r.height      = height;
+    r.threads     = threads;
+    r.warmup      = options.warmup;
+    r.repetitions = options.repetitions;
+    r.median_ms   = (n % 2 == 0) ? .5 * (times_ms[n / 2 - 1] + times_ms[n / 2]) : times_ms[n / 2];
+    r.p95_ms      = times_ms[p95];
+    r.mb_per_s    = (r.median_ms > 0) ? bytes / (1024. * 1024.) / (r.median_ms * 1e-3) : 0;
+
+    // Progress goes to stderr so that the JSON can be written to stdout
+    fprintf(
+      stderr,
+      "%-28s %5zux%-5zu %3d threads  median %10.3f ms  p95 %10.3f ms  %10.1f MB/s\n",
+      r.name.c_str(),
+      r.width,
+      r.height,
+      r.threads,
+      r.median_ms,
+      r.p95_ms,
+      r.mb_per_s);
+
+    results.push_back(r);
+}
+
+
+// Synthetic Macbeth chart (RGGB) so that the demosaicing methods work on
+// realistic edges and noise
+static void fill_mosaic(float* bayered_pixels, size_t width, size_t height)
+{
+    const float peaks[3]  = {600.f, 535.f, 455.f};
+    const float widths[3] = {35.f, 40.f, 30.f};
+
+    SyntheticOptions options;
+    synthetic_default_options(&options);
+    options.width  = width;
+    options.height = height;
+
+    float sensitivities[3 * SYNTHETIC_N_WAVELENGTHS];
+    float patches_rgb[3 * SYNTHETIC_N_PATCHES];
+    float background_rgb[3];
+
+    synthetic_gaussian_sensitivities(peaks, widths, sensitivities);
+    synthetic_chart_colors(&options, NULL, sensitivities, patches_rgb, background_rgb);
+    synthetic_render_mosaic(&options, patches_rgb, background_rgb, bayered_pixels);
+}
+
+
+static int write_dat_capture(
+  const std::string& filename_txt, const std::string& filename_dat, const float* bayered_pixels, size_t width, size_t height)
+{
+    const size_t bit_depth = 12;
+
+    int err = write_dat(filename_dat.c_str(), bayered_pixels, width, height, bit_depth);
+
+    if (err != 0) {
+        return err;
+    }
+
+    const std::string name_dat = filename_dat.substr(filename_dat.find_last_of("/\\") + 1);
+    const std::string name_txt = filename_txt.substr(filename_txt.find_last_of("/\\") + 1);
+
+    RAWMetadata metadata;
+    metadata.ledIdx         = 0;
+    metadata.exposureTime   = 1.f;
+    metadata.aperture       = 1.f;
+    metadata.gain           = 1.f;
+    metadata.bitDepth       = (int)bit_depth;
+    metadata.bayerPattern   = (char*)"RGGB";
+    metadata.filename_image = (char*)name_dat.c_str();
+    metadata.filename_info  = (char*)name_txt.c_str();
+
+    return write_raw_metadata(filename_txt.c_str(), &metadata);
+}
+
+
+static size_t file_size(const std::string& filename)
+{
+    std::ifstream f(filename, std::ios::binary | std::ios::ate);
+    return f.good() ? (size_t)f.tellg() : 0;
+}
+
+
+/*****************************************************************************/
+/* Fitting                                                                   */
+/*****************************************************************************/
+
+// Synthetic patches: the reference is a known matrix applied to the
+// measured values
+static void fill_patches(size_t n_patches, size_t n_exposures, std::vector<float>& reference, std::vector<float>& measured)
+{
+    const float matrix[9] = {0.4124f, 0.3576f, 0.1805f, 0.2126f, 0.7152f, 0.0722f, 0.0193f, 0.1192f, 0.9505f};
+
+    reference.resize(3 * n_patches);
+    measured.resize(3 * n_patches * n_exposures);
+
+    for (size_t i = 0; i < n_patches; i++) {
+        float rgb[3];
+
+        for (int c = 0; c < 3; c++) {
+            uint32_t h = (uint32_t)(3 * i + c + 1) * 2654435761u;
+            h ^= h >> 13;
+            rgb[c] = .05f + .85f * (float)(h & 0xffff) / 65535.f;
+        }
+
+        matmul(matrix, rgb, &reference[3 * i]);
+
+        for (size_t e = 0; e < n_exposures; e++) {
+            for (int c = 0; c < 3; c++) {
+                measured[3 * (i * n_exposures + e) + c] = rgb[c] / (float)(1 << e);
+            }
+        }
+    }
+}
+
+
+// Poorly measured patches: one patch out of four is off by 20% with a noisy
+// area, the weights come from the variance such an area would have
+static void fill_weights(
+  size_t n_patches, size_t n_exposures, std::vector<float>& measured, std::vector<float>& weights)
+{
+    std::vector<float>  variances(measured.size());
+    std::vector<size_t> n_pixels(n_patches * n_exposures, 1000);
+
+    for (size_t i = 0; i < n_patches * n_exposures; i++) {
+        const bool  is_outlier = (i / n_exposures) % 4 == 3;
+        const float noise      = is_outlier ? .2f : .01f;
+
+        for (int c = 0; c < 3; c++) {
+            if (is_outlier) {
+                measured[3 * i + c] *= 1.2f;
+            }
+
+            variances[3 * i + c] = noise * noise * measured[3 * i + c] * measured[3 * i + c];
+        }
+    }
+
+    weights.resize(n_patches * n_exposures);
+    fit_patch_weights(
+      measured.data(), variances.data(), n_pixels.data(), n_patches * n_exposures, weights.data());
+}
+
+
+/*****************************************************************************/
+/* Benchmarks                                                                */
+/*****************************************************************************/
+
+static void bench_demosaic(
+  const BenchOptions& options, size_t width, size_t height, int threads, std::vector<BenchResult>& results)
+{
+    const uint32_t filters = 0x94949494;   // RGGB
+
+    std::vector<float> bayered_pixels(width * height);
+
+    run_benchmark(
+      options,
+      "synthetic/render_mosaic",
+      width,
+      height,
+      threads,
+      sizeof(float) * width * height,
+      [&]() {
+          fill_mosaic(bayered_pixels.data(), width, height);
+          return 0;
+      },
+      results);
+
+    fill_mosaic(bayered_pixels.data(), width, height);
+
+    for (int m = BASIC; m <= NONE; m++) {
+        const RAWDemosaicMethod method = (RAWDemosaicMethod)m;
+
+        size_t out_width, out_height;
+        demosaic_output_size(method, width, height, &out_width, &out_height);
+
+        std::vector<float> r(out_width * out_height);
+        std::vector<float> g(out_width * out_height);
+        std::vector<float> b(out_width * out_height);
+
+        const double bytes = sizeof(float) * (width * height + 3 * out_width * out_height);
+
+        run_benchmark(
+          options,
+          std::string("demosaic/") + demosaic_method_name(method),
+          width,
+          height,
+          threads,
+          bytes,
+          [&]() {
+              demosaic_rgb(bayered_pixels.data(), r.data(), g.data(), b.data(), width, height, filters, method);
+              return 0;
+          },
+          results);
+    }
+
+    // One pass RAW to 8 bits sRGB preview
+    const float matrix[9] = {.41f, .36f, .18f, .21f, .72f, .07f, .02f, .12f, .95f};
+
+    std::vector<unsigned char> thumbnail(3 * (width / 2) * (height / 2));
+
+    run_benchmark(
+      options,
+      "demosaic/thumbnail_srgb8",
+      width,
+      height,
+      threads,
+      sizeof(float) * width * height + thumbnail.size(),
+      [&]() {
+          return demosaic_thumbnail_srgb8(
+            bayered_pixels.data(), width, height, filters, REDUCE2X2, matrix, thumbnail.data());
+      },
+      results);
+}
+
+
+static void bench_io(
+  const BenchOptions& options, size_t width, size_t height, int threads, std::vector<BenchResult>& results)
+{
+    std::vector<float> pixels(width * height);
+    fill_mosaic(pixels.data(), width, height);
+
+    const std::string base = options.tmp_dir + "/camcalib-bench";
+    const std::string dat  = base + ".dat";
+    const std::string txt  = base + ".txt";
+
+    // Readers of RAW captures
+    if (write_dat_capture(txt, dat, pixels.data(), width, height) == 0) {
+        run_benchmark(
+          options,
+          "io/write_dat",
+          width,
+          height,
+          threads,
+          (sizeof(float) + sizeof(unsigned short)) * width * height,
+          [&]() { return write_dat(dat.c_str(), pixels.data(), width, height, 12); },
+          results);
+
+        run_benchmark(
+          options,
+          "io/read_dat",
+          width,
+          height,
+          threads,
+          (double)file_size(dat) + sizeof(float) * width * height,
+          [&]() {
+              float* p = NULL;
+              size_t w, h;
+              int    err = read_dat(dat.c_str(), &p, &w, &h, 12);
+              free(p);
+              return err;
+          },
+          results);
+
+        run_benchmark(
+          options,
+          "io/read_raw_file",
+          width,
+          height,
+          threads,
+          (double)file_size(dat) + sizeof(float) * width * height,
+          [&]() {
+              float*   p = NULL;
+              size_t   w, h;
+              uint32_t filters;
+              int      err = read_raw_file(txt.c_str(), &p, &w, &h, &filters);
+              free(p);
+              return err;
+          },
+          results);
+
+        run_benchmark(
+          options,
+          "io/read_raw_rgb",
+          width,
+          height,
+          threads,
+          (double)file_size(dat) + 3 * sizeof(float) * width * height,
+          [&]() {
+              float* r = NULL;
+              float* g = NULL;
+              float* b = NULL;
+              size_t w, h;
+              int    err = read_raw_rgb(txt.c_str(), &r, &g, &b, &w, &h, BASIC);
+              free(r);
+              free(g);
+              free(b);
+              return err;
+          },
+          results);
+    }
+
+    remove(dat.c_str());
+    remove(txt.c_str());
+
+    // Readers and writers of RGB images, the format is selected by the file
+    // extension. Formats not compiled in are skipped.
+    const char* extensions[] = {"exr", "tiff"};
+
+    for (const char* ext : extensions) {
+        const std::string filename = base + "." + ext;
+
+        run_benchmark(
+          options,
+          std::string("io/write_") + ext,
+          width,
+          height,
+          threads,
+          sizeof(float) * width * height,
+          [&]() { return write_image(filename.c_str(), pixels.data(), width, height); },
+          results);
+
+        run_benchmark(
+          options,
+          std::string("io/read_") + ext,
+          width,
+          height,
+          threads,
+          (double)file_size(filename) + sizeof(float) * width * height,
+          [&]() {
+              float* p = NULL;
+              size_t w, h;
+              int    err = read_image(filename.c_str(), &p, &w, &h);
+              free(p);
+              return err;
+          },
+          results);
+
+        run_benchmark(
+          options,
+          std::string("io/write_") + ext + "_rgb",
+          width,
+          height,
+          threads,
+          3 * sizeof(float) * width * height,
+          [&]() {
+              return write_image_rgb(filename.c_str(), pixels.data(), pixels.data(), pixels.data(), width, height);
+          },
+          results);
+
+        run_benchmark(
+          options,
+          std::string("io/read_") + ext + "_rgb",
+          width,
+          height,
+          threads,
+          (double)file_size(filename) + 3 * sizeof(float) * width * height,
+          [&]() {
+              float* r = NULL;
+              float* g = NULL;
+              float* b = NULL;
+              size_t w, h;
+              int    err = read_image_rgb(filename.c_str(), &r, &g, &b, &w, &h);
+              free(r);
+              free(g);
+              free(b);
+              return err;
+          },
+          results);
+
+        remove(filename.c_str());
+    }
+}
+
+
+static void bench_colors(
+  const BenchOptions& options, size_t width, size_t height, int threads, std::vector<BenchResult>& results)
+{
+    const size_t n_pixels  = width * height;
+    const float  matrix[9] = {1.6f, -.4f, -.2f, -.3f, 1.5f, -.2f, 0.f, -.5f, 1.5f};
+
+    std::vector<float> rgb(3 * n_pixels);
+    std::vector<float> out(3 * n_pixels);
+
+    for (size_t i = 0; i < n_pixels; i++) {
+        rgb[3 * i + 0] = (float)(i % 251) / 250.f;
+        rgb[3 * i + 1] = (float)(i % 241) / 240.f;
+        rgb[3 * i + 2] = (float)(i % 239) / 238.f;
+    }
+
+    const double bytes_rgb = 2 * sizeof(float) * 3 * n_pixels;
+
+    run_benchmark(
+      options,
+      "colors/matmul",
+      width,
+      height,
+      threads,
+      bytes_rgb,
+      [&]() {
+          #pragma omp parallel for
+          for (int i = 0; i < (int)n_pixels; i++) {
+              matmul(matrix, &rgb[3 * i], &out[3 * i]);
+          }
+          return 0;
+      },
+      results);
+
+    run_benchmark(
+      options,
+      "colors/XYZ_to_Lab",
+      width,
+      height,
+      threads,
+      bytes_rgb,
+      [&]() {
+          #pragma omp parallel for
+          for (int i = 0; i < (int)n_pixels; i++) {
+              XYZ_to_Lab(&rgb[3 * i], &out[3 * i]);
+          }
+          return 0;
+      },
+      results);
+
+    run_benchmark(
+      options,
+      "colors/XYZ_to_RGB",
+      width,
+      height,
+      threads,
+      bytes_rgb,
+      [&]() {
+          #pragma omp parallel for
+          for (int i = 0; i < (int)n_pixels; i++) {
+              XYZ_to_RGB(&rgb[3 * i], &out[3 * i]);
+          }
+          return 0;
+      },
+      results);
+
+    run_benchmark(
+      options,
+      "colors/to_sRGB",
+      width,
+      height,
+      threads,
+      bytes_rgb,
+      [&]() {
+          #pragma omp parallel for
+          for (int i = 0; i < (int)(3 * n_pixels); i++) {
+              out[i] = to_sRGB(rgb[i]);
+          }
+          return 0;
+      },
+      results);
+
+    // Lab values of the two buffers are compared pixel by pixel
+    std::vector<float> lab(3 * n_pixels);
+
+    for (size_t i = 0; i < n_pixels; i++) {
+        XYZ_to_Lab(&rgb[3 * i], &lab[3 * i]);
+        matmul(matrix, &rgb[3 * i], &out[3 * i]);
+        XYZ_to_Lab(&out[3 * i], &out[3 * i]);
+    }
+
+    std::vector<float> delta(n_pixels);
+
+    run_benchmark(
+      options,
+      "colors/deltaE_2000",
+      width,
+      height,
+      threads,
+      sizeof(float) * 7 * n_pixels,
+      [&]() {
+          #pragma omp parallel for
+          for (int i = 0; i < (int)n_pixels; i++) {
+              delta[i] = deltaE_2000(&lab[3 * i], &out[3 * i]);
+          }
+          return 0;
+      },
+      results);
+
+    run_benchmark(
+      options,
+      "colors/correct_image",
+      width,
+      height,
+      threads,
+      bytes_rgb,
+      [&]() {
+          memcpy(out.data(), rgb.data(), 3 * n_pixels * sizeof(float));
+          correct_image(out.data(), width, height, (float*)matrix);
+          return 0;
+      },
+      results);
+}
+
+
+static void bench_fitting(const BenchOptions& options, int threads, std::vector<BenchResult>& results)
+{
+    const size_t n_patches   = 24;
+    const size_t n_exposures = 4;
+
+    std::vector<float> reference, measured;
+    fill_patches(n_patches, n_exposures, reference, measured);
+
+    // Single exposure: the first one of each patch
+    std::vector<float> measured_single(3 * n_patches);
+
+    for (size_t i = 0; i < n_patches; i++) {
+        for (int c = 0; c < 3; c++) {
+            measured_single[3 * i + c] = measured[3 * (i * n_exposures) + c];
+        }
+    }
+
+    // Same patches with outliers, weighted down by their variance
+    std::vector<float> measured_outliers(measured), measured_single_outliers(measured_single);
+    std::vector<float> weights, weights_single;
+    fill_weights(n_patches, n_exposures, measured_outliers, weights);
+    fill_weights(n_patches, 1, measured_single_outliers, weights_single);
+
+    const FitPatches fits_matrix[2] = {
+      {n_patches, 1, reference.data(), measured_single.data(), NULL, NULL},
+      {n_patches, 1, reference.data(), measured_single_outliers.data(), NULL, weights_single.data()}};
+
+    const FitPatches fits_exposures[2] = {
+      {n_patches, n_exposures, reference.data(), measured.data(), NULL, NULL},
+      {n_patches, n_exposures, reference.data(), measured_outliers.data(), NULL, weights.data()}};
+
+    const char* suffixes[2] = {"", "_weighted"};
+
+    for (int w = 0; w < 2; w++) {
+        FitPatches fit_matrix    = fits_matrix[w];
+        FitPatches fit_exposures = fits_exposures[w];
+
+        run_benchmark(
+          options,
+          std::string("fit/matrix") + suffixes[w],
+          n_patches,
+          1,
+          threads,
+          sizeof(float) * 6 * n_patches,
+          [&]() {
+              float p[9] = {1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f};
+              float info[LM_INFO_SZ];
+
+              const int n_iter = slevmar_dif(
+                fit_residuals_matrix, p, NULL, 9, n_patches, 1000, NULL, info, NULL, NULL, &fit_matrix);
+              return (n_iter < 0) ? -1 : 0;
+          },
+          results);
+
+        run_benchmark(
+          options,
+          std::string("fit/matrix_exposures") + suffixes[w],
+          n_patches,
+          n_exposures,
+          threads,
+          sizeof(float) * 3 * n_patches * (n_exposures + 1),
+          [&]() {
+              const size_t       n_params = 6 + 3 * n_exposures;
+              std::vector<float> p(n_params, 0.f);
+              float              info[LM_INFO_SZ];
+
+              for (size_t i = 6; i < n_params; i++) {
+                  p[i] = 1.f;
+              }
+
+              const int n_iter = slevmar_dif(
+                fit_residuals_exposures,
+                p.data(),
+                NULL,
+                n_params,
+                n_patches * n_exposures,
+                1000,
+                NULL,
+                info,
+                NULL,
+                NULL,
+                &fit_exposures);
+              return (n_iter < 0) ? -1 : 0;
+          },
+          results);
+    }
+}
+
+
+/*****************************************************************************/
+/* JSON                                                                      */
+/*****************************************************************************/
+
+static int write_results(const char* filename, int n_cores, const std::vector<BenchResult>& results)
+{
+    FILE* fout = (filename != NULL) ? fopen(filename, "w") : stdout;
+
+    if (fout == NULL) {
+        fprintf(stderr, "Cannot open %s for writing\n", filename);
+        return -1;
+    }
+
+    fprintf(fout, "{\n");
+    fprintf(fout, "  \"host\": \"%s\",\n", host_name().c_str());
+    fprintf(fout, "  \"max_threads\": %d,\n", n_cores);
+    fprintf(fout, "  \"results\": [\n");
+
+    // One result per line, the compare mode relies on it
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+
+        fprintf(
+          fout,
+          "    {\"name\": \"%s\", \"width\": %zu, \"height\": %zu, \"threads\": %d, \"warmup\": %d, "
+          "\"repetitions\": %d, \"median_ms\": %.6f, \"p95_ms\": %.6f, \"mb_per_s\": %.3f}%s\n",
+          r.name.c_str(),
+          r.width,
+          r.height,
+          r.threads,
+          r.warmup,
+          r.repetitions,
+          r.median_ms,
+          r.p95_ms,
+          r.mb_per_s,
+          (i + 1 < results.size()) ? "," : "");
+    }
+
+    fprintf(fout, "  ]\n}\n");
+
+    if (filename != NULL) {
+        fclose(fout);
+    }
+
+    return 0;
+}
+
+
+static bool json_string(const std::string& line, const char* key, std::string& value)
+{
+    const std::string pattern = std::string("\"") + key + "\": \"";
+    const size_t      start   = line.find(pattern);
+
+    if (start == std::string::npos) {
+        return false;
+    }
+
+    const size_t end = line.find('"', start + pattern.size());
+
+    if (end == std::string::npos) {
+        return false;
+    }
+
+    value = line.substr(start + pattern.size(), end - start - pattern.size());
+    return true;
+}
+
+
+static bool json_number(const std::string& line, const char* key, double& value)
+{
+    const std::string pattern = std::string("\"") + key + "\": ";
+    const size_t      start   = line.find(pattern);
+
+    if (start == std::string::npos) {
+        return false;
+    }
+
+    value = atof(line.c_str() + start + pattern.size());
+    return true;
+}
+
+
+// Reads a result file written by this tool
+static int read_results(const char* filename, std::vector<BenchResult>& results)
+{
+    std::ifstream fin(filename);
+
+    if (!fin.good()) {
+        fprintf(stderr, "Cannot open %s\n", filename);
+        return -1;
+    }
+
+    std::string line;
+
+    while (std::getline(fin, line)) {
+        BenchResult r;
+        double      width, height, threads, warmup, repetitions;
+
+        if (
+          json_string(line, "name", r.name) && json_number(line, "width", width) && json_number(line, "height", height)
+          && json_number(line, "threads", threads) && json_number(line, "warmup", warmup)
+          && json_number(line, "repetitions", repetitions) && json_number(line, "median_ms", r.median_ms)
+          && json_number(line, "p95_ms", r.p95_ms) && json_number(line, "mb_per_s", r.mb_per_s)) {
+            r.width       = (size_t)width;
+            r.height      = (size_t)height;
+            r.threads     = (int)threads;
+            r.warmup      = (int)warmup;
+            r.repetitions = (int)repetitions;
+
+            results.push_back(r);
+        }
+    }
+
+    return 0;
+}
+
+
+static std::string result_key(const BenchResult& r)
+{
+    std::ostringstream key;
+    key << r.name << " " << r.width << "x" << r.height << " " << r.threads << "T";
+    return key.str();
+}
+
+
+// Returns 1 if a regression above the threshold (in percent) is found
+static int compare_results(const char* filename_baseline, const char* filename_current, double threshold)
+{
+    std::vector<BenchResult> baseline, current;
+
+    if (read_results(filename_baseline, baseline) != 0 || read_results(filename_current, current) != 0) {
+        return -1;
+    }
+
+    std::map<std::string, BenchResult> baseline_map;
+
+    for (const BenchResult& r : baseline) {
+        baseline_map[result_key(r)] = r;
+    }
+
+    int n_regressions  = 0;
+    int n_improvements = 0;
+
+    for (const BenchResult& r : current) {
+        const std::string key = result_key(r);
+        const auto        it  = baseline_map.find(key);
+
+        if (it == baseline_map.end()) {
+            printf("%-48s %10s -> %10.3f ms  (new)\n", key.c_str(), "", r.median_ms);
+            continue;
+        }
+
+        const double change = (it->second.median_ms > 0) ? 100. * (r.median_ms / it->second.median_ms - 1.) : 0.;
+        const char*  status = "";
+
+        if (change > threshold) {
+            status = "REGRESSION";
+            n_regressions++;
+        } else if (change < -threshold) {
+            status = "improvement";
+            n_improvements++;
+        }
+
+        printf(
+          "%-48s %10.3f -> %10.3f ms  %+7.1f%%  %s\n", key.c_str(), it->second.median_ms, r.median_ms, change, status);
+
+        baseline_map.erase(it);
+    }
+
+    for (const auto& it : baseline_map) {
+        printf("%-48s %10.3f -> %10s     (missing)\n", it.first.c_str(), it.second.median_ms, "");
+    }
+
+    printf(
+      "%d regression(s), %d improvement(s) with a %.1f%% threshold\n", n_regressions, n_improvements, threshold);
+
+    return (n_regressions > 0) ? 1 : 0;
+}
+
+
+/*****************************************************************************/
+/* Command line                                                              */
+/*****************************************************************************/
+
+static int parse_sizes(const char* arg, std::vector<std::pair<size_t, size_t>>& sizes)
+{
+    std::stringstream ss(arg);
+    std::string       item;
+
+    sizes.clear();
+
+    while (std::getline(ss, item, ',')) {
+        size_t width, height;
+
+        if (sscanf(item.c_str(), "%zux%zu", &width, &height) != 2 || width < 16 || height < 16) {
+            fprintf(stderr, "Invalid size: %s\n", item.c_str());
+            return -1;
+        }
+
+        sizes.push_back(std::make_pair(width, height));
+    }
+
+    return sizes.empty() ? -1 : 0;
+}
+
+
+static int parse_threads(const char* arg, std::vector<int>& threads)
+{
+    std::stringstream ss(arg);
+    std::string       item;
+
+    threads.clear();
+
+    while (std::getline(ss, item, ',')) {
+        const int n = atoi(item.c_str());
+
+        if (n <= 0) {
+            fprintf(stderr, "Invalid thread count: %s\n", item.c_str());
+            return -1;
+        }
+
+        threads.push_back(n);
+    }
+
+    return threads.empty() ? -1 : 0;
+}
+
+
+static void print_usage()
+{
+    printf(
+      "Usage:\n"
+      "------\n"
+      "camcalib-bench run [-o results.json] [-s WxH,...] [-t N,...] [-w warmup] [-r repetitions]\n"
+      "                   [-f filter] [-d tmp_dir]\n"
+      "    Benchmarks the synthetic mosaic generator, the demosaicing methods, the\n"
+      "    image readers and writers, the color kernels and the fitting routines for\n"
+      "    each image size and thread count. Results are written as JSON (stdout when\n"
+      "    no output is given).\n"
+      "    -s image sizes (default 1024x768,4096x3072)\n"
+      "    -t thread counts (default 1 and the number of cores)\n"
+      "    -w warmup runs (default 1)\n"
+      "    -r timed repetitions (default 5)\n"
+      "    -f only run the benchmarks whose name contains filter (e.g. demosaic/)\n"
+      "    -d directory for temporary files (default /tmp)\n"
+      "\n"
+      "camcalib-bench compare <baseline.json> <current.json> [threshold_percent]\n"
+      "    Compares the median times of two result files and flags changes above the\n"
+      "    threshold (default 10%%). Returns 1 if a regression is found.\n"
+      "\n"
+      "camcalib-bench autotune [-s WxH] [-o config]\n"
+      "    Benchmarks tile sizes of the tiled demosaicing methods (AMaZE, AHD, RCD) on\n"
+      "    a synthetic mosaic (default 4096x3072) and saves the fastest ones to the\n"
+      "    configuration file of the host, loaded by the demosaicing functions.\n"
+      "\n"
+      "camcalib-bench calibrate [-s WxH] [-o config]\n"
+      "    Measures the throughput of each demosaicing method per thread on a\n"
+      "    synthetic mosaic (default 4096x3072) and saves it to the configuration\n"
+      "    file of the host, used by the AUTO method to predict runtimes. Run it\n"
+      "    after autotune.\n");
+}
+
+
+// Options shared by autotune and calibrate
+static int parse_config_options(
+  int argc, char* argv[], std::vector<std::pair<size_t, size_t>>& sizes, const char** filename_config)
+{
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (parse_sizes(argv[++i], sizes) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            *filename_config = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int autotune(int argc, char* argv[])
+{
+    std::vector<std::pair<size_t, size_t>> sizes(1, std::make_pair((size_t)4096, (size_t)3072));
+    const char*                            filename_config = demosaic_host_config_filename();
+
+    if (parse_config_options(argc, argv, sizes, &filename_config) != 0) {
+        return -1;
+    }
+
+    const size_t width  = sizes[0].first;
+    const size_t height = sizes[0].second;
+
+    std::vector<float> bayered_pixels(width * height);
+    fill_mosaic(bayered_pixels.data(), width, height);
+
+    DemosaicTileSizes current, best;
+    demosaic_get_tile_sizes(&current);
+
+    printf("Tuning tile sizes on a %zux%zu mosaic with %d threads...\n", width, height, max_threads());
+
+    if (demosaic_autotune_tile_sizes(bayered_pixels.data(), width, height, 0x94949494, &best) != 0) {
+        return -1;
+    }
+
+    printf("AMaZE: %4d (was %d)\n", best.amaze, current.amaze);
+    printf("AHD:   %4d (was %d)\n", best.ahd, current.ahd);
+    printf("RCD:   %4d (was %d)\n", best.rcd, current.rcd);
+
+    if (demosaic_save_tile_sizes(filename_config, &best) != 0) {
+        fprintf(stderr, "Could not write file: %s\n", filename_config);
+        return -1;
+    }
+
+    printf("Saved to %s\n", filename_config);
+
+    return 0;
+}
+
+
+static int calibrate(int argc, char* argv[])
+{
+    std::vector<std::pair<size_t, size_t>> sizes(1, std::make_pair((size_t)4096, (size_t)3072));
+    const char*                            filename_config = demosaic_host_config_filename();
+
+    if (parse_config_options(argc, argv, sizes, &filename_config) != 0) {
+        return -1;
+    }
+
+    const size_t width  = sizes[0].first;
+    const size_t height = sizes[0].second;
+
+    std::vector<float> bayered_pixels(width * height);
+    fill_mosaic(bayered_pixels.data(), width, height);
+
+    printf("Measuring throughput on a %zux%zu mosaic with %d threads...\n", width, height, max_threads());
+
+    DemosaicThroughput current, measured;
+    demosaic_get_throughput(&current);
+
+    if (demosaic_calibrate_throughput(bayered_pixels.data(), width, height, 0x94949494, &measured) != 0) {
+        return -1;
+    }
+
+    for (int m = BASIC; m < NONE; m++) {
+        printf(
+          "%-16s %8.2f Mpx/s per thread (was %.2f)\n",
+          demosaic_method_name((RAWDemosaicMethod)m),
+          measured.mpx_per_s[m],
+          current.mpx_per_s[m]);
+    }
+
+    if (demosaic_save_throughput(filename_config, &measured) != 0) {
+        fprintf(stderr, "Could not write file: %s\n", filename_config);
+        return -1;
+    }
+
+    printf("Saved to %s\n", filename_config);
+
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        print_usage();
+        return 0;
+    }
+
+    if (strcmp(argv[1], "compare") == 0) {
+        if (argc < 4) {
+            print_usage();
+            return -1;
+        }
+
+        const double threshold = (argc > 4) ? atof(argv[4]) : 10.;
+
+        return compare_results(argv[2], argv[3], threshold);
+    }
+
+    if (strcmp(argv[1], "autotune") == 0) {
+        return autotune(argc, argv);
+    }
+
+    if (strcmp(argv[1], "calibrate") == 0) {
+        return calibrate(argc, argv);
+    }
+
+    if (strcmp(argv[1], "run") != 0) {
+        print_usage();
+        return -1;
+    }
+
+    const int n_cores = max_threads();
+
+    BenchOptions options;
+    options.sizes.push_back(std::make_pair((size_t)1024, (size_t)768));
+    options.sizes.push_back(std::make_pair((size_t)4096, (size_t)3072));
+    options.threads.push_back(1);
+    options.warmup      = 1;
+    options.repetitions = 5;
+    options.tmp_dir     = "/tmp";
+
+    if (n_cores > 1) {
+        options.threads.push_back(n_cores);
+    }
+
+    const char* filename_out = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return -1;
+        }
+
+        int err = 0;
+
+        if (strcmp(argv[i], "-o") == 0) {
+            filename_out = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0) {
+            err = parse_sizes(argv[++i], options.sizes);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            err = parse_threads(argv[++i], options.threads);
+        } else if (strcmp(argv[i], "-w") == 0) {
+            options.warmup = std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-r") == 0) {
+            options.repetitions = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-f") == 0) {
+            options.filter = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            options.tmp_dir = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            err = -1;
+        }
+
+        if (err != 0) {
+            return -1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+
+    for (const auto& size : options.sizes) {
+        for (int threads : options.threads) {
+            bench_demosaic(options, size.first, size.second, threads, results);
+            bench_io(options, size.first, size.second, threads, results);
+            bench_colors(options, size.first, size.second, threads, results);
+        }
+    }
+
+    // The fit does not depend on the image size
+    for (int threads : options.threads) {
+        bench_fitting(options, threads, results);
+    }
+
+    set_threads(n_cores);
+
+    return write_results(filename_out, n_cores, results);
+}
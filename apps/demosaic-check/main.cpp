@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <image.h>
+#include <synthetic.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+struct Mosaic {
+    std::string        name;
+    std::vector<float> pixels;
+    size_t             width;
+    size_t             height;
+    uint32_t           filters;
+};
+
+
+struct CheckOptions {
+    std::string golden_dir;
+    size_t      width;
+    size_t      height;
+    double      min_psnr;
+    double      max_abs_error;
+    double      max_slowdown;   // Runtime over golden runtime, 0 to disable
+    int         repetitions;
+    bool        update;
+};
+
+
+static int synthetic_mosaic(const char* pattern, size_t width, size_t height, Mosaic& mosaic)
+{
+    const float peaks[3]  = {600.f, 535.f, 455.f};
+    const float widths[3] = {35.f, 40.f, 30.f};
+
+    SyntheticOptions options;
+    synthetic_default_options(&options);
+    options.width  = width;
+    options.height = height;
+
+    if (bayer_pattern_to_filters(pattern, &options.filters) != 0) {
+        return -1;
+    }
+
+    float sensitivities[3 * SYNTHETIC_N_WAVELENGTHS];
+    float patches_rgb[3 * SYNTHETIC_N_PATCHES];
+    float background_rgb[3];
+
+    synthetic_gaussian_sensitivities(peaks, widths, sensitivities);
+    synthetic_chart_colors(&options, NULL, sensitivities, patches_rgb, background_rgb);
+
+    mosaic.name    = std::string("synthetic_") + pattern;
+    mosaic.width   = width;
+    mosaic.height  = height;
+    mosaic.filters = options.filters;
+    mosaic.pixels.resize(width * height);
+
+    synthetic_render_mosaic(&options, patches_rgb, background_rgb, mosaic.pixels.data());
+
+    return 0;
+}
+
+
+static int raw_mosaic(const char* filename, Mosaic& mosaic)
+{
+    float* pixels = NULL;
+
+    int err = read_raw_file(filename, &pixels, &mosaic.width, &mosaic.height, &mosaic.filters);
+
+    if (err != 0) {
+        return err;
+    }
+
+    std::string name = filename;
+    name             = name.substr(name.find_last_of("/\\") + 1);
+    name             = name.substr(0, name.find_last_of('.'));
+
+    mosaic.name = name;
+    mosaic.pixels.assign(pixels, pixels + mosaic.width * mosaic.height);
+
+    free(pixels);
+
+    return 0;
+}
+
+
+// Golden runtimes: one "input,method,ms" line per output
+static void load_timings(const std::string& filename, std::map<std::string, double>& timings)
+{
+    std::ifstream fin(filename);
+    std::string   line;
+
+    while (std::getline(fin, line)) {
+        const size_t sep = line.find_last_of(',');
+
+        if (sep != std::string::npos) {
+            timings[line.substr(0, sep)] = atof(line.c_str() + sep + 1);
+        }
+    }
+}
+
+
+static int save_timings(const std::string& filename, const std::map<std::string, double>& timings)
+{
+    FILE* fout = fopen(filename.c_str(), "w");
+
+    if (fout == NULL) {
+        fprintf(stderr, "Cannot open %s for writing\n", filename.c_str());
+        return -1;
+    }
+
+    for (const auto& it : timings) {
+        fprintf(fout, "%s,%f\n", it.first.c_str(), it.second);
+    }
+
+    fclose(fout);
+
+    return 0;
+}
+
+
+// Compares an output to its golden image, returns -1 if the golden image
+// cannot be read or does not match the output size
+static int compare_golden(
+  const std::string& filename,
+  const float*       r,
+  const float*       g,
+  const float*       b,
+  size_t             width,
+  size_t             height,
+  double*            psnr,
+  double*            max_abs_error)
+{
+    float* golden[3] = {NULL, NULL, NULL};
+    size_t golden_width, golden_height;
+
+    int err = read_image_rgb(filename.c_str(), &golden[0], &golden[1], &golden[2], &golden_width, &golden_height);
+
+    if (err != 0 || golden_width != width || golden_height != height) {
+        free(golden[0]);
+        free(golden[1]);
+        free(golden[2]);
+        return -1;
+    }
+
+    const float* output[3] = {r, g, b};
+    const size_t n_elems   = width * height;
+
+    double sum_sq  = 0;
+    double max_abs = 0;
+
+    for (int c = 0; c < 3; c++) {
+        for (size_t i = 0; i < n_elems; i++) {
+            const double d = (double)output[c][i] - (double)golden[c][i];
+
+            sum_sq += d * d;
+            max_abs = std::max(max_abs, std::abs(d));
+        }
+    }
+
+    // Peak value is 1: the outputs are normalized
+    const double mse = sum_sq / (double)(3 * n_elems);
+
+    *psnr          = (mse > 0) ? 10. * log10(1. / mse) : INFINITY;
+    *max_abs_error = max_abs;
+
+    free(golden[0]);
+    free(golden[1]);
+    free(golden[2]);
+
+    return 0;
+}
+
+
+// Returns the number of failed checks
+static int check_mosaic(
+  const CheckOptions& options, const Mosaic& mosaic, std::map<std::string, double>& timings)
+{
+    int n_failed = 0;
+
+    for (int m = BASIC; m <= NONE; m++) {
+        const RAWDemosaicMethod method = (RAWDemosaicMethod)m;
+        const std::string       key    = mosaic.name + "_" + demosaic_method_name(method);
+
+        size_t out_width, out_height;
+        demosaic_output_size(method, mosaic.width, mosaic.height, &out_width, &out_height);
+
+        std::vector<float> r(out_width * out_height);
+        std::vector<float> g(out_width * out_height);
+        std::vector<float> b(out_width * out_height);
+
+        // Best of the repetitions, less sensitive to the load of the machine
+        double ms = INFINITY;
+
+        for (int i = 0; i < options.repetitions; i++) {
+            const auto start = std::chrono::steady_clock::now();
+
+            demosaic_rgb(
+              mosaic.pixels.data(), r.data(), g.data(), b.data(), mosaic.width, mosaic.height, mosaic.filters, method);
+
+            const auto end = std::chrono::steady_clock::now();
+
+            ms = std::min(ms, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+
+        const std::string filename_golden = options.golden_dir + "/" + key + ".exr";
+
+        if (options.update) {
+            int err = write_image_rgb(filename_golden.c_str(), r.data(), g.data(), b.data(), out_width, out_height);
+
+            if (err != 0) {
+                fprintf(stderr, "Could not write file: %s\n", filename_golden.c_str());
+                n_failed++;
+            } else {
+                printf("%-40s %10.3f ms  updated\n", key.c_str(), ms);
+                timings[key] = ms;
+            }
+
+            continue;
+        }
+
+        double psnr, max_abs_error;
+
+        const auto   it        = timings.find(key);
+        const double golden_ms = (it != timings.end()) ? it->second : NAN;
+
+        if (
+          compare_golden(filename_golden, r.data(), g.data(), b.data(), out_width, out_height, &psnr, &max_abs_error)
+          != 0) {
+            printf("%-40s %10.3f ms  %10.3f ms  FAIL (no matching golden output)\n", key.c_str(), ms, golden_ms);
+            n_failed++;
+            continue;
+        }
+
+        const bool accurate = psnr >= options.min_psnr && max_abs_error <= options.max_abs_error;
+
+        // No golden runtime: only the output is checked
+        const bool fast = options.max_slowdown <= 0 || std::isnan(golden_ms) || ms <= options.max_slowdown * golden_ms;
+
+        printf(
+          "%-40s %10.3f ms  %10.3f ms  PSNR %8.2f dB  max abs %.3e  %s\n",
+          key.c_str(),
+          ms,
+          golden_ms,
+          psnr,
+          max_abs_error,
+          !accurate ? "FAIL" : !fast ? "FAIL (slower)" : "ok");
+
+        if (!accurate || !fast) {
+            n_failed++;
+        }
+    }
+
+    return n_failed;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf(
+          "Usage:\n"
+          "------\n"
+          "demosaic-check <golden_dir> [-u] [-s WxH] [-p Min_PSNR] [-e Max_abs_error] [-t Max_slowdown]\n"
+          "               [-r Repetitions] [raw_in_1.txt ...]\n"
+          "Runs every demosaicing method on synthetic charts (one per CFA pattern) and\n"
+          "on the given RAW captures and compares the outputs with the golden outputs\n"
+          "stored in <golden_dir>. Runtimes are reported next to the golden runtimes.\n"
+          "Returns 1 if any check failed, 0 otherwise.\n"
+          "    -u  writes the golden outputs instead of checking them, e.g. with a\n"
+          "        reference build of the library before optimizing the kernels\n"
+          "    -s  size of the synthetic charts, even (default 640x480)\n"
+          "    -p  minimum PSNR in dB (default 70)\n"
+          "    -e  maximum absolute error (default 1e-3)\n"
+          "    -t  maximum ratio of the runtime over the golden runtime, e.g. 1.2\n"
+          "        (default none: runtimes are only reported)\n"
+          "    -r  timed repetitions, the best one is reported (default 3)\n");
+
+        return 0;
+    }
+
+    CheckOptions options;
+    options.golden_dir    = argv[1];
+    options.width         = 640;
+    options.height        = 480;
+    options.min_psnr      = 70.;
+    options.max_abs_error = 1e-3;
+    options.max_slowdown  = 0.;
+    options.repetitions   = 3;
+    options.update        = false;
+
+    std::vector<const char*> filenames_raw;
+
+    for (int i = 2; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "-u") == 0) {
+            options.update = true;
+        } else if (strcmp(argv[i], "-s") == 0 && has_value) {
+            const bool parsed = sscanf(argv[++i], "%zux%zu", &options.width, &options.height) == 2;
+
+            // Whole CFA blocks: half size methods need even sizes
+            if (
+              !parsed || options.width < 16 || options.height < 16 || options.width % 2 != 0
+              || options.height % 2 != 0) {
+                fprintf(stderr, "Invalid size: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-p") == 0 && has_value) {
+            options.min_psnr = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-e") == 0 && has_value) {
+            options.max_abs_error = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && has_value) {
+            options.max_slowdown = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && has_value) {
+            options.repetitions = std::max(1, atoi(argv[++i]));
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return -1;
+        } else {
+            filenames_raw.push_back(argv[i]);
+        }
+    }
+
+    const std::string             filename_timings = options.golden_dir + "/timings.csv";
+    std::map<std::string, double> timings;
+
+    load_timings(filename_timings, timings);
+
+    if (!options.update) {
+        printf("%-40s %13s  %13s\n", "Output", "Runtime", "Golden");
+    }
+
+    int n_failed = 0;
+
+    const char* patterns[] = {"RGGB", "BGGR", "GRBG", "GBRG"};
+
+    for (const char* pattern : patterns) {
+        Mosaic mosaic;
+        synthetic_mosaic(pattern, options.width, options.height, mosaic);
+        n_failed += check_mosaic(options, mosaic, timings);
+    }
+
+    for (const char* filename : filenames_raw) {
+        Mosaic mosaic;
+
+        if (raw_mosaic(filename, mosaic) != 0) {
+            fprintf(stderr, "Could not read file: %s\n", filename);
+            n_failed++;
+            continue;
+        }
+
+        n_failed += check_mosaic(options, mosaic, timings);
+    }
+
+    if (options.update) {
+        if (save_timings(filename_timings, timings) != 0) {
+            n_failed++;
+        }
+    } else {
+        printf("%d check(s) failed\n", n_failed);
+    }
+
+    // Exit codes wrap around at 256
+    return n_failed ? 1 : 0;
+}
@@ -16,12 +16,18 @@ int main(int argc, char* argv[])
           "Demosaicing method is optional. It can be:\n"
           "  - NONE\n"
           "  - BASIC (bilinear)\n"
+          "  - MHC (Malvar-He-Cutler, fast gradient-corrected linear)\n"
           "  - REDUCE2X2\n"
           "  - BARYCENTRIC2X2\n"
           "  - VNG4\n"
           "  - AHD\n"
           "  - RCD\n"
-          "  - AMAZE (default)\n");
+          "  - AMAZE (default)\n"
+          "  - AUTO: picks one of the full resolution methods from the measured\n"
+          "    throughput of the host (see camcalib-bench calibrate).\n"
+          "    AUTO:<ms> gives the best method expected to run within <ms>,\n"
+          "    AUTO:<Method> the fastest method at least as good as <Method>\n"
+          "    (quality order: BASIC, MHC, VNG4, AHD, RCD, AMAZE).\n");
         return 0;
     }
 
@@ -39,28 +45,15 @@ int main(int argc, char* argv[])
     int          ret = 0;
     const size_t len = strlen(filename_in);
 
-    RAWDemosaicMethod method = AMAZE;
+    RAWDemosaicMethod   method = AMAZE;
+    DemosaicAutoOptions auto_options;
+
+    demosaic_get_auto_options(&auto_options);
 
     if (argc > 3) {
         const char* demosaicing_method_arg = argv[3];
 
-        if (strcmp(demosaicing_method_arg, "NONE") == 0) {
-            method = NONE;
-        } else if (strcmp(demosaicing_method_arg, "BASIC") == 0) {
-            method = BASIC;
-        } else if (strcmp(demosaicing_method_arg, "REDUCE2X2") == 0) {
-            method = REDUCE2X2;
-        } else if (strcmp(demosaicing_method_arg, "BARYCENTRIC2X2") == 0) {
-            method = BARYCENTRIC2X2;
-        } else if (strcmp(demosaicing_method_arg, "VNG4") == 0) {
-            method = VNG4;
-        } else if (strcmp(demosaicing_method_arg, "AHD") == 0) {
-            method = AHD;
-        } else if (strcmp(demosaicing_method_arg, "RCD") == 0) {
-            method = RCD;
-        } else if (strcmp(demosaicing_method_arg, "AMAZE") == 0) {
-            method = AMAZE;
-        } else {
+        if (demosaic_parse_method(demosaicing_method_arg, &method, &auto_options) != 0) {
             fprintf(stderr, "Unknown method specified, default to AMAZE\n");
         }
     }
@@ -84,17 +77,16 @@ int main(int argc, char* argv[])
     }
 
     if (ret == 0) {
-        size_t image_out_width  = 0;
-        size_t image_out_height = 0;
-
-        if (method != REDUCE2X2 && method != BARYCENTRIC2X2) {
-            image_out_width  = width;
-            image_out_height = height;
-        } else {
-            image_out_width  = width / 2;
-            image_out_height = height / 2;
+        if (method == AUTO) {
+            float expected_ms;
+            method = demosaic_auto_select_with(&auto_options, width, height, &expected_ms);
+
+            printf("AUTO: using %s (expected %.0f ms)\n", demosaic_method_name(method), expected_ms);
         }
 
+        size_t image_out_width, image_out_height;
+        demosaic_output_size(method, width, height, &image_out_width, &image_out_height);
+
         const size_t image_out_size = image_out_width * image_out_height;
 
         image_r = (float*)calloc(image_out_size, sizeof(float));
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <image.h>
+#include <chartdetection.h>
+#include <patches.h>
+
+// Side of the areas relative to the distance between two patch centers,
+// keeps them clear of the patch edges
+#define BOX_SIZE .5f
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        printf(
+          "Usage:\n"
+          "------\n"
+          "detect-chart <image_in> <output_areas> [output_outline]\n"
+          "Finds the Macbeth chart in a TIFF, EXR or RAW (.txt) image and saves\n"
+          "the areas to average with extract-patches. RAW images are searched\n"
+          "without demosaicing them, areas are given in pixels of the mosaic.\n"
+          "The outline of the chart, the cells of the 6x4 patches, can be saved\n"
+          "as well in the same format.\n");
+
+        return 0;
+    }
+
+    const char* filename_in      = argv[1];
+    const char* filename_areas   = argv[2];
+    const char* filename_outline = (argc > 3) ? argv[3] : NULL;
+
+    float*   pixels = NULL;
+    size_t   width, height;
+    uint32_t filters;
+
+    ChartLocation chart;
+    Box           areas[CHART_N_PATCHES];
+    Point         corners[4];
+    Box           outline;
+
+    const size_t len = strlen(filename_in);
+    int          err = 0;
+
+    if (strcmp(filename_in + len - 3, "txt") == 0 || strcmp(filename_in + len - 3, "TXT") == 0) {
+        err = read_raw_file(filename_in, &pixels, &width, &height, &filters);
+
+        if (err == 0) {
+            err = detect_chart_raw(pixels, width, height, filters, &chart);
+        } else {
+            fprintf(stderr, "Cannot read input image file\n");
+            goto clean;
+        }
+    } else {
+        err = read_image(filename_in, &pixels, &width, &height);
+
+        if (err == 0) {
+            err = detect_chart(pixels, width, height, &chart);
+        } else {
+            fprintf(stderr, "Cannot read input image file\n");
+            goto clean;
+        }
+    }
+
+    if (err != 0) {
+        fprintf(stderr, "No chart found in %s\n", filename_in);
+        goto clean;
+    }
+
+    printf("Chart found on %zu patches\n", chart.n_patches);
+
+    chart_boxes(&chart, BOX_SIZE, areas);
+
+    err = save_boxfile(filename_areas, areas, CHART_N_PATCHES);
+
+    if (err != 0) {
+        fprintf(stderr, "Cannot save area file %s\n", filename_areas);
+        goto clean;
+    }
+
+    if (filename_outline != NULL) {
+        chart_outline(&chart, 0.f, 0.f, corners);
+
+        outline.a = corners[0];
+        outline.b = corners[1];
+        outline.c = corners[2];
+        outline.d = corners[3];
+
+        err = save_boxfile(filename_outline, &outline, 1);
+
+        if (err != 0) {
+            fprintf(stderr, "Cannot save outline file %s\n", filename_outline);
+            goto clean;
+        }
+    }
+
+clean:
+    free(pixels);
+
+    return err;
+}
@@ -5,41 +5,8 @@
 #include <levmar.h>
 #include <io.h>
 #include <color-converter.h>
-
-typedef struct {
-    size_t       n_patches;
-    const float* reference_patches;
-    const float* measured_patches;
-} fit_params;
-
-
-void measure(float* pParameters, float* pMeasurements, int n_parameters, int n_measurements, void* pUserParam)
-{
-    (void)n_parameters;
-    (void)n_measurements;
-
-    const fit_params* info = (fit_params*)pUserParam;
-
-    float tristim_mea_corrected[3];
-    float lab_ref[3];
-    float lab_mea[3];
-
-    // For each patch, we try to minimize the Delta_E_2000 between reference and measurement
-    for (size_t patch_idx = 0; patch_idx < info->n_patches; patch_idx++) {
-        const float* tristim_ref = &(info->reference_patches[3 * patch_idx]);
-        const float* tristim_mea = &(info->measured_patches[3 * patch_idx]);
-
-        // Apply the correction matrix which is optimized by levmar
-        matmul(pParameters, tristim_mea, tristim_mea_corrected);
-
-        // Transform colorspaces to Lab*
-        XYZ_to_Lab(tristim_ref, lab_ref);
-        XYZ_to_Lab(tristim_mea_corrected, lab_mea);
-
-        // The error is the Delta_E_2000 between reference and corrected Lab* values
-        pMeasurements[patch_idx] = deltaE_2000(lab_ref, lab_mea);
-    }
-}
+#include <fitting.h>
+#include <patches.h>
 
 
 int main(int argc, const char* argv[])
@@ -48,7 +15,9 @@ int main(int argc, const char* argv[])
         printf(
           "Usage:\n"
           "------\n"
-          "extract-matrix <data_xyz_ref> <data_measured> <output_matrix>\n");
+          "extract-matrix <data_xyz_ref> <data_measured> <output_matrix> [data_statistics]\n"
+          "With the statistics written by extract-patches, patches are weighted by the\n"
+          "inverse of the relative variance of their mean and clipped patches are left out.\n");
 
         return 0;
     }
@@ -56,10 +25,15 @@ int main(int argc, const char* argv[])
     const char* filename_patches_reference_xyz = argv[1];
     const char* filename_patches_measured      = argv[2];
     const char* filename_output_matrix         = argv[3];
+    const char* filename_statistics            = (argc > 4) ? argv[4] : NULL;
 
-    float* macbeth_patches_reference_xyz = NULL;
-    float* macbeth_patches_measured      = NULL;
-    size_t size                          = 0;
+    float*           macbeth_patches_reference_xyz = NULL;
+    float*           macbeth_patches_measured      = NULL;
+    PatchStatistics* statistics                    = NULL;
+    int*             selected_patches              = NULL;
+    float*           weights                       = NULL;
+    size_t           size                          = 0;
+    size_t           n_statistics                  = 0;
 
     int err = load_xyz(filename_patches_reference_xyz, &macbeth_patches_reference_xyz, &size);
     if (err != 0) {
@@ -74,6 +48,41 @@ int main(int argc, const char* argv[])
         return -1;
     }
 
+    if (filename_statistics != NULL) {
+        err = load_patch_statistics(filename_statistics, &statistics, &n_statistics);
+
+        if (err != 0 || n_statistics != size) {
+            fprintf(stderr, "Cannot read patches statistics file\n");
+            free(macbeth_patches_reference_xyz);
+            free(macbeth_patches_measured);
+            free(statistics);
+            return -1;
+        }
+
+        float*  means     = (float*)calloc(3 * size, sizeof(float));
+        float*  variances = (float*)calloc(3 * size, sizeof(float));
+        size_t* n_pixels  = (size_t*)calloc(size, sizeof(size_t));
+
+        selected_patches = (int*)calloc(size, sizeof(int));
+        weights          = (float*)calloc(size, sizeof(float));
+
+        for (size_t i = 0; i < size; i++) {
+            for (int c = 0; c < 3; c++) {
+                means[3 * i + c]     = statistics[i].mean[c];
+                variances[3 * i + c] = statistics[i].variance[c];
+            }
+
+            n_pixels[i]         = statistics[i].n_pixels;
+            selected_patches[i] = statistics[i].n_clipped <= FIT_MAX_CLIPPED_FRACTION * statistics[i].n_pixels;
+        }
+
+        fit_patch_weights(means, variances, n_pixels, size, weights);
+
+        free(means);
+        free(variances);
+        free(n_pixels);
+    }
+
     // Ensure no value is above 1
     // TODO: remove saturated values
     float max = 0;
@@ -88,14 +97,27 @@ int main(int argc, const char* argv[])
     // Fit matrix to find the transformation between measured colorspace and
     // reference color space
     float      matrix[9] = {1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f};
-    fit_params u_params  = {size, macbeth_patches_reference_xyz, macbeth_patches_measured};
+    FitPatches u_params
+      = {size, 1, macbeth_patches_reference_xyz, macbeth_patches_measured, selected_patches, weights};
     //  float fit_opts[4] = {
 
     //  };
 
     float fit_info[LM_INFO_SZ];
 
-    slevmar_dif(measure, matrix, NULL, 9, size, 1000, NULL, fit_info, NULL, NULL, &u_params);
+    const size_t n_measurements = fit_n_measurements(&u_params);
+
+    if (n_measurements < 9) {
+        fprintf(stderr, "Not enough patches to fit the matrix\n");
+        free(macbeth_patches_reference_xyz);
+        free(macbeth_patches_measured);
+        free(statistics);
+        free(selected_patches);
+        free(weights);
+        return -1;
+    }
+
+    slevmar_dif(fit_residuals_matrix, matrix, NULL, 9, n_measurements, 1000, NULL, fit_info, NULL, NULL, &u_params);
 
     printf("||e||_2 at initial p:             %f\n", fit_info[0]);
     printf("||e||_2 at etimated p:            %f\n", fit_info[1]);
@@ -134,6 +156,9 @@ int main(int argc, const char* argv[])
 
     free(macbeth_patches_reference_xyz);
     free(macbeth_patches_measured);
+    free(statistics);
+    free(selected_patches);
+    free(weights);
 
     if (err != 0) {
         fprintf(stderr, "Cannot write correction matrix file\n");
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <image.h>
+#include <synthetic.h>
+#include <io.h>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+static int load_illuminant(const char* filename, float* illuminant)
+{
+    int*   wavelengths = NULL;
+    float* values      = NULL;
+    size_t size        = 0;
+
+    int err = read_spd(filename, &wavelengths, &values, &size);
+
+    if (err == 0) {
+        synthetic_resample_spectrum(wavelengths, values, size, illuminant);
+    }
+
+    free(wavelengths);
+    free(values);
+
+    return err;
+}
+
+
+// Sensitivities are stored as the CMFs: wavelength,r,g,b
+static int load_sensitivities(const char* filename, float* sensitivities)
+{
+    int*   wavelengths = NULL;
+    float* values_r    = NULL;
+    float* values_g    = NULL;
+    float* values_b    = NULL;
+    size_t size        = 0;
+
+    int err = read_cmfs(filename, &wavelengths, &values_r, &values_g, &values_b, &size);
+
+    if (err == 0) {
+        synthetic_resample_spectrum(wavelengths, values_r, size, &sensitivities[0 * SYNTHETIC_N_WAVELENGTHS]);
+        synthetic_resample_spectrum(wavelengths, values_g, size, &sensitivities[1 * SYNTHETIC_N_WAVELENGTHS]);
+        synthetic_resample_spectrum(wavelengths, values_b, size, &sensitivities[2 * SYNTHETIC_N_WAVELENGTHS]);
+    }
+
+    free(wavelengths);
+    free(values_r);
+    free(values_g);
+    free(values_b);
+
+    return err;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf(
+          "Usage:\n"
+          "------\n"
+          "gen-synthetic-raw <output.txt> [options]\n"
+          "Renders a Macbeth chart in a Bayer mosaic and writes it as a RAW capture\n"
+          "(.txt metadata + .dat data) readable by derawzinator and the other tools.\n"
+          "    -s WxH               size of the mosaic (default 1200x800)\n"
+          "    -p Pattern           CFA pattern: RGGB, BGGR, GRBG or GBRG (default RGGB)\n"
+          "    -b Bit_depth         bit depth of the data (default 12)\n"
+          "    -e Exposure          level of the white patch (default 0.8)\n"
+          "    -n Shot Read         noise: variance per unit of signal and standard\n"
+          "                         deviation of the read noise (default 1e-4 1e-3)\n"
+          "    -r Seed              seed of the noise (default 0)\n"
+          "    -i Illuminant        illuminant SPD file, e.g. data/D65.csv (default\n"
+          "                         equal energy)\n"
+          "    -c Sensitivities     camera sensitivities file: wavelength,r,g,b (default\n"
+          "                         Gaussian model)\n"
+          "    -a Areas             writes the areas of the patches (see extract-patches)\n"
+          "    -x Patches           writes the noiseless camera RGB values of the patches\n");
+
+        return 0;
+    }
+
+    const char* filename_out           = argv[1];
+    const char* filename_illuminant    = NULL;
+    const char* filename_sensitivities = NULL;
+    const char* filename_areas         = NULL;
+    const char* filename_patches       = NULL;
+
+    SyntheticOptions options;
+    synthetic_default_options(&options);
+
+    for (int i = 2; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "-s") == 0 && has_value) {
+            if (sscanf(argv[++i], "%zux%zu", &options.width, &options.height) != 2 || options.width < 2 || options.height < 2) {
+                fprintf(stderr, "Invalid size: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-p") == 0 && has_value) {
+            if (bayer_pattern_to_filters(argv[++i], &options.filters) != 0) {
+                fprintf(stderr, "Unknown CFA pattern: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-b") == 0 && has_value) {
+            options.bit_depth = (size_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-e") == 0 && has_value) {
+            options.exposure = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 2 < argc) {
+            options.shot_noise = (float)atof(argv[++i]);
+            options.read_noise = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && has_value) {
+            options.seed = (uint64_t)strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-i") == 0 && has_value) {
+            filename_illuminant = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && has_value) {
+            filename_sensitivities = argv[++i];
+        } else if (strcmp(argv[i], "-a") == 0 && has_value) {
+            filename_areas = argv[++i];
+        } else if (strcmp(argv[i], "-x") == 0 && has_value) {
+            filename_patches = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (options.bit_depth > 16) {
+        fprintf(stderr, "The bit depth shall not exceed 16\n");
+        return -1;
+    }
+
+    // Spectral data
+    std::vector<float> illuminant(SYNTHETIC_N_WAVELENGTHS, 1.f);
+    std::vector<float> sensitivities(3 * SYNTHETIC_N_WAVELENGTHS);
+
+    if (filename_illuminant != NULL && load_illuminant(filename_illuminant, illuminant.data()) != 0) {
+        fprintf(stderr, "Cannot read the illuminant file %s\n", filename_illuminant);
+        return -1;
+    }
+
+    if (filename_sensitivities != NULL) {
+        if (load_sensitivities(filename_sensitivities, sensitivities.data()) != 0) {
+            fprintf(stderr, "Cannot read the sensitivities file %s\n", filename_sensitivities);
+            return -1;
+        }
+    } else {
+        const float peaks[3]  = {600.f, 535.f, 455.f};
+        const float widths[3] = {35.f, 40.f, 30.f};
+
+        synthetic_gaussian_sensitivities(peaks, widths, sensitivities.data());
+    }
+
+    float patches_rgb[3 * SYNTHETIC_N_PATCHES];
+    float background_rgb[3];
+
+    synthetic_chart_colors(&options, illuminant.data(), sensitivities.data(), patches_rgb, background_rgb);
+
+    // Rendering
+    float* bayered_pixels = (float*)malloc(options.width * options.height * sizeof(float));
+
+    if (bayered_pixels == NULL) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    synthetic_render_mosaic(&options, patches_rgb, background_rgb, bayered_pixels);
+
+    auto end = std::chrono::steady_clock::now();
+
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const double mpx     = (double)(options.width * options.height) * 1e-6;
+
+    std::cout << "Rendered " << mpx << " Mpx in " << seconds << "s (" << mpx / seconds << " Mpx/s)" << std::endl;
+
+    int err = synthetic_write_raw(filename_out, bayered_pixels, &options);
+
+    free(bayered_pixels);
+
+    if (err != 0) {
+        fprintf(stderr, "Could not write file: %s\n", filename_out);
+        return err;
+    }
+
+    if (filename_areas != NULL) {
+        Box boxes[SYNTHETIC_N_PATCHES];
+        synthetic_chart_boxes(options.width, options.height, boxes);
+
+        if (save_boxfile(filename_areas, boxes, SYNTHETIC_N_PATCHES) != 0) {
+            fprintf(stderr, "Could not write file: %s\n", filename_areas);
+            err = -1;
+        }
+    }
+
+    if (filename_patches != NULL && save_xyz(filename_patches, patches_rgb, SYNTHETIC_N_PATCHES) != 0) {
+        fprintf(stderr, "Could not write file: %s\n", filename_patches);
+        err = -1;
+    }
+
+    return err;
+}
@@ -0,0 +1,105 @@
+#include "demosaiccache.h"
+
+#include <cstring>
+
+DemosaicCache::DemosaicCache(size_t budget, bool halfFloat): _budget(budget), _size(0), _halfFloat(halfFloat) {}
+
+
+void DemosaicCache::setBudget(size_t budget, bool halfFloat)
+{
+    QMutexLocker lock(&_mutex);
+
+    // Entries stored with the other precision are dropped
+    if (halfFloat != _halfFloat) {
+        _entries.clear();
+        _size = 0;
+    }
+
+    _budget    = budget;
+    _halfFloat = halfFloat;
+
+    evict(_budget);
+}
+
+
+bool DemosaicCache::fetch(const QString& file, RAWDemosaicMethod method, float* pixels, size_t n_values)
+{
+    QMutexLocker lock(&_mutex);
+
+    for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); it++) {
+        if (it->file != file || it->method != method) continue;
+
+        if (_halfFloat) {
+            if (it->halfPixels.size() != n_values) return false;
+            qFloatFromFloat16(pixels, it->halfPixels.data(), n_values);
+        } else {
+            if (it->pixels.size() != n_values) return false;
+            std::memcpy(pixels, it->pixels.data(), n_values * sizeof(float));
+        }
+
+        _entries.splice(_entries.begin(), _entries, it);
+
+        return true;
+    }
+
+    return false;
+}
+
+
+void DemosaicCache::store(const QString& file, RAWDemosaicMethod method, const float* pixels, size_t n_values)
+{
+    QMutexLocker lock(&_mutex);
+
+    for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); it++) {
+        if (it->file == file && it->method == method) {
+            _size -= getEntrySize(*it);
+            _entries.erase(it);
+            break;
+        }
+    }
+
+    const size_t entry_size = n_values * (_halfFloat ? sizeof(qfloat16) : sizeof(float));
+
+    if (entry_size > _budget) return;
+
+    // Room is made before allocating the new buffer
+    evict(_budget - entry_size);
+
+    Entry entry;
+    entry.file   = file;
+    entry.method = method;
+
+    if (_halfFloat) {
+        entry.halfPixels.resize(n_values);
+        qFloatToFloat16(entry.halfPixels.data(), pixels, n_values);
+    } else {
+        entry.pixels.assign(pixels, pixels + n_values);
+    }
+
+    _entries.push_front(std::move(entry));
+    _size += entry_size;
+}
+
+
+void DemosaicCache::clear()
+{
+    QMutexLocker lock(&_mutex);
+
+    _entries.clear();
+    _size = 0;
+}
+
+
+size_t DemosaicCache::getEntrySize(const Entry& entry)
+{
+    return entry.pixels.size() * sizeof(float) + entry.halfPixels.size() * sizeof(qfloat16);
+}
+
+
+void DemosaicCache::evict(size_t budget)
+{
+    while (_size > budget) {
+        _size -= getEntrySize(_entries.back());
+        _entries.pop_back();
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef DEMOSAICCACHE_H
+#define DEMOSAICCACHE_H
+
+#include <QFloat16>
+#include <QMutex>
+#include <QString>
+#include <list>
+#include <vector>
+#include <demosaicing.h>
+
+// Default memory budget of the cache in MiB
+#define DEMOSAIC_CACHE_DEFAULT_BUDGET 1024
+
+// Least recently used cache of demosaiced RGB buffers, keyed by file and
+// demosaicing method. Buffers can be stored in half floats to hold twice as
+// many images, at the cost of a relative precision of 2^-11.
+class DemosaicCache
+{
+  public:
+    DemosaicCache(size_t budget = size_t(DEMOSAIC_CACHE_DEFAULT_BUDGET) << 20, bool halfFloat = false);
+
+    // Budget in bytes, 0 disables the cache
+    void setBudget(size_t budget, bool halfFloat);
+
+    // Copies the cached buffer of n_values floats into pixels, false if
+    // the file was not demosaiced with this method yet
+    bool fetch(const QString& file, RAWDemosaicMethod method, float* pixels, size_t n_values);
+
+    void store(const QString& file, RAWDemosaicMethod method, const float* pixels, size_t n_values);
+
+    void clear();
+
+  private:
+    struct Entry {
+        QString               file;
+        RAWDemosaicMethod     method;
+        std::vector<float>    pixels;
+        std::vector<qfloat16> halfPixels;
+    };
+
+    static size_t getEntrySize(const Entry& entry);
+
+    // Drops the least recently used entries until the cache fits the budget
+    void evict(size_t budget);
+
+    QMutex           _mutex;
+    std::list<Entry> _entries;   // Most recently used first
+    size_t           _budget;
+    size_t           _size;
+    bool             _halfFloat;
+};
+
+#endif   // DEMOSAICCACHE_H
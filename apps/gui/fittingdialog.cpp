@@ -2,20 +2,27 @@
 #include "ui_fittingdialog.h"
 
 #include <QTimer>
-#include <QFuture>
-#include <QtConcurrent/QtConcurrent>
 #include <QFileDialog>
 
+#include <algorithm>
+#include <cmath>
+
 #include <radiometry.h>
 
 extern "C"
 {
 #include <levmar.h>
 #include <color-converter.h>
+#include <fitting.h>
 #include <spectrum-converter.h>
 #include <io.h>
 }
 
+// The fit is run by steps of this many iterations, the result is shown and
+// the fit can be cancelled between steps
+#define FIT_STEP_ITERATIONS 50
+#define FIT_MAX_ITERATIONS  5000
+
 FittingDialog::FittingDialog(ImageModel* model, QWidget* parent)
   : QDialog(parent)
   , ui(new Ui::FittingDialog)
@@ -31,16 +38,22 @@ FittingDialog::FittingDialog(ImageModel* model, QWidget* parent)
       SENSITIVITY_CIE_1931_2DEG_SIZE,
       this)
   , _image(model)
-  , _processWatcher(new QFutureWatcher<void>(this))
+  , _fitMatrix({1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f})
 {
     ui->setupUi(this);
 
     ui->reference->setModel(&_reference);
     ui->measured->setModel(&_measured);
+
+    // Patches are averaged again when the chart moves
+    connect(_image, SIGNAL(averagedPatchesChanged()), this, SLOT(initModels()));
+    connect(_image, SIGNAL(patchStatisticsChanged()), this, SLOT(initModels()));
+    connect(this, SIGNAL(fitUpdated()), this, SLOT(onFitUpdated()));
 }
 
 FittingDialog::~FittingDialog()
 {
+    _fitJobs.stop();
     delete ui;
 }
 
@@ -50,68 +63,157 @@ void FittingDialog::showEvent(QShowEvent* event)
     QTimer::singleShot(0, this, SLOT(initModels()));
 }
 
-void FittingDialog::measure(
-  float* pParameters, float* pMeasurements, int n_parameters, int n_measurements, void* pUserParam)
+void FittingDialog::fit()
 {
-    (void)n_parameters;
-    (void)n_measurements;
+    if (!_measured.ready()) return;
+
+    // Inputs of the fit as of now, the worker does not read the models
+    const std::array<float, 72> reference = _reference.getLinearColors();
+    const std::array<float, 72> measured  = _measured.getLinearColors();
+    const std::array<bool, 24>  selected  = _measured.getSelectedPatches();
+    const std::array<float, 9>  start     = _fitMatrix;
+
+    // Patches are weighted by their variance once the image model has
+    // scanned them, clipped ones are left out. Statistics of patches since
+    // moved or of previous pixels would mislead the fit: not weighted then
+    std::vector<PatchStatistics> statistics;
+    const bool                   current = _image->getPatchStatistics(statistics);
+
+    std::array<int, 24>   select;
+    std::array<float, 24> weights;
+    const bool            weighted = current && statistics.size() == weights.size();
+
+    if (weighted) {
+        std::array<float, 72>  means, variances;
+        std::array<size_t, 24> n_pixels;
+
+        for (size_t p = 0; p < statistics.size(); p++) {
+            for (int c = 0; c < 3; c++) {
+                means[3 * p + c]     = statistics[p].mean[c];
+                variances[3 * p + c] = statistics[p].variance[c];
+            }
+
+            n_pixels[p] = statistics[p].n_pixels;
+        }
+
+        fit_patch_weights(&means[0], &variances[0], &n_pixels[0], weights.size(), &weights[0]);
+    }
+
+    for (size_t p = 0; p < select.size(); p++) {
+        select[p] = selected[p]
+                    && (!weighted || statistics[p].n_clipped <= FIT_MAX_CLIPPED_FRACTION * statistics[p].n_pixels);
+    }
+
+    _fitJobs.submit(JobScheduler::FIT, [=](const JobToken& token) {
+        FitPatches u_params
+          = {select.size(), 1, &reference[0], &measured[0], &select[0], weighted ? &weights[0] : NULL};
+
+        // The Delta E shown are not weighted
+        FitPatches u_params_shown   = u_params;
+        u_params_shown.weight_patch = NULL;
+
+        const size_t n_selected = fit_n_measurements(&u_params);
+
+        fit_result result;
+        result.matrix    = start;
+        result.nPatches  = n_selected;
+        result.weighted  = weighted;
+        result.converged = false;
+
+        std::vector<float> deltaE(n_selected);
+        int                iterations = 0;
+
+        // Warm start from the last matrix: small edits converge in a few steps
+        while (!result.converged && !token.isCanceled()) {
+            std::array<float, 9> matrix = result.matrix;
+            float                info[LM_INFO_SZ];
+
+            // Fewer patches than parameters: the matrix is kept
+            if (n_selected < matrix.size()) {
+                result.converged = true;
+            } else {
+                slevmar_dif(
+                  fit_residuals_matrix,
+                  &matrix[0],
+                  NULL,
+                  matrix.size(),
+                  n_selected,
+                  FIT_STEP_ITERATIONS,
+                  NULL,
+                  info,
+                  NULL,
+                  NULL,
+                  &u_params);
+
+                iterations += FIT_STEP_ITERATIONS;
+
+                // Stops unless the iteration limit of the step was reached
+                result.converged = info[6] != 3 || iterations >= FIT_MAX_ITERATIONS;
+            }
+
+            // A diverging step is dropped
+            if (std::all_of(matrix.begin(), matrix.end(), [](float v) { return std::isfinite(v); })) {
+                result.matrix = matrix;
+            }
 
-    const fit_params* info = (fit_params*)pUserParam;
+            result.meanDeltaE = 0.f;
+            result.maxDeltaE  = 0.f;
 
-    float tristim_mea_corrected[3];
-    float lab_ref[3];
-    float lab_mea[3];
+            if (n_selected > 0) {
+                fit_residuals_matrix(
+                  &result.matrix[0], deltaE.data(), result.matrix.size(), n_selected, &u_params_shown);
 
-    int measurement_idx = 0;
-    // For each patch, we try to minimize the Delta_E_2000 between reference and measurement
-    for (size_t patch_idx = 0; patch_idx < info->n_patches; patch_idx++) {
-        if (info->selected_patches[patch_idx]) {
-            const float* tristim_ref = &(info->reference_patches[3 * patch_idx]);
-            const float* tristim_mea = &(info->measured_patches[3 * patch_idx]);
+                for (float e : deltaE) {
+                    result.meanDeltaE += e / float(n_selected);
+                    result.maxDeltaE = std::max(result.maxDeltaE, e);
+                }
+            }
 
-            // Apply the correction matrix which is optimized by levmar
-            matmul(pParameters, tristim_mea, tristim_mea_corrected);
+            if (token.isCanceled()) return;
 
-            // Transform colorspaces to Lab*
-            XYZ_to_Lab(tristim_ref, lab_ref);
-            XYZ_to_Lab(tristim_mea_corrected, lab_mea);
+            _mutex.lock();
+            _fitResult = result;
+            _mutex.unlock();
 
-            // The error is the Delta_E_2000 between reference and corrected Lab* values
-            pMeasurements[measurement_idx++] = deltaE_2000(lab_ref, lab_mea);
+            emit fitUpdated();
         }
-    }
+    });
 }
 
-void FittingDialog::fit()
+void FittingDialog::onFitUpdated()
 {
-    ui->applyMatrix->setEnabled(false);
-    ui->apply->setEnabled(false);
-
-    const size_t size = _measured.getNSelectedPatches();
-    _fitMatrix        = {1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f};
-    fit_params u_params
-      = {size, &_reference.getLinearColors()[0], &_measured.getLinearColors()[0], &_measured.getSelectedPatches()[0]};
-    slevmar_dif(FittingDialog::measure, &_fitMatrix[0], NULL, 9, size, 5000, NULL, NULL, NULL, NULL, &u_params);
+    _mutex.lock();
+    const fit_result result = _fitResult;
+    _mutex.unlock();
+
+    _fitMatrix = result.matrix;
     _measured.setMatrix(_fitMatrix);
 
+    ui->fitStatistics->setText(
+      tr("%1 DeltaE 2000 on %2 %3patches: mean %4, max %5")
+        .arg(result.converged ? tr("Fitted") : tr("Fitting..."))
+        .arg(result.nPatches)
+        .arg(result.weighted ? tr("variance weighted ") : QString())
+        .arg(result.meanDeltaE, 0, 'f', 2)
+        .arg(result.maxDeltaE, 0, 'f', 2));
+
     ui->applyMatrix->setEnabled(true);
     ui->apply->setEnabled(true);
 }
 
 void FittingDialog::initModels()
 {
-    QFuture<void> imageLoading = QtConcurrent::run([=]() {
-        std::vector<float> measuredValues;
-        _mutex.lock();
-        _image->getAveragedPatches(measuredValues);
-        _measured.setPatchesValues(measuredValues);
-        ui->illuminant->setEnabled(true);
-        ui->colorMatchingFunctions->setEnabled(true);
-        fit();
-        _mutex.unlock();
-    });
+    if (!_image->isImageLoaded()) return;
+
+    // Cheap from the integral image of the model: done on each chart move
+    std::vector<float> measuredValues;
+    _image->getAveragedPatches(measuredValues);
+    _measured.setPatchesValues(measuredValues);
+
+    ui->illuminant->setEnabled(true);
+    ui->colorMatchingFunctions->setEnabled(true);
 
-    _processWatcher->setFuture(imageLoading);
+    fit();
 }
 
 
@@ -123,8 +225,6 @@ void FittingDialog::on_applyMatrix_toggled(bool checked)
 
 void FittingDialog::on_colorMatchingFunctions_currentIndexChanged(int index)
 {
-    _mutex.lock();
-
     if (index == 0) {
         _reference.setCMFs(
           SENSITIVITY_CIE_1931_2DEG_X,
@@ -206,14 +306,11 @@ void FittingDialog::on_colorMatchingFunctions_currentIndexChanged(int index)
     }
 
     fit();
-    _mutex.unlock();
 }
 
 
 void FittingDialog::on_illuminant_currentIndexChanged(int index)
 {
-    _mutex.lock();
-
     if (index == 0) {
         _reference.setIlluminant(D_65_SPD, D_65_FIRST_WAVELENGTH, D_65_ARRAY_SIZE);
     } else if (index == 1) {
@@ -262,21 +359,16 @@ void FittingDialog::on_illuminant_currentIndexChanged(int index)
 
 
     fit();
-    _mutex.unlock();
 }
 
 void FittingDialog::on_minThreshold_valueChanged(double arg1)
 {
-    _mutex.lock();
     _measured.setMinThreshold(arg1);
     fit();
-    _mutex.unlock();
 }
 
 void FittingDialog::on_maxThreshold_valueChanged(double arg1)
 {
-    _mutex.lock();
     _measured.setMaxThreshold(arg1);
     fit();
-    _mutex.unlock();
 }
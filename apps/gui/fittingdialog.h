@@ -2,9 +2,10 @@
 #define FITTINGDIALOG_H
 
 #include <QDialog>
-#include <QFutureWatcher>
+#include <QMutex>
 
 #include "imagemodel.h"
+#include "jobscheduler.h"
 #include "macbethreferencemodel.h"
 #include "macbethmeasuredmodel.h"
 
@@ -17,13 +18,6 @@ class FittingDialog: public QDialog
 {
     Q_OBJECT
 
-    typedef struct {
-        size_t       n_patches;
-        const float* reference_patches;
-        const float* measured_patches;
-        const bool*  selected_patches;
-    } fit_params;
-
     typedef struct {
         std::vector<float> illuminantSPD;
         int                firstWavelength;
@@ -37,6 +31,15 @@ class FittingDialog: public QDialog
         int                firstWavelength;
     } cmf_data;
 
+    typedef struct {
+        std::array<float, 9> matrix;
+        float                meanDeltaE;
+        float                maxDeltaE;
+        size_t               nPatches;
+        bool                 weighted;
+        bool                 converged;
+    } fit_result;
+
   public:
     explicit FittingDialog(ImageModel* model, QWidget* parent = nullptr);
     ~FittingDialog();
@@ -46,12 +49,15 @@ class FittingDialog: public QDialog
   protected:
     void showEvent(QShowEvent* event);
 
-    static void
-         measure(float* pParameters, float* pMeasurements, int n_parameters, int n_measurements, void* pUserParam);
     void fit();
 
+  signals:
+    // Emitted by the fitting job after each step
+    void fitUpdated();
+
   protected slots:
     void initModels();
+    void onFitUpdated();
 
   private slots:
     void on_applyMatrix_toggled(bool checked);
@@ -72,13 +78,16 @@ class FittingDialog: public QDialog
 
     ImageModel* _image;
 
-    QFutureWatcher<void>* _processWatcher;
-
     std::array<float, 9> _fitMatrix;
 
     std::vector<illuminant_data> _userIlluminants;
     std::vector<cmf_data>        _userCMFs;
-    QMutex                       _mutex;
+
+    // Fits run on their own worker, a new fit cancels the running one and
+    // starts from its last matrix
+    JobScheduler _fitJobs;
+    QMutex       _mutex;
+    fit_result   _fitResult;
 };
 
 #endif   // FITTINGDIALOG_H
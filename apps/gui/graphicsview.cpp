@@ -14,7 +14,7 @@
 GraphicsView::GraphicsView(QWidget* parent)
   : QGraphicsView(parent)
   , _model(nullptr)
-  , _imageItem(nullptr)
+  , _displayLevel(0)
   , _inSelection(false)
   , _selection(nullptr)
   , _showMacbeth(true)
@@ -36,7 +36,7 @@ void GraphicsView::setModel(ImageModel* model)
 {
     _model = model;
 
-    connect(_model, SIGNAL(imageChanged()), this, SLOT(onImageChanged()));
+    connect(_model, SIGNAL(displayTilesChanged()), this, SLOT(onDisplayTilesChanged()));
     connect(_model, SIGNAL(imageLoaded(int, int)), this, SLOT(onImageLoaded(int, int)));
     connect(_model, SIGNAL(macbethChartChanged()), this, SLOT(onMacbethChartChanged()));
 }
@@ -44,27 +44,76 @@ void GraphicsView::setModel(ImageModel* model)
 
 void GraphicsView::onImageLoaded(int width, int height)
 {
+    clearTiles();
+
     _zoomLevel = 1.f;
     fitInView(0, 0, width, height, Qt::KeepAspectRatio);
     _zoomLevel = std::min(viewportTransform().m11(), viewportTransform().m22());
     _autoscale = true;
+
+    updateDisplayViewport();
+    _model->setDisplayZoom(_zoomLevel);
 }
 
 
-void GraphicsView::onImageChanged()
+void GraphicsView::onDisplayTilesChanged()
 {
     if (_model == nullptr) return;
 
-    if (_imageItem != nullptr) {
-        scene()->removeItem(_imageItem);
-        delete _imageItem;
-        _imageItem = nullptr;
+    // Only the tiles which changed are uploaded
+    for (const ImageModel::display_tile& tile : _model->takeDisplayTiles()) {
+        const std::pair<int, int> key(tile.level, tile.index);
+        const QPixmap             pixmap = QPixmap::fromImage(tile.image);
+
+        auto it = _tileItems.find(key);
+
+        if (it != _tileItems.end()) {
+            it->second->setPixmap(pixmap);
+        } else {
+            // Scaled back to the full resolution coordinates used by the chart
+            QGraphicsPixmapItem* item = scene()->addPixmap(pixmap);
+            item->setPos(tile.rect.x() << tile.level, tile.rect.y() << tile.level);
+            item->setScale(1 << tile.level);
+
+            _tileItems[key] = item;
+        }
     }
 
-    const QImage& image = _model->getLoadedImage();
-    _imageItem          = scene()->addPixmap(QPixmap::fromImage(image));
+    _displayLevel = _model->getDisplayLevel();
+    updateTilesVisibility();
+}
+
 
-    onMacbethChartChanged();
+void GraphicsView::updateTilesVisibility()
+{
+    const int background_level = _model->getNDisplayLevels() - 1;
+
+    for (auto it = _tileItems.begin(); it != _tileItems.end();) {
+        const int level = it->first.first;
+
+        // The model converts the other levels again when they are shown
+        if (level != _displayLevel && level != background_level) {
+            scene()->removeItem(it->second);
+            delete it->second;
+            it = _tileItems.erase(it);
+            continue;
+        }
+
+        // Under the chart items
+        it->second->setZValue((level == _displayLevel) ? -1 : -2);
+        ++it;
+    }
+}
+
+
+void GraphicsView::clearTiles()
+{
+    for (auto& it : _tileItems) {
+        scene()->removeItem(it.second);
+        delete it.second;
+    }
+
+    _tileItems.clear();
 }
 
 
@@ -72,7 +121,7 @@ void GraphicsView::onMacbethChartChanged()
 {
     if (_model == nullptr || !_model->isImageLoaded()) return;
 
-    const float ratio = _model->getLoadedImage().width() / 500;
+    const float ratio = _model->getWidth() / 500;
 
     for (QGraphicsItem* item : _chartItems) {
         scene()->removeItem(item);
@@ -154,6 +203,9 @@ void GraphicsView::setZoomLevel(float zoom)
     _zoomLevel = std::max(0.01f, zoom);
     resetTransform();
     scale(_zoomLevel, _zoomLevel);
+
+    updateDisplayViewport();
+    _model->setDisplayZoom(_zoomLevel);
 }
 
 
@@ -195,8 +247,29 @@ void GraphicsView::resizeEvent(QResizeEvent* e)
     QGraphicsView::resizeEvent(e);
     if (_model == nullptr || !_model->isImageLoaded()) return;
 
-    if (_autoscale)
-        fitInView(0, 0, _model->getLoadedImage().width(), _model->getLoadedImage().height(), Qt::KeepAspectRatio);
+    if (_autoscale) {
+        fitInView(0, 0, _model->getWidth(), _model->getHeight(), Qt::KeepAspectRatio);
+        _zoomLevel = std::min(viewportTransform().m11(), viewportTransform().m22());
+    }
+
+    updateDisplayViewport();
+    _model->setDisplayZoom(_zoomLevel);
+}
+
+
+void GraphicsView::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    updateDisplayViewport();
+}
+
+
+// The model converts the tiles in the viewport first
+void GraphicsView::updateDisplayViewport()
+{
+    if (_model == nullptr) return;
+
+    _model->setDisplayViewport(mapToScene(viewport()->rect()).boundingRect());
 }
 
 
@@ -3,6 +3,9 @@
 
 #include <QGraphicsView>
 
+#include <map>
+#include <utility>
+
 #include "imagemodel.h"
 
 class GraphicsView: public QGraphicsView
@@ -16,7 +19,7 @@ class GraphicsView: public QGraphicsView
     void setModel(ImageModel* model);
 
     void onImageLoaded(int width, int height);
-    void onImageChanged();
+    void onDisplayTilesChanged();
     void onMacbethChartChanged();
     void setShowMacbeth(bool show);
     void setShowPatchNumbers(bool show);
@@ -27,6 +30,7 @@ class GraphicsView: public QGraphicsView
   protected:
     void wheelEvent(QWheelEvent* event) override;
     void resizeEvent(QResizeEvent* event) override;
+    void scrollContentsBy(int dx, int dy) override;
 
     void mousePressEvent(QMouseEvent* event) override;
     void mouseMoveEvent(QMouseEvent* event) override;
@@ -36,8 +40,17 @@ class GraphicsView: public QGraphicsView
     void dragEnterEvent(QDragEnterEvent* ev) override;
 
   private:
-    ImageModel*          _model;
-    QGraphicsPixmapItem* _imageItem;
+    void updateDisplayViewport();
+    void updateTilesVisibility();
+    void clearTiles();
+
+    ImageModel* _model;
+
+    // One item per converted tile, by level and tile index. Only the tiles
+    // of the displayed level and of the coarsest one, under the others
+    // until they are converted, are kept.
+    std::map<std::pair<int, int>, QGraphicsPixmapItem*> _tileItems;
+    int                                                 _displayLevel;
 
     QVector<QGraphicsItem*> _chartItems;
 
@@ -2,88 +2,146 @@
 
 #include <cstddef>
 #include <cmath>
+#include <algorithm>
 #include <array>
 #include <fstream>
 
 extern "C"
 {
 #include <image.h>
+#include <chartdetection.h>
 #include <color-converter.h>
 #include <io.h>
+#include <patches.h>
 }
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
-#include <QFuture>
-#include <QtConcurrent/QtConcurrent>
 #include <QFile>
+#include <QLineF>
+#include <QMetaObject>
 
 ImageModel::ImageModel()
   : QObject()
   , _mosaicedPixelBuffer(nullptr)
   , _pixelBuffer(nullptr)
   , _correctionMatrix({1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f})
+  , _displayZoom(0.f)
+  , _displayLevel(0)
+  , _width(0)
+  , _height(0)
+  , _displayKey()
   , _isImageLoaded(false)
   , _isMatrixLoaded(false)
   , _isMatrixActive(false)
   , _isRawImage(false)
   , _innerMarginX(0.01)
   , _innerMarginY(0.01)
+  , _patchesGeneration(0)
+  , _patchStatisticsGeneration(0)
   , _exposure(0)
   , _demosaicingMethod(RAWDemosaicMethod::VNG4)
   , _filters(0x49494949)
-  , _imageLoadingWatcher(new QFutureWatcher<void>(this))
-  , _imageDemosaicingWatcher(new QFutureWatcher<void>(this))
-  , _imageEditingWatcher(new QFutureWatcher<void>(this))
 {
     _macbethOutline << QPointF(0, 0) << QPointF(100, 0) << QPointF(100, 100) << QPointF(0, 100);
 
+    // From the configuration of the host until changed in the view
+    demosaic_get_auto_options(&_autoDemosaicOptions);
+
     recalculateMacbethPatches();
 }
 
 
+// Names of the demosaicing methods shown in the view
+static const struct {
+    const char*       text;
+    RAWDemosaicMethod method;
+} demosaicing_methods[] = {
+  {"None", RAWDemosaicMethod::NONE},
+  {"Basic", RAWDemosaicMethod::BASIC},
+  {"MHC", RAWDemosaicMethod::MHC},
+  {"VNG4", RAWDemosaicMethod::VNG4},
+  {"AHD", RAWDemosaicMethod::AHD},
+  {"RCD", RAWDemosaicMethod::RCD},
+  {"AMaZE", RAWDemosaicMethod::AMAZE},
+  {"Auto", RAWDemosaicMethod::AUTO}};
+
+
+bool ImageModel::getDemosaicingMethod(const QString& text, RAWDemosaicMethod& method)
+{
+    for (const auto& m: demosaicing_methods) {
+        if (text == m.text) {
+            method = m.method;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+QString ImageModel::getDemosaicingMethodText(RAWDemosaicMethod method)
+{
+    for (const auto& m: demosaicing_methods) {
+        if (method == m.method) {
+            return m.text;
+        }
+    }
+
+    return QString();
+}
+
+
 ImageModel::~ImageModel()
 {
+    // The running job still uses the buffers
+    _jobs.stop();
+
     free(_mosaicedPixelBuffer);
     free(_pixelBuffer);
 }
 
 
-void ImageModel::getAveragedPatches(std::vector<float>& values)
+std::vector<ImageModel::display_tile> ImageModel::takeDisplayTiles()
 {
-    std::vector<float> patches_values(4 * _macbethPatches.size(), 0.f);
+    std::vector<display_tile> tiles;
 
-    for (int y = 0; y < _image.height(); y++) {
-        #pragma omp parallel for
-        for (int x = 0; x < _image.width(); x++) {
-            const QPointF currentPixel(x, y);
+    _displayMutex.lock();
+    tiles.swap(_displayTiles);
+    _displayMutex.unlock();
 
-            for (int p = 0; p < _macbethPatches.size(); p++) {
-                if (_macbethPatches[p].containsPoint(currentPixel, Qt::OddEvenFill)) {
-                    for (int c = 0; c < 3; c++) {
-                        patches_values[4 * p + c] += _pixelBuffer[3 * (y * _image.width() + x) + c];
-                    }
-                    patches_values[4 * p + 3] += 1;
-                    //break;
-                }
-            }
-        }
+    return tiles;
+}
 
-        emit processProgress(int(100.f * float(y) / float(_image.height() - 1)));
-    }
+
+void ImageModel::getAveragedPatches(std::vector<float>& values)
+{
+    QMutexLocker lock(&_patchesMutex);
 
     values.resize(3 * _macbethPatches.size());
 
-    #pragma omp parallel for
     for (int p = 0; p < _macbethPatches.size(); p++) {
+        double       sum[3];
+        const size_t n_pixels = _integralImage.sumPolygon(_macbethPatches[p], sum);
+
         for (int c = 0; c < 3; c++) {
-            values[3 * p + c] = patches_values[4 * p + c] / patches_values[4 * p + 3];
+            values[3 * p + c] = (n_pixels > 0) ? sum[c] / double(n_pixels) : 0.f;
         }
     }
 }
 
 
+bool ImageModel::getPatchStatistics(std::vector<PatchStatistics>& statistics)
+{
+    QMutexLocker lock(&_patchesMutex);
+
+    statistics = _patchStatistics;
+
+    return !statistics.empty() && _patchStatisticsGeneration == _patchesGeneration;
+}
+
+
 void ImageModel::openFile(const QString& filename)
 {
     if (
@@ -98,25 +156,38 @@ void ImageModel::openFile(const QString& filename)
 
 void ImageModel::openImage(const QString& filename)
 {
-    free(_mosaicedPixelBuffer);
-    free(_pixelBuffer);
+    // The new image supersedes any work on the previous one
+    const RAWDemosaicMethod   method      = _demosaicingMethod;
+    const DemosaicAutoOptions autoOptions = _autoDemosaicOptions;
 
-    _mosaicedPixelBuffer = nullptr;
-    _pixelBuffer         = nullptr;
-    _isImageLoaded       = false;
-    _isRawImage          = false;
+    // Starts with the coarsest level, refined once the view is fitted
+    _exposure = 0.;
 
-    if (_imageEditingWatcher->isRunning()) {
-        emit _imageEditingWatcher->cancel();
-        _imageEditingWatcher->waitForFinished();
-    }
+    _displayMutex.lock();
+    _displayZoom = 0.f;
+    _displayMutex.unlock();
 
-    if (_imageLoadingWatcher->isRunning()) {
-        emit _imageLoadingWatcher->cancel();
-        _imageLoadingWatcher->waitForFinished();
-    }
+    _jobs.submit(JobScheduler::LOAD, [=](const JobToken& token) {
+        _isImageLoaded = false;
+        _isRawImage    = false;
+
+        _pyramid.clear();
+        resetDisplayCache();
+
+        _patchesMutex.lock();
+        _integralImage.clear();
+        _patchStatistics.clear();
+        _patchesGeneration++;
+        _patchesMutex.unlock();
+
+        free(_mosaicedPixelBuffer);
+        free(_pixelBuffer);
+
+        _mosaicedPixelBuffer = nullptr;
+        _pixelBuffer         = nullptr;
+
+        if (token.isCanceled()) return;
 
-    QFuture<void> imageLoading = QtConcurrent::run([=]() {
         emit   processProgress(0);
         emit   loadingMessage(tr("Loading image..."));
         size_t width, height;
@@ -129,47 +200,69 @@ void ImageModel::openImage(const QString& filename)
             if (success != 0) {
                 emit loadFailed(tr("Cannot open image file"));
                 emit loadingMessage("");
-                delete[] _pixelBuffer;
-                _pixelBuffer = nullptr;
                 return;
             }
+
             _isRawImage  = true;
             _pixelBuffer = (float*)calloc(3 * width * height, sizeof(float));
-            demosaic(_mosaicedPixelBuffer, _pixelBuffer, width, height, _filters, _demosaicingMethod);
+            _width       = width;
+            _height      = height;
+
+            // Shown until the selected method is run region by region
+            buildDemosaicPreview();
         } else {
             success = read_image(filename.toStdString().c_str(), &_pixelBuffer, &width, &height);
 
             if (success != 0) {
                 emit loadFailed(tr("Cannot open image file"));
                 emit loadingMessage("");
-                delete[] _pixelBuffer;
-                _pixelBuffer = nullptr;
                 return;
             }
         }
 
-        _exposure = 0.f;
-        _pixelCorrected.resize(3 * width * height);
-        _image         = QImage(width, height, QImage::Format_RGB888);
+        _width  = width;
+        _height = height;
+
+        emit loadingMessage(tr("Building preview..."));
+        rebuildPyramid();
+        resetDisplayCache();
+        rebuildIntegralImage();
+
         _isImageLoaded = true;
         _imagePath     = filename;
-        _macbethOutline.clear();
-        _macbethOutline << QPointF(0, 0) << QPointF(_image.width(), 0) << QPointF(_image.width(), _image.height())
-                        << QPointF(0, _image.height());
 
-        recalculateMacbethPatches();
+        emit loadingMessage(tr("Detecting color chart..."));
+
+        // The full image unless a chart is found
+        QPolygonF outline;
+
+        if (!locateChart(token, outline)) {
+            outline.clear();
+            outline << QPointF(0, 0) << QPointF(_width, 0) << QPointF(_width, _height) << QPointF(0, _height);
+        }
+
+        setMacbethOutlineLater(outline);
 
         emit processProgress(100);
         emit loadingMessage("");
-        emit exposureChanged(_exposure);
+        emit exposureChanged(0.);
         emit imageLoaded(width, height);
     });
 
-    _imageLoadingWatcher->setFuture(imageLoading);
+    _jobs.submit(JobScheduler::DEMOSAIC, [=](const JobToken& token) {
+        demosaicProgressively(token, method, autoOptions);
+    });
+
     recalculateCorrection(0);
 }
 
 
+void ImageModel::setDemosaicCache(size_t budget, bool halfFloat)
+{
+    _demosaicCache.setBudget(budget, halfFloat);
+}
+
+
 void ImageModel::openCorrectionMatrix(const QString& filename)
 {
     QFile f(filename);
@@ -227,6 +320,25 @@ void ImageModel::setOutlinePosition(int index, QPointF position)
 }
 
 
+void ImageModel::detectChart()
+{
+    _jobs.submit(JobScheduler::DETECT, [=](const JobToken& token) {
+        emit loadingMessage(tr("Detecting color chart..."));
+
+        QPolygonF outline;
+
+        if (locateChart(token, outline)) {
+            setMacbethOutlineLater(outline);
+            emit loadingMessage("");
+        } else if (token.isCanceled()) {
+            emit loadingMessage("");
+        } else {
+            emit loadingMessage(tr("No color chart found"));
+        }
+    });
+}
+
+
 void ImageModel::setExposure(double value)
 {
     recalculateCorrection(value);
@@ -235,46 +347,35 @@ void ImageModel::setExposure(double value)
 
 void ImageModel::setDemosaicingMethod(const QString& method)
 {
-    if (_imageLoadingWatcher->isRunning()) {
-        _imageLoadingWatcher->waitForFinished();
-    }
+    getDemosaicingMethod(method, _demosaicingMethod);
 
-    if (!isImageLoaded()) return;
+    redemosaic();
+}
 
-    if (_imageDemosaicingWatcher->isRunning()) {
-        _imageDemosaicingWatcher->waitForFinished();
-    }
 
-    if (_imageEditingWatcher->isRunning()) {
-        _imageEditingWatcher->waitForFinished();
-    }
+void ImageModel::setAutoDemosaicOptions(double budgetMs, const QString& minQuality)
+{
+    // Only used by this model: the options of the host are left unchanged
+    _autoDemosaicOptions.time_budget_ms = std::max(0., budgetMs);
+    getDemosaicingMethod(minQuality, _autoDemosaicOptions.min_quality);
 
-    if (method == "None") {
-        _demosaicingMethod = RAWDemosaicMethod::NONE;
-    } else if (method == "Basic") {
-        _demosaicingMethod = RAWDemosaicMethod::BASIC;
-    } else if (method == "VNG4") {
-        _demosaicingMethod = RAWDemosaicMethod::VNG4;
-    } else if (method == "AHD") {
-        _demosaicingMethod = RAWDemosaicMethod::AHD;
-    } else if (method == "RCD") {
-        _demosaicingMethod = RAWDemosaicMethod::RCD;
-    } else if (method == "AMaZE") {
-        _demosaicingMethod = RAWDemosaicMethod::AMAZE;
+    if (_demosaicingMethod == RAWDemosaicMethod::AUTO) {
+        redemosaic();
     }
+}
 
-    if (_imageEditingWatcher->isRunning()) {
-        _imageEditingWatcher->waitForFinished();
-    }
 
-    if (_isRawImage) {
-        QFuture<void> demosaicing = QtConcurrent::run([=]() {
-            demosaic(_mosaicedPixelBuffer, _pixelBuffer, _image.width(), _image.height(), _filters, _demosaicingMethod);
-        });
+void ImageModel::redemosaic()
+{
+    const RAWDemosaicMethod   demosaicing_method = _demosaicingMethod;
+    const DemosaicAutoOptions autoOptions        = _autoDemosaicOptions;
 
-        _imageDemosaicingWatcher->setFuture(demosaicing);
-        recalculateCorrection(_exposure);
-    }
+    // Supersedes the demosaicing of a pending load
+    _jobs.submit(JobScheduler::DEMOSAIC, [=](const JobToken& token) {
+        demosaicProgressively(token, demosaicing_method, autoOptions);
+    });
+
+    updateDisplay();
 }
 
 
@@ -301,21 +402,40 @@ void ImageModel::setMatrixActive(bool active)
 }
 
 
+void ImageModel::setDisplayZoom(float zoom)
+{
+    _displayMutex.lock();
+    _displayZoom = zoom;
+    _displayMutex.unlock();
+
+    updateDisplay();
+}
+
+
+void ImageModel::setDisplayViewport(const QRectF& viewport)
+{
+    _displayMutex.lock();
+    _displayViewport = viewport;
+    _displayMutex.unlock();
+
+    // Tiles scrolled into view are converted first
+    updateDisplay();
+}
+
+
 void ImageModel::savePatchesCoordinates(const QString& filename)
 {
-    if (!isImageLoaded()) return;
+    const QVector<QPolygonF> patches = _macbethPatches;
 
-    if (_imageLoadingWatcher->isRunning()) {
-        _imageLoadingWatcher->waitForFinished();
-    }
+    _jobs.enqueue(JobScheduler::EXPORT, [=](const JobToken&) {
+        if (!_isImageLoaded) return;
 
-    QFuture<void> imageLoading = QtConcurrent::run([=]() {
         emit processProgress(0);
         emit loadingMessage(tr("Saving patches coordinates..."));
 
         std::ofstream outputFile(filename.toStdString());
 
-        for (const QPolygonF& patch : _macbethPatches) {
+        for (const QPolygonF& patch : patches) {
             for (const QPointF& p : patch) {
                 outputFile << p.x() << ", " << p.y() << "; ";
             }
@@ -325,20 +445,14 @@ void ImageModel::savePatchesCoordinates(const QString& filename)
         emit processProgress(100);
         emit loadingMessage("");
     });
-
-    _imageLoadingWatcher->setFuture(imageLoading);
 }
 
 
 void ImageModel::savePatchesColors(const QString& filename)
 {
-    if (_imageLoadingWatcher->isRunning()) {
-        _imageLoadingWatcher->waitForFinished();
-    }
-
-    if (!isImageLoaded()) return;
+    _jobs.enqueue(JobScheduler::EXPORT, [=](const JobToken&) {
+        if (!_isImageLoaded) return;
 
-    QFuture<void> imageLoading = QtConcurrent::run([=]() {
         emit processProgress(0);
         emit loadingMessage(tr("Saving patches colors..."));
 
@@ -348,16 +462,31 @@ void ImageModel::savePatchesColors(const QString& filename)
 
         std::ofstream outputFile(filename.toStdString());
 
-        for (int p = 0; p < _macbethPatches.size(); p++) {
+        for (size_t p = 0; p < final_values.size() / 3; p++) {
             outputFile << final_values[3 * p + 0] << ", " << final_values[3 * p + 1] << ", " << final_values[3 * p + 2]
                        << std::endl;
         }
 
+        emit processProgress(50);
+
+        // Statistics for weighting the patches downstream, next to the colors
+        std::vector<PatchStatistics> statistics;
+
+        computePatchStatistics(statistics);
+
+        QString statisticsFilename = filename;
+
+        if (statisticsFilename.endsWith(".csv", Qt::CaseInsensitive)) {
+            statisticsFilename.chop(4);
+        }
+
+        statisticsFilename += "_statistics.csv";
+
+        save_patch_statistics(statisticsFilename.toStdString().c_str(), statistics.data(), statistics.size());
+
         emit processProgress(100);
         emit loadingMessage("");
     });
-
-    _imageLoadingWatcher->setFuture(imageLoading);
 }
 
 
@@ -372,70 +501,528 @@ void ImageModel::recalculateCorrection(double exposure)
     _exposure = exposure;
     emit exposureChanged(_exposure);
 
-    if (_imageEditingWatcher->isRunning()) {
-        emit _imageEditingWatcher->cancel();
-        _imageEditingWatcher->waitForFinished();
+    updateDisplay();
+}
+
+
+void ImageModel::updateDisplay()
+{
+    // Parameters of the request, a newer one cancels the conversion
+    _displayMutex.lock();
+    _displayKey = getDisplayKey();
+    _displayMutex.unlock();
+
+    _jobs.submit(JobScheduler::CORRECT, [=](const JobToken& token) {
+        convertDisplay(token, false);
+    });
+}
+
+
+void ImageModel::convertDisplay(const JobToken& token, bool visibleOnly)
+{
+    if (!_isImageLoaded) return;
+
+    // Latest parameters of the view: only the level matching the zoom is
+    // converted, and the coarsest one shown under it
+    _displayMutex.lock();
+    const display_key key        = _displayKey;
+    const QRectF      viewport   = _displayViewport;
+    const int         level      = _pyramid.getLevelForZoom(_displayZoom);
+    const int         background = (int)_displayLevels.size() - 1;
+    const bool        newLevel   = level != _displayLevel;
+    _displayLevel                = level;
+    _displayMutex.unlock();
+
+    if (newLevel) {
+        // The view drops the tiles of the other levels, they are converted
+        // again when zoomed back
+        for (int l = 0; l < background; l++) {
+            if (l != level) {
+                _displayLevels[l].tiles.clear();
+            }
+        }
     }
 
-    if (_imageLoadingWatcher->isRunning()) {
-        _imageLoadingWatcher->waitForFinished();
+    // Small: kept in step with the parameters so that it does not show them
+    // out of date where the level is not converted yet
+    if (level != background) {
+        const std::vector<int> backgroundTiles = getDirtyTiles(background, key, viewport, false);
+        convertTiles(token, background, key, backgroundTiles, false);
     }
 
-    if (!isImageLoaded()) return;
+    // Tiles already converted with the same parameters are kept
+    const std::vector<int> tiles = getDirtyTiles(level, key, viewport, visibleOnly);
 
-    if (_imageDemosaicingWatcher->isRunning()) {
-        _imageDemosaicingWatcher->waitForFinished();
+    if (tiles.empty()) {
+        // The view only has to show the tiles of this level
+        emit displayTilesChanged();
+        return;
     }
 
-    QFuture<void> imageEditting = QtConcurrent::run([=]() {
+    // When only the visible tiles are converted, the caller reports the
+    // progress
+    if (!visibleOnly) {
         emit processProgress(0);
         emit loadingMessage(tr("Exposure correction..."));
+    }
+
+    convertTiles(token, level, key, tiles, !visibleOnly);
+
+    if (!visibleOnly) {
+        emit loadingMessage("");
+    }
+}
 
-        const float ev = std::pow(2., exposure);
 
-        if (_isMatrixActive) {
-            for (int y = 0; y < _image.height(); y++) {
-                if (_imageLoadingWatcher->isCanceled()) return;
-                uchar* scanline = _image.scanLine(y);
+void ImageModel::convertTiles(
+  const JobToken& token, int level, const display_key& key, const std::vector<int>& tiles, bool reportProgress)
+{
+    display_level& display = _displayLevels[level];
 
-                #pragma omp parallel for
-                for (int x = 0; x < _image.width(); x++) {
-                    const int px_idx = 3 * (y * _image.width() + x);
+    for (size_t i = 0; i < tiles.size() && !token.isCanceled(); i++) {
+        display_tile tile;
+        tile.level = level;
+        tile.index = tiles[i];
+        tile.rect  = getTileRect(level, tiles[i]);
+        tile.image = renderTile(level, tile.rect, key);
 
+        display.tiles[tiles[i]] = key;
 
-                    float tmp_color[3];
-                    matmul(&_correctionMatrix[0], &_pixelBuffer[px_idx], tmp_color);
-                    XYZ_to_RGB(tmp_color, &_pixelCorrected[px_idx]);
+        _displayMutex.lock();
+        _displayTiles.push_back(tile);
+        _displayMutex.unlock();
 
-                    for (int i = 0; i < 3; i++) {
-                        scanline[3 * x + i] = 255 * to_sRGB(_pixelCorrected[px_idx + i] * ev);
-                    }
-                }
-                emit processProgress(int(100.f * float(y) / float(_image.height() - 1)));
+        emit displayTilesChanged();
+
+        if (reportProgress) {
+            emit processProgress(int(100.f * float(i + 1) / float(tiles.size())));
+        }
+    }
+}
+
+
+void ImageModel::buildDemosaicPreview()
+{
+    size_t preview_width, preview_height;
+    demosaic_output_size(RAWDemosaicMethod::BARYCENTRIC2X2, _width, _height, &preview_width, &preview_height);
+
+    if (preview_width == 0 || preview_height == 0) return;
+
+    std::vector<float> preview(3 * preview_width * preview_height);
+    barycentric2x2_demosaic(_mosaicedPixelBuffer, preview.data(), _width, _height, _filters);
+
+    // Each preview pixel covers 2x2 pixels: the first level of the pyramid
+    // is the preview
+    #pragma omp parallel for
+    for (int y = 0; y < _height; y++) {
+        const float* preview_row = &preview[3 * std::min(size_t(y / 2), preview_height - 1) * preview_width];
+
+        for (int x = 0; x < _width; x++) {
+            const float* pixel = &preview_row[3 * std::min(size_t(x / 2), preview_width - 1)];
+
+            for (int c = 0; c < 3; c++) {
+                _pixelBuffer[3 * (y * _width + x) + c] = pixel[c];
             }
-        } else {
-            for (int y = 0; y < _image.height(); y++) {
-                if (_imageLoadingWatcher->isCanceled()) return;
-                uchar* scanline = _image.scanLine(y);
+        }
+    }
+}
 
-                #pragma omp parallel for
-                for (int x = 0; x < _image.width(); x++) {
-                    const int px_idx = 3 * (y * _image.width() + x);
 
-                    for (int i = 0; i < 3; i++) {
-                        scanline[3 * x + i] = 255 * to_sRGB(_pixelBuffer[px_idx + i] * ev);
-                    }
-                }
-                emit processProgress(int(100.f * float(y) / float(_image.height() - 1)));
+void ImageModel::demosaicProgressively(
+  const JobToken& token, RAWDemosaicMethod method, const DemosaicAutoOptions& autoOptions)
+{
+    if (!_isImageLoaded || !_isRawImage || token.isCanceled()) return;
+
+    const size_t n_values = 3 * size_t(_width) * size_t(_height);
+
+    // Resolved here: the choice depends on the size of the image, and the
+    // cache then holds the method actually run
+    const bool isAuto = method == RAWDemosaicMethod::AUTO;
+
+    if (isAuto) {
+        method = demosaic_auto_select_with(&autoOptions, _width, _height, nullptr);
+    }
+
+    // Going back to a method already computed is instant
+    if (_demosaicCache.fetch(_imagePath, method, _pixelBuffer, n_values)) {
+        _pyramid.update(0, 0, _width, _height);
+        invalidateDisplay(QRect(0, 0, _width, _height));
+        rebuildIntegralImage();
+        return;
+    }
+
+    emit processProgress(0);
+
+    if (isAuto) {
+        emit loadingMessage(tr("Demosaicing with %1...").arg(getDemosaicingMethodText(method)));
+    } else {
+        emit loadingMessage(tr("Demosaicing..."));
+    }
+
+    // The preview, or the previous method, is shown meanwhile
+    convertDisplay(token, true);
+
+    _displayMutex.lock();
+    const QRectF viewport = _displayViewport;
+    _displayMutex.unlock();
+
+    const int n_regions_x = (_width + DEMOSAIC_REGION_SIZE - 1) / DEMOSAIC_REGION_SIZE;
+    const int n_regions_y = (_height + DEMOSAIC_REGION_SIZE - 1) / DEMOSAIC_REGION_SIZE;
+
+    std::vector<int>   regions(n_regions_x * n_regions_y);
+    std::vector<char>  visible(regions.size());
+    std::vector<float> distances(regions.size());
+
+    for (int r = 0; r < (int)regions.size(); r++) {
+        const QRectF region(
+          (r % n_regions_x) * DEMOSAIC_REGION_SIZE,
+          (r / n_regions_x) * DEMOSAIC_REGION_SIZE,
+          DEMOSAIC_REGION_SIZE,
+          DEMOSAIC_REGION_SIZE);
+
+        regions[r]   = r;
+        visible[r]   = region.intersects(viewport);
+        distances[r] = QLineF(region.center(), viewport.center()).length();
+    }
+
+    // Visible regions first, from the center of the viewport
+    std::sort(regions.begin(), regions.end(), [&](int a, int b) {
+        if (visible[a] != visible[b]) return visible[a] != 0;
+        return distances[a] < distances[b];
+    });
+
+    for (size_t i = 0; i < regions.size(); i++) {
+        if (token.isCanceled()) {
+            emit loadingMessage("");
+            return;
+        }
+
+        const int x = (regions[i] % n_regions_x) * DEMOSAIC_REGION_SIZE;
+        const int y = (regions[i] / n_regions_x) * DEMOSAIC_REGION_SIZE;
+
+        const QRect region(
+          x, y, std::min(DEMOSAIC_REGION_SIZE, _width - x), std::min(DEMOSAIC_REGION_SIZE, _height - y));
+
+        demosaic_region(
+          _mosaicedPixelBuffer,
+          _pixelBuffer,
+          _width,
+          _height,
+          _filters,
+          method,
+          region.x(),
+          region.y(),
+          region.width(),
+          region.height());
+
+        _pyramid.update(region.x(), region.y(), region.width(), region.height());
+        invalidateDisplay(region);
+
+        // Completed regions are swapped into the view
+        convertDisplay(token, true);
+
+        emit processProgress(int(100.f * float(i + 1) / float(regions.size())));
+    }
+
+    _demosaicCache.store(_imagePath, method, _pixelBuffer, n_values);
+    rebuildIntegralImage();
+
+    emit loadingMessage("");
+}
+
+
+bool ImageModel::locateChart(const JobToken& token, QPolygonF& outline)
+{
+    if (!_isImageLoaded) return false;
+
+    ChartLocation chart;
+    int           err;
+
+    // RAW images are searched without waiting for the demosaicing
+    if (_isRawImage) {
+        err = detect_chart_raw(_mosaicedPixelBuffer, _width, _height, _filters, &chart);
+    } else {
+        err = detect_chart(_pixelBuffer, _width, _height, &chart);
+    }
+
+    if (err != 0 || token.isCanceled()) return false;
+
+    Point corners[4];
+    chart_outline(&chart, _innerMarginX, _innerMarginY, corners);
+
+    outline.clear();
+
+    for (int i = 0; i < 4; i++) {
+        outline << QPointF(corners[i].x, corners[i].y);
+    }
+
+    return true;
+}
+
+
+void ImageModel::setMacbethOutlineLater(const QPolygonF& outline)
+{
+    // The outline is moved by the view meanwhile: only written on its thread
+    QMetaObject::invokeMethod(
+      this,
+      [=]() {
+          _macbethOutline = outline;
+          recalculateMacbethPatches();
+      },
+      Qt::QueuedConnection);
+}
+
+
+unsigned int ImageModel::computePatchStatistics(std::vector<PatchStatistics>& statistics)
+{
+    std::vector<Box> areas;
+
+    _patchesMutex.lock();
+
+    const unsigned int generation = _patchesGeneration;
+
+    for (const QPolygonF& patch: _macbethPatches) {
+        const Box b = {
+          {float(patch[0].x()), float(patch[0].y())},
+          {float(patch[1].x()), float(patch[1].y())},
+          {float(patch[2].x()), float(patch[2].y())},
+          {float(patch[3].x()), float(patch[3].y())}};
+
+        areas.push_back(b);
+    }
+
+    _patchesMutex.unlock();
+
+    statistics.resize(areas.size());
+
+    patch_statistics(
+      _pixelBuffer,
+      _width,
+      _height,
+      areas.data(),
+      areas.size(),
+      PATCH_CLIP_LEVEL,
+      PATCH_TRIM_FRACTION,
+      statistics.data());
+
+    return generation;
+}
+
+
+void ImageModel::rebuildPyramid()
+{
+    _pyramid.build(_pixelBuffer, _width, _height);
+}
+
+
+void ImageModel::rebuildIntegralImage()
+{
+    // Built aside: patches are averaged meanwhile with the previous one
+    IntegralImage integralImage;
+    integralImage.build(_pixelBuffer, _width, _height);
+
+    _patchesMutex.lock();
+    _integralImage.swap(integralImage);
+    _patchesGeneration++;
+    _patchesMutex.unlock();
+
+    emit averagedPatchesChanged();
+
+    updatePatchStatistics();
+}
+
+
+void ImageModel::updatePatchStatistics()
+{
+    // Too slow for each move of the chart: the latest position wins
+    _jobs.submit(JobScheduler::MEASURE, [=](const JobToken& token) {
+        if (!_isImageLoaded || _pixelBuffer == nullptr) return;
+
+        std::vector<PatchStatistics> statistics;
+        const unsigned int           generation = computePatchStatistics(statistics);
+
+        // Run again by the scheduler unless a newer scan replaces it: the
+        // statistics kept meanwhile are stale and the fit ignores them
+        if (token.isCanceled()) return;
+
+        _patchesMutex.lock();
+        _patchStatistics.swap(statistics);
+        _patchStatisticsGeneration = generation;
+        _patchesMutex.unlock();
+
+        emit patchStatisticsChanged();
+    });
+}
+
+
+void ImageModel::resetDisplayCache()
+{
+    _displayMutex.lock();
+    _displayLevels.clear();
+    _displayLevels.resize(_pyramid.getNLevels());
+    _displayLevel = 0;
+    _displayTiles.clear();
+    _displayMutex.unlock();
+}
+
+
+void ImageModel::invalidateDisplay(const QRect& region)
+{
+    for (int level = 0; level < (int)_displayLevels.size(); level++) {
+        display_level& display = _displayLevels[level];
+
+        if (display.tiles.empty()) continue;
+
+        // Tiles of the level holding a pixel of the region
+        const int x_0 = (region.x() >> level) / DISPLAY_TILE_SIZE;
+        const int y_0 = (region.y() >> level) / DISPLAY_TILE_SIZE;
+        const int x_1 = ((region.x() + region.width() - 1) >> level) / DISPLAY_TILE_SIZE;
+        const int y_1 = ((region.y() + region.height() - 1) >> level) / DISPLAY_TILE_SIZE;
+
+        for (int y = y_0; y <= y_1; y++) {
+            for (int x = x_0; x <= x_1; x++) {
+                display.tiles[y * display.nTilesX + x].valid = false;
             }
         }
+    }
+}
 
 
-        emit imageChanged();
-        emit loadingMessage("");
+int ImageModel::getDisplayLevel() const
+{
+    QMutexLocker lock(&_displayMutex);
+    return _displayLevel;
+}
+
+
+int ImageModel::getNDisplayLevels() const
+{
+    QMutexLocker lock(&_displayMutex);
+    return (int)_displayLevels.size();
+}
+
+
+ImageModel::display_key ImageModel::getDisplayKey() const
+{
+    display_key key;
+
+    key.valid          = true;
+    key.exposure       = _exposure;
+    key.isMatrixActive = _isMatrixActive;
+    key.matrix         = _correctionMatrix;
+    key.method         = _demosaicingMethod;
+
+    return key;
+}
+
+
+bool ImageModel::isSameDisplayKey(const display_key& a, const display_key& b)
+{
+    return a.valid && b.valid && a.exposure == b.exposure && a.isMatrixActive == b.isMatrixActive
+           && (!a.isMatrixActive || a.matrix == b.matrix) && a.method == b.method;
+}
+
+
+std::vector<int>
+ImageModel::getDirtyTiles(int level, const display_key& key, const QRectF& sceneViewport, bool visibleOnly)
+{
+    display_level& display = _displayLevels[level];
+
+    if (display.tiles.empty()) {
+        display.nTilesX = (_pyramid.getWidth(level) + DISPLAY_TILE_SIZE - 1) / DISPLAY_TILE_SIZE;
+        display.nTilesY = (_pyramid.getHeight(level) + DISPLAY_TILE_SIZE - 1) / DISPLAY_TILE_SIZE;
+        display.tiles.assign(display.nTilesX * display.nTilesY, display_key());
+    }
+
+    // Viewport in tiles of the level
+    const float  tile_size = float(DISPLAY_TILE_SIZE << level);
+    const QRectF viewport(
+      sceneViewport.x() / tile_size,
+      sceneViewport.y() / tile_size,
+      sceneViewport.width() / tile_size,
+      sceneViewport.height() / tile_size);
+
+    std::vector<int>   tiles;
+    std::vector<char>  visible(display.tiles.size());
+    std::vector<float> distances(display.tiles.size());
+
+    for (int t = 0; t < (int)display.tiles.size(); t++) {
+        if (isSameDisplayKey(display.tiles[t], key)) continue;
+
+        const QRectF tile(t % display.nTilesX, t / display.nTilesX, 1, 1);
+
+        visible[t]   = tile.intersects(viewport);
+        distances[t] = QLineF(tile.center(), viewport.center()).length();
+
+        if (visibleOnly && !visible[t]) continue;
+
+        tiles.push_back(t);
+    }
+
+    // Visible tiles first, from the center of the viewport
+    std::sort(tiles.begin(), tiles.end(), [&](int a, int b) {
+        if (visible[a] != visible[b]) return visible[a] != 0;
+        return distances[a] < distances[b];
     });
 
-    _imageEditingWatcher->setFuture(imageEditting);
+    return tiles;
+}
+
+
+QRect ImageModel::getTileRect(int level, int tile) const
+{
+    const display_level& display = _displayLevels[level];
+
+    const int x = (tile % display.nTilesX) * DISPLAY_TILE_SIZE;
+    const int y = (tile / display.nTilesX) * DISPLAY_TILE_SIZE;
+
+    return QRect(
+      x,
+      y,
+      std::min(DISPLAY_TILE_SIZE, _pyramid.getWidth(level) - x),
+      std::min(DISPLAY_TILE_SIZE, _pyramid.getHeight(level) - y));
+}
+
+
+QImage ImageModel::renderTile(int level, const QRect& rect, const display_key& key) const
+{
+    const int    width  = _pyramid.getWidth(level);
+    const float* pixels = _pyramid.getLevel(level);
+
+    QImage image(rect.width(), rect.height(), QImage::Format_RGB888);
+
+    // Pointers taken once: scanLine() may detach the image
+    uchar*       bits           = image.bits();
+    const size_t bytes_per_line = image.bytesPerLine();
+
+    const float ev = std::pow(2., key.exposure);
+
+    #pragma omp parallel for
+    for (int y = 0; y < rect.height(); y++) {
+        uchar*       scanline = &bits[y * bytes_per_line];
+        const float* row      = &pixels[3 * ((rect.y() + y) * width + rect.x())];
+
+        for (int x = 0; x < rect.width(); x++) {
+            const float* pixel = &row[3 * x];
+            float        color[3];
+
+            if (key.isMatrixActive) {
+                float tmp_color[3];
+                matmul(&key.matrix[0], pixel, tmp_color);
+                XYZ_to_RGB(tmp_color, color);
+            } else {
+                for (int i = 0; i < 3; i++) {
+                    color[i] = pixel[i];
+                }
+            }
+
+            for (int i = 0; i < 3; i++) {
+                scanline[3 * x + i] = 255 * to_sRGB(color[i] * ev);
+            }
+        }
+    }
+
+    return image;
 }
 
 
@@ -447,8 +1034,8 @@ float lerp(float a, float b, float t)
 
 void ImageModel::recalculateMacbethPatches()
 {
-    _macbethPatches.clear();
-    _macbethPatchesCenters.clear();
+    QVector<QPolygonF> patches;
+    QVector<QPointF>   patchesCenters;
 
     std::array<cv::Point2f, 4> src {cv::Point2f(0., 0.), cv::Point2f(1., 0.), cv::Point2f(1., 1.), cv::Point2f(0., 1.)};
     std::array<cv::Point2f, 4> dest;
@@ -503,7 +1090,7 @@ void ImageModel::recalculateMacbethPatches()
                 patch << QPointF(p.x, p.y);
             }
 
-            _macbethPatches << patch;
+            patches << patch;
 
             // Transformation for patch center
             const std::vector<cv::Point2f> patch_center_org = {cv::Point2f(x_center, y_center)};
@@ -511,9 +1098,18 @@ void ImageModel::recalculateMacbethPatches()
 
             cv::perspectiveTransform(patch_center_org, patch_center_dest, transform);
 
-            _macbethPatchesCenters << QPointF(patch_center_dest[0].x, patch_center_dest[0].y);
+            patchesCenters << QPointF(patch_center_dest[0].x, patch_center_dest[0].y);
         }
     }
 
+    _patchesMutex.lock();
+    _macbethPatches.swap(patches);
+    _macbethPatchesCenters.swap(patchesCenters);
+    _patchesGeneration++;
+    _patchesMutex.unlock();
+
     emit macbethChartChanged();
+    emit averagedPatchesChanged();
+
+    updatePatchStatistics();
 }
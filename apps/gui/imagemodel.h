@@ -3,20 +3,64 @@
 
 #include <QObject>
 #include <QImage>
+#include <QMutex>
+#include <QRect>
+#include <QRectF>
 #include <QVector>
-#include <QFutureWatcher>
 #include <array>
+#include <vector>
 #include <demosaicing.h>
+#include <patches.h>
+
+#include "demosaiccache.h"
+#include "imagepyramid.h"
+#include "integralimage.h"
+#include "jobscheduler.h"
+
+// Size of the tiles of the displayed image in pixels of the pyramid level
+#define DISPLAY_TILE_SIZE 256
+
+// Size of the regions of a RAW image demosaiced in turn, in pixels
+#define DEMOSAIC_REGION_SIZE 512
+
+// Patch statistics exported with the patches colors: pixels reaching the
+// clipping level are counted, the trimmed mean leaves out this fraction of
+// the pixels on each side
+#define PATCH_CLIP_LEVEL    1.f
+#define PATCH_TRIM_FRACTION .1f
 
 class ImageModel: public QObject
 {
     Q_OBJECT
 
+    // Parameters a displayed tile was converted with
+    typedef struct {
+        bool                 valid;
+        double               exposure;
+        bool                 isMatrixActive;
+        std::array<float, 9> matrix;
+        RAWDemosaicMethod    method;
+    } display_key;
+
+    // State of the tiles of a pyramid level
+    typedef struct {
+        int                      nTilesX;
+        int                      nTilesY;
+        std::vector<display_key> tiles;
+    } display_level;
+
   public:
+    // Converted tile of the displayed image, handed over to the view
+    typedef struct {
+        int    level;
+        int    index;
+        QRect  rect;   // In pixels of the level
+        QImage image;
+    } display_tile;
+
     ImageModel();
     virtual ~ImageModel();
 
-    const QImage&             getLoadedImage() const { return _image; }
     const QString&            getLoadedImagePath() const { return _imagePath; }
     const QPolygonF&          getMacbethOutline() const { return _macbethOutline; }
     const QVector<QPolygonF>& getMacbethPatches() const { return _macbethPatches; }
@@ -24,13 +68,42 @@ class ImageModel: public QObject
 
     const std::array<float, 9>& getCorrectionMatrix() const { return _correctionMatrix; }
 
+    // Full resolution size of the image
+    int getWidth() const { return _width; }
+    int getHeight() const { return _height; }
+
+    // Pyramid level matching the zoom of the view, its pixels are
+    // 2^level full resolution pixels wide
+    int getDisplayLevel() const;
+    int getNDisplayLevels() const;
+
+    // Tiles converted since the last call
+    std::vector<display_tile> takeDisplayTiles();
+
+    // Mean of the pixels of each patch, from the integral image: cheap
+    // enough to be called on each move of the chart
     void getAveragedPatches(std::vector<float>& values);
 
+    // Statistics of each patch from the last scan of its pixels, redone in
+    // the background when the patches change. Empty until the first scan
+    // @returns true if they were scanned from the current patches and pixels
+    bool getPatchStatistics(std::vector<PatchStatistics>& statistics);
+
+    const DemosaicAutoOptions& getAutoDemosaicOptions() const { return _autoDemosaicOptions; }
+
+    // Names of the demosaicing methods in the view
+    static bool    getDemosaicingMethod(const QString& text, RAWDemosaicMethod& method);
+    static QString getDemosaicingMethodText(RAWDemosaicMethod method);
+
     bool isImageLoaded() const { return _isImageLoaded; }
     bool isMatrixLoaded() const { return _isMatrixLoaded; }
     bool isMatrixActive() const { return _isMatrixActive; }
     bool isRawImage() const { return _isRawImage; }
 
+    // Memory budget in bytes of the demosaiced buffers kept per file and
+    // method, optionally stored in half floats
+    void setDemosaicCache(size_t budget, bool halfFloat);
+
   public slots:
     void openFile(const QString& filename);
     void openImage(const QString& filename);
@@ -41,10 +114,19 @@ class ImageModel: public QObject
 
     void setOutlinePosition(int index, QPointF position);
 
+    // Places the outline on the chart found in the image, left unchanged
+    // if there is none
+    void detectChart();
+
     void setExposure(double value);
     void setDemosaicingMethod(const QString& method);
+
+    // Options of the Auto method, a budget of 0 uses the minimum quality
+    void setAutoDemosaicOptions(double budgetMs, const QString& minQuality);
     void setMatrix(const std::array<float, 9> matrix);
     void setMatrixActive(bool active);
+    void setDisplayZoom(float zoom);
+    void setDisplayViewport(const QRectF& viewport);
 
     void savePatchesCoordinates(const QString& filename);
     void savePatchesColors(const QString& filename);
@@ -52,7 +134,9 @@ class ImageModel: public QObject
 
   signals:
     void macbethChartChanged();
-    void imageChanged();
+    void averagedPatchesChanged();
+    void patchStatisticsChanged();
+    void displayTilesChanged();
     void imageLoaded(int width, int height);
     void exposureChanged(double exposure);
     void loadFailed(QString message);
@@ -63,15 +147,59 @@ class ImageModel: public QObject
 
   protected:
     void recalculateCorrection(double exposure);
+    void updateDisplay();
+    void buildDemosaicPreview();
+    void redemosaic();
+
+    // The outline and the patches are only written on the thread of the
+    // model, which the view reads them from: jobs apply the outline they
+    // find later on this thread
     void recalculateMacbethPatches();
+    void setMacbethOutlineLater(const QPolygonF& outline);
+
+    // Job bodies: only run by the job scheduler
+    void convertDisplay(const JobToken& token, bool visibleOnly);
+    void convertTiles(
+      const JobToken& token, int level, const display_key& key, const std::vector<int>& tiles, bool reportProgress);
+    void demosaicProgressively(const JobToken& token, RAWDemosaicMethod method, const DemosaicAutoOptions& autoOptions);
+    bool locateChart(const JobToken& token, QPolygonF& outline);
+    unsigned int computePatchStatistics(std::vector<PatchStatistics>& statistics);
+    void rebuildPyramid();
+    void rebuildIntegralImage();
+    void updatePatchStatistics();
+    void resetDisplayCache();
+    void invalidateDisplay(const QRect& region);
+
+    static bool isSameDisplayKey(const display_key& a, const display_key& b);
+
+    display_key      getDisplayKey() const;
+    std::vector<int> getDirtyTiles(int level, const display_key& key, const QRectF& sceneViewport, bool visibleOnly);
+    QRect            getTileRect(int level, int tile) const;
+    QImage           renderTile(int level, const QRect& rect, const display_key& key) const;
 
   private:
     float*               _mosaicedPixelBuffer;
     float*               _pixelBuffer;
-    std::vector<float>   _pixelCorrected;
     std::array<float, 9> _correctionMatrix;
 
-    QImage  _image;
+    DemosaicCache _demosaicCache;
+    ImagePyramid  _pyramid;
+    float         _displayZoom;
+    int           _displayLevel;
+    int           _width;
+    int           _height;
+
+    std::vector<display_level> _displayLevels;
+    display_key                _displayKey;
+    QRectF                     _displayViewport;
+
+    // Tiles are converted in new images and handed over to the view through
+    // this queue: the view never reads an image being written. Also guards
+    // the parameters of the view (key, zoom, viewport and level) read by
+    // the jobs
+    mutable QMutex            _displayMutex;
+    std::vector<display_tile> _displayTiles;
+
     QString _imagePath;
     bool    _isImageLoaded;
     bool    _isMatrixLoaded;
@@ -84,13 +212,24 @@ class ImageModel: public QObject
     QVector<QPolygonF> _macbethPatches;
     QVector<QPointF>   _macbethPatchesCenters;
 
-    double            _exposure;
-    RAWDemosaicMethod _demosaicingMethod;
-    unsigned int      _filters;
-
-    QFutureWatcher<void>* _imageLoadingWatcher;
-    QFutureWatcher<void>* _imageDemosaicingWatcher;
-    QFutureWatcher<void>* _imageEditingWatcher;
+    // Patches are averaged from any thread: guards the patches, the
+    // integral image of the pixel buffer and the patch statistics. The
+    // generation changes with the patches or the pixels, the statistics
+    // keep the one they were scanned from
+    QMutex                       _patchesMutex;
+    IntegralImage                _integralImage;
+    std::vector<PatchStatistics> _patchStatistics;
+    unsigned int                 _patchesGeneration;
+    unsigned int                 _patchStatisticsGeneration;
+
+    double              _exposure;
+    RAWDemosaicMethod   _demosaicingMethod;
+    DemosaicAutoOptions _autoDemosaicOptions;
+    unsigned int        _filters;
+
+    // Background work: loading, demosaicing, conversion and exports. Buffers
+    // are only written by its jobs
+    JobScheduler _jobs;
 };
 
 #endif   // IMAGEMODEL_H
@@ -0,0 +1,125 @@
+#include "imagepyramid.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Levels are not built below this size
+#define PYRAMID_MIN_SIZE 256
+
+ImagePyramid::ImagePyramid(): _base(nullptr), _width(0), _height(0) {}
+
+
+void ImagePyramid::build(const float* pixels, int width, int height)
+{
+    clear();
+
+    _base   = pixels;
+    _width  = width;
+    _height = height;
+
+    int src_width  = width;
+    int src_height = height;
+
+    while (src_width > PYRAMID_MIN_SIZE || src_height > PYRAMID_MIN_SIZE) {
+        Level level;
+        level.width  = (src_width + 1) / 2;
+        level.height = (src_height + 1) / 2;
+        level.pixels.resize(3 * level.width * level.height);
+
+        _levels.push_back(std::move(level));
+        downsample((int)_levels.size(), 0, 0, _levels.back().width, _levels.back().height);
+
+        src_width  = _levels.back().width;
+        src_height = _levels.back().height;
+    }
+}
+
+
+void ImagePyramid::update(int x, int y, int width, int height)
+{
+    int x_0 = x;
+    int y_0 = y;
+    int x_1 = x + width;
+    int y_1 = y + height;
+
+    for (int level = 1; level < getNLevels(); level++) {
+        // Pixels of the level averaging a pixel of the region
+        x_0 = x_0 / 2;
+        y_0 = y_0 / 2;
+        x_1 = (x_1 + 1) / 2;
+        y_1 = (y_1 + 1) / 2;
+
+        downsample(level, x_0, y_0, x_1, y_1);
+    }
+}
+
+
+void ImagePyramid::downsample(int level, int x_0, int y_0, int x_1, int y_1)
+{
+    const float* src        = getLevel(level - 1);
+    const int    src_width  = getWidth(level - 1);
+    const int    src_height = getHeight(level - 1);
+    const int    dst_width  = getWidth(level);
+    float*       dst        = _levels[level - 1].pixels.data();
+
+    // The last row and column are repeated for odd sizes
+    #pragma omp parallel for schedule(static)
+    for (int y = y_0; y < y_1; y++) {
+        const float* row_0 = &src[3 * (2 * y) * src_width];
+        const float* row_1 = &src[3 * std::min(2 * y + 1, src_height - 1) * src_width];
+
+        for (int x = x_0; x < x_1; x++) {
+            const int c_0 = 3 * (2 * x);
+            const int c_1 = 3 * std::min(2 * x + 1, src_width - 1);
+
+            for (int c = 0; c < 3; c++) {
+                dst[3 * (y * dst_width + x) + c]
+                  = .25f * (row_0[c_0 + c] + row_0[c_1 + c] + row_1[c_0 + c] + row_1[c_1 + c]);
+            }
+        }
+    }
+}
+
+
+void ImagePyramid::clear()
+{
+    _base   = nullptr;
+    _width  = 0;
+    _height = 0;
+    _levels.clear();
+}
+
+
+int ImagePyramid::getWidth(int level) const
+{
+    return (level == 0) ? _width : _levels[level - 1].width;
+}
+
+
+int ImagePyramid::getHeight(int level) const
+{
+    return (level == 0) ? _height : _levels[level - 1].height;
+}
+
+
+const float* ImagePyramid::getLevel(int level) const
+{
+    return (level == 0) ? _base : _levels[level - 1].pixels.data();
+}
+
+
+int ImagePyramid::getLevelForZoom(float zoom) const
+{
+    if (zoom >= 1.f) {
+        return 0;
+    }
+
+    // Unknown zoom: the coarsest level gives the fastest preview
+    if (zoom <= 0.f) {
+        return getNLevels() - 1;
+    }
+
+    const int level = (int)std::floor(std::log2(1.f / zoom));
+
+    return std::min(level, getNLevels() - 1);
+}
@@ -0,0 +1,53 @@
+#ifndef IMAGEPYRAMID_H
+#define IMAGEPYRAMID_H
+
+#include <vector>
+
+// Mipmap pyramid of a linear interleaved RGB image. Level 0 is the full
+// resolution buffer, each next level halves the resolution (rounded up) by
+// averaging 2x2 pixels.
+class ImagePyramid
+{
+  public:
+    ImagePyramid();
+
+    // The full resolution buffer is not copied and shall outlive the pyramid
+    // or be released with clear()
+    void build(const float* pixels, int width, int height);
+    void clear();
+
+    // Updates the levels after a region of the full resolution buffer
+    // changed
+    void update(int x, int y, int width, int height);
+
+    bool isEmpty() const { return _base == nullptr; }
+
+    int getNLevels() const { return 1 + (int)_levels.size(); }
+    int getWidth(int level) const;
+    int getHeight(int level) const;
+
+    const float* getLevel(int level) const;
+
+    // Coarsest level which still gives at least one pixel per screen pixel
+    // at this zoom (screen pixels per full resolution pixel), the coarsest
+    // level if the zoom is not known yet (0)
+    int getLevelForZoom(float zoom) const;
+
+  private:
+    // Computes the pixels [x_0, x_1) x [y_0, y_1) of a level from the
+    // previous one
+    void downsample(int level, int x_0, int y_0, int x_1, int y_1);
+
+    struct Level {
+        int                width;
+        int                height;
+        std::vector<float> pixels;
+    };
+
+    const float*       _base;
+    int                _width;
+    int                _height;
+    std::vector<Level> _levels;
+};
+
+#endif   // IMAGEPYRAMID_H
@@ -0,0 +1,124 @@
+#include "integralimage.h"
+
+#include <algorithm>
+#include <cmath>
+
+IntegralImage::IntegralImage(): _width(0), _height(0), _nBlocks(0) {}
+
+
+void IntegralImage::build(const float* pixels, int width, int height)
+{
+    _width   = width;
+    _height  = height;
+    _nBlocks = width / INTEGRAL_BLOCK_SIZE + 1;
+
+    _local.resize(3 * size_t(width + 1) * height);
+    _blocks.resize(3 * size_t(_nBlocks) * height);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; y++) {
+        const float* row    = &pixels[3 * size_t(y) * width];
+        float*       local  = &_local[3 * size_t(y) * (width + 1)];
+        double*      blocks = &_blocks[3 * size_t(y) * _nBlocks];
+
+        double total[3]     = {0., 0., 0.};
+        float  block_sum[3] = {0.f, 0.f, 0.f};
+
+        for (int x = 0; x <= width; x++) {
+            if (x % INTEGRAL_BLOCK_SIZE == 0) {
+                for (int c = 0; c < 3; c++) {
+                    total[c] += block_sum[c];
+                    block_sum[c] = 0.f;
+
+                    blocks[3 * (x / INTEGRAL_BLOCK_SIZE) + c] = total[c];
+                }
+            }
+
+            for (int c = 0; c < 3; c++) {
+                local[3 * x + c] = block_sum[c];
+            }
+
+            if (x < width) {
+                for (int c = 0; c < 3; c++) {
+                    block_sum[c] += row[3 * x + c];
+                }
+            }
+        }
+    }
+}
+
+
+void IntegralImage::clear()
+{
+    _width   = 0;
+    _height  = 0;
+    _nBlocks = 0;
+    _local.clear();
+    _blocks.clear();
+}
+
+
+void IntegralImage::swap(IntegralImage& other)
+{
+    std::swap(_width, other._width);
+    std::swap(_height, other._height);
+    std::swap(_nBlocks, other._nBlocks);
+    _local.swap(other._local);
+    _blocks.swap(other._blocks);
+}
+
+
+size_t IntegralImage::sumPolygon(const QPolygonF& polygon, double sum[3]) const
+{
+    sum[0] = sum[1] = sum[2] = 0.;
+
+    if (isEmpty() || polygon.size() < 3) return 0;
+
+    const QRectF bounds = polygon.boundingRect();
+
+    const int y_0 = std::max(0, (int)std::ceil(bounds.top()));
+    const int y_1 = std::min(_height - 1, (int)std::floor(bounds.bottom()));
+
+    size_t             n_pixels = 0;
+    std::vector<qreal> crossings;
+
+    for (int y = y_0; y <= y_1; y++) {
+        // Edges crossing the row through the pixel centers, each edge holds
+        // its lower end only so a vertex is not counted twice
+        crossings.clear();
+
+        for (int i = 0; i < polygon.size(); i++) {
+            const QPointF& a = polygon[i];
+            const QPointF& b = polygon[(i + 1) % polygon.size()];
+
+            if ((a.y() <= y) != (b.y() <= y)) {
+                crossings.push_back(a.x() + (y - a.y()) * (b.x() - a.x()) / (b.y() - a.y()));
+            }
+        }
+
+        std::sort(crossings.begin(), crossings.end());
+
+        // Pixels between pairs of crossings are inside
+        for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+            const int x_0 = std::max(0, (int)std::ceil(crossings[i]));
+            const int x_1 = std::min(_width, (int)std::ceil(crossings[i + 1]));
+
+            if (x_1 <= x_0) continue;
+
+            for (int c = 0; c < 3; c++) {
+                sum[c] += getPrefix(y, x_1, c) - getPrefix(y, x_0, c);
+            }
+
+            n_pixels += x_1 - x_0;
+        }
+    }
+
+    return n_pixels;
+}
+
+
+double IntegralImage::getPrefix(int y, int x, int c) const
+{
+    return _blocks[3 * (size_t(y) * _nBlocks + x / INTEGRAL_BLOCK_SIZE) + c]
+           + _local[3 * (size_t(y) * (_width + 1) + x) + c];
+}
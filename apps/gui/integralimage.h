@@ -0,0 +1,40 @@
+#ifndef INTEGRALIMAGE_H
+#define INTEGRALIMAGE_H
+
+#include <QPolygonF>
+#include <vector>
+
+// Row prefix sums are stored by blocks of this many pixels in single
+// precision, on top of double precision sums of the previous blocks
+#define INTEGRAL_BLOCK_SIZE 64
+
+// Integral image of a linear interleaved RGB image along its rows: the sum
+// of the pixels of any polygon is given in one lookup per row it covers.
+class IntegralImage
+{
+  public:
+    IntegralImage();
+
+    // The pixels are not needed once the integral image is built
+    void build(const float* pixels, int width, int height);
+    void clear();
+    void swap(IntegralImage& other);
+
+    bool isEmpty() const { return _width == 0; }
+
+    // Sum of the pixels whose center lies in the polygon (odd-even rule),
+    // exact on the edges of the polygon. Gives the number of pixels summed.
+    size_t sumPolygon(const QPolygonF& polygon, double sum[3]) const;
+
+  private:
+    // Sum of the pixels [0, x) of a row
+    double getPrefix(int y, int x, int c) const;
+
+    int                 _width;
+    int                 _height;
+    int                 _nBlocks;
+    std::vector<float>  _local;    // 3 * (width + 1) per row: sums from the block start
+    std::vector<double> _blocks;   // 3 * nBlocks per row: sums before each block
+};
+
+#endif   // INTEGRALIMAGE_H
@@ -0,0 +1,117 @@
+#include "jobscheduler.h"
+
+JobScheduler::JobScheduler(): _runningStage(N_STAGES), _runningCoalesce(false), _stopped(false)
+{
+    _thread = std::thread(&JobScheduler::run, this);
+}
+
+
+JobScheduler::~JobScheduler()
+{
+    stop();
+}
+
+
+void JobScheduler::submit(Stage stage, const Job& job)
+{
+    push(stage, job, true);
+}
+
+
+void JobScheduler::enqueue(Stage stage, const Job& job)
+{
+    push(stage, job, false);
+}
+
+
+void JobScheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_stopped) return;
+
+        _stopped = true;
+
+        for (std::deque<entry>& pending : _pending) {
+            pending.clear();
+        }
+
+        if (_runningCanceled) {
+            _runningCanceled->store(true);
+        }
+    }
+
+    _condition.notify_one();
+    _thread.join();
+}
+
+
+void JobScheduler::push(Stage stage, const Job& job, bool coalesce)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_stopped) return;
+
+        if (coalesce) {
+            _pending[stage].clear();
+
+            if (_runningCanceled && _runningCoalesce && _runningStage >= stage) {
+                _runningCanceled->store(true);
+            }
+        }
+
+        entry e;
+        e.job      = job;
+        e.canceled = std::make_shared<std::atomic<bool>>(false);
+        e.coalesce = coalesce;
+
+        _pending[stage].push_back(e);
+    }
+
+    _condition.notify_one();
+}
+
+
+void JobScheduler::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+        int stage = 0;
+
+        while (stage < N_STAGES && _pending[stage].empty()) {
+            stage++;
+        }
+
+        if (_stopped) return;
+
+        if (stage == N_STAGES) {
+            _condition.wait(lock);
+            continue;
+        }
+
+        entry e = _pending[stage].front();
+        _pending[stage].pop_front();
+
+        _runningCanceled = e.canceled;
+        _runningStage    = stage;
+        _runningCoalesce = e.coalesce;
+
+        lock.unlock();
+        e.job(JobToken(e.canceled));
+        lock.lock();
+
+        _runningCanceled.reset();
+        _runningStage    = N_STAGES;
+        _runningCoalesce = false;
+
+        // Not replaced: cancelled for an earlier stage, its result is still
+        // needed once that stage is done
+        if (e.canceled->load() && !_stopped && _pending[stage].empty()) {
+            e.canceled = std::make_shared<std::atomic<bool>>(false);
+            _pending[stage].push_back(e);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Cooperative cancellation: long jobs check it between steps and return
+// early when it is set
+class JobToken
+{
+  public:
+    explicit JobToken(const std::shared_ptr<std::atomic<bool>>& canceled): _canceled(canceled) {}
+
+    bool isCanceled() const { return _canceled->load(); }
+
+  private:
+    std::shared_ptr<std::atomic<bool>> _canceled;
+};
+
+
+// Runs background jobs one at a time on a single worker thread. Jobs belong
+// to stages which depend on each other in this order: pending jobs of the
+// earliest stage run first so a job always sees the results of the jobs of
+// the previous stages submitted before it.
+class JobScheduler
+{
+  public:
+    enum Stage
+    {
+        LOAD,
+        DEMOSAIC,
+        DETECT,
+        CORRECT,
+        MEASURE,
+        FIT,
+        EXPORT,
+        N_STAGES
+    };
+
+    typedef std::function<void(const JobToken&)> Job;
+
+    JobScheduler();
+    ~JobScheduler();
+
+    // Latest wins: replaces the pending job of the stage and cancels the
+    // running submitted job if it belongs to the stage, its result is
+    // superseded, or to a later one. A job cancelled for an earlier stage
+    // only is run again once that stage is done: it shall be safe to repeat
+    void submit(Stage stage, const Job& job);
+
+    // Runs the job after the pending jobs of the stage, it is never
+    // cancelled but by stop()
+    void enqueue(Stage stage, const Job& job);
+
+    // Cancels all the jobs and waits for the running one, no job is run
+    // afterwards
+    void stop();
+
+  private:
+    typedef struct {
+        Job                                job;
+        std::shared_ptr<std::atomic<bool>> canceled;
+        bool                               coalesce;   // Submitted, not enqueued
+    } entry;
+
+    void push(Stage stage, const Job& job, bool coalesce);
+    void run();
+
+    std::mutex                                 _mutex;
+    std::condition_variable                    _condition;
+    std::array<std::deque<entry>, N_STAGES>    _pending;
+    std::shared_ptr<std::atomic<bool>>         _runningCanceled;
+    int                                        _runningStage;
+    bool                                       _runningCoalesce;
+    bool                                       _stopped;
+    std::thread                                _thread;
+};
+
+#endif   // JOBSCHEDULER_H
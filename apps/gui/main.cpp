@@ -20,6 +20,8 @@ enum CommandLineParseResult
 struct Command {
     bool    hasInputFile = false;
     QString inputFile;
+    size_t  demosaicCacheBudget    = DEMOSAIC_CACHE_DEFAULT_BUDGET;
+    bool    demosaicCacheHalfFloat = false;
 };
 
 CommandLineParseResult parseCommandLine(QCommandLineParser& parser, Command* result, QString* errorMessage)
@@ -38,6 +40,17 @@ under certain conditions.\n"
     const QCommandLineOption helpOption(parser.addHelpOption());
     const QCommandLineOption versionOption(parser.addVersionOption());
 
+    const QCommandLineOption cacheOption(
+      "demosaic-cache",
+      "Memory budget in MiB of the demosaiced images kept when switching methods (default: "
+        + QString::number(DEMOSAIC_CACHE_DEFAULT_BUDGET) + ", 0 disables the cache).",
+      "MiB");
+    parser.addOption(cacheOption);
+
+    const QCommandLineOption cacheHalfOption(
+      "demosaic-cache-half", "Stores the demosaiced images in half floats to keep twice as many.");
+    parser.addOption(cacheHalfOption);
+
     parser.addPositionalArgument("input file", "Sets file to process.");
 
     // Basic handling, parsing error & version & help
@@ -54,6 +67,20 @@ under certain conditions.\n"
         return CommandLineHelpRequested;
     }
 
+    // Demosaicing cache
+    if (parser.isSet(cacheOption)) {
+        bool ok = false;
+
+        result->demosaicCacheBudget = parser.value(cacheOption).toUInt(&ok);
+
+        if (!ok) {
+            *errorMessage = "Invalid demosaic cache budget: " + parser.value(cacheOption);
+            return CommandLineError;
+        }
+    }
+
+    result->demosaicCacheHalfFloat = parser.isSet(cacheHalfOption);
+
     // Input file
     const QStringList positionalArguments = parser.positionalArguments();
 
@@ -110,6 +137,7 @@ int main(int argc, char* argv[])
         a.setStyleSheet(ts.readAll());
     }
 
+    w.setDemosaicCache(command.demosaicCacheBudget << 20, command.demosaicCacheHalfFloat);
     w.show();
 
     if (command.hasInputFile) {
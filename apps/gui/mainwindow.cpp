@@ -4,7 +4,6 @@
 #include <QUrl>
 #include <QMimeData>
 #include <QDragEnterEvent>
-#include "fittingdialog.h"
 
 MainWindow::MainWindow(QWidget* parent)
   : QMainWindow(parent)
@@ -20,6 +19,12 @@ MainWindow::MainWindow(QWidget* parent)
 
     statusBar()->insertPermanentWidget(0, _statusBarProgress);
 
+    // Options of the configuration of the host
+    const DemosaicAutoOptions autoOptions = _model.getAutoDemosaicOptions();
+
+    ui->autoBudget->setValue(int(autoOptions.time_budget_ms));
+    ui->autoMinQuality->setCurrentText(ImageModel::getDemosaicingMethodText(autoOptions.min_quality));
+
     on_sliderInnerMarginX_valueChanged(ui->sliderInnerMarginX->value());
     on_sliderInnerMarginY_valueChanged(ui->sliderInnerMarginY->value());
     connect(&_model, SIGNAL(exposureChanged(double)), ui->exposureValue, SLOT(setValue(double)));
@@ -50,6 +55,12 @@ void MainWindow::openFile(const QString& filename)
 }
 
 
+void MainWindow::setDemosaicCache(size_t budget, bool halfFloat)
+{
+    _model.setDemosaicCache(budget, halfFloat);
+}
+
+
 void MainWindow::dropEvent(QDropEvent* ev)
 {
     QList<QUrl> urls = ev->mimeData()->urls();
@@ -116,6 +127,12 @@ void MainWindow::on_actionSave_correction_matrix_triggered()
 }
 
 
+void MainWindow::on_actionDetect_chart_triggered()
+{
+    _model.detectChart();
+}
+
+
 void MainWindow::on_showMacbeth_toggled(bool checked)
 {
     ui->sliderInnerMarginX->setEnabled(checked);
@@ -163,9 +180,11 @@ void MainWindow::onImageLoaded(int, int)
     ui->buttonFit->setEnabled(true);
     ui->actionExport_coordinates->setEnabled(true);
     ui->action_Save_areas->setEnabled(true);
+    ui->actionDetect_chart->setEnabled(true);
 
     ui->activeMatrix->setEnabled(_model.isMatrixLoaded());
     ui->demosaicingMode->setEnabled(_model.isRawImage());
+    updateAutoDemosaicingControls();
 
     ui->actionZoom_in->setEnabled(true);
     ui->actionZoom_out->setEnabled(true);
@@ -267,15 +286,63 @@ void MainWindow::on_m22_textChanged(const QString& arg1)
 
 void MainWindow::on_buttonFit_clicked()
 {
-    FittingDialog* f = new FittingDialog(&_model, this);
+    if (_fittingDialog) {
+        if (_fittingDialog->isVisible()) {
+            _fittingDialog->raise();
+            _fittingDialog->activateWindow();
+            return;
+        }
+
+        // Closed but not deleted yet: its fit is stopped before another one
+        // starts
+        delete _fittingDialog;
+    }
+
+    _fittingDialog = new FittingDialog(&_model, this);
+    _fittingDialog->setAttribute(Qt::WA_DeleteOnClose);
+
+    // Not modal: the chart can still be moved, the fit follows it
+    connect(_fittingDialog, SIGNAL(accepted()), this, SLOT(onFittingAccepted()));
+    _fittingDialog->show();
+}
+
 
-    if (f->exec() == QDialog::Accepted) {
+void MainWindow::onFittingAccepted()
+{
+    const FittingDialog* f = qobject_cast<const FittingDialog*>(sender());
+
+    if (f != nullptr) {
         _model.setMatrix(f->getFitMatrix());
     }
 }
 
 
-void MainWindow::on_demosaicingMode_currentIndexChanged(const QString& arg1)
+void MainWindow::on_demosaicingMode_currentTextChanged(const QString& arg1)
 {
     _model.setDemosaicingMethod(arg1);
+    updateAutoDemosaicingControls();
+}
+
+
+void MainWindow::on_autoBudget_valueChanged(int value)
+{
+    _model.setAutoDemosaicOptions(value, ui->autoMinQuality->currentText());
+    updateAutoDemosaicingControls();
+}
+
+
+void MainWindow::on_autoMinQuality_currentTextChanged(const QString& arg1)
+{
+    _model.setAutoDemosaicOptions(ui->autoBudget->value(), arg1);
+}
+
+
+void MainWindow::updateAutoDemosaicingControls()
+{
+    const bool isAuto = _model.isRawImage() && ui->demosaicingMode->currentText() == "Auto";
+
+    ui->autoBudget->setEnabled(isAuto);
+
+    // Only used without budget
+    ui->autoMinQuality->setEnabled(isAuto && ui->autoBudget->value() == 0);
 }
@@ -2,8 +2,10 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QPointer>
 #include <QProgressBar>
 
+#include "fittingdialog.h"
 #include "imagemodel.h"
 
 QT_BEGIN_NAMESPACE
@@ -22,6 +24,7 @@ class MainWindow: public QMainWindow
     ~MainWindow();
 
     void openFile(const QString& filename);
+    void setDemosaicCache(size_t budget, bool halfFloat);
 
   private:
     void dropEvent(QDropEvent* event);
@@ -32,6 +35,7 @@ class MainWindow: public QMainWindow
     void on_actionExport_coordinates_triggered();
     void on_action_Save_areas_triggered();
     void on_actionSave_correction_matrix_triggered();
+    void on_actionDetect_chart_triggered();
 
     void on_showMacbeth_toggled(bool checked);
     void on_sliderInnerMarginX_valueChanged(int value);
@@ -54,12 +58,22 @@ class MainWindow: public QMainWindow
     void on_m22_textChanged(const QString& arg1);
 
     void on_buttonFit_clicked();
+    void onFittingAccepted();
 
-    void on_demosaicingMode_currentIndexChanged(const QString& arg1);
+    void on_demosaicingMode_currentTextChanged(const QString& arg1);
+    void on_autoBudget_valueChanged(int value);
+    void on_autoMinQuality_currentTextChanged(const QString& arg1);
+
+  private:
+    void updateAutoDemosaicingControls();
 
   private:
     Ui::MainWindow* ui;
     ImageModel      _model;
     QProgressBar*   _statusBarProgress;
+
+    // A single fitting dialog at a time: levmar is not reentrant, it keeps
+    // its work buffers in static variables
+    QPointer<FittingDialog> _fittingDialog;
 };
 #endif   // MAINWINDOW_H
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <image.h>
+#include <hdrmerge.h>
+
+// Writes the merged Bayer frame as a RAW capture: <name>.txt + <name>.exr
+int write_raw_hdr(const char* filename, const float* bayered_pixels, size_t width, size_t height, RAWMetadata* metadata)
+{
+    const size_t len       = strlen(filename);
+    const char*  basename  = strrchr(filename, '/');
+    char*        path_exr  = (char*)calloc(len + 2, sizeof(char));
+    char*        name_info = NULL;
+    char*        name_exr  = NULL;
+
+    basename = (basename == NULL) ? filename : basename + 1;
+
+    memcpy(path_exr, filename, len - 3);
+    strcpy(path_exr + len - 3, "exr");
+
+    name_info = (char*)calloc(strlen(basename) + 1, sizeof(char));
+    name_exr  = (char*)calloc(strlen(basename) + 1, sizeof(char));
+    strcpy(name_info, basename);
+    strcpy(name_exr, path_exr + (basename - filename));
+
+    free(metadata->filename_image);
+    free(metadata->filename_info);
+    metadata->filename_image = name_exr;
+    metadata->filename_info  = name_info;
+
+    int err = write_exr_rgb(path_exr, bayered_pixels, bayered_pixels, bayered_pixels, width, height);
+
+    if (err == 0) {
+        err = write_raw_metadata(filename, metadata);
+    }
+
+    free(path_exr);
+
+    return err;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        printf(
+          "Usage:\n"
+          "------\n"
+          "hdr-merge [-m Method] <image_out> <raw_in_1> [<raw_in_2> ...]\n"
+          "Merges bracketed RAW captures (.txt) of the same scene in a linear HDR image\n"
+          "using the exposure time, aperture and gain of each capture.\n"
+          "The result is expressed with the exposure of the first capture.\n"
+          "When <image_out> is a .txt file, the merged Bayer frame is written as a RAW\n"
+          "capture (.txt metadata + .exr data). Otherwise it is demosaiced with Method\n"
+          "(see derawzinator, default AMAZE).\n");
+
+        return 0;
+    }
+
+    RAWDemosaicMethod method    = AMAZE;
+    int               arg_start = 1;
+
+    if (strcmp(argv[1], "-m") == 0 && argc > 4) {
+        DemosaicAutoOptions auto_options;
+
+        if (demosaic_parse_method(argv[2], &method, &auto_options) != 0) {
+            fprintf(stderr, "Unknown method specified, default to AMAZE\n");
+        } else {
+            // Used by the demosaicing of the merged frame
+            demosaic_set_auto_options(&auto_options);
+        }
+
+        arg_start = 3;
+    }
+
+    const char*  filename_out = argv[arg_start];
+    const char** filenames_in = (const char**)&argv[arg_start + 1];
+    const size_t n_files      = argc - arg_start - 1;
+    const size_t len          = strlen(filename_out);
+
+    float*   bayered_pixels = NULL;
+    float*   image_r        = NULL;
+    float*   image_g        = NULL;
+    float*   image_b        = NULL;
+    size_t   width, height;
+    uint32_t filters;
+
+    RAWMetadata metadata;
+    metadata.bayerPattern   = NULL;
+    metadata.filename_image = NULL;
+    metadata.filename_info  = NULL;
+
+    int err = hdr_merge_raw_files(filenames_in, n_files, &bayered_pixels, &width, &height, &filters, &metadata);
+
+    if (err != 0) {
+        fprintf(stderr, "Could not merge the captures\n");
+        goto clean;
+    }
+
+    if (strcmp(filename_out + len - 3, "txt") == 0 || strcmp(filename_out + len - 3, "TXT") == 0) {
+        err = write_raw_hdr(filename_out, bayered_pixels, width, height, &metadata);
+    } else {
+        size_t image_out_width, image_out_height;
+        demosaic_output_size(method, width, height, &image_out_width, &image_out_height);
+
+        const size_t image_out_size = image_out_width * image_out_height;
+
+        image_r = (float*)calloc(image_out_size, sizeof(float));
+        image_g = (float*)calloc(image_out_size, sizeof(float));
+        image_b = (float*)calloc(image_out_size, sizeof(float));
+
+        demosaic_rgb(bayered_pixels, image_r, image_g, image_b, width, height, filters, method);
+
+        err = write_image_rgb(filename_out, image_r, image_g, image_b, image_out_width, image_out_height);
+    }
+
+    if (err != 0) {
+        fprintf(stderr, "Could not write file: %s\n", filename_out);
+    }
+
+clean:
+    free(bayered_pixels);
+    free(image_r);
+    free(image_g);
+    free(image_b);
+
+    free(metadata.bayerPattern);
+    free(metadata.filename_image);
+    free(metadata.filename_info);
+
+    return err;
+}
@@ -0,0 +1,807 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <image.h>
+#include <chartdetection.h>
+#include <hdrmerge.h>
+#include <patches.h>
+#include <io.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#    include <windows.h>
+#else
+#    include <dirent.h>
+#endif
+
+#ifdef _OPENMP
+#    include <omp.h>
+#endif
+
+// Each compute thread holds a few full resolution buffers and the queue two
+// decoded frames per thread: a few threads sharing the cores through OpenMP
+// keep the memory bounded on many-core nodes
+#define DEFAULT_N_CPU_THREADS 2
+
+struct Capture {
+    std::string filename;
+    int         led_idx;
+    float       exposure;
+    float       gain;
+};
+
+
+struct Frame {
+    size_t   capture_idx;
+    float*   bayered_pixels;
+    size_t   width, height;
+    uint32_t filters;
+};
+
+
+struct LEDStack {
+    size_t n_frames              = 0;
+    size_t n_processed           = 0;
+    size_t n_accumulated         = 0;
+    size_t n_patches_accumulated = 0;   // Frames where the chart was found
+    size_t width                 = 0;
+    size_t height                = 0;
+
+    std::vector<float> image_sum;
+    std::vector<float> patches_sum;
+
+    // Used instead of the sums when merging the frames as HDR. Frames come
+    // in any order: the merge is expressed with the shortest exposure
+    HDRMerge merge              = HDRMerge();
+    bool     merge_initialized  = false;
+    float    reference_exposure = 0.f;
+
+    std::mutex mutex;
+};
+
+
+// Chart followed from frame to frame when no area file is given: the chart
+// of a capture sequence is detected once, later frames only check it is
+// still there
+struct ChartTracker {
+    bool          found      = false;
+    size_t        n_tracked  = 0;
+    size_t        n_detected = 0;
+    ChartLocation location;
+    Box           areas[CHART_N_PATCHES];   // Last areas, in the demosaiced image
+
+    std::mutex mutex;
+};
+
+
+struct ProcessingSettings {
+    RAWDemosaicMethod method;
+    float*            matrix;
+    const Box*        areas;
+    size_t            n_areas;
+    ChartTracker*     tracker;
+};
+
+
+// Gives the patch areas of a frame from the tracked chart. Frames where the
+// chart is lost are searched again, the previous areas are kept when it
+// cannot be found (e.g. too dark frame)
+int locate_chart_areas(
+  ChartTracker&     tracker,
+  RAWDemosaicMethod method,
+  const float*      bayered_pixels,
+  size_t            bayer_width,
+  size_t            bayer_height,
+  uint32_t          filters,
+  Box*              areas)
+{
+    ChartLocation previous;
+    bool          detected = false;
+    {
+        // The first detection is done once, the other threads wait for it
+        std::lock_guard<std::mutex> lock(tracker.mutex);
+
+        if (!tracker.found) {
+            detected = detect_chart_raw(bayered_pixels, bayer_width, bayer_height, filters, &tracker.location) == 0;
+
+            if (detected) {
+                tracker.found = true;
+                tracker.n_detected++;
+            }
+        }
+
+        if (!tracker.found) return -1;
+
+        previous = tracker.location;
+    }
+
+    ChartLocation location = previous;
+    bool          located  = detected;
+
+    if (!detected) {
+        if (track_chart_raw(bayered_pixels, bayer_width, bayer_height, filters, &previous, &location) == 0) {
+            located = true;
+
+            std::lock_guard<std::mutex> lock(tracker.mutex);
+            tracker.n_tracked++;
+        } else if (detect_chart_raw(bayered_pixels, bayer_width, bayer_height, filters, &location) == 0) {
+            located = true;
+
+            std::lock_guard<std::mutex> lock(tracker.mutex);
+            tracker.n_detected++;
+        } else {
+            location = previous;
+        }
+    }
+
+    chart_boxes(&location, .5f, areas);
+
+    // Half size demosaicing methods: an output pixel covers 2x2 pixels
+    size_t width, height;
+    demosaic_output_size(method, bayer_width, bayer_height, &width, &height);
+
+    const float scale = (float)width / (float)bayer_width;
+
+    for (int i = 0; i < CHART_N_PATCHES; i++) {
+        Point* corners[4] = {&areas[i].a, &areas[i].b, &areas[i].c, &areas[i].d};
+
+        for (Point* p: corners) {
+            p->x = (p->x + .5f) * scale - .5f;
+            p->y = (p->y + .5f) * scale - .5f;
+        }
+    }
+
+    if (located) {
+        std::lock_guard<std::mutex> lock(tracker.mutex);
+        tracker.location = location;
+        std::copy(areas, areas + CHART_N_PATCHES, tracker.areas);
+    }
+
+    return 0;
+}
+
+
+// Demosaics a frame, extracts the camera RGB patches then applies the
+// correction matrix
+int develop_frame(
+  const ProcessingSettings& settings,
+  const float*              bayered_pixels,
+  size_t                    bayer_width,
+  size_t                    bayer_height,
+  uint32_t                  filters,
+  std::vector<float>&       planes,
+  std::vector<float>&       image,
+  std::vector<float>&       patches,
+  size_t&                   width,
+  size_t&                   height)
+{
+    demosaic_output_size(settings.method, bayer_width, bayer_height, &width, &height);
+
+    const size_t image_size = width * height;
+
+    planes.resize(3 * image_size);
+    image.resize(3 * image_size);
+    patches.assign(3 * settings.n_areas, 0.f);
+
+    const Box* areas = settings.areas;
+    Box        tracked_areas[CHART_N_PATCHES];
+    int        err = 0;
+
+    if (settings.tracker != NULL) {
+        err = locate_chart_areas(
+          *settings.tracker, settings.method, bayered_pixels, bayer_width, bayer_height, filters, tracked_areas);
+
+        areas = (err == 0) ? tracked_areas : NULL;
+    }
+
+    float* r = &planes[0];
+    float* g = &planes[image_size];
+    float* b = &planes[2 * image_size];
+
+    demosaic_rgb(bayered_pixels, r, g, b, bayer_width, bayer_height, filters, settings.method);
+
+    for (size_t i = 0; i < image_size; i++) {
+        image[3 * i + 0] = r[i];
+        image[3 * i + 1] = g[i];
+        image[3 * i + 2] = b[i];
+    }
+
+    if (settings.n_areas > 0 && areas != NULL) {
+        average_patches(image.data(), width, height, areas, settings.n_areas, patches.data());
+    }
+
+    if (settings.matrix != NULL) {
+        correct_image(image.data(), width, height, settings.matrix);
+    }
+
+    return err;
+}
+
+
+// Bounded FIFO used between the I/O and the compute threads: it limits the
+// number of decoded frames waiting in memory.
+template<typename T>
+class BoundedQueue
+{
+  public:
+    BoundedQueue(size_t capacity): _capacity(capacity), _closed(false) {}
+
+    void push(const T& value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [this] { return _queue.size() < _capacity; });
+        _queue.push_back(value);
+        _not_empty.notify_one();
+    }
+
+    // Returns false once the queue is closed and empty
+    bool pop(T& value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [this] { return !_queue.empty() || _closed; });
+
+        if (_queue.empty()) {
+            return false;
+        }
+
+        value = _queue.front();
+        _queue.pop_front();
+        _not_full.notify_one();
+
+        return true;
+    }
+
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _closed = true;
+        _not_empty.notify_all();
+    }
+
+  private:
+    size_t                  _capacity;
+    bool                    _closed;
+    std::deque<T>           _queue;
+    std::mutex              _mutex;
+    std::condition_variable _not_full;
+    std::condition_variable _not_empty;
+};
+
+
+int list_captures(const std::string& directory, std::vector<std::string>& filenames)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA find_data;
+    HANDLE           h_find = FindFirstFileA((directory + "\\*").c_str(), &find_data);
+
+    if (h_find == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    do {
+        filenames.push_back(find_data.cFileName);
+    } while (FindNextFileA(h_find, &find_data) != 0);
+
+    FindClose(h_find);
+#else
+    DIR* dir = opendir(directory.c_str());
+
+    if (dir == NULL) {
+        return -1;
+    }
+
+    struct dirent* entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+        filenames.push_back(entry->d_name);
+    }
+
+    closedir(dir);
+#endif
+
+    // Keep only the metadata files, the image data is referenced from them
+    filenames.erase(
+      std::remove_if(
+        filenames.begin(),
+        filenames.end(),
+        [](const std::string& f) {
+            return f.size() < 4
+                   || (f.compare(f.size() - 4, 4, ".txt") != 0 && f.compare(f.size() - 4, 4, ".TXT") != 0);
+        }),
+      filenames.end());
+
+    std::sort(filenames.begin(), filenames.end());
+
+    return 0;
+}
+
+
+int write_led_stack(const std::string& output_dir, int led_idx, LEDStack& stack, size_t n_areas)
+{
+    const float  inv_n      = 1.f / (float)stack.n_accumulated;
+    const size_t image_size = stack.width * stack.height;
+
+    for (size_t i = 0; i < 3 * image_size; i++) {
+        stack.image_sum[i] *= inv_n;
+    }
+
+    const std::string basename = output_dir + "/led_" + std::to_string(led_idx);
+
+    int err = write_image((basename + ".exr").c_str(), stack.image_sum.data(), stack.width, stack.height);
+
+    if (err != 0) {
+        std::cerr << "Could not write image for LED " << led_idx << std::endl;
+        return err;
+    }
+
+    if (n_areas > 0 && stack.n_patches_accumulated == 0) {
+        std::cerr << "No color chart found for LED " << led_idx << ", no patches written" << std::endl;
+    } else if (n_areas > 0) {
+        const float inv_n_patches = 1.f / (float)stack.n_patches_accumulated;
+
+        for (size_t i = 0; i < 3 * n_areas; i++) {
+            stack.patches_sum[i] *= inv_n_patches;
+        }
+
+        err = save_xyz((basename + "_patches.csv").c_str(), stack.patches_sum.data(), n_areas);
+
+        if (err != 0) {
+            std::cerr << "Could not write patches for LED " << led_idx << std::endl;
+            return err;
+        }
+    }
+
+    // Release the accumulation buffers as soon as the LED is done
+    std::vector<float>().swap(stack.image_sum);
+    std::vector<float>().swap(stack.patches_sum);
+
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        printf(
+          "Usage:\n"
+          "------\n"
+          "process-stack <input_dir> <output_dir> [options]\n"
+          "Processes all the RAW captures (.txt + .dat) of a directory grouped by LED.\n"
+          "For each LED, writes the average corrected image led_<idx>.exr and, when\n"
+          "areas are provided, the average camera RGB patches led_<idx>_patches.csv\n"
+          "(before correction, as extract-patches does).\n"
+          "Options:\n"
+          "  -m <method>   Demosaicing method (default AMAZE)\n"
+          "  -x <matrix>   Correction matrix (as written by extract-matrix)\n"
+          "  -a <areas>    Area file for patch extraction\n"
+          "  -t            Detect the chart on the first frame and follow it on the\n"
+          "                next ones instead of using an area file, writes the areas\n"
+          "                of the last position to areas.csv\n"
+          "  -d <dark>     Master dark frame (see stack-frames)\n"
+          "  -f <flat>     Master flat frame\n"
+          "  -b <level>    Normalized black level, used without dark frame (default 0)\n"
+          "  -H            Merge the frames of each LED as HDR (bracketed exposures)\n"
+          "                instead of averaging them\n"
+          "  -i <n>        Number of I/O threads (default 2)\n"
+          "  -c <n>        Number of compute threads sharing the cores (default %d)\n",
+          DEFAULT_N_CPU_THREADS);
+
+        return 0;
+    }
+
+    const std::string input_dir  = argv[1];
+    const std::string output_dir = argv[2];
+
+    RAWDemosaicMethod method          = AMAZE;
+    const char*       filename_matrix = NULL;
+    const char*       filename_areas  = NULL;
+    const char*       filename_dark   = NULL;
+    const char*       filename_flat   = NULL;
+    float             black_level     = 0.f;
+    int               n_io_threads    = 2;
+    int               n_cpu_threads   = DEFAULT_N_CPU_THREADS;
+    bool              merge_hdr       = false;
+    bool              track_chart     = false;
+
+    for (int i = 3; i < argc; i += 2) {
+        if (strcmp(argv[i], "-H") == 0) {
+            merge_hdr = true;
+            i--;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            track_chart = true;
+            i--;
+        } else if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for option %s\n", argv[i]);
+            return -1;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            DemosaicAutoOptions auto_options;
+
+            if (demosaic_parse_method(argv[i + 1], &method, &auto_options) != 0) {
+                fprintf(stderr, "Unknown method specified, default to AMAZE\n");
+            } else {
+                // Used by the demosaicing of every frame
+                demosaic_set_auto_options(&auto_options);
+            }
+        } else if (strcmp(argv[i], "-x") == 0) {
+            filename_matrix = argv[i + 1];
+        } else if (strcmp(argv[i], "-a") == 0) {
+            filename_areas = argv[i + 1];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            filename_dark = argv[i + 1];
+        } else if (strcmp(argv[i], "-f") == 0) {
+            filename_flat = argv[i + 1];
+        } else if (strcmp(argv[i], "-b") == 0) {
+            black_level = (float)atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-i") == 0) {
+            n_io_threads = std::max(1, atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "-c") == 0) {
+            n_cpu_threads = std::max(1, atoi(argv[i + 1]));
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (track_chart && filename_areas != NULL) {
+        fprintf(stderr, "Options -a and -t cannot be used together\n");
+        return -1;
+    }
+
+    float* matrix  = NULL;
+    Box*   areas   = NULL;
+    size_t n_areas = track_chart ? CHART_N_PATCHES : 0;
+
+    if (filename_matrix != NULL) {
+        size_t mat_size;
+        int    err = load_xyz(filename_matrix, &matrix, &mat_size);
+
+        if (err != 0 || mat_size != 3) {
+            fprintf(stderr, "Cannot open matrix file\n");
+            free(matrix);
+            return -1;
+        }
+    }
+
+    if (filename_areas != NULL) {
+        int err = load_boxfile(filename_areas, &areas, &n_areas);
+
+        if (err != 0) {
+            fprintf(stderr, "Cannot open area file %s\n", filename_areas);
+            free(matrix);
+            return -1;
+        }
+    }
+
+    // Calibration frames are loaded once for the whole stack
+    RAWCalibration calibration;
+
+    if (load_raw_calibration(filename_dark, filename_flat, black_level, &calibration) != 0) {
+        free(matrix);
+        free(areas);
+        return -1;
+    }
+
+    // Group the captures by LED. Metadata files are small, so this is cheap
+    // compared to the image decoding.
+    std::vector<std::string> filenames;
+
+    if (list_captures(input_dir, filenames) != 0) {
+        fprintf(stderr, "Cannot list directory %s\n", input_dir.c_str());
+        free(matrix);
+        free(areas);
+        free_raw_calibration(&calibration);
+        return -1;
+    }
+
+    std::vector<Capture> captures;
+
+    for (const std::string& f: filenames) {
+        const std::string path = input_dir + "/" + f;
+
+        RAWMetadata metadata;
+        metadata.bayerPattern   = NULL;
+        metadata.filename_image = NULL;
+        metadata.filename_info  = NULL;
+
+        if (read_raw_metadata(path.c_str(), &metadata) == 0) {
+            captures.push_back({path, metadata.ledIdx, raw_exposure(&metadata), metadata.gain});
+        } else {
+            std::cerr << "Skipping " << path << std::endl;
+        }
+
+        free(metadata.bayerPattern);
+        free(metadata.filename_image);
+        free(metadata.filename_info);
+    }
+
+    // Processing the captures LED after LED keeps only a few stacks alive
+    std::stable_sort(captures.begin(), captures.end(), [](const Capture& a, const Capture& b) {
+        return a.led_idx < b.led_idx;
+    });
+
+    std::map<int, LEDStack> stacks;
+
+    for (const Capture& c: captures) {
+        LEDStack& stack = stacks[c.led_idx];
+
+        if (c.exposure > 0 && (stack.reference_exposure <= 0 || c.exposure < stack.reference_exposure)) {
+            stack.reference_exposure = c.exposure;
+        }
+
+        stack.n_frames++;
+    }
+
+    std::cout << "Found " << captures.size() << " captures for " << stacks.size() << " LEDs" << std::endl;
+
+    ChartTracker tracker;
+
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    // I/O threads: decode the RAW files in order
+    BoundedQueue<Frame> decoded(2 * n_cpu_threads);
+    std::mutex          next_capture_mutex;
+    size_t              next_capture = 0;
+    std::mutex          status_mutex;
+    int                 status = 0;
+
+    std::vector<std::thread> io_threads;
+
+    for (int t = 0; t < n_io_threads; t++) {
+        io_threads.emplace_back([&] {
+            for (;;) {
+                size_t capture_idx;
+                {
+                    std::lock_guard<std::mutex> lock(next_capture_mutex);
+
+                    if (next_capture >= captures.size()) {
+                        break;
+                    }
+
+                    capture_idx = next_capture++;
+                }
+
+                Frame frame;
+                frame.capture_idx    = capture_idx;
+                frame.bayered_pixels = NULL;
+
+                const int err = read_raw_file_calibrated(
+                  captures[capture_idx].filename.c_str(),
+                  &calibration,
+                  &frame.bayered_pixels,
+                  &frame.width,
+                  &frame.height,
+                  &frame.filters);
+
+                if (err != 0) {
+                    // Still forwarded so the LED stack knows this frame is done
+                    std::cerr << "Could not read " << captures[capture_idx].filename << std::endl;
+                    frame.bayered_pixels = NULL;
+
+                    std::lock_guard<std::mutex> lock(status_mutex);
+                    status = -1;
+                }
+
+                decoded.push(frame);
+            }
+        });
+    }
+
+    // Compute threads: demosaic, correct, extract patches and accumulate
+    std::vector<std::thread> cpu_threads;
+    size_t                   n_frames_done = 0;
+
+    for (int t = 0; t < n_cpu_threads; t++) {
+        cpu_threads.emplace_back([&] {
+#ifdef _OPENMP
+            // Share the cores between the compute threads instead of
+            // oversubscribing them with one OpenMP team per thread
+            omp_set_num_threads(std::max(1, omp_get_num_procs() / n_cpu_threads));
+#endif
+            const ProcessingSettings settings = {method, matrix, areas, n_areas, track_chart ? &tracker : NULL};
+
+            std::vector<float> planes, image, patches;
+            Frame              frame;
+
+            while (decoded.pop(frame)) {
+                const int  led_idx  = captures[frame.capture_idx].led_idx;
+                LEDStack&  stack    = stacks.at(led_idx);
+                const bool readable = frame.bayered_pixels != NULL;
+
+                size_t width, height;
+                int    develop_err = 0;
+
+                if (readable && !merge_hdr) {
+                    develop_err = develop_frame(
+                      settings,
+                      frame.bayered_pixels,
+                      frame.width,
+                      frame.height,
+                      frame.filters,
+                      planes,
+                      image,
+                      patches,
+                      width,
+                      height);
+
+                    if (develop_err != 0) {
+                        std::cerr << "No color chart found in " << captures[frame.capture_idx].filename << std::endl;
+                        std::lock_guard<std::mutex> lock(status_mutex);
+                        status = -1;
+                    }
+                }
+
+                bool done = false;
+                {
+                    std::lock_guard<std::mutex> lock(stack.mutex);
+
+                    if (!readable) {
+                        // Unreadable frame, already reported
+                    } else if (merge_hdr) {
+                        if (!stack.merge_initialized) {
+                            stack.width             = frame.width;
+                            stack.height            = frame.height;
+                            stack.merge_initialized = true;
+
+                            const int err = hdr_merge_init(
+                              &stack.merge, frame.width, frame.height, frame.filters, stack.reference_exposure);
+
+                            if (err != 0) {
+                                std::lock_guard<std::mutex> lock_status(status_mutex);
+                                status = -1;
+                            }
+                        }
+
+                        if (
+                          stack.merge.radiance_sum != NULL && stack.width == frame.width
+                          && stack.height == frame.height && stack.merge.filters == frame.filters) {
+                            const Capture& c = captures[frame.capture_idx];
+
+                            if (hdr_merge_add(&stack.merge, frame.bayered_pixels, c.exposure, c.gain) == 0) {
+                                stack.n_accumulated++;
+                            } else {
+                                std::cerr << "Cannot merge " << c.filename << std::endl;
+                                std::lock_guard<std::mutex> lock_status(status_mutex);
+                                status = -1;
+                            }
+                        } else {
+                            std::cerr << "Cannot merge " << captures[frame.capture_idx].filename << std::endl;
+                            std::lock_guard<std::mutex> lock_status(status_mutex);
+                            status = -1;
+                        }
+                    } else if (stack.n_accumulated == 0 || (stack.width == width && stack.height == height)) {
+                        if (stack.n_accumulated == 0) {
+                            stack.width  = width;
+                            stack.height = height;
+                            stack.image_sum.assign(image.size(), 0.f);
+                            stack.patches_sum.assign(patches.size(), 0.f);
+                        }
+
+                        for (size_t i = 0; i < image.size(); i++) {
+                            stack.image_sum[i] += image[i];
+                        }
+
+                        // Patches of a frame without chart are zeros: left out of the average
+                        if (develop_err == 0) {
+                            for (size_t i = 0; i < patches.size(); i++) {
+                                stack.patches_sum[i] += patches[i];
+                            }
+
+                            stack.n_patches_accumulated++;
+                        }
+
+                        stack.n_accumulated++;
+                    } else {
+                        std::cerr << "Size mismatch for " << captures[frame.capture_idx].filename << std::endl;
+                        std::lock_guard<std::mutex> lock_status(status_mutex);
+                        status = -1;
+                    }
+
+                    stack.n_processed++;
+                    done = stack.n_processed == stack.n_frames;
+                }
+
+                free(frame.bayered_pixels);
+
+                if (done && merge_hdr && stack.n_accumulated > 0) {
+                    // All the exposures are in: develop the merged frame once
+                    std::vector<float> merged(stack.width * stack.height);
+                    hdr_merge_resolve(&stack.merge, merged.data());
+                    hdr_merge_free(&stack.merge);
+
+                    const int err = develop_frame(
+                      settings,
+                      merged.data(),
+                      stack.merge.width,
+                      stack.merge.height,
+                      stack.merge.filters,
+                      planes,
+                      stack.image_sum,
+                      stack.patches_sum,
+                      width,
+                      height);
+
+                    if (err != 0) {
+                        std::cerr << "No color chart found for LED " << led_idx << std::endl;
+                        std::lock_guard<std::mutex> lock(status_mutex);
+                        status = -1;
+                    }
+
+                    stack.width  = width;
+                    stack.height = height;
+
+                    stack.n_accumulated         = 1;
+                    stack.n_patches_accumulated = (err == 0) ? 1 : 0;
+                } else if (done && merge_hdr) {
+                    hdr_merge_free(&stack.merge);
+                }
+
+                // No other thread touches a completed stack: it is written
+                // without holding the status
+                int write_err = 0;
+
+                if (done && stack.n_accumulated > 0) {
+                    write_err = write_led_stack(output_dir, led_idx, stack, n_areas);
+                }
+
+                std::lock_guard<std::mutex> lock(status_mutex);
+
+                if (write_err != 0) {
+                    status = write_err;
+                }
+
+                if (done && stack.n_accumulated > 0) {
+                    std::cout << "LED " << led_idx << ": " << stack.n_processed << " frame(s)" << std::endl;
+                }
+
+                if (readable) {
+                    n_frames_done++;
+                }
+            }
+        });
+    }
+
+    for (std::thread& t: io_threads) {
+        t.join();
+    }
+
+    decoded.close();
+
+    for (std::thread& t: cpu_threads) {
+        t.join();
+    }
+
+    const auto   stop    = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(stop - start).count();
+
+    std::cout << "Processed " << n_frames_done << " frames in " << seconds << "s ("
+              << (seconds > 0 ? (double)n_frames_done / seconds : 0.) << " frames/s)" << std::endl;
+
+    if (track_chart && tracker.found) {
+        std::cout << "Chart detected " << tracker.n_detected << " time(s), tracked on " << tracker.n_tracked
+                  << " frame(s)" << std::endl;
+
+        const std::string filename_tracked = output_dir + "/areas.csv";
+
+        if (save_boxfile(filename_tracked.c_str(), tracker.areas, CHART_N_PATCHES) != 0) {
+            std::cerr << "Could not write " << filename_tracked << std::endl;
+            status = -1;
+        }
+    }
+
+    free(matrix);
+    free(areas);
+    free_raw_calibration(&calibration);
+
+    return status;
+}
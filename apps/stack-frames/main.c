@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <image.h>
+#include <io.h>
+#include <stacking.h>
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        printf(
+          "Usage:\n"
+          "------\n"
+          "stack-frames <frame_list> <master_out> [Method] [Sigma] [Memory] [Bit_depth]\n"
+          "Builds a master frame (e.g. dark or flat) from the frames listed in <frame_list>.\n"
+          "Frames can be RAW captures (.txt), .dat files, EXR or TIFF images.\n"
+          "The master frame is written as an EXR file.\n"
+          "Method is optional. It can be:\n"
+          "  - MEAN (default)\n"
+          "  - SIGMA_CLIP: mean of the samples within Sigma standard deviations (default 3)\n"
+          "  - MEDIAN: processed in row bands fitting in Memory MB (default 1024)\n"
+          "Bit_depth is used to normalize .dat files (default 16).\n");
+
+        return 0;
+    }
+
+    const char* filename_list = argv[1];
+    const char* filename_out  = argv[2];
+
+    StackingOptions options;
+    stacking_default_options(&options);
+
+    if (argc > 3 && stacking_method_from_name(argv[3], &options.method) != 0) {
+        fprintf(stderr, "Unknown method specified, default to MEAN\n");
+    }
+
+    if (argc > 4) {
+        options.sigma = (float)atof(argv[4]);
+    }
+
+    if (argc > 5) {
+        options.memory_budget = (size_t)atoi(argv[5]) * 1024 * 1024;
+    }
+
+    if (argc > 6) {
+        options.bit_depth = (size_t)atoi(argv[6]);
+    }
+
+    char** filelist = NULL;
+    size_t n_files  = 0;
+    float* master   = NULL;
+    size_t width, height;
+
+    int err = load_list_file(filename_list, &filelist, &n_files);
+
+    if (err != 0) {
+        fprintf(stderr, "Could not read file list %s\n", filename_list);
+        goto clean;
+    }
+
+    err = stack_frames((const char**)filelist, n_files, &options, &master, &width, &height);
+
+    if (err != 0) {
+        fprintf(stderr, "Could not stack the frames\n");
+        goto clean;
+    }
+
+    err = write_exr_rgb(filename_out, master, master, master, width, height);
+
+    if (err != 0) {
+        fprintf(stderr, "Could not write file: %s\n", filename_out);
+    }
+
+clean:
+    free_list_file(filelist, n_files);
+    free(master);
+
+    return err;
+}
@@ -0,0 +1,130 @@
+#include <math.h>
+#include <fitting.h>
+#include <color-converter.h>
+
+// Smallest relative variance of a patch mean in the weights, about 0.1% of noise
+#define FIT_MIN_RELATIVE_VARIANCE 1e-6f
+
+
+static int is_selected(const FitPatches* patches, size_t idx)
+{
+    return patches->select_patch == NULL || patches->select_patch[idx] != 0;
+}
+
+
+// Delta E 2000 between a reference patch and a corrected one, weighted for
+// a least squares fit
+static float get_residual(const FitPatches* patches, size_t idx, const float* lab_ref, const float* tristim_corrected)
+{
+    float lab_mea[3];
+    XYZ_to_Lab(tristim_corrected, lab_mea);
+
+    const float deltaE = deltaE_2000(lab_ref, lab_mea);
+
+    return (patches->weight_patch != NULL) ? sqrtf(patches->weight_patch[idx]) * deltaE : deltaE;
+}
+
+
+size_t fit_n_measurements(const FitPatches* patches)
+{
+    size_t n_measurements = 0;
+
+    for (size_t i = 0; i < patches->n_patches * patches->n_exposures; i++) {
+        if (is_selected(patches, i)) {
+            n_measurements++;
+        }
+    }
+
+    return n_measurements;
+}
+
+
+void fit_residuals_matrix(float* p, float* x, int n_parameters, int n_measurements, void* patches)
+{
+    (void)n_parameters;
+    (void)n_measurements;
+
+    const FitPatches* info = (const FitPatches*)patches;
+
+    float tristim_corrected[3];
+    float lab_ref[3];
+
+    size_t measurement_idx = 0;
+
+    for (size_t patch_idx = 0; patch_idx < info->n_patches; patch_idx++) {
+        const size_t offset = patch_idx * info->n_exposures;
+
+        // The reference is converted once for all the exposures
+        XYZ_to_Lab(&info->reference_patches[3 * patch_idx], lab_ref);
+
+        for (size_t exposure_idx = 0; exposure_idx < info->n_exposures; exposure_idx++) {
+            if (is_selected(info, offset + exposure_idx)) {
+                matmul(p, &info->measured_patches[3 * (offset + exposure_idx)], tristim_corrected);
+
+                x[measurement_idx++] = get_residual(info, offset + exposure_idx, lab_ref, tristim_corrected);
+            }
+        }
+    }
+}
+
+
+void fit_residuals_exposures(float* p, float* x, int n_parameters, int n_measurements, void* patches)
+{
+    (void)n_parameters;
+    (void)n_measurements;
+
+    const FitPatches* info = (const FitPatches*)patches;
+
+    float tristim_corrected[3];
+    float lab_ref[3];
+
+    size_t measurement_idx = 0;
+
+    for (size_t patch_idx = 0; patch_idx < info->n_patches; patch_idx++) {
+        const size_t offset = patch_idx * info->n_exposures;
+
+        XYZ_to_Lab(&info->reference_patches[3 * patch_idx], lab_ref);
+
+        for (size_t exposure_idx = 0; exposure_idx < info->n_exposures; exposure_idx++) {
+            if (is_selected(info, offset + exposure_idx)) {
+                const float* tristim_mea = &info->measured_patches[3 * (offset + exposure_idx)];
+                const float* diagonal    = &p[6 + 3 * exposure_idx];
+
+                tristim_corrected[0] = diagonal[0] * tristim_mea[0] + p[0] * tristim_mea[1] + p[1] * tristim_mea[2];
+                tristim_corrected[1] = p[2] * tristim_mea[0] + diagonal[1] * tristim_mea[1] + p[3] * tristim_mea[2];
+                tristim_corrected[2] = p[4] * tristim_mea[0] + p[5] * tristim_mea[1] + diagonal[2] * tristim_mea[2];
+
+                x[measurement_idx++] = get_residual(info, offset + exposure_idx, lab_ref, tristim_corrected);
+            }
+        }
+    }
+}
+
+
+void fit_patch_weights(
+  const float* means, const float* variances, const size_t* n_pixels, size_t size, float* weights)
+{
+    float sum = 0.f;
+
+    for (size_t i = 0; i < size; i++) {
+        const float* m = &means[3 * i];
+        const float* v = &variances[3 * i];
+
+        const float signal = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+
+        // A black or empty patch tells nothing of its noise
+        if (signal > 0.f && n_pixels[i] > 0) {
+            const float variance_mean = (v[0] + v[1] + v[2]) / (float)n_pixels[i];
+
+            weights[i] = 1.f / (variance_mean / signal + FIT_MIN_RELATIVE_VARIANCE);
+        } else {
+            weights[i] = 0.f;
+        }
+
+        sum += weights[i];
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        weights[i] = (sum > 0.f) ? weights[i] * (float)size / sum : 1.f;
+    }
+}
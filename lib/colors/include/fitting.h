@@ -0,0 +1,89 @@
+#ifndef FITTING_H_
+#define FITTING_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif   // __cplusplus
+
+#include <stddef.h>
+
+// Patches with a larger fraction of clipped pixels are left out of the fits
+#define FIT_MAX_CLIPPED_FRACTION .01f
+
+    /**
+     * Patches a correction matrix is fitted on, given to the residual
+     * functions as levmar user data.
+     */
+    typedef struct {
+        size_t n_patches;
+        size_t n_exposures;
+
+        // 3 * n_patches array
+        // -------------------
+        // reference_patches(idx_patch, idx_color)
+        //     = reference_patches[3 * idx_patch + idx_color]
+        const float* reference_patches;
+
+        // 3 * n_patches * n_exposures array
+        // ---------------------------------
+        // measured_patches(idx_exposure, idx_patch, idx_color)
+        //     = measured_patches[3 * (idx_patch * n_exposures + idx_exposure) + idx_color]
+        const float* measured_patches;
+
+        // n_patches * n_exposures arrays, NULL selects all the patches or
+        // gives them the same weight
+        // ---------------------------------------------------------------
+        // select_patch(idx_exposure, idx_patch)
+        //     = select_patch[idx_patch * n_exposures + idx_exposure]
+        const int*   select_patch;
+        const float* weight_patch;
+    } FitPatches;
+
+    /**
+     * Number of residuals given by the residual functions: one per selected
+     * patch and exposure.
+     */
+    size_t fit_n_measurements(const FitPatches* patches);
+
+    /**
+     * Residuals of a 3x3 matrix (9 parameters, row major) applied to all
+     * the exposures: the Delta E 2000 between the reference and the
+     * corrected selected patches, scaled by the square root of their weight
+     * so that levmar minimizes the weighted sum of squares.
+     *
+     * Has the signature of a levmar function, patches is a FitPatches.
+     */
+    void fit_residuals_matrix(float* p, float* x, int n_parameters, int n_measurements, void* patches);
+
+    /**
+     * Residuals of a matrix whose off diagonal terms are shared by all the
+     * exposures and diagonal terms are specific to each exposure: p holds the
+     * 6 off diagonal terms then the 3 diagonal terms of each exposure.
+     *
+     * Has the signature of a levmar function, patches is a FitPatches.
+     */
+    void fit_residuals_exposures(float* p, float* x, int n_parameters, int n_measurements, void* patches);
+
+    /**
+     * Weights of patches from their measurement variance: the inverse of
+     * the variance of the patch mean (the variance of its pixels over
+     * their number) relative to the patch color, floored so a very uniform
+     * patch does not take over the fit. Weights average to 1.
+     *
+     * @param means mean color of each patch (3 * size)
+     * @param variances variance of the pixels of each channel of each patch
+     *        (3 * size)
+     * @param n_pixels number of pixels averaged in each patch (size)
+     * @param size number of patches
+     * @param weights weight of each patch (size)
+     */
+    void fit_patch_weights(
+      const float* means, const float* variances, const size_t* n_pixels, size_t size, float* weights);
+
+#ifdef __cplusplus
+}
+#endif   // __cplusplus
+
+
+#endif   // FITTING_H_
@@ -16,6 +16,19 @@ extern "C"
     int load_xyz(const char* filename, float** xyz, size_t* size);
     int save_xyz(const char* filename, const float* xyz, size_t size);
 
+    /**
+     * Reads a list of file names, one per line. Blank lines and the blanks
+     * around each name are ignored.
+     *
+     * @param filename file to read
+     * @param list gives the names, to be freed with free_list_file
+     * @param size gives the number of names
+     *
+     * @returns 0 if sucessfull, nothing is to be freed otherwise
+     */
+    int  load_list_file(const char* filename, char*** list, size_t* size);
+    void free_list_file(char** list, size_t size);
+
 #ifdef __cplusplus
 }
 #endif   // __cplusplus
@@ -206,3 +206,79 @@ int save_xyz(const char* filename, const float* xyz, size_t size)
 
     return 0;
 }
+
+
+void free_list_file(char** list, size_t size)
+{
+    if (list == NULL) return;
+
+    for (size_t i = 0; i < size; i++) {
+        free(list[i]);
+    }
+
+    free(list);
+}
+
+
+int load_list_file(const char* filename, char*** list, size_t* size)
+{
+    FILE*  fin       = fopen(filename, "r");
+    char** buff_list = NULL;
+    char   line[4096];
+
+    *list = NULL;
+    *size = 0;
+
+    if (fin == NULL) {
+        fprintf(stderr, "Cannot open file %s\n", filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fin) != NULL) {
+        size_t len = strlen(line);
+
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && ungetc(fgetc(fin), fin) != EOF) {
+            fprintf(stderr, "Line too long in file %s\n", filename);
+            free_list_file(buff_list, *size);
+            *size = 0;
+            fclose(fin);
+            return -1;
+        }
+
+        // Surrounding blanks and blank lines are ignored
+        char* begin = line;
+
+        while (*begin == ' ' || *begin == '\t') {
+            begin++;
+        }
+
+        while (len > 0 && strchr(" \t\r\n", line[len - 1]) != NULL) {
+            line[--len] = '\0';
+        }
+
+        if (*begin == '\0') continue;
+
+        char** buff_list_temp = (char**)realloc(buff_list, (*size + 1) * sizeof(char*));
+        char*  element        = (char*)malloc(strlen(begin) + 1);
+
+        if (buff_list_temp != NULL) buff_list = buff_list_temp;
+
+        if (buff_list_temp == NULL || element == NULL) {
+            fprintf(stderr, "Memory allocation error\n");
+            free(element);
+            free_list_file(buff_list, *size);
+            *size = 0;
+            fclose(fin);
+            return -1;
+        }
+
+        strcpy(element, begin);
+        buff_list[(*size)++] = element;
+    }
+
+    fclose(fin);
+
+    *list = buff_list;
+
+    return 0;
+}
@@ -0,0 +1,1178 @@
+#include <chartdetection.h>
+#include <demosaicing.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Largest size of the coarsest level of the pyramid the patches are searched
+// in, in pixels
+#define DETECT_COARSE_SIZE 1024
+
+// Largest relative change of luminance across two pixels of a flat region
+#define DETECT_FLAT_CONTRAST .1f
+
+// Offset of the luminance in the relative contrast as a fraction of the
+// 95th percentile, keeps the noise of dark areas out
+#define DETECT_DARK_OFFSET .02f
+
+// Smallest area of a patch in pixels of the coarsest level
+#define DETECT_MIN_PATCH_AREA 12
+
+// Patches on the grid for a candidate chart to be accepted
+#define DETECT_MIN_PATCHES 12
+
+// Largest distance of a patch to its grid node, in grid steps
+#define DETECT_GRID_TOLERANCE .25f
+
+// Grid nodes are searched up to this distance from the seed patch
+#define DETECT_GRID_RADIUS 5
+
+// Side of the area the color of a patch is taken from during refinement as
+// a fraction of the patch pitch, and largest relative difference to this
+// color of the pixels of the patch
+#define DETECT_SEED_SIZE       .3f
+#define DETECT_COLOR_TOLERANCE .2f
+
+// Largest number of samples across a patch during refinement
+#define DETECT_REFINE_SAMPLES 128
+
+// Grids refined at full resolution before giving up
+#define DETECT_MAX_GRIDS 8
+
+// Smallest correlation of the luminance of the neutral row with its expected
+// decrease
+#define DETECT_MIN_NEUTRAL_SCORE .9
+
+// Largest move of a patch between two tracked frames as a fraction of the
+// patch pitch, beyond which the chart is searched again
+#define DETECT_TRACK_MAX_SHIFT .25f
+
+// Luminance level of the pyramid: a pixel covers scale x scale pixels of the
+// image and its center is at scale * (x + .5) - .5 in the image
+typedef struct {
+    std::vector<float> pixels;
+    int                width;
+    int                height;
+    int                scale;
+} luminance_level;
+
+// Flat region of the coarsest level, a patch candidate
+typedef struct {
+    float x, y;   // Centroid in pixels of the level
+    float area;
+} patch_candidate;
+
+// Patches found on a grid: node (i, j) of the grid is in the image at
+// (a[0] + a[1] i + a[2] j, a[3] + a[4] i + a[5] j) for an affine grid
+typedef struct {
+    int    width;    // Nodes along i, CHART_N_COLUMNS or CHART_N_ROWS
+    int    height;   // Nodes along j
+    int    n_patches;
+    int    n_outside;   // Patches on the same grid out of the window
+    double residual;
+
+    std::vector<int> nodes;   // Candidate of each node, -1 if none
+} patch_grid;
+
+
+// Pixels of an interleaved RGB image, as read by the refinement
+struct rgb_image {
+    const float* pixels;
+    int          width;
+    int          height;
+
+    inline void get(int x, int y, float* rgb) const
+    {
+        const float* p = &pixels[3 * ((size_t)y * width + x)];
+
+        rgb[0] = p[0];
+        rgb[1] = p[1];
+        rgb[2] = p[2];
+    }
+};
+
+
+// REDUCE2X2 image of a mosaic computed on demand: pixel (x, y) gathers the
+// 2x2 cell of the mosaic at (2x, 2y). Tracking only reads the pixels around
+// the patches, reducing the whole mosaic would cost more than the search
+struct reduced_mosaic {
+    const float* pixels;
+    size_t       mosaic_width;
+    uint32_t     filters;
+    int          width;
+    int          height;
+
+    inline void get(int x, int y, float* rgb) const
+    {
+        float v[4] = {0.f, 0.f, 0.f, 0.f};
+
+        for (int row = 2 * y; row < 2 * y + 2; row++) {
+            for (int col = 2 * x; col < 2 * x + 2; col++) {
+                v[filters >> (((row << 1 & 14) + (col & 1)) << 1) & 3] += pixels[(size_t)row * mosaic_width + col];
+            }
+        }
+
+        // The second green is reported as 3 by some patterns
+        rgb[0] = v[0];
+        rgb[1] = .5f * (v[1] + v[3]);
+        rgb[2] = v[2];
+    }
+};
+
+
+static void apply_homography(const double* H, double x, double y, double* u, double* v)
+{
+    const double w = H[6] * x + H[7] * y + H[8];
+
+    *u = (H[0] * x + H[1] * y + H[2]) / w;
+    *v = (H[3] * x + H[4] * y + H[5]) / w;
+}
+
+
+// Solves A x = b for a square system of size n, A and b are overwritten
+static bool solve_linear(double* A, double* b, int n)
+{
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+
+        for (int row = col + 1; row < n; row++) {
+            if (std::abs(A[row * n + col]) > std::abs(A[pivot * n + col])) pivot = row;
+        }
+
+        if (std::abs(A[pivot * n + col]) < 1e-12) return false;
+
+        if (pivot != col) {
+            for (int k = 0; k < n; k++) {
+                std::swap(A[col * n + k], A[pivot * n + k]);
+            }
+
+            std::swap(b[col], b[pivot]);
+        }
+
+        for (int row = col + 1; row < n; row++) {
+            const double f = A[row * n + col] / A[col * n + col];
+
+            for (int k = col; k < n; k++) {
+                A[row * n + k] -= f * A[col * n + k];
+            }
+
+            b[row] -= f * b[col];
+        }
+    }
+
+    for (int row = n - 1; row >= 0; row--) {
+        for (int k = row + 1; k < n; k++) {
+            b[row] -= A[row * n + k] * b[k];
+        }
+
+        b[row] /= A[row * n + row];
+    }
+
+    return true;
+}
+
+
+// Similarity bringing points to their centroid with a mean distance of
+// sqrt(2), keeps the homography fit well conditioned
+static void normalizing_transform(const double* points, int n, double* T)
+{
+    double cx = 0., cy = 0.;
+
+    for (int i = 0; i < n; i++) {
+        cx += points[2 * i];
+        cy += points[2 * i + 1];
+    }
+
+    cx /= n;
+    cy /= n;
+
+    double d = 0.;
+
+    for (int i = 0; i < n; i++) {
+        d += std::hypot(points[2 * i] - cx, points[2 * i + 1] - cy);
+    }
+
+    const double s = (d > 0.) ? std::sqrt(2.) * n / d : 1.;
+
+    T[0] = s;
+    T[1] = 0.;
+    T[2] = -s * cx;
+    T[3] = 0.;
+    T[4] = s;
+    T[5] = -s * cy;
+    T[6] = 0.;
+    T[7] = 0.;
+    T[8] = 1.;
+}
+
+
+static void mat3_mul(const double* A, const double* B, double* C)
+{
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            C[3 * i + j] = A[3 * i] * B[j] + A[3 * i + 1] * B[3 + j] + A[3 * i + 2] * B[6 + j];
+        }
+    }
+}
+
+
+// Least squares homography mapping the points src to dst (2 * n values each)
+static bool fit_homography(const double* src, const double* dst, int n, double* H)
+{
+    if (n < 4) return false;
+
+    double T_src[9], T_dst[9];
+    normalizing_transform(src, n, T_src);
+    normalizing_transform(dst, n, T_dst);
+
+    // Normal equations of the linear system with h_22 = 1
+    double A[64] = {0.};
+    double b[8]  = {0.};
+
+    for (int i = 0; i < n; i++) {
+        const double x = T_src[0] * src[2 * i] + T_src[2];
+        const double y = T_src[4] * src[2 * i + 1] + T_src[5];
+        const double u = T_dst[0] * dst[2 * i] + T_dst[2];
+        const double v = T_dst[4] * dst[2 * i + 1] + T_dst[5];
+
+        const double rows[2][9] = {{x, y, 1., 0., 0., 0., -x * u, -y * u, u},
+                                   {0., 0., 0., x, y, 1., -x * v, -y * v, v}};
+
+        for (int r = 0; r < 2; r++) {
+            for (int k = 0; k < 8; k++) {
+                for (int l = 0; l < 8; l++) {
+                    A[8 * k + l] += rows[r][k] * rows[r][l];
+                }
+
+                b[k] += rows[r][k] * rows[r][8];
+            }
+        }
+    }
+
+    if (!solve_linear(A, b, 8)) return false;
+
+    const double H_n[9] = {b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], 1.};
+
+    // H = T_dst^-1 H_n T_src
+    const double T_dst_inv[9]
+      = {1. / T_dst[0], 0., -T_dst[2] / T_dst[0], 0., 1. / T_dst[4], -T_dst[5] / T_dst[4], 0., 0., 1.};
+
+    double tmp[9];
+    mat3_mul(H_n, T_src, tmp);
+    mat3_mul(T_dst_inv, tmp, H);
+
+    return true;
+}
+
+
+static void build_coarse_level(const float* image, size_t width, size_t height, luminance_level& level)
+{
+    // First level straight from the image
+    level.width  = (int)(width / 2);
+    level.height = (int)(height / 2);
+    level.scale  = 2;
+    level.pixels.resize((size_t)level.width * level.height);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < level.height; y++) {
+        const float* row_0 = &image[3 * (2 * y) * width];
+        const float* row_1 = &image[3 * (2 * y + 1) * width];
+
+        for (int x = 0; x < level.width; x++) {
+            float sum = 0.f;
+
+            for (int c = 0; c < 6; c++) {
+                sum += row_0[6 * x + c] + row_1[6 * x + c];
+            }
+
+            level.pixels[(size_t)y * level.width + x] = sum / 12.f;
+        }
+    }
+
+    // Halved until small enough
+    while (std::max(level.width, level.height) > DETECT_COARSE_SIZE) {
+        const int w = level.width / 2;
+        const int h = level.height / 2;
+
+        std::vector<float> pixels((size_t)w * h);
+
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < h; y++) {
+            const float* row_0 = &level.pixels[(size_t)(2 * y) * level.width];
+            const float* row_1 = &level.pixels[(size_t)(2 * y + 1) * level.width];
+
+            for (int x = 0; x < w; x++) {
+                pixels[(size_t)y * w + x] = .25f * (row_0[2 * x] + row_0[2 * x + 1] + row_1[2 * x] + row_1[2 * x + 1]);
+            }
+        }
+
+        level.pixels.swap(pixels);
+        level.width  = w;
+        level.height = h;
+        level.scale *= 2;
+    }
+}
+
+
+// Luminance below which differences are mostly noise
+static float get_dark_offset(const luminance_level& level)
+{
+    if (level.pixels.empty()) return 0.f;
+
+    std::vector<float> sorted(level.pixels);
+    std::vector<float>::iterator p95 = sorted.begin() + (sorted.size() * 95) / 100;
+    std::nth_element(sorted.begin(), p95, sorted.end());
+
+    return DETECT_DARK_OFFSET * std::max(*p95, 0.f);
+}
+
+
+// Flat regions of the level shaped like a patch seen in perspective
+static void find_patch_candidates(
+  const luminance_level& level, float dark_offset, std::vector<patch_candidate>& candidates)
+{
+    const int w = level.width;
+    const int h = level.height;
+
+    std::vector<char> flat((size_t)w * h, 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 1; y < h - 1; y++) {
+        for (int x = 1; x < w - 1; x++) {
+            const float* p  = &level.pixels[(size_t)y * w + x];
+            const float  dx = std::abs(p[1] - p[-1]);
+            const float  dy = std::abs(p[w] - p[-w]);
+
+            flat[(size_t)y * w + x] = std::max(dx, dy) < DETECT_FLAT_CONTRAST * (p[0] + dark_offset);
+        }
+    }
+
+    // Connected regions and their moments, flat pixels are cleared once
+    // visited
+    std::vector<int> stack;
+
+    for (int start = 0; start < w * h; start++) {
+        if (!flat[start]) continue;
+
+        double n = 0., sx = 0., sy = 0., sxx = 0., syy = 0., sxy = 0.;
+
+        flat[start] = 0;
+        stack.push_back(start);
+
+        while (!stack.empty()) {
+            const int i = stack.back();
+            const int x = i % w;
+            const int y = i / w;
+            stack.pop_back();
+
+            n += 1.;
+            sx += x;
+            sy += y;
+            sxx += (double)x * x;
+            syy += (double)y * y;
+            sxy += (double)x * y;
+
+            const int neighbours[4] = {i - 1, i + 1, i - w, i + w};
+
+            for (int k = 0; k < 4; k++) {
+                if (flat[neighbours[k]]) {
+                    flat[neighbours[k]] = 0;
+                    stack.push_back(neighbours[k]);
+                }
+            }
+        }
+
+        if (n < DETECT_MIN_PATCH_AREA || n > (double)w * h / CHART_N_PATCHES) continue;
+
+        const double mx  = sx / n;
+        const double my  = sy / n;
+        const double vxx = sxx / n - mx * mx;
+        const double vyy = syy / n - my * my;
+        const double vxy = sxy / n - mx * my;
+        const double det = vxx * vyy - vxy * vxy;
+
+        if (det <= 0.) continue;
+
+        // A parallelogram or an ellipse has an area of about 12 sqrt(det):
+        // holes and thin shapes give less
+        const double compactness = n / std::sqrt(det);
+
+        if (compactness < 9. || compactness > 15.) continue;
+
+        // Not more elongated than 3:1
+        const double half_trace = .5 * (vxx + vyy);
+        const double spread     = std::sqrt(.25 * (vxx - vyy) * (vxx - vyy) + vxy * vxy);
+
+        if (half_trace + spread > 9. * (half_trace - spread)) continue;
+
+        patch_candidate candidate;
+        candidate.x    = (float)mx;
+        candidate.y    = (float)my;
+        candidate.area = (float)n;
+
+        candidates.push_back(candidate);
+    }
+}
+
+
+static bool is_similar_area(const patch_candidate& a, const patch_candidate& b)
+{
+    return a.area < 2.f * b.area && b.area < 2.f * a.area;
+}
+
+
+// Least squares affine grid from the nodes found so far
+static bool fit_affine_grid(
+  const std::vector<patch_candidate>& candidates, const std::vector<int>& nodes, int size, double* a)
+{
+    double A[9]  = {0.};
+    double bx[3] = {0.};
+    double by[3] = {0.};
+    int    n     = 0;
+
+    for (int k = 0; k < size * size; k++) {
+        if (nodes[k] < 0) continue;
+
+        const double row[3] = {1., (double)(k % size - size / 2), (double)(k / size - size / 2)};
+
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                A[3 * r + c] += row[r] * row[c];
+            }
+
+            bx[r] += row[r] * candidates[nodes[k]].x;
+            by[r] += row[r] * candidates[nodes[k]].y;
+        }
+
+        n++;
+    }
+
+    if (n < 3) return false;
+
+    double A_y[9];
+    std::memcpy(A_y, A, sizeof(A));
+
+    if (!solve_linear(A, bx, 3) || !solve_linear(A_y, by, 3)) return false;
+
+    a[0] = bx[0];
+    a[1] = bx[1];
+    a[2] = bx[2];
+    a[3] = by[0];
+    a[4] = by[1];
+    a[5] = by[2];
+
+    return true;
+}
+
+
+// Grows a grid from a seed patch and its closest neighbours, keeps the
+// window of the size of a chart holding the most patches
+static bool grow_grid(const std::vector<patch_candidate>& candidates, int seed, patch_grid& grid)
+{
+    const patch_candidate& s = candidates[seed];
+
+    // Two closest neighbours in different directions give the grid steps
+    int   u_idx = -1;
+    float u_x = 0.f, u_y = 0.f, u_d2 = 0.f;
+
+    for (int c = 0; c < (int)candidates.size(); c++) {
+        if (c == seed || !is_similar_area(s, candidates[c])) continue;
+
+        const float dx = candidates[c].x - s.x;
+        const float dy = candidates[c].y - s.y;
+        const float d2 = dx * dx + dy * dy;
+
+        if (u_idx < 0 || d2 < u_d2) {
+            u_idx = c;
+            u_x   = dx;
+            u_y   = dy;
+            u_d2  = d2;
+        }
+    }
+
+    // The pitch is larger than a patch but not by much
+    if (u_idx < 0 || u_d2 < s.area || u_d2 > 9.f * s.area) return false;
+
+    int   v_idx = -1;
+    float v_x = 0.f, v_y = 0.f, v_d2 = 0.f;
+
+    for (int c = 0; c < (int)candidates.size(); c++) {
+        if (c == seed || !is_similar_area(s, candidates[c])) continue;
+
+        const float dx  = candidates[c].x - s.x;
+        const float dy  = candidates[c].y - s.y;
+        const float d2  = dx * dx + dy * dy;
+        const float dot = dx * u_x + dy * u_y;
+
+        if (dot * dot > .25f * d2 * u_d2 || d2 < .25f * u_d2 || d2 > 4.f * u_d2) continue;
+
+        if (v_idx < 0 || d2 < v_d2) {
+            v_idx = c;
+            v_x   = dx;
+            v_y   = dy;
+            v_d2  = d2;
+        }
+    }
+
+    if (v_idx < 0) return false;
+
+    // Same handedness as the image
+    if (u_x * v_y - u_y * v_x < 0.f) {
+        v_x = -v_x;
+        v_y = -v_y;
+    }
+
+    // Only the patches around the seed can be on its grid
+    const float      reach = 1.5f * (DETECT_GRID_RADIUS + 1) * std::sqrt(std::max(u_d2, v_d2));
+    std::vector<int> local;
+
+    for (int c = 0; c < (int)candidates.size(); c++) {
+        if (c == seed || !is_similar_area(s, candidates[c])) continue;
+
+        const float dx = candidates[c].x - s.x;
+        const float dy = candidates[c].y - s.y;
+
+        if (dx * dx + dy * dy < reach * reach) local.push_back(c);
+    }
+
+    // Nodes (i, j) in [-DETECT_GRID_RADIUS, DETECT_GRID_RADIUS]
+    const int size = 2 * DETECT_GRID_RADIUS + 1;
+
+    double              a[6] = {s.x, u_x, v_x, s.y, u_y, v_y};
+    std::vector<int>    nodes(size * size);
+    std::vector<double> residuals(size * size);
+
+    for (int radius = 1; radius <= DETECT_GRID_RADIUS; radius++) {
+        std::fill(nodes.begin(), nodes.end(), -1);
+        nodes[(size / 2) * size + size / 2] = seed;
+
+        const double det = a[1] * a[5] - a[2] * a[4];
+
+        if (std::abs(det) < 1e-6) return false;
+
+        for (size_t l = 0; l < local.size(); l++) {
+            const int c = local[l];
+
+            const double dx = candidates[c].x - a[0];
+            const double dy = candidates[c].y - a[3];
+            const double i  = (a[5] * dx - a[2] * dy) / det;
+            const double j  = (a[1] * dy - a[4] * dx) / det;
+            const int    ni = (int)std::lround(i);
+            const int    nj = (int)std::lround(j);
+
+            if (std::abs(ni) > radius || std::abs(nj) > radius) continue;
+
+            const double residual = std::max(std::abs(i - ni), std::abs(j - nj));
+
+            if (residual > DETECT_GRID_TOLERANCE) continue;
+
+            const int k = (nj + size / 2) * size + ni + size / 2;
+
+            if (nodes[k] < 0 || residual < residuals[k]) {
+                nodes[k]     = c;
+                residuals[k] = residual;
+            }
+        }
+
+        fit_affine_grid(candidates, nodes, size, a);
+    }
+
+    residuals[(size / 2) * size + size / 2] = 0.;
+
+    // Window of the size of the chart, in either orientation. The chart is
+    // isolated by its frame: patches on the ring of nodes around the window
+    // are more likely a regular pattern of the scene
+    grid.n_patches = 0;
+    grid.n_outside = 0;
+    grid.residual  = 0.;
+
+    for (int orientation = 0; orientation < 2; orientation++) {
+        const int nx = (orientation == 0) ? CHART_N_COLUMNS : CHART_N_ROWS;
+        const int ny = (orientation == 0) ? CHART_N_ROWS : CHART_N_COLUMNS;
+
+        for (int j_0 = 0; j_0 + ny <= size; j_0++) {
+            for (int i_0 = 0; i_0 + nx <= size; i_0++) {
+                int    n        = 0;
+                int    n_ring   = 0;
+                double residual = 0.;
+
+                for (int j = std::max(0, j_0 - 1); j <= std::min(size - 1, j_0 + ny); j++) {
+                    for (int i = std::max(0, i_0 - 1); i <= std::min(size - 1, i_0 + nx); i++) {
+                        if (nodes[j * size + i] < 0) continue;
+
+                        if (i < i_0 || i >= i_0 + nx || j < j_0 || j >= j_0 + ny) {
+                            n_ring++;
+                        } else {
+                            n++;
+                            residual += residuals[j * size + i];
+                        }
+                    }
+                }
+
+                const int score = n - n_ring;
+                const int best  = grid.n_patches - grid.n_outside;
+
+                if (n < DETECT_MIN_PATCHES) continue;
+
+                if (grid.n_patches == 0 || score > best || (score == best && residual < grid.residual)) {
+                    grid.width     = nx;
+                    grid.height    = ny;
+                    grid.n_patches = n;
+                    grid.n_outside = n_ring;
+                    grid.residual  = residual;
+                    grid.nodes.resize(nx * ny);
+
+                    for (int j = 0; j < ny; j++) {
+                        for (int i = 0; i < nx; i++) {
+                            grid.nodes[j * nx + i] = nodes[(j_0 + j) * size + i_0 + i];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return grid.n_patches >= DETECT_MIN_PATCHES;
+}
+
+
+// Moves a patch center to the centroid of the pixels of the patch color
+// around it. Gives false if the patch is not found where expected
+template<typename Image>
+static bool refine_patch(
+  const Image& image, const double* H, int i, int j, float dark_offset, double* center, double* color)
+{
+    double x_l, y_l, x_r, y_r, x_t, y_t, x_b, y_b;
+    apply_homography(H, i, j, &center[0], &center[1]);
+    apply_homography(H, i - .5, j, &x_l, &y_l);
+    apply_homography(H, i + .5, j, &x_r, &y_r);
+    apply_homography(H, i, j - .5, &x_t, &y_t);
+    apply_homography(H, i, j + .5, &x_b, &y_b);
+
+    const double pitch = std::min(std::hypot(x_r - x_l, y_r - y_l), std::hypot(x_b - x_t, y_b - y_t));
+
+    const int radius      = (int)(.5 * pitch);
+    const int seed_radius = std::max(1, (int)(.5 * DETECT_SEED_SIZE * pitch));
+    const int step        = std::max(1, 2 * radius / DETECT_REFINE_SAMPLES);
+
+    if (radius < 2) return false;
+
+    double fraction = 0.;
+
+    // Twice: the first window may be off the patch
+    for (int iteration = 0; iteration < 2; iteration++) {
+        const int x_c = (int)std::lround(center[0]);
+        const int y_c = (int)std::lround(center[1]);
+
+        if (x_c < 0 || x_c >= image.width || y_c < 0 || y_c >= image.height) return false;
+
+        const int x_0 = std::max(0, x_c - seed_radius);
+        const int x_1 = std::min(image.width - 1, x_c + seed_radius);
+        const int y_0 = std::max(0, y_c - seed_radius);
+        const int y_1 = std::min(image.height - 1, y_c + seed_radius);
+
+        double seed[3] = {0., 0., 0.};
+        int    n_seed  = 0;
+
+        for (int y = y_0; y <= y_1; y += step) {
+            for (int x = x_0; x <= x_1; x += step) {
+                float p[3];
+                image.get(x, y, p);
+
+                for (int c = 0; c < 3; c++) {
+                    seed[c] += p[c];
+                }
+
+                n_seed++;
+            }
+        }
+
+        for (int c = 0; c < 3; c++) {
+            seed[c] /= n_seed;
+        }
+
+        const double tolerance = DETECT_COLOR_TOLERANCE * (seed[0] + seed[1] + seed[2]) + 3. * dark_offset;
+
+        double sum_x = 0., sum_y = 0., sum[3] = {0., 0., 0.};
+        int    n = 0, n_window = 0;
+
+        for (int y = y_c - radius; y <= y_c + radius; y += step) {
+            for (int x = x_c - radius; x <= x_c + radius; x += step) {
+                n_window++;
+
+                if (x < 0 || x >= image.width || y < 0 || y >= image.height) continue;
+
+                float p[3];
+                image.get(x, y, p);
+
+                if (std::abs(p[0] - seed[0]) + std::abs(p[1] - seed[1]) + std::abs(p[2] - seed[2]) > tolerance) {
+                    continue;
+                }
+
+                sum_x += x;
+                sum_y += y;
+
+                for (int c = 0; c < 3; c++) {
+                    sum[c] += p[c];
+                }
+
+                n++;
+            }
+        }
+
+        if (n == 0) return false;
+
+        center[0] = sum_x / n;
+        center[1] = sum_y / n;
+
+        for (int c = 0; c < 3; c++) {
+            color[c] = sum[c] / n;
+        }
+
+        fraction = (double)n / n_window;
+    }
+
+    // A patch covers most of the window but not all of it: too few pixels
+    // is a missed patch, all of them a uniform area
+    return fraction > .3 && fraction < .95;
+}
+
+
+// Fits the homography from the grid to the image on the refined patches,
+// a second time without the patches far from the first fit
+static bool fit_refined_grid(
+  const std::vector<double>& nodes, const std::vector<double>& centers, std::vector<char>& valid, double* H)
+{
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<double> src, dst;
+
+        for (size_t k = 0; k < valid.size(); k++) {
+            if (!valid[k]) continue;
+
+            src.push_back(nodes[2 * k]);
+            src.push_back(nodes[2 * k + 1]);
+            dst.push_back(centers[2 * k]);
+            dst.push_back(centers[2 * k + 1]);
+        }
+
+        if ((int)src.size() / 2 < DETECT_MIN_PATCHES) return false;
+        if (!fit_homography(src.data(), dst.data(), (int)src.size() / 2, H)) return false;
+
+        if (pass == 1) break;
+
+        std::vector<double> errors(valid.size(), 0.);
+        std::vector<double> sorted;
+
+        for (size_t k = 0; k < valid.size(); k++) {
+            if (!valid[k]) continue;
+
+            double u, v;
+            apply_homography(H, nodes[2 * k], nodes[2 * k + 1], &u, &v);
+
+            errors[k] = std::hypot(u - centers[2 * k], v - centers[2 * k + 1]);
+            sorted.push_back(errors[k]);
+        }
+
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        const double limit = std::max(1., 3. * sorted[sorted.size() / 2]);
+
+        for (size_t k = 0; k < valid.size(); k++) {
+            if (errors[k] > limit) valid[k] = 0;
+        }
+    }
+
+    return true;
+}
+
+
+// Correlation of the luminance of the neutral row of the chart with its
+// decrease from the white to the black patch, for a mapping of the chart
+// columns and rows to the grid nodes
+static double neutral_row_score(const std::vector<double>& colors, const int* columns, const int* rows, int grid_width)
+{
+    double x[CHART_N_COLUMNS], y[CHART_N_COLUMNS];
+    double mean_x = 0., mean_y = 0.;
+
+    for (int col = 0; col < CHART_N_COLUMNS; col++) {
+        const int     k = rows[col] * grid_width + columns[col];
+        const double* c = &colors[3 * k];
+
+        x[col] = -col;
+        y[col] = std::log(std::max(c[0] + c[1] + c[2], 1e-6));
+        mean_x += x[col] / CHART_N_COLUMNS;
+        mean_y += y[col] / CHART_N_COLUMNS;
+    }
+
+    double sxy = 0., sxx = 0., syy = 0.;
+
+    for (int col = 0; col < CHART_N_COLUMNS; col++) {
+        sxy += (x[col] - mean_x) * (y[col] - mean_y);
+        sxx += (x[col] - mean_x) * (x[col] - mean_x);
+        syy += (y[col] - mean_y) * (y[col] - mean_y);
+    }
+
+    return (syy > 0.) ? sxy / std::sqrt(sxx * syy) : -1.;
+}
+
+
+// Fills a chart location from the homography of the chart to the image
+// and the patches it was fitted on
+static void set_chart_location(const double* H, const std::vector<char>& valid, ChartLocation* chart)
+{
+    for (int k = 0; k < 9; k++) {
+        chart->homography[k] = (float)(H[k] / H[8]);
+    }
+
+    for (int p = 0; p < CHART_N_PATCHES; p++) {
+        chart->centers[p] = chart_to_image(chart, (float)(p % CHART_N_COLUMNS), (float)(p / CHART_N_COLUMNS));
+    }
+
+    chart->n_patches = std::count(valid.begin(), valid.end(), 1);
+}
+
+
+// Maps a chart location to an image where the pixel (x, y) is at
+// (scale * x + offset, scale * y + offset)
+static void scale_chart(ChartLocation* chart, float scale, float offset)
+{
+    for (int k = 0; k < 3; k++) {
+        chart->homography[k]     = scale * chart->homography[k] + offset * chart->homography[6 + k];
+        chart->homography[3 + k] = scale * chart->homography[3 + k] + offset * chart->homography[6 + k];
+    }
+
+    for (int p = 0; p < CHART_N_PATCHES; p++) {
+        chart->centers[p].x = scale * chart->centers[p].x + offset;
+        chart->centers[p].y = scale * chart->centers[p].y + offset;
+    }
+}
+
+
+// Refines the patches of a grid at full resolution and fits the chart on
+// them. Gives false if the grid does not look like a chart
+static bool locate_chart(
+  const float*                        image,
+  size_t                              width,
+  size_t                              height,
+  const luminance_level&              level,
+  const std::vector<patch_candidate>& candidates,
+  const patch_grid&                   grid,
+  float                               dark_offset,
+  ChartLocation*                      chart)
+{
+    const int n_nodes = grid.width * grid.height;
+
+    std::vector<double> nodes(2 * n_nodes);
+    std::vector<double> centers(2 * n_nodes);
+    std::vector<double> colors(3 * n_nodes, 0.);
+    std::vector<char>   valid(n_nodes);
+
+    for (int k = 0; k < n_nodes; k++) {
+        nodes[2 * k]     = k % grid.width;
+        nodes[2 * k + 1] = k / grid.width;
+        valid[k]         = grid.nodes[k] >= 0;
+
+        if (valid[k]) {
+            const patch_candidate& c = candidates[grid.nodes[k]];
+
+            centers[2 * k]     = level.scale * (c.x + .5) - .5;
+            centers[2 * k + 1] = level.scale * (c.y + .5) - .5;
+        }
+    }
+
+    double H[9];
+
+    if (!fit_refined_grid(nodes, centers, valid, H)) return false;
+
+    // Each patch, including the ones missed on the coarse level, is refined
+    const rgb_image rgb = {image, (int)width, (int)height};
+
+    for (int k = 0; k < n_nodes; k++) {
+        valid[k] = refine_patch(rgb, H, k % grid.width, k / grid.width, dark_offset, &centers[2 * k], &colors[3 * k]);
+    }
+
+    if (!fit_refined_grid(nodes, centers, valid, H)) return false;
+
+    // Orientation: the neutral row goes from white to black, on one of the
+    // two long sides of the grid
+    int columns[2][CHART_N_COLUMNS], rows[2][CHART_N_COLUMNS];
+
+    for (int col = 0; col < CHART_N_COLUMNS; col++) {
+        const int row = CHART_N_ROWS - 1;
+
+        if (grid.width == CHART_N_COLUMNS) {
+            columns[0][col] = col;
+            rows[0][col]    = row;
+            columns[1][col] = CHART_N_COLUMNS - 1 - col;
+            rows[1][col]    = CHART_N_ROWS - 1 - row;
+        } else {
+            columns[0][col] = CHART_N_ROWS - 1 - row;
+            rows[0][col]    = col;
+            columns[1][col] = row;
+            rows[1][col]    = CHART_N_COLUMNS - 1 - col;
+        }
+    }
+
+    const double score_0 = neutral_row_score(colors, columns[0], rows[0], grid.width);
+    const double score_1 = neutral_row_score(colors, columns[1], rows[1], grid.width);
+
+    // A regular pattern that is not a chart has no such row
+    if (std::max(score_0, score_1) < DETECT_MIN_NEUTRAL_SCORE) return false;
+
+    const int orientation = (score_0 >= score_1) ? 0 : 1;
+
+    // Chart coordinates to grid coordinates, then to the image
+    double G[9];
+
+    if (grid.width == CHART_N_COLUMNS) {
+        const double G_0[9] = {1., 0., 0., 0., 1., 0., 0., 0., 1.};
+        const double G_1[9] = {-1., 0., CHART_N_COLUMNS - 1, 0., -1., CHART_N_ROWS - 1, 0., 0., 1.};
+        std::memcpy(G, (orientation == 0) ? G_0 : G_1, sizeof(G));
+    } else {
+        const double G_0[9] = {0., -1., CHART_N_ROWS - 1, 1., 0., 0., 0., 0., 1.};
+        const double G_1[9] = {0., 1., 0., -1., 0., CHART_N_COLUMNS - 1, 0., 0., 1.};
+        std::memcpy(G, (orientation == 0) ? G_0 : G_1, sizeof(G));
+    }
+
+    double H_chart[9];
+    mat3_mul(H, G, H_chart);
+
+    set_chart_location(H_chart, valid, chart);
+
+    return true;
+}
+
+
+// Refines the patches of a chart around their previous location and fits
+// the chart on them. Gives false if the chart moved too much or is no
+// longer there, the previous location may be the one updated
+template<typename Image>
+static bool track_patches(const Image& image, const ChartLocation* previous, ChartLocation* chart)
+{
+    double H[9];
+
+    for (int k = 0; k < 9; k++) {
+        H[k] = previous->homography[k];
+    }
+
+    // The white patch sets the noise level instead of the whole image
+    float white = 0.f;
+
+    for (int p = 0; p < CHART_N_PATCHES; p++) {
+        const int x = (int)std::lround(previous->centers[p].x);
+        const int y = (int)std::lround(previous->centers[p].y);
+
+        if (x < 0 || x >= image.width || y < 0 || y >= image.height) continue;
+
+        float rgb[3];
+        image.get(x, y, rgb);
+
+        white = std::max(white, (rgb[0] + rgb[1] + rgb[2]) / 3.f);
+    }
+
+    const float dark_offset = DETECT_DARK_OFFSET * white;
+
+    std::vector<double> nodes(2 * CHART_N_PATCHES);
+    std::vector<double> centers(2 * CHART_N_PATCHES);
+    std::vector<double> colors(3 * CHART_N_PATCHES, 0.);
+    std::vector<char>   valid(CHART_N_PATCHES);
+
+    for (int k = 0; k < CHART_N_PATCHES; k++) {
+        const int i = k % CHART_N_COLUMNS;
+        const int j = k / CHART_N_COLUMNS;
+
+        nodes[2 * k]     = i;
+        nodes[2 * k + 1] = j;
+        valid[k]         = refine_patch(image, H, i, j, dark_offset, &centers[2 * k], &colors[3 * k]);
+    }
+
+    if (!fit_refined_grid(nodes, centers, valid, H)) return false;
+
+    // Something else than the chart may fit the grid after a large move
+    int columns[CHART_N_COLUMNS], rows[CHART_N_COLUMNS];
+
+    for (int col = 0; col < CHART_N_COLUMNS; col++) {
+        columns[col] = col;
+        rows[col]    = CHART_N_ROWS - 1;
+    }
+
+    if (neutral_row_score(colors, columns, rows, CHART_N_COLUMNS) < DETECT_MIN_NEUTRAL_SCORE) return false;
+
+    ChartLocation tracked;
+    set_chart_location(H, valid, &tracked);
+
+    const Point& first = previous->centers[0];
+    const Point& last  = previous->centers[CHART_N_COLUMNS - 1];
+
+    const float pitch = std::hypot(last.x - first.x, last.y - first.y) / (CHART_N_COLUMNS - 1);
+
+    for (int p = 0; p < CHART_N_PATCHES; p++) {
+        const float shift = std::hypot(
+          tracked.centers[p].x - previous->centers[p].x,
+          tracked.centers[p].y - previous->centers[p].y);
+
+        if (shift > DETECT_TRACK_MAX_SHIFT * pitch) return false;
+    }
+
+    *chart = tracked;
+
+    return true;
+}
+
+
+extern "C"
+{
+    int detect_chart(const float* image, size_t width, size_t height, ChartLocation* chart)
+    {
+        if (width < 4 || height < 4) return -1;
+
+        // Coarse: patches are localized in the pyramid
+        luminance_level level;
+        build_coarse_level(image, width, height, level);
+
+        const float dark_offset = get_dark_offset(level);
+
+        std::vector<patch_candidate> candidates;
+        find_patch_candidates(level, dark_offset, candidates);
+
+        std::vector<patch_grid> grids;
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int seed = 0; seed < (int)candidates.size(); seed++) {
+            patch_grid grid;
+
+            if (!grow_grid(candidates, seed, grid)) continue;
+
+            #pragma omp critical
+            grids.push_back(grid);
+        }
+
+        std::sort(grids.begin(), grids.end(), [](const patch_grid& a, const patch_grid& b) {
+            if (a.n_patches - a.n_outside != b.n_patches - b.n_outside) {
+                return a.n_patches - a.n_outside > b.n_patches - b.n_outside;
+            }
+
+            return a.residual < b.residual;
+        });
+
+        // Fine: the best grids are refined at full resolution until one of
+        // them is a chart. Most seeds of a chart grow the same grid
+        std::vector<const patch_grid*> tried;
+
+        for (size_t g = 0; g < grids.size() && tried.size() < DETECT_MAX_GRIDS; g++) {
+            bool is_new = true;
+
+            for (size_t t = 0; t < tried.size() && is_new; t++) {
+                is_new = tried[t]->nodes != grids[g].nodes;
+            }
+
+            if (!is_new) continue;
+
+            if (locate_chart(image, width, height, level, candidates, grids[g], dark_offset, chart)) return 0;
+
+            tried.push_back(&grids[g]);
+        }
+
+        return -1;
+    }
+
+
+    int detect_chart_raw(
+      const float* bayered_image, size_t width, size_t height, uint32_t filters, ChartLocation* chart)
+    {
+        size_t reduced_width, reduced_height;
+        demosaic_output_size(REDUCE2X2, width, height, &reduced_width, &reduced_height);
+
+        std::vector<float> reduced(3 * reduced_width * reduced_height);
+        reduce2x2_demosaic(bayered_image, reduced.data(), width, height, filters);
+
+        if (detect_chart(reduced.data(), reduced_width, reduced_height, chart) != 0) return -1;
+
+        // A reduced pixel covers 2x2 pixels of the mosaic
+        scale_chart(chart, 2.f, .5f);
+
+        return 0;
+    }
+
+
+    int track_chart(
+      const float* image, size_t width, size_t height, const ChartLocation* previous, ChartLocation* chart)
+    {
+        const rgb_image rgb = {image, (int)width, (int)height};
+
+        return track_patches(rgb, previous, chart) ? 0 : -1;
+    }
+
+
+    int track_chart_raw(
+      const float*         bayered_image,
+      size_t               width,
+      size_t               height,
+      uint32_t             filters,
+      const ChartLocation* previous,
+      ChartLocation*       chart)
+    {
+        // Tracked in the coordinates of the reduced image detect_chart_raw
+        // works in, only the pixels around the patches are reduced
+        const reduced_mosaic reduced = {bayered_image, width, filters, (int)(width / 2), (int)(height / 2)};
+
+        ChartLocation reduced_previous = *previous;
+        scale_chart(&reduced_previous, .5f, -.25f);
+
+        if (!track_patches(reduced, &reduced_previous, chart)) return -1;
+
+        scale_chart(chart, 2.f, .5f);
+
+        return 0;
+    }
+
+
+    Point chart_to_image(const ChartLocation* chart, float x, float y)
+    {
+        const float* H = chart->homography;
+        const float  w = H[6] * x + H[7] * y + H[8];
+
+        const Point p = {(H[0] * x + H[1] * y + H[2]) / w, (H[3] * x + H[4] * y + H[5]) / w};
+
+        return p;
+    }
+
+
+    void chart_outline(const ChartLocation* chart, float margin_x, float margin_y, Point* outline)
+    {
+        // Layout of the GUI: n + 1 margins share the inner margin, n patches
+        // the rest of the outline
+        const float gap_x   = margin_x / (float)(CHART_N_COLUMNS + 1);
+        const float gap_y   = margin_y / (float)(CHART_N_ROWS + 1);
+        const float patch_x = (1.f - margin_x) / (float)CHART_N_COLUMNS;
+        const float patch_y = (1.f - margin_y) / (float)CHART_N_ROWS;
+
+        // Outline edges in chart coordinates
+        const float x_0 = -(gap_x + .5f * patch_x) / (gap_x + patch_x);
+        const float x_1 = (1.f - gap_x - .5f * patch_x) / (gap_x + patch_x);
+        const float y_0 = -(gap_y + .5f * patch_y) / (gap_y + patch_y);
+        const float y_1 = (1.f - gap_y - .5f * patch_y) / (gap_y + patch_y);
+
+        outline[0] = chart_to_image(chart, x_0, y_0);
+        outline[1] = chart_to_image(chart, x_1, y_0);
+        outline[2] = chart_to_image(chart, x_1, y_1);
+        outline[3] = chart_to_image(chart, x_0, y_1);
+    }
+
+
+    void chart_boxes(const ChartLocation* chart, float size, Box* boxes)
+    {
+        const float s = .5f * size;
+
+        for (int p = 0; p < CHART_N_PATCHES; p++) {
+            const float x = (float)(p % CHART_N_COLUMNS);
+            const float y = (float)(p / CHART_N_COLUMNS);
+
+            boxes[p].a = chart_to_image(chart, x - s, y - s);
+            boxes[p].b = chart_to_image(chart, x + s, y - s);
+            boxes[p].c = chart_to_image(chart, x + s, y + s);
+            boxes[p].d = chart_to_image(chart, x - s, y + s);
+        }
+    }
+}
@@ -2,12 +2,69 @@
 #include <imageprocessing.h>
 #include <demosaicing.h>
 
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <climits>
 #include <cmath>
+#include <algorithm>
 
-void amaze_demosaic_RT(const float* in, float* out, int width, int height, const unsigned int filters);
+// Mosaic pixels read around a region by demosaic_region, larger than the
+// support of every full resolution method
+#define DEMOSAIC_REGION_MARGIN 32
+
+void amaze_demosaic_RT(const float* in, float* out, int width, int height, const unsigned int filters, int ts);
+
+// Demosaicing with the given tile sizes instead of the ones in use, see
+// demosaic_rgb and demosaic. Used where the sizes shall not change between
+// two reads (demosaic_region) or are being tuned
+void demosaic_rgb_tiled(
+  const float*             bayered_image,
+  float*                   pixels_red,
+  float*                   pixels_green,
+  float*                   pixels_blue,
+  size_t                   width,
+  size_t                   height,
+  unsigned int             filters,
+  RAWDemosaicMethod        method,
+  const DemosaicTileSizes* tile_sizes);
+
+void demosaic_tiled(
+  const float*             bayered_image,
+  float*                   debayered_image,
+  size_t                   width,
+  size_t                   height,
+  unsigned int             filters,
+  RAWDemosaicMethod        method,
+  const DemosaicTileSizes* tile_sizes);
+
+// Extent along one axis of the sub-mosaic demosaic_region reads around the
+// pixels [begin, end) of a mosaic of the given size
+static void demosaic_region_extent(
+  RAWDemosaicMethod        method,
+  const DemosaicTileSizes* tile_sizes,
+  size_t                   begin,
+  size_t                   end,
+  size_t                   size,
+  size_t*                  sub_begin,
+  size_t*                  sub_end)
+{
+    if (method == AMAZE) {
+        // AMaZE results depend on the extent of its tiles: the sub-mosaic
+        // holds the whole tiles of the mosaic grid covering the region, and
+        // the tile before to keep the region away from the borders
+        const size_t step = tile_sizes->amaze - 32;
+
+        *sub_begin = (begin >= step) ? (begin / step - 1) * step : 0;
+        *sub_end   = std::min(size, *sub_begin + ((end - 1 - *sub_begin) / step + 1) * step + 16);
+    } else {
+        // The sub-mosaic starts on an even row and column to keep the phase
+        // of the Bayer pattern, and has even sizes unless it reaches an odd
+        // edge of the mosaic
+        *sub_begin = (begin > DEMOSAIC_REGION_MARGIN) ? (begin - DEMOSAIC_REGION_MARGIN) & ~size_t(1) : 0;
+        *sub_end   = std::min(size, (end + DEMOSAIC_REGION_MARGIN + 1) & ~size_t(1));
+    }
+}
 
 extern "C"
 {
@@ -88,6 +145,22 @@ extern "C"
             case AMAZE:
                 amaze_demosaic_rgb(bayered_image, pixels_red, pixels_green, pixels_blue, width, height, filters);
                 break;
+
+            case MHC:
+                mhc_demosaic_rgb(bayered_image, pixels_red, pixels_green, pixels_blue, width, height, filters);
+                break;
+
+            case AUTO:
+                demosaic_rgb(
+                  bayered_image,
+                  pixels_red,
+                  pixels_green,
+                  pixels_blue,
+                  width,
+                  height,
+                  filters,
+                  demosaic_auto_select(width, height, NULL));
+                break;
         }
     }
 
@@ -132,6 +205,135 @@ extern "C"
             case AMAZE:
                 amaze_demosaic(bayered_image, debayered_image, width, height, filters);
                 break;
+
+            case MHC:
+                mhc_demosaic(bayered_image, debayered_image, width, height, filters);
+                break;
+
+            case AUTO:
+                demosaic(
+                  bayered_image, debayered_image, width, height, filters, demosaic_auto_select(width, height, NULL));
+                break;
+        }
+    }
+
+
+    int demosaic_region(
+      const float*      bayered_image,
+      float*            debayered_image,
+      size_t            width,
+      size_t            height,
+      unsigned int      filters,
+      RAWDemosaicMethod method,
+      size_t            x,
+      size_t            y,
+      size_t            region_width,
+      size_t            region_height)
+    {
+        if (method == REDUCE2X2 || method == BARYCENTRIC2X2) {
+            return -1;
+        }
+
+        if (x + region_width > width || y + region_height > height) {
+            return -1;
+        }
+
+        if (region_width == 0 || region_height == 0) {
+            return 0;
+        }
+
+        // Picked for the whole mosaic: all the regions use the same method
+        if (method == AUTO) {
+            method = demosaic_auto_select(width, height, NULL);
+        }
+
+        // Read once: the sub-mosaic is demosaiced on the grid it was cut for
+        DemosaicTileSizes tile_sizes;
+        demosaic_get_tile_sizes(&tile_sizes);
+
+        size_t x_0, x_1, y_0, y_1;
+        demosaic_region_extent(method, &tile_sizes, x, x + region_width, width, &x_0, &x_1);
+        demosaic_region_extent(method, &tile_sizes, y, y + region_height, height, &y_0, &y_1);
+
+        const size_t sub_width  = x_1 - x_0;
+        const size_t sub_height = y_1 - y_0;
+
+        float* sub_mosaic = new float[sub_width * sub_height];
+        float* sub_image  = new float[3 * sub_width * sub_height];
+
+        for (size_t row = 0; row < sub_height; row++) {
+            memcpy(
+              &sub_mosaic[row * sub_width],
+              &bayered_image[(y_0 + row) * width + x_0],
+              sub_width * sizeof(float));
+        }
+
+        demosaic_tiled(sub_mosaic, sub_image, sub_width, sub_height, filters, method, &tile_sizes);
+
+        for (size_t row = 0; row < region_height; row++) {
+            memcpy(
+              &debayered_image[3 * ((y + row) * width + x)],
+              &sub_image[3 * ((y - y_0 + row) * sub_width + (x - x_0))],
+              3 * region_width * sizeof(float));
+        }
+
+        delete[] sub_mosaic;
+        delete[] sub_image;
+
+        return 0;
+    }
+
+    int demosaic_method_from_name(const char* name, RAWDemosaicMethod* method)
+    {
+        for (int m = BASIC; m <= AUTO; m++) {
+            if (strcmp(name, demosaic_method_name((RAWDemosaicMethod)m)) == 0) {
+                *method = (RAWDemosaicMethod)m;
+                return 0;
+            }
+        }
+
+        return -1;
+    }
+
+
+    const char* demosaic_method_name(RAWDemosaicMethod method)
+    {
+        switch (method) {
+            case BASIC:
+                return "BASIC";
+            case REDUCE2X2:
+                return "REDUCE2X2";
+            case BARYCENTRIC2X2:
+                return "BARYCENTRIC2X2";
+            case VNG4:
+                return "VNG4";
+            case AHD:
+                return "AHD";
+            case RCD:
+                return "RCD";
+            case AMAZE:
+                return "AMAZE";
+            case MHC:
+                return "MHC";
+            case NONE:
+                return "NONE";
+            case AUTO:
+                return "AUTO";
+        }
+
+        return "";
+    }
+
+
+    void demosaic_output_size(
+      RAWDemosaicMethod method, size_t width, size_t height, size_t* output_width, size_t* output_height)
+    {
+        if (method == REDUCE2X2 || method == BARYCENTRIC2X2) {
+            *output_width  = width / 2;
+            *output_height = height / 2;
+        } else {
+            *output_width  = width;
+            *output_height = height;
         }
     }
 
@@ -310,356 +512,6 @@ extern "C"
 
     ////////////////////////////////////////////////////////////////////////////
 
-    void reduce2x2_demosaic_rgb(
-      const float* bayered_image,
-      float*       pixels_red,
-      float*       pixels_green,
-      float*       pixels_blue,
-      size_t       width,
-      size_t       height,
-      unsigned int filters)
-    {
-        int color_offsets[4];   // R GG B
-
-        switch (filters) {
-            case 0x16161616:
-                // ┌─┬─┐
-                // │B│G│
-                // ├─┼─┤
-                // │G│R│
-                // └─┴─┘
-                color_offsets[0] = width + 1;   // R
-                color_offsets[1] = 1;           // G
-                color_offsets[2] = width;       // G
-                color_offsets[3] = 0;           // B
-                break;
-            case 0x61616161:
-                // ┌─┬─┐
-                // │G│R│
-                // ├─┼─┤
-                // │B│G│
-                // └─┴─┘
-                color_offsets[0] = 1;           // R
-                color_offsets[1] = 0;           // G
-                color_offsets[2] = width + 1;   // G
-                color_offsets[3] = width;       // B
-                break;
-            case 0x49494949:   // GBRG
-                // ┌─┬─┐
-                // │G│B│
-                // ├─┼─┤
-                // │R│G│
-                // └─┴─┘
-                color_offsets[0] = width;       // R
-                color_offsets[1] = 0;           // G
-                color_offsets[2] = width + 1;   // G
-                color_offsets[3] = 1;           // B
-                break;
-            case 0x94949494:   // RGGB
-                // ┌─┬─┐
-                // │R│G│
-                // ├─┼─┤
-                // │G│B│
-                // └─┴─┘
-                color_offsets[0] = 0;           // R
-                color_offsets[1] = 1;           // G
-                color_offsets[2] = width;       // G
-                color_offsets[3] = width + 1;   // B
-                break;
-            default:
-                return;
-        }
-
-        const size_t scanline_image = width / 2;
-
-        for (size_t y = 0; y < height / 2; y++) {
-            for (size_t x = 0; x < width / 2; x++) {
-                const size_t offset_bayer = 2 * y * width + 2 * x;
-
-                pixels_red[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[0]];
-                pixels_green[y * scanline_image + x]
-                  = 0.5
-                    * (bayered_image[offset_bayer + color_offsets[1]] + bayered_image[offset_bayer + color_offsets[2]]);
-                pixels_blue[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[3]];
-            }
-        }
-    }
-
-
-    void reduce2x2_demosaic(
-      const float* bayered_image, float* debayered_image, size_t width, size_t height, unsigned int filters)
-    {
-        demosaic_rgb_to_img(bayered_image, debayered_image, width, height, filters, reduce2x2_demosaic_rgb);
-    }
-
-
-    ////////////////////////////////////////////////////////////////////////////
-
-    void barycentric2x2_demosaic_rgb(
-      const float* bayered_image,
-      float*       pixels_red,
-      float*       pixels_green,
-      float*       pixels_blue,
-      size_t       width,
-      size_t       height,
-      unsigned int filters)
-    {
-        // 4 corners coordinates
-        int red_offsets[4];
-        int blue_offsets[4];
-
-        // 4 corners weights
-        float red_weights[4];
-        float blue_weights[4];
-
-        int green_offsets[2];
-
-        const float normalization_f = 2.f * std::sqrt(2.f) + std::sqrt(10.f);
-
-        switch (filters) {
-            case 0x16161616:
-                // ┌─┬─┐
-                // │B│G│
-                // ├─┼─┤
-                // │G│R│
-                // └─┴─┘
-                red_offsets[0] = -width - 1;
-                red_offsets[1] = -width + 1;
-                red_offsets[2] = width + 1;
-                red_offsets[3] = width - 1;
-
-                green_offsets[0] = 1;
-                green_offsets[1] = width;
-
-                blue_offsets[0] = 0;
-                blue_offsets[1] = 2;
-                blue_offsets[2] = 2 * width + 2;
-                blue_offsets[3] = 2 * width;
-
-                red_weights[0] = (3.f * std::sqrt(2.f) / 2.f) / normalization_f;
-                red_weights[1] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                red_weights[2] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                red_weights[3] = (std::sqrt(2.f) / 2.f) / normalization_f;
-
-                blue_weights[0] = (std::sqrt(2.f) / 2.f) / normalization_f;
-                blue_weights[1] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                blue_weights[2] = (3.f * std::sqrt(2.f) / 2.f) / normalization_f;
-                blue_weights[3] = (std::sqrt(10.f) / 2.f) / normalization_f;
-
-                break;
-            case 0x61616161:
-                // ┌─┬─┐
-                // │G│R│
-                // ├─┼─┤
-                // │B│G│
-                // └─┴─┘
-                red_offsets[0] = -1;
-                red_offsets[1] = 1;
-                red_offsets[2] = 2 * width + 1;
-                red_offsets[3] = 2 * width - 1;
-
-                green_offsets[0] = 0;           // G
-                green_offsets[1] = width + 1;   // G
-
-                blue_offsets[0] = -width;
-                blue_offsets[1] = -width + 2;
-                blue_offsets[2] = width + 2;
-                blue_offsets[3] = width;
-
-                red_weights[0] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                red_weights[1] = (std::sqrt(2.f) / 2.f) / normalization_f;
-                red_weights[2] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                red_weights[3] = (3.f * std::sqrt(2.f) / 2.f) / normalization_f;
-
-                blue_weights[0] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                blue_weights[1] = (3.f * std::sqrt(2.f) / 2.f) / normalization_f;
-                blue_weights[2] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                blue_weights[3] = (std::sqrt(2.f) / 2.f) / normalization_f;
-                break;
-            case 0x49494949:   // GBRG
-                // ┌─┬─┐
-                // │G│B│
-                // ├─┼─┤
-                // │R│G│
-                // └─┴─┘
-                red_offsets[0] = -width;
-                red_offsets[1] = -width + 2;
-                red_offsets[2] = width + 2;
-                red_offsets[3] = width;
-
-                green_offsets[0] = 0;           // G
-                green_offsets[1] = width + 1;   // G
-
-                blue_offsets[0] = -1;
-                blue_offsets[1] = 1;
-                blue_offsets[2] = 2 * width + 1;
-                blue_offsets[3] = 2 * width - 1;
-
-                red_weights[0] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                red_weights[1] = (3.f * std::sqrt(2.f) / 2.f) / normalization_f;
-                red_weights[2] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                red_weights[3] = (std::sqrt(2.f) / 2.f) / normalization_f;
-
-                blue_weights[0] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                blue_weights[1] = (std::sqrt(2.f) / 2.f) / normalization_f;
-                blue_weights[2] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                blue_weights[3] = (3.f * std::sqrt(2.f) / 2.f) / normalization_f;
-                break;
-            case 0x94949494:   // RGGB
-                // ┌─┬─┐
-                // │R│G│
-                // ├─┼─┤
-                // │G│B│
-                // └─┴─┘
-                red_offsets[0] = 0;
-                red_offsets[1] = 2;
-                red_offsets[2] = 2 * width + 2;
-                red_offsets[3] = 2 * width;
-
-                green_offsets[0] = 1;       // G
-                green_offsets[1] = width;   // G
-
-                blue_offsets[0] = -width - 1;
-                blue_offsets[1] = -width + 1;
-                blue_offsets[2] = width + 1;
-                blue_offsets[3] = width - 1;
-
-                red_weights[0] = (std::sqrt(2.f) / 2.f) / normalization_f;
-                red_weights[1] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                red_weights[2] = (3.f * std::sqrt(2.f) / 2.f) / normalization_f;
-                red_weights[3] = (std::sqrt(10.f) / 2.f) / normalization_f;
-
-                blue_weights[0] = (3.f * std::sqrt(2.f) / 2.f) / normalization_f;
-                blue_weights[1] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                blue_weights[2] = (std::sqrt(10.f) / 2.f) / normalization_f;
-                blue_weights[3] = (std::sqrt(2.f) / 2.f) / normalization_f;
-
-                break;
-            default:
-                return;
-        }
-
-        const size_t scanline_image = width / 2;
-
-        memset(pixels_red, 0, width / 2 * height / 2 * sizeof(float));
-        memset(pixels_green, 0, width / 2 * height / 2 * sizeof(float));
-        memset(pixels_blue, 0, width / 2 * height / 2 * sizeof(float));
-
-        for (size_t y = 1; y < height / 2 - 1; y++) {
-            for (size_t x = 1; x < width / 2 - 1; x++) {
-                const size_t offset_bayer = 2 * y * width + 2 * x;
-
-                for (int i = 0; i < 4; i++) {
-                    pixels_red[y * scanline_image + x] += red_weights[i] * bayered_image[offset_bayer + red_offsets[i]];
-                    pixels_blue[y * scanline_image + x]
-                      += blue_weights[i] * bayered_image[offset_bayer + blue_offsets[i]];
-                }
-
-                pixels_green[y * scanline_image + x]
-                  = 0.5
-                    * (bayered_image[offset_bayer + green_offsets[0]] + bayered_image[offset_bayer + green_offsets[1]]);
-            }
-        }
-
-        // Borders
-        int color_offsets[4];   // R GG B
-
-        switch (filters) {
-            case 0x16161616:
-                // ┌─┬─┐
-                // │B│G│
-                // ├─┼─┤
-                // │G│R│
-                // └─┴─┘
-                color_offsets[0] = width + 1;   // R
-                color_offsets[1] = 1;           // G
-                color_offsets[2] = width;       // G
-                color_offsets[3] = 0;           // B
-                break;
-            case 0x61616161:
-                // ┌─┬─┐
-                // │G│R│
-                // ├─┼─┤
-                // │B│G│
-                // └─┴─┘
-                color_offsets[0] = 1;           // R
-                color_offsets[1] = 0;           // G
-                color_offsets[2] = width + 1;   // G
-                color_offsets[3] = width;       // B
-                break;
-            case 0x49494949:   // GBRG
-                // ┌─┬─┐
-                // │G│B│
-                // ├─┼─┤
-                // │R│G│
-                // └─┴─┘
-                color_offsets[0] = width;       // R
-                color_offsets[1] = 0;           // G
-                color_offsets[2] = width + 1;   // G
-                color_offsets[3] = 1;           // B
-                break;
-            case 0x94949494:   // RGGB
-                // ┌─┬─┐
-                // │R│G│
-                // ├─┼─┤
-                // │G│B│
-                // └─┴─┘
-                color_offsets[0] = 0;           // R
-                color_offsets[1] = 1;           // G
-                color_offsets[2] = width;       // G
-                color_offsets[3] = width + 1;   // B
-                break;
-            default:
-                return;
-        }
-
-
-        for (size_t y = 0; y < height / 2; y++) {
-            size_t x            = 0;
-            size_t offset_bayer = 2 * y * width + 2 * x;
-
-            pixels_red[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[0]];
-            pixels_green[y * scanline_image + x]
-              = 0.5 * (bayered_image[offset_bayer + color_offsets[1]] + bayered_image[offset_bayer + color_offsets[2]]);
-            pixels_blue[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[3]];
-
-            x            = width / 2;
-            offset_bayer = 2 * y * width + 2 * x;
-
-            pixels_red[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[0]];
-            pixels_green[y * scanline_image + x]
-              = 0.5 * (bayered_image[offset_bayer + color_offsets[1]] + bayered_image[offset_bayer + color_offsets[2]]);
-            pixels_blue[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[3]];
-        }
-
-        for (size_t x = 1; x < width / 2 - 1; x++) {
-            size_t y            = 0;
-            size_t offset_bayer = 2 * y * width + 2 * x;
-
-            pixels_red[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[0]];
-            pixels_green[y * scanline_image + x]
-              = 0.5 * (bayered_image[offset_bayer + color_offsets[1]] + bayered_image[offset_bayer + color_offsets[2]]);
-            pixels_blue[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[3]];
-
-            y            = height / 2 - 1;
-            offset_bayer = 2 * y * width + 2 * x;
-
-            pixels_red[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[0]];
-            pixels_green[y * scanline_image + x]
-              = 0.5 * (bayered_image[offset_bayer + color_offsets[1]] + bayered_image[offset_bayer + color_offsets[2]]);
-            pixels_blue[y * scanline_image + x] = bayered_image[offset_bayer + color_offsets[3]];
-        }
-    }
-
-
-    void barycentric2x2_demosaic(
-      const float* bayered_image, float* debayered_image, size_t width, size_t height, unsigned int filters)
-    {
-        demosaic_rgb_to_img(bayered_image, debayered_image, width, height, filters, barycentric2x2_demosaic_rgb);
-    }
-
-    ////////////////////////////////////////////////////////////////////////////
-
     void amaze_demosaic_rgb(
       const float*       bayered_image,
       float*             pixels_red,
@@ -669,9 +521,12 @@ extern "C"
       size_t             height,
       const unsigned int filters)
     {
+        DemosaicTileSizes tile_sizes;
+        demosaic_get_tile_sizes(&tile_sizes);
+
         float* debayered_temp = new float[4 * width * height];
 
-        amaze_demosaic_RT(bayered_image, debayered_temp, width, height, filters);
+        amaze_demosaic_RT(bayered_image, debayered_temp, width, height, filters, tile_sizes.amaze);
 
         for (size_t row = 0; row < height; row++) {
             for (size_t col = 0; col < width; col++) {
@@ -688,9 +543,12 @@ extern "C"
     void amaze_demosaic(
       const float* bayered_image, float* debayered_image, size_t width, size_t height, unsigned int filters)
     {
+        DemosaicTileSizes tile_sizes;
+        demosaic_get_tile_sizes(&tile_sizes);
+
         float* debayered_temp = new float[4 * width * height];
 
-        amaze_demosaic_RT(bayered_image, debayered_temp, width, height, filters);
+        amaze_demosaic_RT(bayered_image, debayered_temp, width, height, filters, tile_sizes.amaze);
 
         for (size_t row = 0; row < height; row++) {
             for (size_t col = 0; col < width; col++) {
@@ -1076,7 +934,7 @@ static inline const _Tp ULIM(const _Tp a, const _Tp b, const _Tp c)
 //
 ////////////////////////////////////////////////////////////////
 
-void amaze_demosaic_RT(const float* in, float* out, int width, int height, const unsigned int filters)
+void amaze_demosaic_RT(const float* in, float* out, int width, int height, const unsigned int filters, int ts)
 {
     int         winx    = 0;
     int         winy    = 0;
@@ -1084,16 +942,10 @@ void amaze_demosaic_RT(const float* in, float* out, int width, int height, const
     //  fminf(piece->pipe->dsc.processed_maximum[1], piece->pipe->dsc.processed_maximum[2]));
     const float clip_pt8 = 0.8f * clip_pt;
 
-// this allows to pass AMAZETS to the code. On some machines larger AMAZETS is faster
-// If AMAZETS is undefined it will be set to 160, which is the fastest on modern x86/64 machines
-#ifndef AMAZETS
-#    define AMAZETS 160
-#endif
     // Tile size; the image is processed in square tiles to lower memory requirements and facilitate
     // multi-threading
-    // We assure that Tile size is a multiple of 32 in the range [96;992]
-    constexpr int ts  = (AMAZETS & 992) < 96 ? 96 : (AMAZETS & 992);
-    constexpr int tsh = ts / 2;   // half of Tile size
+    // The tile size is a multiple of 32 in the range [96;992], see demosaic_set_tile_sizes
+    const int tsh = ts / 2;   // half of Tile size
 
     // offset of R pixel within a Bayer quartet
     int ex, ey;
@@ -1118,7 +970,7 @@ void amaze_demosaic_RT(const float* in, float* out, int width, int height, const
     }
 
     // shifts of pointer value to access pixels in vertical and diagonal directions
-    constexpr int v1 = ts, v2 = 2 * ts, v3 = 3 * ts, p1 = -ts + 1, p2 = -2 * ts + 2, p3 = -3 * ts + 3, m1 = ts + 1,
+    const int v1 = ts, v2 = 2 * ts, v3 = 3 * ts, p1 = -ts + 1, p2 = -2 * ts + 2, p3 = -3 * ts + 3, m1 = ts + 1,
                   m2 = 2 * ts + 2, m3 = 3 * ts + 3;
 
     // tolerance to avoid dividing by zero
@@ -1182,7 +1034,7 @@ void amaze_demosaic_RT(const float* in, float* out, int width, int height, const
         // weight to give horizontal vs vertical interpolation
         float* hvwt = (float(*))((char*)cddiffsq + sizeof(float) * ts * ts + 2 * cldf * 64);   // 1
         // final interpolated colour difference
-        float(*Dgrb)[ts * tsh] = (float(*)[ts * tsh]) vcdalt;   // there is no overlap in buffer usage => share
+        float* Dgrb[2] = {vcdalt, vcdalt + ts * tsh};   // there is no overlap in buffer usage => share
         // gradient in plus (NE/SW) direction
         float* delp = (float(*))cddiffsq;   // there is no overlap in buffer usage => share
         // gradient in minus (NW/SE) direction
@@ -2906,151 +2758,56 @@ void amaze_demosaic_RT(const float* in, float* out, int width, int height, const
 void border_interpolate(
   int winw, int winh, int lborders, const float* rawData, float* red, float* green, float* blue, unsigned int filters)
 {
-    int bord   = lborders;
-    int width  = winw;
-    int height = winh;
+    const int bord   = lborders;
+    const int width  = winw;
+    const int height = winh;
 
+    #pragma omp parallel for schedule(static)
     for (int i = 0; i < height; i++) {
-        float sum[6];
-
-        for (int j = 0; j < bord; j++) {
-            // first few columns
-            memset(sum, 0, 6 * sizeof(float));
-
-            for (int i1 = i - 1; i1 < i + 2; i1++)
-                for (int j1 = j - 1; j1 < j + 2; j1++) {
-                    if ((i1 > -1) && (i1 < height) && (j1 > -1)) {
-                        int c = FC(i1, j1, filters);
-                        sum[c] += rawData[i1 * width + j1];
-                        sum[c + 3]++;
-                    }
-                }
-
-            int c = FC(i, j, filters);
+        // Neighbour rows clamped to the image, weighted 0 when outside
+        const int   rows[3]        = {std::max(i - 1, 0), i, std::min(i + 1, height - 1)};
+        const float row_weights[3] = {(float)(i > 0), 1.f, (float)(i < height - 1)};
 
-            if (c == 1) {
-                red[i * width + j]   = sum[0] / sum[3];
-                green[i * width + j] = rawData[i * width + j];
-                blue[i * width + j]  = sum[2] / sum[5];
-            } else {
-                green[i * width + j] = sum[1] / sum[4];
+        // Colors of the neighbour rows for even and odd columns
+        unsigned int colors[3][2];
 
-                if (c == 0) {
-                    red[i * width + j]  = rawData[i * width + j];
-                    blue[i * width + j] = sum[2] / sum[5];
-                } else {
-                    red[i * width + j]  = sum[0] / sum[3];
-                    blue[i * width + j] = rawData[i * width + j];
-                }
-            }
-        }   //j
-
-        for (int j = width - bord; j < width; j++) {   //last few columns
-            for (int c = 0; c < 6; c++) {
-                sum[c] = 0;
-            }
-
-            for (int i1 = i - 1; i1 < i + 2; i1++)
-                for (int j1 = j - 1; j1 < j + 2; j1++) {
-                    if ((i1 > -1) && (i1 < height) && (j1 < width)) {
-                        int c = FC(i1, j1, filters);
-                        sum[c] += rawData[i1 * width + j1];
-                        sum[c + 3]++;
-                    }
-                }
-
-            int c = FC(i, j, filters);
+        for (int y = 0; y < 3; y++) {
+            colors[y][0] = FC(rows[y], 0, filters);
+            colors[y][1] = FC(rows[y], 1, filters);
+        }
 
-            if (c == 1) {
-                red[i * width + j]   = sum[0] / sum[3];
-                green[i * width + j] = rawData[i * width + j];
-                blue[i * width + j]  = sum[2] / sum[5];
-            } else {
-                green[i * width + j] = sum[1] / sum[4];
+        // Border spans of the row: the whole row in the first and last rows
+        const bool full_row = i < bord || i >= height - bord;
+        const int  split    = full_row ? width : std::min(bord, width);
+        const int  spans[2][2] = {{0, split}, {std::max(width - bord, split), width}};
 
-                if (c == 0) {
-                    red[i * width + j]  = rawData[i * width + j];
-                    blue[i * width + j] = sum[2] / sum[5];
-                } else {
-                    red[i * width + j]  = sum[0] / sum[3];
-                    blue[i * width + j] = rawData[i * width + j];
-                }
-            }
-        }   //j
-    }       //i
+        for (int s = 0; s < 2; s++) {
+            for (int j = spans[s][0]; j < spans[s][1]; j++) {
+                const int   cols[3]        = {std::max(j - 1, 0), j, std::min(j + 1, width - 1)};
+                const float col_weights[3] = {(float)(j > 0), 1.f, (float)(j < width - 1)};
 
-    for (int i = 0; i < bord; i++) {
-        float sum[6];
+                float sum[4]   = {0.f, 0.f, 0.f, 0.f};
+                float count[4] = {0.f, 0.f, 0.f, 0.f};
 
-        for (int j = bord; j < width - bord; j++) {   //first few rows
-            for (int c = 0; c < 6; c++) {
-                sum[c] = 0;
-            }
+                for (int y = 0; y < 3; y++) {
+                    for (int x = 0; x < 3; x++) {
+                        const float        weight = row_weights[y] * col_weights[x];
+                        const unsigned int c      = colors[y][cols[x] & 1];
 
-            for (int i1 = i - 1; i1 < i + 2; i1++)
-                for (int j1 = j - 1; j1 < j + 2; j1++) {
-                    if ((i1 > -1) && (i1 < height) && (j1 > -1)) {
-                        int c = FC(i1, j1, filters);
-                        sum[c] += rawData[i1 * width + j1];
-                        sum[c + 3]++;
+                        sum[c] += weight * rawData[rows[y] * width + cols[x]];
+                        count[c] += weight;
                     }
                 }
 
-            int c = FC(i, j, filters);
+                float value[3] = {sum[0] / count[0], sum[1] / count[1], sum[2] / count[2]};
 
-            if (c == 1) {
-                red[i * width + j]   = sum[0] / sum[3];
-                green[i * width + j] = rawData[i * width + j];
-                blue[i * width + j]  = sum[2] / sum[5];
-            } else {
-                green[i * width + j] = sum[1] / sum[4];
+                value[colors[1][j & 1]] = rawData[i * width + j];
 
-                if (c == 0) {
-                    red[i * width + j]  = rawData[i * width + j];
-                    blue[i * width + j] = sum[2] / sum[5];
-                } else {
-                    red[i * width + j]  = sum[0] / sum[3];
-                    blue[i * width + j] = rawData[i * width + j];
-                }
-            }
-        }   //j
-    }
-
-    for (int i = height - bord; i < height; i++) {
-        float sum[6];
-
-        for (int j = bord; j < width - bord; j++) {   //last few rows
-            for (int c = 0; c < 6; c++) {
-                sum[c] = 0;
+                red[i * width + j]   = value[0];
+                green[i * width + j] = value[1];
+                blue[i * width + j]  = value[2];
             }
-
-            for (int i1 = i - 1; i1 < i + 2; i1++)
-                for (int j1 = j - 1; j1 < j + 2; j1++) {
-                    if ((i1 > -1) && (i1 < height) && (j1 < width)) {
-                        int c = FC(i1, j1, filters);
-                        sum[c] += rawData[i1 * width + j1];
-                        sum[c + 3]++;
-                    }
-                }
-
-            int c = FC(i, j, filters);
-
-            if (c == 1) {
-                red[i * width + j]   = sum[0] / sum[3];
-                green[i * width + j] = rawData[i * width + j];
-                blue[i * width + j]  = sum[2] / sum[5];
-            } else {
-                green[i * width + j] = sum[1] / sum[4];
-
-                if (c == 0) {
-                    red[i * width + j]  = rawData[i * width + j];
-                    blue[i * width + j] = sum[2] / sum[5];
-                } else {
-                    red[i * width + j]  = sum[0] / sum[3];
-                    blue[i * width + j] = rawData[i * width + j];
-                }
-            }
-        }   //j
+        }
     }
 }
 
@@ -3067,6 +2824,51 @@ bool ISBLUE(unsigned row, unsigned col, unsigned filters)
     return ((filters >> ((((row) << 1 & 14) + ((col)&1)) << 1) & 3) == 2);
 }
 
+// Rows of the linear interpolation kept by each thread, 4 of them are shared
+// by consecutive bands
+#define VNG4_WINDOW_ROWS 36
+
+// Linear interpolation of a row, the 4 values of each pixel are given (G1 and
+// G2 are separated). Only the value of the pixel color is set on the borders.
+inline void vng4interpolate_row_linear(
+  const float* rawData,
+  float (*out)[4],
+  int          row,
+  int          width,
+  int          height,
+  unsigned int prefilters,
+  const int    lcode[16][16][32],
+  const float  mul[16][16][8],
+  const float  csum[16][16][3])
+{
+    const float* raw = &rawData[static_cast<size_t>(row) * width];
+
+    memset(out, 0, width * sizeof *out);
+
+    for (int col = 0; col < width; col++) {
+        out[col][FC(row, col, prefilters)] = raw[col];
+    }
+
+    if (row < 1 || row > height - 2) {
+        return;
+    }
+
+    for (int col = 1; col < width - 1; col++) {
+        float*     pix    = out[col];
+        const int* ip     = lcode[row & 15][col & 15];
+        float      sum[4] = {};
+
+        for (int i = 0; i < 8; i++, ip += 2) {
+            sum[ip[1]] += raw[col + ip[0]] * mul[row & 15][col & 15][i];
+        }
+
+        for (unsigned int i = 0; i < 3; i++, ip++) {
+            pix[ip[0]] = sum[ip[0]] * csum[row & 15][col & 15][i];
+        }
+    }
+}
+
+
 inline void vng4interpolate_row_redblue(
   const float*       rawData,
   float*             ar,
@@ -3165,8 +2967,6 @@ extern "C"
         const int              width = w, height = h;
         constexpr unsigned int colors = 4;
 
-        float(*image)[4] = (float(*)[4])calloc(static_cast<size_t>(height) * width, sizeof *image);
-
         int   lcode[16][16][32];
         float mul[16][16][8];
         float csum[16][16][3];
@@ -3186,8 +2986,9 @@ extern "C"
                             continue;
                         }
 
+                        // Offset of the neighbour in the bayered image
                         int color = FC(row + y, col + x, prefilters);
-                        *ip++     = (width * y + x) * 4 + color;
+                        *ip++     = width * y + x;
 
                         mul[row][col][mulcount] = (1 << shift);
                         *ip++                   = color;
@@ -3205,80 +3006,6 @@ extern "C"
                     }
             }
 
-#ifdef _OPENMP
-            #pragma omp parallel
-#endif
-        {
-            int firstRow = -1;
-            int lastRow  = -1;
-#ifdef _OPENMP
-            // note, static scheduling is important in this implementation
-            #pragma omp for schedule(static)
-#endif
-
-            for (int ii = 0; ii < height; ii++) {
-                if (firstRow == -1) {
-                    firstRow = ii;
-                }
-                lastRow = ii;
-                for (int jj = 0; jj < width; jj++) {
-                    image[ii * width + jj][FC(ii, jj, prefilters)] = rawData[ii * width + jj];
-                }
-                if (ii - 1 > firstRow) {
-                    int row = ii - 1;
-                    for (int col = 1; col < width - 1; col++) {
-                        float* pix    = image[row * width + col];
-                        int*   ip     = lcode[row & 15][col & 15];
-                        float  sum[4] = {};
-
-                        for (int i = 0; i < 8; i++, ip += 2) {
-                            sum[ip[1]] += pix[ip[0]] * mul[row & 15][col & 15][i];
-                        }
-
-                        for (unsigned int i = 0; i < colors - 1; i++, ip++) {
-                            pix[ip[0]] = sum[ip[0]] * csum[row & 15][col & 15][i];
-                        }
-                    }
-                }
-            }
-
-            // now all rows are processed except the first and last row of each chunk
-            // let's process them now but skip row 0 and row H - 1
-            if (firstRow > 0 && firstRow < height - 1) {
-                const int row = firstRow;
-                for (int col = 1; col < width - 1; col++) {
-                    float* pix    = image[row * width + col];
-                    int*   ip     = lcode[row & 15][col & 15];
-                    float  sum[4] = {};
-
-                    for (int i = 0; i < 8; i++, ip += 2) {
-                        sum[ip[1]] += pix[ip[0]] * mul[row & 15][col & 15][i];
-                    }
-
-                    for (unsigned int i = 0; i < colors - 1; i++, ip++) {
-                        pix[ip[0]] = sum[ip[0]] * csum[row & 15][col & 15][i];
-                    }
-                }
-            }
-
-            if (lastRow > 0 && lastRow < height - 1) {
-                const int row = lastRow;
-                for (int col = 1; col < width - 1; col++) {
-                    float* pix    = image[row * width + col];
-                    int*   ip     = lcode[row & 15][col & 15];
-                    float  sum[4] = {};
-
-                    for (int i = 0; i < 8; i++, ip += 2) {
-                        sum[ip[1]] += pix[ip[0]] * mul[row & 15][col & 15][i];
-                    }
-
-                    for (unsigned int i = 0; i < colors - 1; i++, ip++) {
-                        pix[ip[0]] = sum[ip[0]] * csum[row & 15][col & 15][i];
-                    }
-                }
-            }
-        }
-
         constexpr int prow = 7, pcol = 1;
         int32_t*      code[8][2];
         int32_t*      ip = (int32_t*)calloc((prow + 1) * (pcol + 1), 1280);
@@ -3351,6 +3078,13 @@ extern "C"
         {
             // constexpr int progressStep = 64;
             // const double progressInc = (1.0 - progress) / ((height - 2) / progressStep);
+
+            // Rolling window over the linear interpolation of the rows of the
+            // thread: the VNG of a row reads from row - 2 to row + 2
+            float(*window)[4] = (float(*)[4])malloc(static_cast<size_t>(VNG4_WINDOW_ROWS) * width * sizeof *window);
+            int window_first  = 0;   // First row of the image in the window
+            int window_rows   = 0;   // Number of rows in the window
+
             int firstRow = -1;
             int lastRow  = -1;
 #ifdef _OPENMP
@@ -3363,8 +3097,42 @@ extern "C"
                     firstRow = row;
                 }
                 lastRow = row;
+
+                if (row - 2 < window_first || row - 2 >= window_first + window_rows) {
+                    window_first = row - 2;
+                    window_rows  = 0;
+                }
+
+                while (window_first + window_rows <= row + 2) {
+                    if (window_rows == VNG4_WINDOW_ROWS) {
+                        // Only keeps the rows still needed
+                        const int shift = row - 2 - window_first;
+
+                        memmove(
+                          window[0],
+                          window[shift * width],
+                          static_cast<size_t>(window_rows - shift) * width * sizeof *window);
+
+                        window_first += shift;
+                        window_rows -= shift;
+                    }
+
+                    vng4interpolate_row_linear(
+                      rawData,
+                      &window[window_rows * width],
+                      window_first + window_rows,
+                      width,
+                      height,
+                      prefilters,
+                      lcode,
+                      mul,
+                      csum);
+
+                    window_rows++;
+                }
+
                 for (int col = 2; col < width - 2; col++) {
-                    float*   pix     = image[row * width + col];
+                    float*   pix     = window[(row - window_first) * width + col];
                     int      color   = FC(row, col, prefilters);
                     int32_t* ip      = code[row & prow][col & pcol];
                     float    gval[8] = {};
@@ -3479,7 +3247,13 @@ extern "C"
                   w,
                   filters);
             }
+
+            free(window);
+
 #ifdef _OPENMP
+            // The border interpolation overwrites the green values next to the
+            // borders, still read by the red and blue rows of the other threads
+            #pragma omp barrier
             #pragma omp single
 #endif
             {
@@ -3489,7 +3263,6 @@ extern "C"
         }
 
         free(code[0][0]);
-        free(image);
 
         // if(plistenerActive) {
         //     plistener->setProgress (1.0);
@@ -3544,15 +3317,14 @@ unsigned fc(const unsigned int cfa[2][2], int r, int c)
     return cfa[r & 1][c & 1];
 }
 
-#define TS 144
-
 extern "C"
 {
-    void ahd_demosaic_rgb(
-      const float* rawData, float* red, float* green, float* blue, size_t w, size_t h, unsigned int filters)
+    // AHD on tiles of ts pixels
+    static void ahd_demosaic_tiled(
+      const float* rawData, float* red, float* green, float* blue, size_t w, size_t h, unsigned int filters, int ts)
     {
         const unsigned int cfa[2][2] = {{FC(0, 0, filters), FC(0, 1, filters)}, {FC(1, 0, filters), FC(1, 1, filters)}};
-        constexpr int      dirs[4]   = {-1, 1, -TS, TS};
+        const int          dirs[4]   = {-1, 1, -ts, ts};
         float              xyz_cam[3][3];
         float*             cbrt = new float[65536];
 
@@ -3597,50 +3369,53 @@ extern "C"
 #endif
         {
             // int    progresscounter = 0;
-            float* buffer = new float[13 * TS * TS]; /* 1053 kB per core */
-            auto   rgb    = (float(*)[TS][TS][3])buffer;
-            auto   lab    = (float(*)[TS][TS][3])(buffer + 6 * TS * TS);
-            auto   homo   = (uint16_t(*)[TS][TS])(buffer + 12 * TS * TS);
+            // Tiles are indexed [row * ts + col], rgb and lab hold 3 floats per pixel
+            typedef float pixel3[3];
+
+            float*    buffer  = new float[13 * ts * ts]; /* 1053 kB per core with ts = 144 */
+            pixel3*   rgb[2]  = {(pixel3*)buffer, (pixel3*)(buffer + 3 * ts * ts)};
+            pixel3*   lab[2]  = {(pixel3*)(buffer + 6 * ts * ts), (pixel3*)(buffer + 9 * ts * ts)};
+            uint16_t* homo[2] = {(uint16_t*)(buffer + 12 * ts * ts), (uint16_t*)(buffer + 12 * ts * ts) + ts * ts};
 
 #ifdef _OPENMP
             #pragma omp for collapse(2) schedule(dynamic) nowait
 #endif
-            for (int top = 2; top < height - 5; top += TS - 6) {
-                for (int left = 2; left < width - 5; left += TS - 6) {
+            for (int top = 2; top < height - 5; top += ts - 6) {
+                for (int left = 2; left < width - 5; left += ts - 6) {
                     //  Interpolate green horizontally and vertically:
-                    for (int row = top; row < top + TS && row < height - 2; row++) {
-                        for (int col = left + (fc(cfa, row, left) & 1); col < std::min(left + TS, width - 2);
+                    for (int row = top; row < top + ts && row < height - 2; row++) {
+                        for (int col = left + (fc(cfa, row, left) & 1); col < std::min(left + ts, width - 2);
                              col += 2) {
                             auto  pix  = &rawData[row * width + col];
                             float val0 = 0.25f * ((pix[-1] + pix[0] + pix[1]) * 2 - pix[-2] - pix[2]);
 
-                            rgb[0][row - top][col - left][1] = median(val0, pix[-1], pix[1]);
+                            rgb[0][(row - top) * ts + col - left][1] = median(val0, pix[-1], pix[1]);
 
                             float val1
                               = 0.25f * ((pix[-width] + pix[0] + pix[width]) * 2 - pix[-2 * width] - pix[2 * width]);
 
-                            rgb[1][row - top][col - left][1] = median(val1, pix[-width], pix[width]);
+                            rgb[1][(row - top) * ts + col - left][1] = median(val1, pix[-width], pix[width]);
                         }
                     }
 
                     //  Interpolate red and blue, and convert to CIELab:
                     for (int d = 0; d < 2; d++)
-                        for (int row = top + 1; row < top + TS - 1 && row < height - 3; row++) {
+                        for (int row = top + 1; row < top + ts - 1 && row < height - 3; row++) {
                             int cng = fc(cfa, row + 1, fc(cfa, row + 1, 0) & 1);
-                            for (int col = left + 1; col < std::min(left + TS - 1, width - 3); col++) {
+                            for (int col = left + 1; col < std::min(left + ts - 1, width - 3); col++) {
                                 auto pix = &rawData[row * width + col];
-                                auto rix = &rgb[d][row - top][col - left];
-                                auto lix = lab[d][row - top][col - left];
+                                auto rix = &rgb[d][(row - top) * ts + col - left];
+                                auto lix = lab[d][(row - top) * ts + col - left];
                                 if (fc(cfa, row, col) == 1) {
                                     rix[0][2 - cng]
                                       = CLIP(pix[0] + (0.5f * (pix[-1] + pix[1] - rix[-1][1] - rix[1][1])));
                                     rix[0][cng]
-                                      = CLIP(pix[0] + (0.5f * (pix[-width] + pix[width] - rix[-TS][1] - rix[TS][1])));
+                                      = CLIP(pix[0] + (0.5f * (pix[-width] + pix[width] - rix[-ts][1] - rix[ts][1])));
                                     rix[0][1] = pix[0];
                                 } else {
                                     rix[0][cng] = CLIP(
                                       rix[0][1]
-                                      + (0.25f * (pix[-width - 1] + pix[-width + 1] + pix[+width - 1] + pix[+width + 1] - rix[-TS - 1][1] - rix[-TS + 1][1] - rix[+TS - 1][1] - rix[+TS + 1][1])));
+                                      + (0.25f * (pix[-width - 1] + pix[-width + 1] + pix[+width - 1] + pix[+width + 1] - rix[-ts - 1][1] - rix[-ts + 1][1] - rix[+ts - 1][1] - rix[+ts + 1][1])));
                                     rix[0][2 - cng] = pix[0];
                                 }
                                 float xyz[3] = {};
@@ -3663,13 +3438,13 @@ extern "C"
 
                     //  Build homogeneity maps from the CIELab images:
 
-                    for (int row = top + 2; row < top + TS - 2 && row < height - 4; row++) {
+                    for (int row = top + 2; row < top + ts - 2 && row < height - 4; row++) {
                         int   tr = row - top;
                         float ldiff[2][4], abdiff[2][4];
 
-                        for (int col = left + 2, tc = 2; col < left + TS - 2 && col < width - 4; col++, tc++) {
+                        for (int col = left + 2, tc = 2; col < left + ts - 2 && col < width - 4; col++, tc++) {
                             for (int d = 0; d < 2; d++) {
-                                auto lix = &lab[d][tr][tc];
+                                auto lix = &lab[d][tr * ts + tc];
 
                                 for (int i = 0; i < 4; i++) {
                                     ldiff[d][i]  = std::fabs(lix[0][0] - lix[dirs[i]][0]);
@@ -3683,35 +3458,35 @@ extern "C"
                               = std::min(std::max(abdiff[0][0], abdiff[0][1]), std::max(abdiff[1][2], abdiff[1][3]));
 
                             for (int d = 0; d < 2; d++) {
-                                homo[d][tr][tc] = 0;
+                                homo[d][tr * ts + tc] = 0;
                                 for (int i = 0; i < 4; i++) {
-                                    homo[d][tr][tc] += (ldiff[d][i] <= leps) * (abdiff[d][i] <= abeps);
+                                    homo[d][tr * ts + tc] += (ldiff[d][i] <= leps) * (abdiff[d][i] <= abeps);
                                 }
                             }
                         }
                     }
 
                     //  Combine the most homogeneous pixels for the final result:
-                    for (int row = top + 3; row < top + TS - 3 && row < height - 5; row++) {
+                    for (int row = top + 3; row < top + ts - 3 && row < height - 5; row++) {
                         int tr = row - top;
 
-                        for (int col = left + 3, tc = 3; col < std::min(left + TS - 3, width - 5); col++, tc++) {
+                        for (int col = left + 3, tc = 3; col < std::min(left + ts - 3, width - 5); col++, tc++) {
                             uint16_t hm0 = 0, hm1 = 0;
                             for (int i = tr - 1; i <= tr + 1; i++)
                                 for (int j = tc - 1; j <= tc + 1; j++) {
-                                    hm0 += homo[0][i][j];
-                                    hm1 += homo[1][i][j];
+                                    hm0 += homo[0][i * ts + j];
+                                    hm1 += homo[1][i * ts + j];
                                 }
 
                             if (hm0 != hm1) {
                                 int dir                  = hm1 > hm0;
-                                red[row * width + col]   = rgb[dir][tr][tc][0];
-                                green[row * width + col] = rgb[dir][tr][tc][1];
-                                blue[row * width + col]  = rgb[dir][tr][tc][2];
+                                red[row * width + col]   = rgb[dir][tr * ts + tc][0];
+                                green[row * width + col] = rgb[dir][tr * ts + tc][1];
+                                blue[row * width + col]  = rgb[dir][tr * ts + tc][2];
                             } else {
-                                red[row * width + col]   = 0.5f * (rgb[0][tr][tc][0] + rgb[1][tr][tc][0]);
-                                green[row * width + col] = 0.5f * (rgb[0][tr][tc][1] + rgb[1][tr][tc][1]);
-                                blue[row * width + col]  = 0.5f * (rgb[0][tr][tc][2] + rgb[1][tr][tc][2]);
+                                red[row * width + col]   = 0.5f * (rgb[0][tr * ts + tc][0] + rgb[1][tr * ts + tc][0]);
+                                green[row * width + col] = 0.5f * (rgb[0][tr * ts + tc][1] + rgb[1][tr * ts + tc][1]);
+                                blue[row * width + col]  = 0.5f * (rgb[0][tr * ts + tc][2] + rgb[1][tr * ts + tc][2]);
                             }
                         }
                     }
@@ -3724,7 +3499,7 @@ extern "C"
                     //                     #pragma omp critical (ahdprogress)
                     // #endif
                     //                     {
-                    //                         progress += 32.0 * SQR(TS - 6) / (height * width);
+                    //                         progress += 32.0 * SQR(ts - 6) / (height * width);
                     //                         progress = std::min(progress, 1.0);
                     //                         plistener->setProgress(progress);
                     //                     }
@@ -3737,8 +3512,21 @@ extern "C"
         // if(plistener) {
         //     plistener->setProgress (1.0);
         // }
+
+        delete[] cbrt;
     }
 
+
+    void ahd_demosaic_rgb(
+      const float* rawData, float* red, float* green, float* blue, size_t w, size_t h, unsigned int filters)
+    {
+        DemosaicTileSizes tile_sizes;
+        demosaic_get_tile_sizes(&tile_sizes);
+
+        ahd_demosaic_tiled(rawData, red, green, blue, w, h, filters, tile_sizes.ahd);
+    }
+
+
     void
     ahd_demosaic(const float* bayered_image, float* debayered_image, size_t width, size_t height, unsigned int filters)
     {
@@ -3757,8 +3545,15 @@ extern "C"
      * Licensed under the GNU GPL version 3
      */
     // Tiled version by Ingo Weyrich (heckflosse67@gmx.de)
-    void rcd_demosaic_rgb(
-      const float* rawData, float* red, float* green, float* blue, size_t w, size_t h, unsigned int filters)
+    static void rcd_demosaic_tiled(
+      const float* rawData,
+      float*       red,
+      float*       green,
+      float*       blue,
+      size_t       w,
+      size_t       h,
+      unsigned int filters,
+      int          tileSize)
     {
         const int width  = w;
         const int height = h;
@@ -3791,11 +3586,10 @@ extern "C"
         const unsigned int cfarray[2][2]
           = {{FC(0, 0, filters), FC(0, 1, filters)}, {FC(1, 0, filters), FC(1, 1, filters)}};
         constexpr int rcdBorder = 9;
-        constexpr int tileSize  = 214;
-        constexpr int tileSizeN = tileSize - 2 * rcdBorder;
+        const int     tileSizeN = tileSize - 2 * rcdBorder;
         const int     numTh     = height / (tileSizeN) + ((height % (tileSizeN)) ? 1 : 0);
         const int     numTw     = width / (tileSizeN) + ((width % (tileSizeN)) ? 1 : 0);
-        constexpr int w1 = tileSize, w2 = 2 * tileSize, w3 = 3 * tileSize, w4 = 4 * tileSize;
+        const int     w1 = tileSize, w2 = 2 * tileSize, w3 = 3 * tileSize, w4 = 4 * tileSize;
         //Tolerance to avoid dividing by zero
         constexpr float eps   = 1e-5f;
         constexpr float epssq = 1e-10f;
@@ -3806,7 +3600,8 @@ extern "C"
         {
             // int    progresscounter           = 0;
             float* cfa                       = (float*)calloc(tileSize * tileSize, sizeof *cfa);
-            float(*rgb)[tileSize * tileSize] = (float(*)[tileSize * tileSize]) malloc(3 * sizeof *rgb);
+            float* rgb_buffer                = (float*)malloc(3 * tileSize * tileSize * sizeof(float));
+            float* rgb[3] = {rgb_buffer, rgb_buffer + tileSize * tileSize, rgb_buffer + 2 * tileSize * tileSize};
             float* VH_Dir                    = (float*)calloc(tileSize * tileSize, sizeof *VH_Dir);
             float* PQ_Dir                    = (float*)calloc(tileSize * tileSize, sizeof *PQ_Dir);
             float* lpf                       = PQ_Dir;   // reuse buffer, they don't overlap in usage
@@ -4200,7 +3995,7 @@ extern "C"
             }
 
             free(cfa);
-            free(rgb);
+            free(rgb_buffer);
             free(VH_Dir);
             free(PQ_Dir);
         }
@@ -4213,9 +4008,259 @@ extern "C"
     }
 
 
+    void rcd_demosaic_rgb(
+      const float* rawData, float* red, float* green, float* blue, size_t w, size_t h, unsigned int filters)
+    {
+        DemosaicTileSizes tile_sizes;
+        demosaic_get_tile_sizes(&tile_sizes);
+
+        rcd_demosaic_tiled(rawData, red, green, blue, w, h, filters, tile_sizes.rcd);
+    }
+
+
     void
     rcd_demosaic(const float* bayered_image, float* debayered_image, size_t width, size_t height, unsigned int filters)
     {
         demosaic_rgb_to_img(bayered_image, debayered_image, width, height, filters, rcd_demosaic_rgb);
     }
-}
\ No newline at end of file
+}
+
+
+void demosaic_rgb_tiled(
+  const float*             bayered_image,
+  float*                   pixels_red,
+  float*                   pixels_green,
+  float*                   pixels_blue,
+  size_t                   width,
+  size_t                   height,
+  unsigned int             filters,
+  RAWDemosaicMethod        method,
+  const DemosaicTileSizes* tile_sizes)
+{
+    switch (method) {
+        case AHD:
+            ahd_demosaic_tiled(
+              bayered_image, pixels_red, pixels_green, pixels_blue, width, height, filters, tile_sizes->ahd);
+            break;
+
+        case RCD:
+            rcd_demosaic_tiled(
+              bayered_image, pixels_red, pixels_green, pixels_blue, width, height, filters, tile_sizes->rcd);
+            break;
+
+        case AMAZE: {
+            float* debayered_temp = new float[4 * width * height];
+
+            amaze_demosaic_RT(bayered_image, debayered_temp, width, height, filters, tile_sizes->amaze);
+
+            for (size_t i = 0; i < width * height; i++) {
+                pixels_red[i]   = debayered_temp[4 * i + 0];
+                pixels_green[i] = debayered_temp[4 * i + 1];
+                pixels_blue[i]  = debayered_temp[4 * i + 2];
+            }
+
+            delete[] debayered_temp;
+        } break;
+
+        default:
+            // Not tiled
+            demosaic_rgb(bayered_image, pixels_red, pixels_green, pixels_blue, width, height, filters, method);
+            break;
+    }
+}
+
+
+void demosaic_tiled(
+  const float*             bayered_image,
+  float*                   debayered_image,
+  size_t                   width,
+  size_t                   height,
+  unsigned int             filters,
+  RAWDemosaicMethod        method,
+  const DemosaicTileSizes* tile_sizes)
+{
+    if (method == AMAZE) {
+        float* debayered_temp = new float[4 * width * height];
+
+        amaze_demosaic_RT(bayered_image, debayered_temp, width, height, filters, tile_sizes->amaze);
+
+        for (size_t i = 0; i < width * height; i++) {
+            for (int c = 0; c < 3; c++) {
+                debayered_image[3 * i + c] = debayered_temp[4 * i + c];
+            }
+        }
+
+        delete[] debayered_temp;
+        return;
+    }
+
+    if (method != AHD && method != RCD) {
+        demosaic(bayered_image, debayered_image, width, height, filters, method);
+        return;
+    }
+
+    float* pixels = new float[3 * width * height];
+
+    demosaic_rgb_tiled(
+      bayered_image,
+      &pixels[0],
+      &pixels[width * height],
+      &pixels[2 * width * height],
+      width,
+      height,
+      filters,
+      method,
+      tile_sizes);
+
+    for (size_t i = 0; i < width * height; i++) {
+        for (int c = 0; c < 3; c++) {
+            debayered_image[3 * i + c] = pixels[c * width * height + i];
+        }
+    }
+
+    delete[] pixels;
+}
+////////////////////////////////////////////////////////////////////////////////
+// MHC
+////////////////////////////////////////////////////////////////////////////////
+
+// Malvar, He and Cutler, "High-quality linear interpolation for demosaicing of
+// Bayer-patterned color images", ICASSP 2004.
+//
+// All the 5x5 filters are combinations of the same six sums of neighbours, so
+// they are computed once per pixel from a single read of the neighbourhood.
+// The image is processed in tiles to keep the 5 rows used by a tile row in the
+// L1 cache.
+
+#define MHC_BORDER      2
+#define MHC_TILE_WIDTH  512   // Shall be even: tiles start on an even column
+#define MHC_TILE_HEIGHT 32
+
+static inline void mhc_interpolate_pixel(const float* p, int width, bool green, float* x, float* g, float* y)
+{
+    const float c    = p[0];
+    const float h1   = p[-1] + p[1];
+    const float v1   = p[-width] + p[width];
+    const float h2   = p[-2] + p[2];
+    const float v2   = p[-2 * width] + p[2 * width];
+    const float diag = p[-width - 1] + p[-width + 1] + p[width - 1] + p[width + 1];
+
+    if (green) {
+        // x: color of the horizontal neighbours, y: color of the vertical ones
+        *x = .125f * (5.f * c + 4.f * h1 - diag - h2 + .5f * v2);
+        *g = c;
+        *y = .125f * (5.f * c + 4.f * v1 - diag - v2 + .5f * h2);
+    } else {
+        // x: color of the pixel, y: color of the diagonal neighbours
+        *x = c;
+        *g = .125f * (4.f * c + 2.f * (h1 + v1) - h2 - v2);
+        *y = .125f * (6.f * c + 2.f * diag - 1.5f * (h2 + v2));
+    }
+}
+
+
+// Interpolates [col_start, col_end) of a row, col_start shall be even
+static void mhc_interpolate_row(
+  const float* rawData,
+  float*       red,
+  float*       green,
+  float*       blue,
+  int          width,
+  int          row,
+  int          col_start,
+  int          col_end,
+  unsigned int filters)
+{
+    // Green is reported either as 1 or 3
+    const bool green_even = (FC(row, 0, filters) & 1) != 0;
+    const int  color      = green_even ? FC(row, 1, filters) : FC(row, 0, filters);
+
+    float* out_x = (color == 0) ? red : blue;
+    float* out_y = (color == 0) ? blue : red;
+
+    const size_t offset = (size_t)row * width;
+    int          col    = col_start;
+
+#ifdef __SSE2__
+    const vmask green_lanes = green_even ? _mm_set_epi32(0, -1, 0, -1) : _mm_set_epi32(-1, 0, -1, 0);
+
+    const vfloat c0125v = F2V(.125f);
+    const vfloat c05v   = F2V(.5f);
+    const vfloat c15v   = F2V(1.5f);
+    const vfloat c2v    = F2V(2.f);
+    const vfloat c4v    = F2V(4.f);
+    const vfloat c5v    = F2V(5.f);
+    const vfloat c6v    = F2V(6.f);
+
+    for (; col + 3 < col_end; col += 4) {
+        const float* p = &rawData[offset + col];
+
+        const vfloat c    = LVFU(p[0]);
+        const vfloat h1   = LVFU(p[-1]) + LVFU(p[1]);
+        const vfloat v1   = LVFU(p[-width]) + LVFU(p[width]);
+        const vfloat h2   = LVFU(p[-2]) + LVFU(p[2]);
+        const vfloat v2   = LVFU(p[-2 * width]) + LVFU(p[2 * width]);
+        const vfloat diag = LVFU(p[-width - 1]) + LVFU(p[-width + 1]) + LVFU(p[width - 1]) + LVFU(p[width + 1]);
+
+        const vfloat x_green = c0125v * (c5v * c + c4v * h1 - diag - h2 + c05v * v2);
+        const vfloat y_green = c0125v * (c5v * c + c4v * v1 - diag - v2 + c05v * h2);
+        const vfloat g_color = c0125v * (c4v * c + c2v * (h1 + v1) - h2 - v2);
+        const vfloat y_color = c0125v * (c6v * c + c2v * diag - c15v * (h2 + v2));
+
+        STVFU(out_x[offset + col], vself(green_lanes, x_green, c));
+        STVFU(green[offset + col], vself(green_lanes, c, g_color));
+        STVFU(out_y[offset + col], vself(green_lanes, y_green, y_color));
+    }
+#endif
+
+    for (; col < col_end; col++) {
+        const bool is_green = ((col & 1) == 0) == green_even;
+
+        mhc_interpolate_pixel(
+          &rawData[offset + col],
+          width,
+          is_green,
+          &out_x[offset + col],
+          &green[offset + col],
+          &out_y[offset + col]);
+    }
+}
+
+
+extern "C"
+{
+    void mhc_demosaic_rgb(
+      const float* rawData, float* red, float* green, float* blue, size_t w, size_t h, unsigned int filters)
+    {
+        const int width  = (int)w;
+        const int height = (int)h;
+
+        const int inner_width  = std::max(0, width - 2 * MHC_BORDER);
+        const int inner_height = std::max(0, height - 2 * MHC_BORDER);
+        const int n_tiles_x    = (inner_width + MHC_TILE_WIDTH - 1) / MHC_TILE_WIDTH;
+        const int n_tiles_y    = (inner_height + MHC_TILE_HEIGHT - 1) / MHC_TILE_HEIGHT;
+
+        #pragma omp parallel for collapse(2) schedule(static)
+        for (int ty = 0; ty < n_tiles_y; ty++) {
+            for (int tx = 0; tx < n_tiles_x; tx++) {
+                const int row_start = MHC_BORDER + ty * MHC_TILE_HEIGHT;
+                const int row_end   = std::min(row_start + MHC_TILE_HEIGHT, height - MHC_BORDER);
+                const int col_start = MHC_BORDER + tx * MHC_TILE_WIDTH;
+                const int col_end   = std::min(col_start + MHC_TILE_WIDTH, width - MHC_BORDER);
+
+                for (int row = row_start; row < row_end; row++) {
+                    mhc_interpolate_row(rawData, red, green, blue, width, row, col_start, col_end, filters);
+                }
+            }
+        }
+
+        border_interpolate(width, height, MHC_BORDER, rawData, red, green, blue, filters);
+    }
+
+
+    void
+    mhc_demosaic(const float* bayered_image, float* debayered_image, size_t width, size_t height, unsigned int filters)
+    {
+        demosaic_rgb_to_img(bayered_image, debayered_image, width, height, filters, mhc_demosaic_rgb);
+    }
+}
@@ -0,0 +1,436 @@
+#include <demosaicing.h>
+#include <color-converter.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#    include <emmintrin.h>
+#endif
+
+// Half resolution demosaicing: each 2x2 cell of the Bayer pattern gives one
+// RGB pixel. The kernels are specialized for each CFA pattern by the position
+// of the colors in the cell: 0 top left, 1 top right, 2 bottom left and 3
+// bottom right. They write through an output policy so that the same pass
+// can write planes, interleaved values or a 8 bits sRGB thumbnail.
+
+// Size of the table encoding linear values to 8 bits sRGB
+#define SRGB8_LUT_SIZE 16384
+
+// Barycentric weights of the 4 nearest samples of a color, proportional to
+// their distance to the center of the cell
+static const float normalization_f = 2.f * std::sqrt(2.f) + std::sqrt(10.f);
+static const float weight_near     = (std::sqrt(2.f) / 2.f) / normalization_f;
+static const float weight_mid      = (std::sqrt(10.f) / 2.f) / normalization_f;
+static const float weight_far      = (3.f * std::sqrt(2.f) / 2.f) / normalization_f;
+
+
+struct PlanarOutput {
+    float* red;
+    float* green;
+    float* blue;
+
+    inline void store(size_t i, float r, float g, float b)
+    {
+        red[i]   = r;
+        green[i] = g;
+        blue[i]  = b;
+    }
+
+#ifdef __SSE2__
+    inline void store4(size_t i, __m128 r, __m128 g, __m128 b)
+    {
+        _mm_storeu_ps(&red[i], r);
+        _mm_storeu_ps(&green[i], g);
+        _mm_storeu_ps(&blue[i], b);
+    }
+#endif
+};
+
+
+struct InterleavedOutput {
+    float* pixels;
+
+    inline void store(size_t i, float r, float g, float b)
+    {
+        pixels[3 * i + 0] = r;
+        pixels[3 * i + 1] = g;
+        pixels[3 * i + 2] = b;
+    }
+
+#ifdef __SSE2__
+    inline void store4(size_t i, __m128 r, __m128 g, __m128 b)
+    {
+        // r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+        const __m128 rg_lo = _mm_unpacklo_ps(r, g);   // r0 g0 r1 g1
+        const __m128 rg_hi = _mm_unpackhi_ps(r, g);   // r2 g2 r3 g3
+        const __m128 b_lo  = _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 1, 0, 0));
+        const __m128 b_hi  = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 2, 2));
+
+        const __m128 v0 = _mm_shuffle_ps(
+          rg_lo, _mm_shuffle_ps(b_lo, rg_lo, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0));
+        const __m128 v1 = _mm_shuffle_ps(
+          _mm_shuffle_ps(rg_lo, b_lo, _MM_SHUFFLE(2, 2, 3, 3)), rg_hi, _MM_SHUFFLE(1, 0, 2, 0));
+        const __m128 v2 = _mm_shuffle_ps(
+          _mm_shuffle_ps(b_hi, rg_hi, _MM_SHUFFLE(2, 2, 0, 0)),
+          _mm_shuffle_ps(rg_hi, b_hi, _MM_SHUFFLE(2, 2, 3, 3)),
+          _MM_SHUFFLE(2, 0, 2, 0));
+
+        _mm_storeu_ps(&pixels[3 * i + 0], v0);
+        _mm_storeu_ps(&pixels[3 * i + 4], v1);
+        _mm_storeu_ps(&pixels[3 * i + 8], v2);
+    }
+#endif
+};
+
+
+struct Srgb8Output {
+    unsigned char*       rgb;
+    float                matrix[9];   // Applied to the camera RGB values
+    const unsigned char* lut;         // Linear [0, 1] to 8 bits sRGB
+
+    inline unsigned char encode(float v) const
+    {
+        // Also maps NaN to 0
+        v = (v > 0.f) ? std::min(v, 1.f) : 0.f;
+
+        return lut[(int)(v * (float)(SRGB8_LUT_SIZE - 1) + .5f)];
+    }
+
+    inline void store(size_t i, float r, float g, float b)
+    {
+        rgb[3 * i + 0] = encode(matrix[0] * r + matrix[1] * g + matrix[2] * b);
+        rgb[3 * i + 1] = encode(matrix[3] * r + matrix[4] * g + matrix[5] * b);
+        rgb[3 * i + 2] = encode(matrix[6] * r + matrix[7] * g + matrix[8] * b);
+    }
+
+#ifdef __SSE2__
+    inline __m128i lut_index(__m128 r, __m128 g, __m128 b, const float* m) const
+    {
+        __m128 v = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0]), r), _mm_mul_ps(_mm_set1_ps(m[1]), g)),
+          _mm_mul_ps(_mm_set1_ps(m[2]), b));
+
+        // _mm_max_ps gives the second operand for NaN
+        v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.f));
+
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps((float)(SRGB8_LUT_SIZE - 1))), _mm_set1_ps(.5f)));
+    }
+
+    inline void store4(size_t i, __m128 r, __m128 g, __m128 b)
+    {
+        int idx[3][4];
+
+        _mm_storeu_si128((__m128i*)idx[0], lut_index(r, g, b, &matrix[0]));
+        _mm_storeu_si128((__m128i*)idx[1], lut_index(r, g, b, &matrix[3]));
+        _mm_storeu_si128((__m128i*)idx[2], lut_index(r, g, b, &matrix[6]));
+
+        unsigned char* out = &rgb[3 * i];
+
+        for (int k = 0; k < 4; k++) {
+            out[3 * k + 0] = lut[idx[0][k]];
+            out[3 * k + 1] = lut[idx[1][k]];
+            out[3 * k + 2] = lut[idx[2][k]];
+        }
+    }
+#endif
+};
+
+
+static const unsigned char* srgb8_lut()
+{
+    static const std::vector<unsigned char> lut = []() {
+        std::vector<unsigned char> values(SRGB8_LUT_SIZE);
+
+        for (int i = 0; i < SRGB8_LUT_SIZE; i++) {
+            values[i] = (unsigned char)(255.f * to_sRGB((float)i / (float)(SRGB8_LUT_SIZE - 1)) + .5f);
+        }
+
+        return values;
+    }();
+
+    return lut.data();
+}
+
+
+// Value at the position P of the cell (cx, cy)
+template<int P>
+static inline float cell_value(const float* bayered_image, size_t width, size_t cx, size_t cy)
+{
+    return bayered_image[(2 * cy + (P >> 1)) * width + 2 * cx + (P & 1)];
+}
+
+
+// Barycentric estimate of the color at the position P at the center of the
+// cell (cx, cy), from the 4 nearest samples. The cell shall not be on the
+// border of the image.
+template<int P>
+static inline float barycentric_value(const float* bayered_image, size_t width, size_t cx, size_t cy)
+{
+    const size_t nx = (P & 1) ? cx - 1 : cx + 1;
+    const size_t ny = (P >> 1) ? cy - 1 : cy + 1;
+
+    return weight_near * cell_value<P>(bayered_image, width, cx, cy)
+           + weight_mid * (cell_value<P>(bayered_image, width, nx, cy) + cell_value<P>(bayered_image, width, cx, ny))
+           + weight_far * cell_value<P>(bayered_image, width, nx, ny);
+}
+
+
+#ifdef __SSE2__
+// Values at the position P of the 4 cells starting at (cx, cy): the two Bayer
+// rows are loaded and the values of the position are shuffled out
+template<int P>
+static inline __m128 load_cells(const float* bayered_image, size_t width, size_t cx, size_t cy)
+{
+    const float* p  = &bayered_image[(2 * cy + (P >> 1)) * width + 2 * cx];
+    const __m128 v0 = _mm_loadu_ps(p);
+    const __m128 v1 = _mm_loadu_ps(p + 4);
+
+    return (P & 1) ? _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)) : _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+
+template<int P>
+static inline __m128 barycentric_cells(const float* bayered_image, size_t width, size_t cx, size_t cy)
+{
+    const size_t nx = (P & 1) ? cx - 1 : cx + 1;
+    const size_t ny = (P >> 1) ? cy - 1 : cy + 1;
+
+    const __m128 v_near = load_cells<P>(bayered_image, width, cx, cy);
+    const __m128 v_mid = _mm_add_ps(load_cells<P>(bayered_image, width, nx, cy), load_cells<P>(bayered_image, width, cx, ny));
+    const __m128 v_far = load_cells<P>(bayered_image, width, nx, ny);
+
+    return _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(_mm_set1_ps(weight_near), v_near), _mm_mul_ps(_mm_set1_ps(weight_mid), v_mid)),
+      _mm_mul_ps(_mm_set1_ps(weight_far), v_far));
+}
+#endif
+
+
+// Reduce 2x2 of the cells [x_start, x_end) of the row y
+template<int R, int G1, int G2, int B, typename Output>
+static void reduce2x2_row(const float* bayered_image, size_t width, size_t y, size_t x_start, size_t x_end, Output& output)
+{
+    const size_t scanline_image = width / 2;
+    size_t       x              = x_start;
+
+#ifdef __SSE2__
+    const __m128 half = _mm_set1_ps(.5f);
+
+    for (; x + 4 <= x_end; x += 4) {
+        const __m128 g = _mm_add_ps(load_cells<G1>(bayered_image, width, x, y), load_cells<G2>(bayered_image, width, x, y));
+
+        output.store4(
+          y * scanline_image + x,
+          load_cells<R>(bayered_image, width, x, y),
+          _mm_mul_ps(half, g),
+          load_cells<B>(bayered_image, width, x, y));
+    }
+#endif
+
+    for (; x < x_end; x++) {
+        output.store(
+          y * scanline_image + x,
+          cell_value<R>(bayered_image, width, x, y),
+          .5f * (cell_value<G1>(bayered_image, width, x, y) + cell_value<G2>(bayered_image, width, x, y)),
+          cell_value<B>(bayered_image, width, x, y));
+    }
+}
+
+
+template<int R, int G1, int G2, int B, typename Output>
+static void reduce2x2(const float* bayered_image, size_t width, size_t height, Output output)
+{
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < (int)(height / 2); y++) {
+        Output row_output = output;
+        reduce2x2_row<R, G1, G2, B>(bayered_image, width, y, 0, width / 2, row_output);
+    }
+}
+
+
+// Cells on the border of the image are reduced, they miss neighbours
+template<int R, int G1, int G2, int B, typename Output>
+static void barycentric2x2(const float* bayered_image, size_t width, size_t height, Output output)
+{
+    const size_t out_width  = width / 2;
+    const size_t out_height = height / 2;
+
+    if (out_width < 3 || out_height < 3) {
+        reduce2x2<R, G1, G2, B>(bayered_image, width, height, output);
+        return;
+    }
+
+    const size_t scanline_image = out_width;
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < (int)out_height; y++) {
+        Output row_output = output;
+
+        if (y == 0 || y == (int)out_height - 1) {
+            reduce2x2_row<R, G1, G2, B>(bayered_image, width, y, 0, out_width, row_output);
+            continue;
+        }
+
+        reduce2x2_row<R, G1, G2, B>(bayered_image, width, y, 0, 1, row_output);
+
+        size_t x = 1;
+
+#ifdef __SSE2__
+        const __m128 half = _mm_set1_ps(.5f);
+
+        for (; x + 4 <= out_width - 1; x += 4) {
+            const __m128 g
+              = _mm_add_ps(load_cells<G1>(bayered_image, width, x, y), load_cells<G2>(bayered_image, width, x, y));
+
+            row_output.store4(
+              y * scanline_image + x,
+              barycentric_cells<R>(bayered_image, width, x, y),
+              _mm_mul_ps(half, g),
+              barycentric_cells<B>(bayered_image, width, x, y));
+        }
+#endif
+
+        for (; x < out_width - 1; x++) {
+            row_output.store(
+              y * scanline_image + x,
+              barycentric_value<R>(bayered_image, width, x, y),
+              .5f * (cell_value<G1>(bayered_image, width, x, y) + cell_value<G2>(bayered_image, width, x, y)),
+              barycentric_value<B>(bayered_image, width, x, y));
+        }
+
+        reduce2x2_row<R, G1, G2, B>(bayered_image, width, y, out_width - 1, out_width, row_output);
+    }
+}
+
+
+// Runs a 2x2 kernel specialized for the CFA pattern
+template<typename Output>
+static int dispatch2x2(
+  const float* bayered_image, size_t width, size_t height, unsigned int filters, bool barycentric, Output output)
+{
+    switch (filters) {
+        case 0x16161616:   // BGGR
+            if (barycentric) {
+                barycentric2x2<3, 1, 2, 0>(bayered_image, width, height, output);
+            } else {
+                reduce2x2<3, 1, 2, 0>(bayered_image, width, height, output);
+            }
+            return 0;
+
+        case 0x61616161:   // GRBG
+            if (barycentric) {
+                barycentric2x2<1, 0, 3, 2>(bayered_image, width, height, output);
+            } else {
+                reduce2x2<1, 0, 3, 2>(bayered_image, width, height, output);
+            }
+            return 0;
+
+        case 0x49494949:   // GBRG
+            if (barycentric) {
+                barycentric2x2<2, 0, 3, 1>(bayered_image, width, height, output);
+            } else {
+                reduce2x2<2, 0, 3, 1>(bayered_image, width, height, output);
+            }
+            return 0;
+
+        case 0x94949494:   // RGGB
+            if (barycentric) {
+                barycentric2x2<0, 1, 2, 3>(bayered_image, width, height, output);
+            } else {
+                reduce2x2<0, 1, 2, 3>(bayered_image, width, height, output);
+            }
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+
+extern "C"
+{
+    void reduce2x2_demosaic_rgb(
+      const float* bayered_image,
+      float*       pixels_red,
+      float*       pixels_green,
+      float*       pixels_blue,
+      size_t       width,
+      size_t       height,
+      unsigned int filters)
+    {
+        PlanarOutput output = {pixels_red, pixels_green, pixels_blue};
+        dispatch2x2(bayered_image, width, height, filters, false, output);
+    }
+
+
+    void reduce2x2_demosaic(
+      const float* bayered_image, float* debayered_image, size_t width, size_t height, unsigned int filters)
+    {
+        InterleavedOutput output = {debayered_image};
+        dispatch2x2(bayered_image, width, height, filters, false, output);
+    }
+
+
+    void barycentric2x2_demosaic_rgb(
+      const float* bayered_image,
+      float*       pixels_red,
+      float*       pixels_green,
+      float*       pixels_blue,
+      size_t       width,
+      size_t       height,
+      unsigned int filters)
+    {
+        PlanarOutput output = {pixels_red, pixels_green, pixels_blue};
+        dispatch2x2(bayered_image, width, height, filters, true, output);
+    }
+
+
+    void barycentric2x2_demosaic(
+      const float* bayered_image, float* debayered_image, size_t width, size_t height, unsigned int filters)
+    {
+        InterleavedOutput output = {debayered_image};
+        dispatch2x2(bayered_image, width, height, filters, true, output);
+    }
+
+
+    int demosaic_thumbnail_srgb8(
+      const float*      bayered_image,
+      size_t            width,
+      size_t            height,
+      unsigned int      filters,
+      RAWDemosaicMethod method,
+      const float*      matrix,
+      unsigned char*    thumbnail)
+    {
+        if (method != REDUCE2X2 && method != BARYCENTRIC2X2) {
+            return -1;
+        }
+
+        Srgb8Output output;
+        output.rgb = thumbnail;
+        output.lut = srgb8_lut();
+
+        if (matrix != NULL) {
+            // Same as correct_image: camera RGB to XYZ then XYZ to linear
+            // sRGB, combined column by column
+            for (int c = 0; c < 3; c++) {
+                const float column[3] = {matrix[c], matrix[3 + c], matrix[6 + c]};
+                float       rgb[3];
+
+                XYZ_to_RGB(column, rgb);
+
+                output.matrix[c]     = rgb[0];
+                output.matrix[3 + c] = rgb[1];
+                output.matrix[6 + c] = rgb[2];
+            }
+        } else {
+            const float identity[9] = {1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f};
+            memcpy(output.matrix, identity, sizeof(identity));
+        }
+
+        return dispatch2x2(bayered_image, width, height, filters, method == BARYCENTRIC2X2, output);
+    }
+}
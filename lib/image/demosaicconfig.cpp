@@ -0,0 +1,643 @@
+#include <demosaicing.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#    include <direct.h>
+#else
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#ifdef _OPENMP
+#    include <omp.h>
+#endif
+
+// Compile time default of the AMaZE tile size, 160 is the fastest on most
+// x86/64 machines
+#ifndef AMAZETS
+#    define AMAZETS 160
+#endif
+
+// Throughput per thread in Mpx/s measured on a x86/64 desktop, in the order
+// of RAWDemosaicMethod
+static const float default_throughput[NONE] = {40.f, 2000.f, 1500.f, 8.f, 15.f, 20.f, 13.f, 260.f};
+
+// Full resolution methods usable by AUTO, from the lowest to the highest
+// quality
+static const RAWDemosaicMethod auto_methods[] = {BASIC, MHC, VNG4, AHD, RCD, AMAZE};
+
+// Candidates are timed with explicit tile sizes, see demosaic.cpp: the sizes
+// in use are left to the concurrent demosaicing calls
+void demosaic_rgb_tiled(
+  const float*             bayered_image,
+  float*                   pixels_red,
+  float*                   pixels_green,
+  float*                   pixels_blue,
+  size_t                   width,
+  size_t                   height,
+  unsigned int             filters,
+  RAWDemosaicMethod        method,
+  const DemosaicTileSizes* tile_sizes);
+
+static DemosaicTileSizes   g_tile_sizes = {AMAZETS, 144, 214};
+static DemosaicThroughput  g_throughput;
+static DemosaicAutoOptions g_auto_options = {0.f, AMAZE};
+static std::mutex          g_config_mutex;
+static std::once_flag      g_host_config_loaded;
+
+
+static int max_threads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+
+static int auto_quality_rank(RAWDemosaicMethod method)
+{
+    for (size_t i = 0; i < sizeof(auto_methods) / sizeof(auto_methods[0]); i++) {
+        if (auto_methods[i] == method) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+
+static int auto_quality_rank_from_name(const std::string& name)
+{
+    for (size_t i = 0; i < sizeof(auto_methods) / sizeof(auto_methods[0]); i++) {
+        if (name == demosaic_method_name(auto_methods[i])) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+
+static bool valid_tile_sizes(const DemosaicTileSizes* sizes)
+{
+    return sizes->amaze >= 96 && sizes->amaze <= 992 && sizes->amaze % 32 == 0   //
+           && sizes->ahd >= 16 && sizes->ahd <= 1024                           //
+           && sizes->rcd >= 32 && sizes->rcd <= 1024;
+}
+
+
+// Configuration files hold one "key value" entry per line, lines starting
+// with # are comments
+static int read_config(const char* filename, std::map<std::string, std::string>& entries)
+{
+    std::ifstream fin(filename);
+
+    if (!fin.good()) {
+        return -1;
+    }
+
+    std::string line;
+
+    while (std::getline(fin, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream ss(line);
+        std::string        key, value;
+
+        if (ss >> key >> value) {
+            entries[key] = value;
+        }
+    }
+
+    return 0;
+}
+
+
+static void make_parent_directories(const std::string& filename)
+{
+    for (size_t sep = filename.find_first_of("/\\", 1); sep != std::string::npos;
+         sep        = filename.find_first_of("/\\", sep + 1)) {
+        const std::string dir = filename.substr(0, sep);
+#ifdef _WIN32
+        _mkdir(dir.c_str());
+#else
+        mkdir(dir.c_str(), 0755);
+#endif
+    }
+}
+
+
+// Updates entries of a configuration file, the other ones are kept
+static int update_config(const char* filename, const std::map<std::string, std::string>& updated)
+{
+    std::map<std::string, std::string> entries;
+    read_config(filename, entries);
+
+    for (const auto& it : updated) {
+        entries[it.first] = it.second;
+    }
+
+    make_parent_directories(filename);
+
+    FILE* fout = fopen(filename, "w");
+
+    if (fout == NULL) {
+        std::cerr << "Cannot open file " << filename << " for writing" << std::endl;
+        return -1;
+    }
+
+    fprintf(fout, "# camera-calibration demosaicing configuration\n");
+
+    for (const auto& it : entries) {
+        fprintf(fout, "%s %s\n", it.first.c_str(), it.second.c_str());
+    }
+
+    fclose(fout);
+
+    return 0;
+}
+
+
+static void load_host_config()
+{
+    const char* filename = demosaic_host_config_filename();
+
+    DemosaicTileSizes sizes = g_tile_sizes;
+
+    if (demosaic_load_tile_sizes(filename, &sizes) == 0) {
+        g_tile_sizes = sizes;
+    }
+
+    demosaic_default_throughput(&g_throughput);
+    demosaic_load_throughput(filename, &g_throughput);
+
+    std::map<std::string, std::string> entries;
+    read_config(filename, entries);
+
+    DemosaicAutoOptions options = g_auto_options;
+
+    bool valid = true;
+
+    if (entries.count("auto_time_budget_ms")) {
+        options.time_budget_ms = (float)atof(entries["auto_time_budget_ms"].c_str());
+        valid                  = options.time_budget_ms >= 0;
+    }
+
+    // Only the methods usable by AUTO
+    if (entries.count("auto_min_quality")) {
+        const int rank = auto_quality_rank_from_name(entries["auto_min_quality"]);
+
+        if (rank >= 0) {
+            options.min_quality = auto_methods[rank];
+        }
+
+        valid = valid && rank >= 0;
+    }
+
+    if (valid) {
+        g_auto_options = options;
+    } else {
+        std::cerr << "Invalid AUTO demosaicing options in " << filename << ", using the defaults" << std::endl;
+    }
+}
+
+
+// Best time in ms of a few runs of a demosaicing method with the given tile
+// sizes
+static double time_method(
+  RAWDemosaicMethod        method,
+  const DemosaicTileSizes* tile_sizes,
+  const float*             bayered_image,
+  std::vector<float>&      buffer,
+  size_t                   width,
+  size_t                   height,
+  unsigned int             filters)
+{
+    const size_t n_elems = width * height;
+    double       best    = -1;
+
+    for (int i = 0; i < 3; i++) {
+        const auto start = std::chrono::steady_clock::now();
+
+        demosaic_rgb_tiled(
+          bayered_image,
+          &buffer[0],
+          &buffer[n_elems],
+          &buffer[2 * n_elems],
+          width,
+          height,
+          filters,
+          method,
+          tile_sizes);
+
+        const auto   end = std::chrono::steady_clock::now();
+        const double ms  = std::chrono::duration<double, std::milli>(end - start).count();
+
+        best = (best < 0) ? ms : std::min(best, ms);
+    }
+
+    return best;
+}
+
+
+extern "C"
+{
+    void demosaic_default_tile_sizes(DemosaicTileSizes* sizes)
+    {
+        sizes->amaze = AMAZETS;
+        sizes->ahd   = 144;
+        sizes->rcd   = 214;
+    }
+
+
+    void demosaic_get_tile_sizes(DemosaicTileSizes* sizes)
+    {
+        std::call_once(g_host_config_loaded, load_host_config);
+
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        *sizes = g_tile_sizes;
+    }
+
+
+    int demosaic_set_tile_sizes(const DemosaicTileSizes* sizes)
+    {
+        if (!valid_tile_sizes(sizes)) {
+            std::cerr << "Invalid tile sizes: AMaZE " << sizes->amaze << ", AHD " << sizes->ahd << ", RCD "
+                      << sizes->rcd << std::endl;
+            return -1;
+        }
+
+        // Makes sure a later first use does not override the sizes with the
+        // host configuration
+        std::call_once(g_host_config_loaded, load_host_config);
+
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        g_tile_sizes = *sizes;
+
+        return 0;
+    }
+
+
+    const char* demosaic_host_config_filename()
+    {
+        static std::string filename;
+        static std::once_flag once;
+
+        std::call_once(once, []() {
+            const char* env = getenv("CAMCALIB_DEMOSAIC_CONFIG");
+
+            if (env != NULL && env[0] != '\0') {
+                filename = env;
+                return;
+            }
+
+            char        host[256] = "unknown";
+            const char* home      = NULL;
+#ifdef _WIN32
+            const char* computer = getenv("COMPUTERNAME");
+            if (computer != NULL) {
+                snprintf(host, sizeof(host), "%s", computer);
+            }
+            home = getenv("APPDATA");
+            filename = std::string(home != NULL ? home : ".") + "\\camera-calibration\\demosaic-" + host + ".cfg";
+#else
+            gethostname(host, sizeof(host) - 1);
+            home     = getenv("HOME");
+            filename = std::string(home != NULL ? home : ".") + "/.config/camera-calibration/demosaic-" + host + ".cfg";
+#endif
+        });
+
+        return filename.c_str();
+    }
+
+
+    int demosaic_load_tile_sizes(const char* filename, DemosaicTileSizes* sizes)
+    {
+        std::map<std::string, std::string> entries;
+
+        if (read_config(filename, entries) != 0) {
+            return -1;
+        }
+
+        DemosaicTileSizes loaded = *sizes;
+
+        if (entries.count("amaze_tile_size")) loaded.amaze = atoi(entries["amaze_tile_size"].c_str());
+        if (entries.count("ahd_tile_size")) loaded.ahd = atoi(entries["ahd_tile_size"].c_str());
+        if (entries.count("rcd_tile_size")) loaded.rcd = atoi(entries["rcd_tile_size"].c_str());
+
+        if (!valid_tile_sizes(&loaded)) {
+            std::cerr << "Invalid tile sizes in " << filename << ", using the defaults" << std::endl;
+            return -1;
+        }
+
+        *sizes = loaded;
+
+        return 0;
+    }
+
+
+    int demosaic_save_tile_sizes(const char* filename, const DemosaicTileSizes* sizes)
+    {
+        std::map<std::string, std::string> entries;
+        entries["amaze_tile_size"] = std::to_string(sizes->amaze);
+        entries["ahd_tile_size"]   = std::to_string(sizes->ahd);
+        entries["rcd_tile_size"]   = std::to_string(sizes->rcd);
+
+        return update_config(filename, entries);
+    }
+
+
+    int demosaic_autotune_tile_sizes(
+      const float* bayered_image, size_t width, size_t height, unsigned int filters, DemosaicTileSizes* best)
+    {
+        if (width < 64 || height < 64) {
+            std::cerr << "The mosaic is too small to tune the tile sizes" << std::endl;
+            return -1;
+        }
+
+        const int amaze_candidates[] = {96, 128, 160, 192, 224, 256, 320, 384, 512};
+        const int ahd_candidates[]   = {64, 96, 128, 144, 192, 256, 384};
+        const int rcd_candidates[]   = {118, 150, 182, 214, 278, 342, 470};
+
+        DemosaicTileSizes initial;
+        demosaic_get_tile_sizes(&initial);
+
+        DemosaicTileSizes  current = initial;
+        std::vector<float> buffer(3 * width * height);
+        double             best_ms;
+
+        *best = initial;
+
+        best_ms = -1;
+        for (int candidate : amaze_candidates) {
+            current.amaze = candidate;
+            const double ms = time_method(AMAZE, &current, bayered_image, buffer, width, height, filters);
+            if (best_ms < 0 || ms < best_ms) {
+                best_ms     = ms;
+                best->amaze = candidate;
+            }
+        }
+        current.amaze = best->amaze;
+
+        best_ms = -1;
+        for (int candidate : ahd_candidates) {
+            current.ahd = candidate;
+            const double ms = time_method(AHD, &current, bayered_image, buffer, width, height, filters);
+            if (best_ms < 0 || ms < best_ms) {
+                best_ms   = ms;
+                best->ahd = candidate;
+            }
+        }
+        current.ahd = best->ahd;
+
+        best_ms = -1;
+        for (int candidate : rcd_candidates) {
+            current.rcd = candidate;
+            const double ms = time_method(RCD, &current, bayered_image, buffer, width, height, filters);
+            if (best_ms < 0 || ms < best_ms) {
+                best_ms   = ms;
+                best->rcd = candidate;
+            }
+        }
+
+        return 0;
+    }
+
+
+    void demosaic_default_throughput(DemosaicThroughput* throughput)
+    {
+        for (int m = 0; m < NONE; m++) {
+            throughput->mpx_per_s[m] = default_throughput[m];
+        }
+    }
+
+
+    void demosaic_get_throughput(DemosaicThroughput* throughput)
+    {
+        std::call_once(g_host_config_loaded, load_host_config);
+
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        *throughput = g_throughput;
+    }
+
+
+    int demosaic_set_throughput(const DemosaicThroughput* throughput)
+    {
+        for (int m = 0; m < NONE; m++) {
+            if (!(throughput->mpx_per_s[m] > 0)) {
+                std::cerr << "Invalid throughput for " << demosaic_method_name((RAWDemosaicMethod)m) << ": "
+                          << throughput->mpx_per_s[m] << std::endl;
+                return -1;
+            }
+        }
+
+        std::call_once(g_host_config_loaded, load_host_config);
+
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        g_throughput = *throughput;
+
+        return 0;
+    }
+
+
+    int demosaic_load_throughput(const char* filename, DemosaicThroughput* throughput)
+    {
+        std::map<std::string, std::string> entries;
+
+        if (read_config(filename, entries) != 0) {
+            return -1;
+        }
+
+        DemosaicThroughput loaded = *throughput;
+
+        for (int m = 0; m < NONE; m++) {
+            const std::string key = std::string("throughput_") + demosaic_method_name((RAWDemosaicMethod)m);
+
+            if (entries.count(key)) {
+                loaded.mpx_per_s[m] = (float)atof(entries[key].c_str());
+
+                if (!(loaded.mpx_per_s[m] > 0)) {
+                    std::cerr << "Invalid throughput in " << filename << ", using the defaults" << std::endl;
+                    return -1;
+                }
+            }
+        }
+
+        *throughput = loaded;
+
+        return 0;
+    }
+
+
+    int demosaic_save_throughput(const char* filename, const DemosaicThroughput* throughput)
+    {
+        std::map<std::string, std::string> entries;
+
+        for (int m = 0; m < NONE; m++) {
+            const std::string key = std::string("throughput_") + demosaic_method_name((RAWDemosaicMethod)m);
+
+            entries[key] = std::to_string(throughput->mpx_per_s[m]);
+        }
+
+        return update_config(filename, entries);
+    }
+
+
+    int demosaic_calibrate_throughput(
+      const float* bayered_image, size_t width, size_t height, unsigned int filters, DemosaicThroughput* throughput)
+    {
+        if (width < 64 || height < 64) {
+            std::cerr << "The mosaic is too small to measure the throughput" << std::endl;
+            return -1;
+        }
+
+        const double       mpx = (double)(width * height) * 1e-6;
+        std::vector<float> buffer(3 * width * height);
+        DemosaicTileSizes  sizes;
+
+        demosaic_get_tile_sizes(&sizes);
+
+        for (int m = 0; m < NONE; m++) {
+            const double ms = time_method((RAWDemosaicMethod)m, &sizes, bayered_image, buffer, width, height, filters);
+
+            throughput->mpx_per_s[m] = (float)(mpx / (ms * 1e-3) / (double)max_threads());
+        }
+
+        return 0;
+    }
+
+
+    void demosaic_default_auto_options(DemosaicAutoOptions* options)
+    {
+        options->time_budget_ms = 0.f;
+        options->min_quality    = AMAZE;
+    }
+
+
+    void demosaic_get_auto_options(DemosaicAutoOptions* options)
+    {
+        std::call_once(g_host_config_loaded, load_host_config);
+
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        *options = g_auto_options;
+    }
+
+
+    int demosaic_set_auto_options(const DemosaicAutoOptions* options)
+    {
+        if (options->time_budget_ms < 0 || auto_quality_rank(options->min_quality) < 0) {
+            std::cerr << "Invalid AUTO demosaicing options: the budget shall be positive and the minimum quality a "
+                         "full resolution method"
+                      << std::endl;
+            return -1;
+        }
+
+        std::call_once(g_host_config_loaded, load_host_config);
+
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        g_auto_options = *options;
+
+        return 0;
+    }
+
+
+    int demosaic_parse_method(const char* name, RAWDemosaicMethod* method, DemosaicAutoOptions* options)
+    {
+        demosaic_get_auto_options(options);
+
+        // AUTO with a time budget or a quality target
+        if (strncmp(name, "AUTO:", 5) != 0) {
+            return demosaic_method_from_name(name, method);
+        }
+
+        DemosaicAutoOptions parsed = *options;
+
+        const char* arg = name + 5;
+        char*       end = NULL;
+
+        const float budget_ms = strtof(arg, &end);
+
+        if (end != arg && *end == '\0' && budget_ms >= 0) {
+            parsed.time_budget_ms = budget_ms;
+        } else if (auto_quality_rank_from_name(arg) >= 0) {
+            parsed.time_budget_ms = 0;
+            parsed.min_quality    = auto_methods[auto_quality_rank_from_name(arg)];
+        } else {
+            return -1;
+        }
+
+        *method  = AUTO;
+        *options = parsed;
+
+        return 0;
+    }
+
+
+    RAWDemosaicMethod demosaic_auto_select(size_t width, size_t height, float* expected_ms)
+    {
+        DemosaicAutoOptions options;
+        demosaic_get_auto_options(&options);
+
+        return demosaic_auto_select_with(&options, width, height, expected_ms);
+    }
+
+
+    RAWDemosaicMethod demosaic_auto_select_with(
+      const DemosaicAutoOptions* options, size_t width, size_t height, float* expected_ms)
+    {
+        DemosaicThroughput throughput;
+        demosaic_get_throughput(&throughput);
+
+        const int    n_methods = (int)(sizeof(auto_methods) / sizeof(auto_methods[0]));
+        const double mpx       = (double)(width * height) * 1e-6;
+        const int    n_threads = max_threads();
+
+        double ms[n_methods];
+
+        for (int i = 0; i < n_methods; i++) {
+            ms[i] = 1e3 * mpx / ((double)throughput.mpx_per_s[auto_methods[i]] * n_threads);
+        }
+
+        int selected = -1;
+
+        if (options->time_budget_ms > 0) {
+            // Best quality within the budget
+            for (int i = n_methods - 1; i >= 0 && selected < 0; i--) {
+                if (ms[i] <= options->time_budget_ms) {
+                    selected = i;
+                }
+            }
+
+            // Otherwise, the fastest
+            if (selected < 0) {
+                selected = (int)(std::min_element(ms, ms + n_methods) - ms);
+            }
+        } else {
+            // Fastest with the required quality
+            const int first = std::max(0, auto_quality_rank(options->min_quality));
+            selected        = (int)(std::min_element(ms + first, ms + n_methods) - ms);
+        }
+
+        if (expected_ms != NULL) {
+            *expected_ms = (float)ms[selected];
+        }
+
+        return auto_methods[selected];
+    }
+}
@@ -0,0 +1,200 @@
+#include <hdrmerge.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+extern "C"
+{
+    float raw_exposure(const RAWMetadata* metadata)
+    {
+        const float aperture = (metadata->aperture > 0) ? metadata->aperture : 1.f;
+        const float gain     = (metadata->gain > 0) ? metadata->gain : 1.f;
+
+        return metadata->exposureTime * gain / (aperture * aperture);
+    }
+
+
+    int hdr_merge_init(HDRMerge* merge, size_t width, size_t height, uint32_t filters, float reference_exposure)
+    {
+        merge->radiance_sum = NULL;
+        merge->weight_sum   = NULL;
+        merge->fallback     = NULL;
+
+        if (reference_exposure <= 0) {
+            std::cerr << "Invalid reference exposure: " << reference_exposure << std::endl;
+            return -1;
+        }
+
+        merge->width   = width;
+        merge->height  = height;
+        merge->filters = filters;
+
+        merge->saturation  = 0.95f;
+        merge->black_level = 0.f;
+        merge->shot_noise  = 1e-4f;
+        merge->read_noise  = 1e-3f;
+
+        merge->reference_exposure = reference_exposure;
+        merge->fallback_exposure  = 0.f;
+        merge->n_frames           = 0;
+
+        merge->radiance_sum = (float*)calloc(width * height, sizeof(float));
+        merge->weight_sum   = (float*)calloc(width * height, sizeof(float));
+        merge->fallback     = (float*)calloc(width * height, sizeof(float));
+
+        if (merge->radiance_sum == NULL || merge->weight_sum == NULL || merge->fallback == NULL) {
+            std::cerr << "Memory allocation error" << std::endl;
+            hdr_merge_free(merge);
+            return -1;
+        }
+
+        return 0;
+    }
+
+
+    int hdr_merge_add(HDRMerge* merge, const float* bayered_pixels, float exposure, float gain)
+    {
+        if (exposure <= 0) {
+            std::cerr << "Invalid exposure: " << exposure << std::endl;
+            return -1;
+        }
+
+        const bool   update_fallback = merge->n_frames == 0 || exposure < merge->fallback_exposure;
+        const float  inv_exposure    = 1.f / exposure;
+        const float  shot            = ((gain > 0) ? gain : 1.f) * merge->shot_noise;
+        const float  read_var        = merge->read_noise * merge->read_noise;
+        const size_t width           = merge->width;
+
+        #pragma omp parallel for
+        for (int y = 0; y < (int)merge->height; y++) {
+            const float* row_in       = &bayered_pixels[y * width];
+            float*       row_radiance = &merge->radiance_sum[y * width];
+            float*       row_weight   = &merge->weight_sum[y * width];
+            float*       row_fallback = &merge->fallback[y * width];
+
+            for (size_t x = 0; x < width; x++) {
+                const float v = std::max(row_in[x] - merge->black_level, 0.f);
+
+                // Inverse variance of the radiance v / exposure, zero when saturated
+                const float w = (row_in[x] < merge->saturation) ? exposure * exposure / (shot * v + read_var) : 0.f;
+
+                row_radiance[x] += w * v * inv_exposure;
+                row_weight[x] += w;
+
+                if (update_fallback) {
+                    row_fallback[x] = v * inv_exposure;
+                }
+            }
+        }
+
+        if (update_fallback) {
+            merge->fallback_exposure = exposure;
+        }
+
+        merge->n_frames++;
+
+        return 0;
+    }
+
+
+    void hdr_merge_resolve(const HDRMerge* merge, float* bayered_pixels)
+    {
+        const int n_elems = (int)(merge->width * merge->height);
+
+        #pragma omp parallel for
+        for (int i = 0; i < n_elems; i++) {
+            const float radiance = (merge->weight_sum[i] > 0) ? merge->radiance_sum[i] / merge->weight_sum[i]
+                                                              : merge->fallback[i];
+
+            bayered_pixels[i] = radiance * merge->reference_exposure;
+        }
+    }
+
+
+    void hdr_merge_free(HDRMerge* merge)
+    {
+        free(merge->radiance_sum);
+        free(merge->weight_sum);
+        free(merge->fallback);
+
+        merge->radiance_sum = NULL;
+        merge->weight_sum   = NULL;
+        merge->fallback     = NULL;
+    }
+
+
+    int hdr_merge_raw_files(
+      const char** filenames,
+      size_t       n_files,
+      float**      bayered_pixels,
+      size_t*      width,
+      size_t*      height,
+      uint32_t*    filters,
+      RAWMetadata* metadata)
+    {
+        HDRMerge merge;
+        merge.radiance_sum = NULL;
+        merge.weight_sum   = NULL;
+        merge.fallback     = NULL;
+
+        int err = 0;
+
+        for (size_t i = 0; i < n_files && err == 0; i++) {
+            RAWMetadata frame_metadata;
+            frame_metadata.bayerPattern   = NULL;
+            frame_metadata.filename_image = NULL;
+            frame_metadata.filename_info  = NULL;
+
+            float*   frame         = NULL;
+            size_t   frame_width   = 0;
+            size_t   frame_height  = 0;
+            uint32_t frame_filters = 0;
+
+            err = read_raw_metadata(filenames[i], &frame_metadata);
+
+            if (err == 0) {
+                err = read_raw_file(filenames[i], &frame, &frame_width, &frame_height, &frame_filters);
+            }
+
+            if (err == 0 && i == 0) {
+                *width   = frame_width;
+                *height  = frame_height;
+                *filters = frame_filters;
+
+                err = hdr_merge_init(&merge, frame_width, frame_height, frame_filters, raw_exposure(&frame_metadata));
+            } else if (err == 0 && (frame_width != *width || frame_height != *height || frame_filters != *filters)) {
+                std::cerr << "Frame " << filenames[i] << " does not match the first frame" << std::endl;
+                err = -1;
+            }
+
+            if (err == 0) {
+                err = hdr_merge_add(&merge, frame, raw_exposure(&frame_metadata), frame_metadata.gain);
+            } else {
+                std::cerr << "Could not merge " << filenames[i] << std::endl;
+            }
+
+            free(frame);
+
+            if (i == 0 && metadata != NULL) {
+                *metadata = frame_metadata;
+            } else {
+                free(frame_metadata.bayerPattern);
+                free(frame_metadata.filename_image);
+                free(frame_metadata.filename_info);
+            }
+        }
+
+        if (err == 0 && n_files > 0) {
+            *bayered_pixels = (float*)calloc((*width) * (*height), sizeof(float));
+            hdr_merge_resolve(&merge, *bayered_pixels);
+        } else if (err == 0) {
+            err = -1;
+        }
+
+        hdr_merge_free(&merge);
+
+        return err;
+    }
+}
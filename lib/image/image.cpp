@@ -16,7 +16,7 @@ extern "C"
         }
 
         if (strcmp(filename + len - 3, "txt") == 0 || strcmp(filename + len - 3, "TXT") == 0) {
-            return read_raw(filename, pixels, width, height, AMAZE);
+            return read_raw(filename, pixels, width, height, AUTO);
         }
 
 #ifdef HAS_TIFF
@@ -48,7 +48,7 @@ extern "C"
         }
 
         if (strcmp(filename + len - 3, "txt") == 0 || strcmp(filename + len - 3, "TXT") == 0) {
-            return read_raw_rgb(filename, pixels_red, pixels_green, pixels_blue, width, height, AMAZE);
+            return read_raw_rgb(filename, pixels_red, pixels_green, pixels_blue, width, height, AUTO);
         }
 
 #ifdef HAS_TIFF
@@ -111,7 +111,8 @@ extern "C"
 
     void correct_image(float* pixels, size_t width, size_t height, float* matrix)
     {
-        for (size_t i = 0; i < width * height; i++) {
+        #pragma omp parallel for
+        for (int i = 0; i < (int)(width * height); i++) {
             float tmp_color[3];
             matmul(matrix, &pixels[3 * i], tmp_color);
             XYZ_to_RGB(tmp_color, &pixels[3 * i]);
@@ -1,13 +1,76 @@
 #include <imageraw.h>
 #include <imageprocessing.h>
 #include <imagergb.h>
+#include <image.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
 
 #include <tinyxml2.h>
 
+// Converts samples to normalized floats and applies the calibration frames in
+// the same pass so the correction does not cost an extra trip to memory
+template<typename T>
+static void convert_calibrated(
+  const T* buff, float* bayered_image, int n_elems, float renorm, const RAWCalibration* calibration)
+{
+    if (calibration == NULL) {
+        #pragma omp parallel for
+        for (int i = 0; i < n_elems; i++)
+            bayered_image[i] = (float)buff[i] / renorm;
+
+        return;
+    }
+
+    const float  inv_renorm = 1.f / renorm;
+    const float  black      = calibration->black_level;
+    const float* dark       = calibration->dark;
+    const float* flat_gain  = calibration->flat_gain;
+
+    if (dark != NULL && flat_gain != NULL) {
+        #pragma omp parallel for
+        for (int i = 0; i < n_elems; i++)
+            bayered_image[i] = ((float)buff[i] * inv_renorm - dark[i]) * flat_gain[i];
+    } else if (dark != NULL) {
+        #pragma omp parallel for
+        for (int i = 0; i < n_elems; i++)
+            bayered_image[i] = (float)buff[i] * inv_renorm - dark[i];
+    } else if (flat_gain != NULL) {
+        #pragma omp parallel for
+        for (int i = 0; i < n_elems; i++)
+            bayered_image[i] = ((float)buff[i] * inv_renorm - black) * flat_gain[i];
+    } else {
+        #pragma omp parallel for
+        for (int i = 0; i < n_elems; i++)
+            bayered_image[i] = (float)buff[i] * inv_renorm - black;
+    }
+}
+
+
+// Loads a single channel master frame
+static int read_master_frame(const char* filename, float** pixels, size_t* width, size_t* height)
+{
+    const size_t len = strlen(filename);
+
+    if (strcmp(filename + len - 3, "txt") == 0 || strcmp(filename + len - 3, "TXT") == 0) {
+        uint32_t filters;
+        return read_raw_file(filename, pixels, width, height, &filters);
+    }
+
+    float* pg = NULL;
+    float* pb = NULL;
+
+    int err = read_image_rgb(filename, pixels, &pg, &pb, width, height);
+
+    free(pg);
+    free(pb);
+
+    return err;
+}
+
+
 extern "C"
 {
     int read_raw_metadata(const char* filename, RAWMetadata* metadata)
@@ -88,7 +151,112 @@ extern "C"
         return 0;
     }
 
+    int write_raw_metadata(const char* filename, const RAWMetadata* metadata)
+    {
+        tinyxml2::XMLDocument doc;
+        doc.InsertEndChild(doc.NewDeclaration());
+
+        tinyxml2::XMLElement* cameraImage = doc.NewElement("CameraImage");
+        tinyxml2::XMLElement* lighting    = doc.NewElement("Lighting");
+        tinyxml2::XMLElement* cameraState = doc.NewElement("CameraInternalState");
+
+        doc.InsertEndChild(cameraImage);
+        cameraImage->InsertEndChild(lighting);
+        cameraImage->InsertEndChild(cameraState);
+
+        if (metadata->ledIdx >= 0) {
+            tinyxml2::XMLElement* LED     = doc.NewElement("LED");
+            tinyxml2::XMLElement* LED_idx = doc.NewElement("idx");
+
+            LED_idx->SetText(metadata->ledIdx);
+            LED->InsertEndChild(LED_idx);
+            lighting->InsertEndChild(LED);
+        }
+
+        tinyxml2::XMLElement* exposureTime = doc.NewElement("exposureTime");
+        tinyxml2::XMLElement* aperture     = doc.NewElement("aperture");
+        tinyxml2::XMLElement* gain         = doc.NewElement("gain");
+        tinyxml2::XMLElement* bitDepth     = doc.NewElement("bitDepth");
+        tinyxml2::XMLElement* bayerPattern = doc.NewElement("bayerPattern");
+
+        exposureTime->SetText(metadata->exposureTime);
+        aperture->SetText(metadata->aperture);
+        gain->SetText(metadata->gain);
+        bitDepth->SetText(metadata->bitDepth);
+        bayerPattern->SetText(metadata->bayerPattern);
+
+        cameraState->InsertEndChild(exposureTime);
+        cameraState->InsertEndChild(aperture);
+        cameraState->InsertEndChild(gain);
+        cameraState->InsertEndChild(bitDepth);
+        cameraState->InsertEndChild(bayerPattern);
+
+        tinyxml2::XMLElement* filepath_img  = doc.NewElement("filepath_img");
+        tinyxml2::XMLElement* filepath_info = doc.NewElement("filepath_info");
+
+        filepath_img->SetText(metadata->filename_image);
+        filepath_info->SetText(metadata->filename_info);
+
+        cameraImage->InsertEndChild(filepath_img);
+        cameraImage->InsertEndChild(filepath_info);
+
+        if (doc.SaveFile(filename) != tinyxml2::XML_SUCCESS) {
+            std::cerr << "Could not write metadata to " << filename << std::endl;
+            return -1;
+        }
+
+        return 0;
+    }
+
+
+    int bayer_pattern_to_filters(const char* bayer_pattern, uint32_t* filters)
+    {
+        if (strcmp(bayer_pattern, "BGGR") == 0) {
+            *filters = 0x16161616;
+        } else if (strcmp(bayer_pattern, "GRBG") == 0) {
+            *filters = 0x61616161;
+        } else if (strcmp(bayer_pattern, "GBRG") == 0) {
+            *filters = 0x49494949;
+        } else if (strcmp(bayer_pattern, "RGGB") == 0) {
+            *filters = 0x94949494;
+        } else {
+            return -1;
+        }
+
+        return 0;
+    }
+
+
+    const char* filters_to_bayer_pattern(uint32_t filters)
+    {
+        switch (filters) {
+            case 0x16161616:
+                return "BGGR";
+            case 0x61616161:
+                return "GRBG";
+            case 0x49494949:
+                return "GBRG";
+            case 0x94949494:
+                return "RGGB";
+        }
+
+        return NULL;
+    }
+
+
     int read_raw_file(const char* filename, float** bayered_pixels, size_t* width, size_t* height, uint32_t* filters)
+    {
+        return read_raw_file_calibrated(filename, NULL, bayered_pixels, width, height, filters);
+    }
+
+
+    int read_raw_file_calibrated(
+      const char*           filename,
+      const RAWCalibration* calibration,
+      float**               bayered_pixels,
+      size_t*               width,
+      size_t*               height,
+      uint32_t*             filters)
     {
         RAWMetadata metadata;
         metadata.bayerPattern   = NULL;
@@ -130,10 +298,14 @@ extern "C"
             err       = read_exr_rgb(path_filename_img, bayered_pixels, &pg, &pb, width, height);
             free(pg);
             free(pb);
+
+            if (err == 0) {
+                err = apply_raw_calibration(*bayered_pixels, *width, *height, calibration);
+            }
         } else if (
           strcmp(metadata.filename_image + len_filename_img - 3, "dat") == 0
           || strcmp(metadata.filename_image + len_filename_img - 3, "DAT") == 0) {
-            err = read_dat(path_filename_img, bayered_pixels, width, height, metadata.bitDepth);
+            err = read_dat_calibrated(path_filename_img, calibration, bayered_pixels, width, height, metadata.bitDepth);
         }
 #ifdef HAS_TIFF
         else if (
@@ -146,6 +318,10 @@ extern "C"
             err       = read_tiff_rgb(path_filename_img, bayered_pixels, &pg, &pb, width, height);
             free(pg);
             free(pb);
+
+            if (err == 0) {
+                err = apply_raw_calibration(*bayered_pixels, *width, *height, calibration);
+            }
         }
 #endif
         else {
@@ -155,17 +331,10 @@ extern "C"
         if (err != 0) {
             std::cerr << "Could not decode the image data." << std::endl;
             free(*bayered_pixels);
+            *bayered_pixels = NULL;
         }
 
-        if (strcmp(metadata.bayerPattern, "BGGR") == 0) {
-            *filters = 0x16161616;
-        } else if (strcmp(metadata.bayerPattern, "GRBG") == 0) {
-            *filters = 0x61616161;
-        } else if (strcmp(metadata.bayerPattern, "GBRG") == 0) {
-            *filters = 0x49494949;
-        } else if (strcmp(metadata.bayerPattern, "RGGB") == 0) {
-            *filters = 0x94949494;
-        }
+        bayer_pattern_to_filters(metadata.bayerPattern, filters);
 
         free(metadata.bayerPattern);
         free(metadata.filename_image);
@@ -178,6 +347,18 @@ extern "C"
 
 
     int read_dat(const char* filename, float** bayered_pixels, size_t* width, size_t* height, size_t bit_depth)
+    {
+        return read_dat_calibrated(filename, NULL, bayered_pixels, width, height, bit_depth);
+    }
+
+
+    int read_dat_calibrated(
+      const char*           filename,
+      const RAWCalibration* calibration,
+      float**               bayered_pixels,
+      size_t*               width,
+      size_t*               height,
+      size_t                bit_depth)
     {
         FILE* fin = fopen(filename, "rb");
 
@@ -244,6 +425,14 @@ extern "C"
             return -1;
         }
 
+        if (
+          calibration != NULL && (calibration->dark != NULL || calibration->flat_gain != NULL)
+          && (calibration->width != l_width || calibration->height != l_height)) {
+            std::cerr << "The calibration frames do not match the image size" << std::endl;
+            fclose(fin);
+            return -1;
+        }
+
         // We determine the number of bytes to read based on the datatype
         size_t n_bytes_per_channel;
 
@@ -307,80 +496,45 @@ extern "C"
         }
 
         // Copy cast
-        float* bayered_image = new float[n_elems];
+        float* bayered_image = (float*)malloc(n_elems * sizeof(float));
         float  renorm        = float(1 << bit_depth) - 1.f;
 
         switch (data_type) {
             case 1:   // bool
-            {
-                bool* buff = reinterpret_cast<bool*>(read_buff);
-                #pragma omp parallel for
-                for (int i = 0; i < int(n_elems); i++)
-                    bayered_image[i] = (float)buff[i] / renorm;
-            } break;
+                convert_calibrated(reinterpret_cast<bool*>(read_buff), bayered_image, int(n_elems), renorm, calibration);
+                break;
 
             case 2:   // unsigned char
-            {
-                unsigned char* buff = reinterpret_cast<unsigned char*>(read_buff);
-                #pragma omp parallel for
-                for (int i = 0; i < int(n_elems); i++)
-                    bayered_image[i] = (float)buff[i] / renorm;
-            } break;
+                convert_calibrated(reinterpret_cast<unsigned char*>(read_buff), bayered_image, int(n_elems), renorm, calibration);
+                break;
 
             case 3:   // char
-            {
-                char* buff = reinterpret_cast<char*>(read_buff);
-                #pragma omp parallel for
-                for (int i = 0; i < int(n_elems); i++)
-                    bayered_image[i] = (float)buff[i] / renorm;
-            } break;
+                convert_calibrated(reinterpret_cast<char*>(read_buff), bayered_image, int(n_elems), renorm, calibration);
+                break;
+
             case 4:   // unsigned short
-            {
-                unsigned short* buff = reinterpret_cast<unsigned short*>(read_buff);
-                #pragma omp parallel for
-                for (int i = 0; i < int(n_elems); i++)
-                    bayered_image[i] = (float)buff[i] / renorm;
-            } break;
+                convert_calibrated(reinterpret_cast<unsigned short*>(read_buff), bayered_image, int(n_elems), renorm, calibration);
+                break;
 
             case 5:   // short
-            {
-                short* buff = reinterpret_cast<short*>(read_buff);
-                #pragma omp parallel for
-                for (int i = 0; i < int(n_elems); i++)
-                    bayered_image[i] = (float)buff[i] / renorm;
-            } break;
+                convert_calibrated(reinterpret_cast<short*>(read_buff), bayered_image, int(n_elems), renorm, calibration);
+                break;
 
             case 6:   // unsigned int
-            {
-                unsigned int* buff = reinterpret_cast<unsigned int*>(read_buff);
-                #pragma omp parallel for
-                for (int i = 0; i < int(n_elems); i++)
-                    bayered_image[i] = (float)buff[i] / renorm;
-            } break;
+                convert_calibrated(reinterpret_cast<unsigned int*>(read_buff), bayered_image, int(n_elems), renorm, calibration);
+                break;
 
             case 7:   // int
-            {
-                int* buff = reinterpret_cast<int*>(read_buff);
-                #pragma omp parallel for
-                for (int i = 0; i < int(n_elems); i++)
-                    bayered_image[i] = (float)buff[i] / renorm;
-            } break;
+                convert_calibrated(reinterpret_cast<int*>(read_buff), bayered_image, int(n_elems), renorm, calibration);
+                break;
 
             case 8:   // float
-            {
-                float* buff = reinterpret_cast<float*>(read_buff);
-                #pragma omp parallel for
-                for (int i = 0; i < int(n_elems); i++)
-                    bayered_image[i] = (float)buff[i] / renorm;
-            } break;
+                convert_calibrated(reinterpret_cast<float*>(read_buff), bayered_image, int(n_elems), renorm, calibration);
+                break;
 
             case 9:   // double
-            {
-                double* buff = reinterpret_cast<double*>(read_buff);
-                #pragma omp parallel for
-                for (int i = 0; i < int(n_elems); i++)
-                    bayered_image[i] = (float)buff[i] / renorm;
-            } break;
+                convert_calibrated(reinterpret_cast<double*>(read_buff), bayered_image, int(n_elems), renorm, calibration);
+                break;
 
             default:
                 // This should not happen since this is already checked.
@@ -399,6 +553,172 @@ extern "C"
     }
 
 
+    int write_dat(const char* filename, const float* bayered_pixels, size_t width, size_t height, size_t bit_depth)
+    {
+        if (bit_depth == 0 || bit_depth > 16) {
+            std::cerr << "Unsupported bit depth: " << bit_depth << std::endl;
+            return -1;
+        }
+
+        const char         data_type  = 4;   // unsigned short
+        const unsigned int l_width    = (unsigned int)width;
+        const unsigned int l_height   = (unsigned int)height;
+        const unsigned int n_channels = 1;
+        const float        max_value  = (float)((1 << bit_depth) - 1);
+        const size_t       n_elems    = width * height;
+
+        unsigned short* write_buff = (unsigned short*)malloc(n_elems * sizeof(unsigned short));
+
+        if (write_buff == NULL) {
+            std::cerr << "Memory allocation error" << std::endl;
+            return -1;
+        }
+
+        #pragma omp parallel for
+        for (int i = 0; i < (int)n_elems; i++) {
+            const float v = std::min(std::max(bayered_pixels[i], 0.f), 1.f);
+            write_buff[i] = (unsigned short)(v * max_value + .5f);
+        }
+
+        FILE* fout = fopen(filename, "wb");
+
+        if (fout == NULL) {
+            std::cerr << "Cannot open file " << filename << " for writing" << std::endl;
+            free(write_buff);
+            return -1;
+        }
+
+        size_t ret_write = 0;
+        ret_write += fwrite(&data_type, sizeof(char), 1, fout);
+        ret_write += fwrite(&l_width, sizeof(unsigned int), 1, fout);
+        ret_write += fwrite(&l_height, sizeof(unsigned int), 1, fout);
+        ret_write += fwrite(&n_channels, sizeof(unsigned int), 1, fout);
+        ret_write += fwrite(write_buff, sizeof(unsigned short), n_elems, fout);
+
+        fclose(fout);
+        free(write_buff);
+
+        if (ret_write != 4 + n_elems) {
+            std::cerr << "Error while writing " << filename << std::endl;
+            return -1;
+        }
+
+        return 0;
+    }
+
+
+    int load_raw_calibration(
+      const char* filename_dark, const char* filename_flat, float black_level, RAWCalibration* calibration)
+    {
+        calibration->width       = 0;
+        calibration->height      = 0;
+        calibration->black_level = black_level;
+        calibration->dark        = NULL;
+        calibration->flat_gain   = NULL;
+
+        if (filename_dark != NULL) {
+            int err = read_master_frame(filename_dark, &calibration->dark, &calibration->width, &calibration->height);
+
+            if (err != 0) {
+                std::cerr << "Could not read the dark frame " << filename_dark << std::endl;
+                calibration->dark = NULL;
+                return err;
+            }
+        }
+
+        if (filename_flat != NULL) {
+            float* flat        = NULL;
+            size_t flat_width  = 0;
+            size_t flat_height = 0;
+
+            int err = read_master_frame(filename_flat, &flat, &flat_width, &flat_height);
+
+            if (err != 0) {
+                std::cerr << "Could not read the flat frame " << filename_flat << std::endl;
+                free_raw_calibration(calibration);
+                return err;
+            }
+
+            if (calibration->dark != NULL && (flat_width != calibration->width || flat_height != calibration->height)) {
+                std::cerr << "The dark and flat frames do not have the same size" << std::endl;
+                free(flat);
+                free_raw_calibration(calibration);
+                return -1;
+            }
+
+            calibration->width  = flat_width;
+            calibration->height = flat_height;
+
+            // The flat gets the same offset as the frames it corrects
+            if (calibration->dark != NULL) {
+                for (size_t i = 0; i < flat_width * flat_height; i++) {
+                    flat[i] -= calibration->dark[i];
+                }
+            } else {
+                for (size_t i = 0; i < flat_width * flat_height; i++) {
+                    flat[i] -= black_level;
+                }
+            }
+
+            // Normalize each position of the 2x2 Bayer cell independently
+            double sum[4]   = {0, 0, 0, 0};
+            size_t count[4] = {0, 0, 0, 0};
+
+            for (size_t y = 0; y < flat_height; y++) {
+                for (size_t x = 0; x < flat_width; x++) {
+                    sum[2 * (y & 1) + (x & 1)] += flat[y * flat_width + x];
+                    count[2 * (y & 1) + (x & 1)]++;
+                }
+            }
+
+            #pragma omp parallel for
+            for (int y = 0; y < (int)flat_height; y++) {
+                for (size_t x = 0; x < flat_width; x++) {
+                    const int   cell = 2 * (y & 1) + (x & 1);
+                    const float mean = (float)(sum[cell] / (double)count[cell]);
+                    float&      v    = flat[y * flat_width + x];
+
+                    // Dead pixels in the flat are left untouched
+                    v = (v > 0) ? mean / v : 1.f;
+                }
+            }
+
+            calibration->flat_gain = flat;
+        }
+
+        return 0;
+    }
+
+
+    void free_raw_calibration(RAWCalibration* calibration)
+    {
+        free(calibration->dark);
+        free(calibration->flat_gain);
+
+        calibration->dark      = NULL;
+        calibration->flat_gain = NULL;
+    }
+
+
+    int apply_raw_calibration(float* bayered_pixels, size_t width, size_t height, const RAWCalibration* calibration)
+    {
+        if (calibration == NULL) {
+            return 0;
+        }
+
+        if (
+          (calibration->dark != NULL || calibration->flat_gain != NULL)
+          && (calibration->width != width || calibration->height != height)) {
+            std::cerr << "The calibration frames do not match the image size" << std::endl;
+            return -1;
+        }
+
+        convert_calibrated(bayered_pixels, bayered_pixels, int(width * height), 1.f, calibration);
+
+        return 0;
+    }
+
+
     int read_raw(const char* filename, float** pixels, size_t* width, size_t* height, RAWDemosaicMethod method)
     {
         float*       bayered_pixels = NULL;
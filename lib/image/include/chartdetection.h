@@ -0,0 +1,132 @@
+#ifndef CHARTDETECTION_H_
+#define CHARTDETECTION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <patches.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif   // __cplusplus
+
+#define CHART_N_COLUMNS 6
+#define CHART_N_ROWS    4
+#define CHART_N_PATCHES 24
+
+    /**
+     * Location of a Macbeth chart in an image. Chart coordinates are given
+     * in patches: the center of the patch at column i and row j is at (i, j),
+     * the dark skin patch is at (0, 0) and the black patch at (5, 3).
+     */
+    typedef struct {
+        float  homography[9];              // Chart to image coordinates (row major)
+        Point  centers[CHART_N_PATCHES];   // Centers of the patches in the image
+        size_t n_patches;                  // Number of patches the homography was fitted on
+    } ChartLocation;
+
+    /**
+     * Finds a Macbeth chart in an RGB image.
+     *
+     * The patches are first searched as flat regions arranged on a grid in a
+     * downsampled luminance pyramid, then each patch center is refined at
+     * full resolution and the orientation is given by the neutral row.
+     *
+     * @param image the image (3 * width * height)
+     * @param width width of the image
+     * @param height height of the image
+     * @param chart gives the location of the chart
+     *
+     * @returns 0 if sucessfull, -1 if no chart was found
+     */
+    int detect_chart(const float* image, size_t width, size_t height, ChartLocation* chart);
+
+    /**
+     * Finds a Macbeth chart in a RAW mosaic. The chart is searched in the
+     * REDUCE2X2 demosaiced image, which avoids a full resolution
+     * demosaicing: coordinates are then given in pixels of the mosaic.
+     *
+     * @param bayered_image the mosaic (width * height)
+     * @param width width of the mosaic
+     * @param height height of the mosaic
+     * @param filters CFA pattern of the mosaic
+     * @param chart gives the location of the chart
+     *
+     * @returns 0 if sucessfull, -1 if no chart was found
+     */
+    int detect_chart_raw(
+      const float* bayered_image, size_t width, size_t height, uint32_t filters, ChartLocation* chart);
+
+    /**
+     * Follows a Macbeth chart found in a previous image of a sequence. Each
+     * patch is only searched in a window around its previous location, which
+     * costs a fraction of a detection when the chart barely moves.
+     *
+     * @param image the image (3 * width * height)
+     * @param width width of the image
+     * @param height height of the image
+     * @param previous location of the chart in the previous image
+     * @param chart gives the location of the chart, may be previous
+     *
+     * @returns 0 if sucessfull, -1 if the chart moved or is hidden: it shall
+     *          then be detected again
+     */
+    int track_chart(
+      const float* image, size_t width, size_t height, const ChartLocation* previous, ChartLocation* chart);
+
+    /**
+     * Follows a Macbeth chart in a RAW mosaic, like detect_chart_raw the
+     * patches are searched in the REDUCE2X2 image and coordinates are given in
+     * pixels of the mosaic.
+     *
+     * @param bayered_image the mosaic (width * height)
+     * @param width width of the mosaic
+     * @param height height of the mosaic
+     * @param filters CFA pattern of the mosaic
+     * @param previous location of the chart in the previous mosaic
+     * @param chart gives the location of the chart, may be previous
+     *
+     * @returns 0 if sucessfull, -1 if the chart moved or is hidden
+     */
+    int track_chart_raw(
+      const float*         bayered_image,
+      size_t               width,
+      size_t               height,
+      uint32_t             filters,
+      const ChartLocation* previous,
+      ChartLocation*       chart);
+
+    /**
+     * Maps chart coordinates to the image.
+     */
+    Point chart_to_image(const ChartLocation* chart, float x, float y);
+
+    /**
+     * Gives the outline of the chart such that the patches laid out by the
+     * GUI with the given inner margins fall on the detected patches.
+     *
+     * @param chart location of the chart
+     * @param margin_x fraction of the width of the outline between patches
+     * @param margin_y fraction of the height of the outline between patches
+     * @param outline corners of the outline, clockwise from the dark skin
+     *        patch corner (4)
+     */
+    void chart_outline(const ChartLocation* chart, float margin_x, float margin_y, Point* outline);
+
+    /**
+     * Gives square areas centered on the patches, in the order of the
+     * reference patches, to be saved with save_boxfile.
+     *
+     * @param chart location of the chart
+     * @param size side of the areas as a fraction of the distance between
+     *        two patch centers
+     * @param boxes areas of the patches (CHART_N_PATCHES)
+     */
+    void chart_boxes(const ChartLocation* chart, float size, Box* boxes);
+
+#ifdef __cplusplus
+}
+#endif   // __cplusplus
+
+#endif   // CHARTDETECTION_H_
@@ -17,9 +17,206 @@ extern "C"
         AHD,
         RCD,
         AMAZE,
-        NONE
+        MHC,
+        NONE,
+        AUTO   // Picks one of the full resolution methods, see demosaic_auto_select
     } RAWDemosaicMethod;
 
+    /**
+     * Gets the demosaicing method corresponding to a name as used by the
+     * command line tools (e.g. "AMAZE"). Names giving AUTO options are
+     * read with demosaic_parse_method.
+     *
+     * @param name name of the method
+     * @param method gives the demosaicing method
+     *
+     * @returns 0 if sucessfull
+     */
+    int demosaic_method_from_name(const char* name, RAWDemosaicMethod* method);
+
+    const char* demosaic_method_name(RAWDemosaicMethod method);
+
+    /**
+     * Gives the size of the image produced by a demosaicing method: the
+     * 2x2 methods halve the resolution.
+     */
+    void demosaic_output_size(
+      RAWDemosaicMethod method, size_t width, size_t height, size_t* output_width, size_t* output_height);
+
+    /**
+     * Tile sizes of the tiled demosaicing methods. The best values depend on
+     * the cache sizes of the machine: they can be tuned with
+     * demosaic_autotune_tile_sizes and stored in the configuration file of
+     * the host, loaded on the first demosaicing.
+     */
+    typedef struct {
+        int amaze;   // Multiple of 32 in [96, 992]
+        int ahd;     // In [16, 1024]
+        int rcd;     // In [32, 1024]
+    } DemosaicTileSizes;
+
+    void demosaic_default_tile_sizes(DemosaicTileSizes* sizes);
+
+    /**
+     * Gives the tile sizes in use. The first call loads the configuration
+     * file of the host if there is one.
+     */
+    void demosaic_get_tile_sizes(DemosaicTileSizes* sizes);
+
+    /**
+     * Sets the tile sizes used by the next demosaicing calls.
+     *
+     * @returns 0 if sucessfull, -1 if a size is out of range
+     */
+    int demosaic_set_tile_sizes(const DemosaicTileSizes* sizes);
+
+    /**
+     * Gives the configuration file of the host: $CAMCALIB_DEMOSAIC_CONFIG
+     * if set, ~/.config/camera-calibration/demosaic-<hostname>.cfg otherwise.
+     */
+    const char* demosaic_host_config_filename();
+
+    /**
+     * Loads tile sizes from a configuration file. Sizes missing from the
+     * file keep the value given in sizes.
+     *
+     * @returns 0 if sucessfull
+     */
+    int demosaic_load_tile_sizes(const char* filename, DemosaicTileSizes* sizes);
+
+    /**
+     * Saves tile sizes to a configuration file, other entries of the file
+     * are kept.
+     *
+     * @returns 0 if sucessfull
+     */
+    int demosaic_save_tile_sizes(const char* filename, const DemosaicTileSizes* sizes);
+
+    /**
+     * Benchmarks candidate tile sizes of the tiled methods on a mosaic and
+     * gives the fastest ones. The tile sizes in use are not modified.
+     *
+     * @param bayered_image mosaic to demosaic, should be representative of
+     *        the usual image size
+     * @param width width of the mosaic
+     * @param height height of the mosaic
+     * @param filters Arrangement of the Bayer pattern
+     * @param best gives the fastest tile sizes
+     *
+     * @returns 0 if sucessfull
+     */
+    int demosaic_autotune_tile_sizes(
+      const float* bayered_image, size_t width, size_t height, unsigned int filters, DemosaicTileSizes* best);
+
+    /**
+     * Measured throughput of the demosaicing methods on the host, in
+     * Mpx/s per thread. Used by the AUTO mode to predict runtimes, the
+     * defaults can be replaced by measured values with
+     * demosaic_calibrate_throughput and stored in the configuration file of
+     * the host.
+     */
+    typedef struct {
+        float mpx_per_s[NONE];   // Indexed by RAWDemosaicMethod
+    } DemosaicThroughput;
+
+    void demosaic_default_throughput(DemosaicThroughput* throughput);
+
+    void demosaic_get_throughput(DemosaicThroughput* throughput);
+
+    /**
+     * @returns 0 if sucessfull, -1 if a throughput is not positive
+     */
+    int demosaic_set_throughput(const DemosaicThroughput* throughput);
+
+    /**
+     * Loads throughputs from a configuration file. Methods missing from the
+     * file keep the value given in throughput.
+     *
+     * @returns 0 if sucessfull
+     */
+    int demosaic_load_throughput(const char* filename, DemosaicThroughput* throughput);
+
+    /**
+     * Saves throughputs to a configuration file, other entries of the file
+     * are kept.
+     *
+     * @returns 0 if sucessfull
+     */
+    int demosaic_save_throughput(const char* filename, const DemosaicThroughput* throughput);
+
+    /**
+     * Measures the throughput of every demosaicing method on a mosaic with
+     * the current number of threads and tile sizes.
+     *
+     * @param bayered_image mosaic to demosaic
+     * @param width width of the mosaic
+     * @param height height of the mosaic
+     * @param filters Arrangement of the Bayer pattern
+     * @param throughput gives the measured throughputs
+     *
+     * @returns 0 if sucessfull
+     */
+    int demosaic_calibrate_throughput(
+      const float* bayered_image, size_t width, size_t height, unsigned int filters, DemosaicThroughput* throughput);
+
+    /**
+     * Options of the AUTO mode. With a time budget, AUTO picks the best
+     * quality method expected to run within the budget (the fastest one if
+     * none does). Without a budget, it picks the fastest method at least as
+     * good as min_quality.
+     *
+     * From the lowest to the highest quality: BASIC, MHC, VNG4, AHD, RCD,
+     * AMAZE. The defaults (no budget, AMAZE) always give AMAZE.
+     */
+    typedef struct {
+        float             time_budget_ms;   // 0 for no budget
+        RAWDemosaicMethod min_quality;      // Used when there is no budget
+    } DemosaicAutoOptions;
+
+    void demosaic_default_auto_options(DemosaicAutoOptions* options);
+
+    /**
+     * Gives the options of the AUTO mode. The first call loads the
+     * configuration file of the host if there is one.
+     */
+    void demosaic_get_auto_options(DemosaicAutoOptions* options);
+
+    /**
+     * @returns 0 if sucessfull, -1 if the options are invalid
+     */
+    int demosaic_set_auto_options(const DemosaicAutoOptions* options);
+
+    /**
+     * Reads a method name as given to the command line tools: "AUTO" may be
+     * followed by a time budget in ms ("AUTO:200") or by the lowest quality
+     * method allowed ("AUTO:AHD"). The options in use are not modified.
+     *
+     * @param name name of the method
+     * @param method gives the demosaicing method
+     * @param options gives the AUTO options the name asks for, the options in
+     *        use for other names
+     *
+     * @returns 0 if sucessfull
+     */
+    int demosaic_parse_method(const char* name, RAWDemosaicMethod* method, DemosaicAutoOptions* options);
+
+    /**
+     * Gives the method the AUTO mode uses for a mosaic, given the current
+     * options, the throughputs and the number of threads.
+     *
+     * @param width width of the mosaic
+     * @param height height of the mosaic
+     * @param expected_ms gives the expected runtime of the method, can be
+     *        NULL
+     */
+    RAWDemosaicMethod demosaic_auto_select(size_t width, size_t height, float* expected_ms);
+
+    /**
+     * Gives the method the AUTO mode would use with the given options.
+     */
+    RAWDemosaicMethod demosaic_auto_select_with(
+      const DemosaicAutoOptions* options, size_t width, size_t height, float* expected_ms);
+
     void demosaic_rgb(
       const float*      bayered_image,
       float*            pixels_red,
@@ -38,6 +235,41 @@ extern "C"
       unsigned int      filters,
       RAWDemosaicMethod method);
 
+    /**
+     * Demosaics a region of a mosaic with a full resolution method. The
+     * mosaic around the region is read so that the region matches the
+     * result of demosaic on the whole mosaic: a large mosaic can be
+     * demosaiced progressively, region by region. The other pixels of
+     * debayered_image are not modified.
+     *
+     * @param bayered_image The bayered image
+     * @param debayered_image A buffer holding the whole debayered image
+     *        (3*width*height), the region is written in it
+     * @param width Width of the bayered image
+     * @param height Height of the bayered image
+     * @param filters Arrangement of the Bayer pattern
+     * @param method A full resolution method, AUTO picks it for the whole
+     *        mosaic
+     * @param x Left column of the region
+     * @param y Top row of the region
+     * @param region_width Width of the region
+     * @param region_height Height of the region
+     *
+     * @returns 0 if sucessfull, -1 for a 2x2 method or a region out of the
+     *          image
+     */
+    int demosaic_region(
+      const float*      bayered_image,
+      float*            debayered_image,
+      size_t            width,
+      size_t            height,
+      unsigned int      filters,
+      RAWDemosaicMethod method,
+      size_t            x,
+      size_t            y,
+      size_t            region_width,
+      size_t            region_height);
+
     // NONE
 
     void no_demosaic_rgb(
@@ -150,6 +382,35 @@ extern "C"
     void barycentric2x2_demosaic(
       const float* bayered_image, float* debayered_image, size_t width, size_t height, unsigned int filters);
 
+    /**
+     * @brief One pass RAW to thumbnail
+     *
+     * Demosaics at half resolution (REDUCE2X2 or BARYCENTRIC2X2), applies an
+     * optional correction matrix and encodes the result in 8 bits sRGB, in a
+     * single pass over the bayered image.
+     *
+     * @param bayered_image The bayered image
+     * @param width Original width of the bayered image
+     * @param height Original height of the bayered image
+     * @param filters Arrangement of the Bayer pattern
+     * @param method REDUCE2X2 or BARYCENTRIC2X2
+     * @param matrix Correction matrix (camera RGB to XYZ, as written by
+     *        extract-matrix) applied as correct_image does, NULL to encode
+     *        the camera RGB values
+     * @param thumbnail A buffer to output the interleaved RGB thumbnail
+     *        (3*(width/2*height/2))
+     *
+     * @returns 0 if sucessfull
+     */
+    int demosaic_thumbnail_srgb8(
+      const float*      bayered_image,
+      size_t            width,
+      size_t            height,
+      unsigned int      filters,
+      RAWDemosaicMethod method,
+      const float*      matrix,
+      unsigned char*    thumbnail);
+
     // VGN 4
 
     void vng4_demosaic_rgb(
@@ -199,6 +460,30 @@ extern "C"
 
     void rcd_demosaic(const float* bayered_image, float* debayered_image, size_t w, size_t h, unsigned int filters);
 
+    // MHC
+
+    /**
+     * @brief Malvar-He-Cutler gradient-corrected linear demosaicing
+     *
+     * Bilinear interpolation corrected by the Laplacian of the channel
+     * available at each pixel (5x5 filters). Much sharper than BASIC for a
+     * cost close to a copy of the image: suited to previews and to the
+     * processing of large batches. Being linear, it preserves the average of
+     * uniform areas.
+     *
+     * @param rawData The bayered image
+     * @param red A buffer to write the red channel (w*h)
+     * @param green A buffer to write the green channel (w*h)
+     * @param blue A buffer to write the blue channel (w*h)
+     * @param w Width of the bayered image
+     * @param h Height of the bayered image
+     * @param filters Arrangement of the Bayer pattern
+     */
+    void mhc_demosaic_rgb(
+      const float* rawData, float* red, float* green, float* blue, size_t w, size_t h, unsigned int filters);
+
+    void mhc_demosaic(const float* bayered_image, float* debayered_image, size_t w, size_t h, unsigned int filters);
+
 #ifdef __cplusplus
 }
 #endif   // __cplusplus
@@ -0,0 +1,116 @@
+#ifndef HDRMERGE_H_
+#define HDRMERGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <imageraw.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif   // __cplusplus
+
+    /**
+     * Streaming merge of bracketed Bayer frames into a single linear HDR
+     * Bayer frame.
+     *
+     * Each frame is added one after the other: only the accumulators are
+     * kept in memory. Each sample is converted to a radiance by dividing it
+     * by the exposure of its frame and weighted by the inverse of its
+     * variance. Samples above the saturation level are discarded.
+     *
+     * The noise model for a normalized sample v taken with a linear gain g is
+     *     var(v) = g * shot_noise * v + read_noise^2
+     */
+    typedef struct {
+        size_t   width;
+        size_t   height;
+        uint32_t filters;
+
+        float saturation;    // Samples above are discarded (normalized)
+        float black_level;   // Subtracted from each sample (normalized)
+        float shot_noise;    // Variance of a full scale sample at unit gain
+        float read_noise;    // Standard deviation of the read noise (normalized)
+
+        float  reference_exposure;   // Exposure the result is expressed in
+        float  fallback_exposure;    // Exposure of the frame stored in fallback
+        size_t n_frames;
+
+        float* radiance_sum;   // Sum of weight * radiance
+        float* weight_sum;     // Sum of weights
+        float* fallback;       // Radiance from the shortest exposure
+    } HDRMerge;
+
+    /**
+     * Relative exposure of a capture: exposureTime * gain / aperture^2
+     * aperture is the f-number, gain is expected to be linear.
+     */
+    float raw_exposure(const RAWMetadata* metadata);
+
+    /**
+     * Allocates the accumulators of a merge.
+     *
+     * @param merge the merge accumulators
+     * @param width width of the frames
+     * @param height height of the frames
+     * @param filters arrangement of the Bayer pattern of the frames
+     * @param reference_exposure exposure the merged frame is expressed in,
+     *        independent of the order the frames are added in
+     *
+     * @returns 0 if sucessfull
+     */
+    int hdr_merge_init(HDRMerge* merge, size_t width, size_t height, uint32_t filters, float reference_exposure);
+
+    /**
+     * Adds a frame to the merge.
+     *
+     * @param merge the merge accumulators
+     * @param bayered_pixels normalized bayered frame (width * height)
+     * @param exposure relative exposure of the frame (see raw_exposure)
+     * @param gain linear gain the frame was taken with
+     *
+     * @returns 0 if sucessfull
+     */
+    int hdr_merge_add(HDRMerge* merge, const float* bayered_pixels, float exposure, float gain);
+
+    /**
+     * Gives the merged frame, expressed with the reference exposure. Pixels
+     * saturated in every frame take the value of the shortest exposure.
+     *
+     * @param merge the merge accumulators
+     * @param bayered_pixels buffer to write the merged frame to (width * height)
+     */
+    void hdr_merge_resolve(const HDRMerge* merge, float* bayered_pixels);
+
+    void hdr_merge_free(HDRMerge* merge);
+
+    /**
+     * Merges RAW captures (.txt metadata files) of the same scene using the
+     * exposure, aperture and gain from their metadata. The merged frame is
+     * expressed with the exposure of the first file.
+     *
+     * @param filenames RAW metadata files
+     * @param n_files number of files
+     * @param bayered_pixels merged frame allocated by the function (width * height)
+     * @param width gives the width of the frame
+     * @param height gives the height of the frame
+     * @param filters gives the arrangement of the Bayer pattern
+     * @param metadata gives the metadata of the first frame, can be NULL
+     *
+     * @returns 0 if sucessfull
+     */
+    int hdr_merge_raw_files(
+      const char** filenames,
+      size_t       n_files,
+      float**      bayered_pixels,
+      size_t*      width,
+      size_t*      height,
+      uint32_t*    filters,
+      RAWMetadata* metadata);
+
+#ifdef __cplusplus
+}
+#endif   // __cplusplus
+
+#endif   // HDRMERGE_H_
@@ -15,6 +15,8 @@
 extern "C"
 {
 #endif
+    // RAW captures (.txt) are demosaiced with the AUTO method: AMAZE unless
+    // the host configuration sets a time budget (see demosaic_auto_select)
     int read_image(const char* filename, float** pixels, size_t* width, size_t* height);
     int read_image_rgb(
       const char* filename,
@@ -21,10 +21,103 @@ extern "C"
         char* filename_info;
     } RAWMetadata;
 
+    /**
+     * Master calibration frames applied while loading RAW data:
+     *     pixel = (raw - dark) * flat_gain
+     * dark already contains the black level. When there is no dark frame,
+     * black_level is subtracted instead.
+     */
+    typedef struct {
+        size_t width;
+        size_t height;
+        float  black_level;   // Normalized black level, used without dark frame
+        float* dark;          // Master dark frame (width * height) or NULL
+        float* flat_gain;     // Inverse of the normalized master flat (width * height) or NULL
+    } RAWCalibration;
+
     int read_raw_metadata(const char* filename, RAWMetadata* metadata);
+
+    /**
+     * Writes a RAW metadata file. The image file name is stored as is:
+     * it shall be relative to the directory of the metadata file.
+     *
+     * @param filename filename to write the metadata to
+     * @param metadata metadata to write
+     *
+     * @returns 0 if sucessfull
+     */
+    int write_raw_metadata(const char* filename, const RAWMetadata* metadata);
+
+    int bayer_pattern_to_filters(const char* bayer_pattern, uint32_t* filters);
+
+    const char* filters_to_bayer_pattern(uint32_t filters);
+
     int read_raw_file(const char* filename, float** bayered_pixels, size_t* width, size_t* height, uint32_t* filters);
     int read_dat(const char* filename, float** bayered_pixels, size_t* width, size_t* height, size_t bit_depth);
 
+    /**
+     * Writes a single channel .dat file of unsigned short values, the
+     * normalized pixels are scaled by (1 << bit_depth) - 1 as read_dat
+     * expects.
+     *
+     * @param filename filename to write the data to
+     * @param bayered_pixels normalized pixels (width * height)
+     * @param width width of the image
+     * @param height height of the image
+     * @param bit_depth bit depth of the stored values (up to 16)
+     *
+     * @returns 0 if sucessfull
+     */
+    int write_dat(const char* filename, const float* bayered_pixels, size_t width, size_t height, size_t bit_depth);
+
+    /**
+     * Loads master dark and flat frames, to be reused for all the frames of
+     * a session. Master frames are RAW captures (.txt) or single channel
+     * images stored in the red channel of an EXR or TIFF file, normalized
+     * as the frames they correct (this is what stack-frames writes).
+     * The flat is normalized independently for each position of the 2x2
+     * Bayer cell so that it does not change the white balance.
+     *
+     * @param filename_dark master dark frame, can be NULL
+     * @param filename_flat master flat frame, can be NULL
+     * @param black_level normalized black level used when there is no dark frame
+     * @param calibration calibration to initialize
+     *
+     * @returns 0 if sucessfull
+     */
+    int load_raw_calibration(
+      const char* filename_dark, const char* filename_flat, float black_level, RAWCalibration* calibration);
+
+    void free_raw_calibration(RAWCalibration* calibration);
+
+    /**
+     * Applies calibration frames to an already loaded bayered frame.
+     *
+     * @returns 0 if sucessfull
+     */
+    int apply_raw_calibration(float* bayered_pixels, size_t width, size_t height, const RAWCalibration* calibration);
+
+    /**
+     * Same as read_raw_file and read_dat, applying calibration frames.
+     * For DAT files, the correction is fused with the conversion to float.
+     * calibration can be NULL.
+     */
+    int read_raw_file_calibrated(
+      const char*           filename,
+      const RAWCalibration* calibration,
+      float**               bayered_pixels,
+      size_t*               width,
+      size_t*               height,
+      uint32_t*             filters);
+
+    int read_dat_calibrated(
+      const char*           filename,
+      const RAWCalibration* calibration,
+      float**               bayered_pixels,
+      size_t*               width,
+      size_t*               height,
+      size_t                bit_depth);
+
     int read_raw(const char* filename, float** pixels, size_t* width, size_t* height, RAWDemosaicMethod method);
 
     int read_raw_rgb(
@@ -0,0 +1,135 @@
+#ifndef PATCHES_H_
+#define PATCHES_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif   // __cplusplus
+
+    typedef struct {
+        float x, y;
+    } Point;
+
+
+    typedef struct {
+        Point a, b, c, d;
+    } Box;
+
+
+    /**
+     * Statistics of the pixels of an area, per channel.
+     */
+    typedef struct {
+        size_t n_pixels;
+        size_t n_clipped;         // Pixels with a channel at or above the clipping level
+        float  mean[3];
+        float  variance[3];       // Unbiased variance of the pixels
+        float  trimmed_mean[3];   // Mean without the lowest and highest pixels
+        float  median[3];
+    } PatchStatistics;
+
+    /**
+     * Loads an area file: one quad per line, formatted as
+     * "ax,ay;bx,by;cx,cy;dx,dy;"
+     *
+     * @param filename filename to read the areas from
+     * @param areas areas that are going to be allocated by the function
+     * @param size gives the number of read areas
+     *
+     * @returns 0 if sucessfull
+     */
+    int load_boxfile(const char* filename, Box** areas, size_t* size);
+
+    /**
+     * Saves areas in the format read by load_boxfile.
+     *
+     * @param filename filename to write the areas to
+     * @param areas areas to write
+     * @param size number of areas
+     *
+     * @returns 0 if sucessfull
+     */
+    int save_boxfile(const char* filename, const Box* areas, size_t size);
+
+    int isInTriangle(const Point* p, const Point* p0, const Point* p1, const Point* p2);
+
+    int isInBox(const Point* p, const Box* b);
+
+    /**
+     * Computes the average color of each area of an RGB image.
+     *
+     * Only the bounding box of each area is scanned so the cost is
+     * proportional to the area covered by the patches, not to the image size.
+     *
+     * @param image the image (3 * width * height)
+     * @param width width of the image
+     * @param height height of the image
+     * @param areas areas to average
+     * @param n_areas number of areas
+     * @param patches_avg average color of each area (3 * n_areas)
+     */
+    void average_patches(
+      const float* image, size_t width, size_t height, const Box* areas, size_t n_areas, float* patches_avg);
+
+    /**
+     * Computes robust statistics of each area of an RGB image in a single
+     * scan of its pixels, the same ones average_patches averages.
+     *
+     * The variance is accumulated with Welford's method. Trimmed mean and
+     * median come from a histogram of each channel with 256 bins per stop
+     * over the 16 stops up to the clipping level: the median is accurate to
+     * 0.4% and the trimmed mean is exact but for the pixels of the bins it
+     * is cut in.
+     *
+     * @param image the image (3 * width * height)
+     * @param width width of the image
+     * @param height height of the image
+     * @param areas areas to analyze
+     * @param n_areas number of areas
+     * @param clip_level value at which a channel is considered clipped (> 0)
+     * @param trim fraction of the pixels left out on each side of the
+     *        trimmed mean, in [0, .5)
+     * @param statistics statistics of each area (n_areas)
+     */
+    void patch_statistics(
+      const float*     image,
+      size_t           width,
+      size_t           height,
+      const Box*       areas,
+      size_t           n_areas,
+      float            clip_level,
+      float            trim,
+      PatchStatistics* statistics);
+
+    /**
+     * Saves patch statistics as a CSV file, one line per area:
+     * "n_pixels,n_clipped,mean (RGB),variance (RGB),trimmed mean (RGB),
+     * median (RGB)"
+     *
+     * @param filename filename to write the statistics to
+     * @param statistics statistics to write
+     * @param size number of areas
+     *
+     * @returns 0 if sucessfull
+     */
+    int save_patch_statistics(const char* filename, const PatchStatistics* statistics, size_t size);
+
+    /**
+     * Loads patch statistics saved by save_patch_statistics.
+     *
+     * @param filename filename to read the statistics from
+     * @param statistics statistics that are going to be allocated by the
+     *        function
+     * @param size gives the number of read areas
+     *
+     * @returns 0 if sucessfull
+     */
+    int load_patch_statistics(const char* filename, PatchStatistics** statistics, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif   // __cplusplus
+
+#endif   // PATCHES_H_
@@ -0,0 +1,64 @@
+#ifndef STACKING_H_
+#define STACKING_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif   // __cplusplus
+
+    typedef enum
+    {
+        STACK_MEAN,
+        STACK_SIGMA_CLIPPED_MEAN,
+        STACK_MEDIAN
+    } StackingMethod;
+
+    typedef struct {
+        StackingMethod method;
+        float          sigma;           // Rejection threshold in standard deviations (sigma clipping)
+        size_t         bit_depth;       // Bit depth of the raw .dat files
+        size_t         memory_budget;   // Bytes used to hold samples (median)
+    } StackingOptions;
+
+    void stacking_default_options(StackingOptions* options);
+
+    int stacking_method_from_name(const char* name, StackingMethod* method);
+
+    /**
+     * Combines single channel frames into a master frame (e.g. master dark
+     * or flat).
+     *
+     * Frames are streamed: the mean keeps one frame and the accumulators in
+     * memory. The sigma clipped mean needs a second pass on the frames: the
+     * first pass gives the mean and standard deviation of each pixel, the
+     * second one averages the samples within sigma standard deviations.
+     * The median processes the frames in row bands so that the samples of a
+     * band fit in the memory budget: each band needs a pass on the frames.
+     *
+     * Frames can be RAW captures (.txt), .dat files or images (EXR, TIFF),
+     * in which case only the red channel is used.
+     *
+     * @param filenames frames to combine
+     * @param n_files number of frames
+     * @param options stacking options
+     * @param master master frame allocated by the function (width * height)
+     * @param width gives the width of the master frame
+     * @param height gives the height of the master frame
+     *
+     * @returns 0 if sucessfull
+     */
+    int stack_frames(
+      const char**           filenames,
+      size_t                 n_files,
+      const StackingOptions* options,
+      float**                master,
+      size_t*                width,
+      size_t*                height);
+
+#ifdef __cplusplus
+}
+#endif   // __cplusplus
+
+#endif   // STACKING_H_
@@ -0,0 +1,113 @@
+#ifndef SYNTHETIC_H_
+#define SYNTHETIC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <patches.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif   // __cplusplus
+
+#define SYNTHETIC_N_WAVELENGTHS 36   // Sampling of macbeth_patches: 380nm to 730nm, 10nm step
+#define SYNTHETIC_N_PATCHES     24
+
+    typedef struct {
+        size_t   width;
+        size_t   height;
+        uint32_t filters;       // CFA pattern of the mosaic
+        size_t   bit_depth;     // Values are quantized to this bit depth (0 to disable)
+        float    exposure;      // Normalized level of the brightest channel of the white patch
+        float    background;    // Reflectance of the background around the patches
+        float    shot_noise;    // Variance of the noise per unit of normalized signal
+        float    read_noise;    // Standard deviation of the signal independent noise
+        uint64_t seed;          // Seed of the noise, a given seed always gives the same mosaic
+    } SyntheticOptions;
+
+    void synthetic_default_options(SyntheticOptions* options);
+
+    /**
+     * Resamples a spectrum (e.g. from read_spd or read_cmfs) to the
+     * wavelengths of the Macbeth patches. Values outside of the spectrum
+     * range are clamped to the closest sample.
+     *
+     * @param wavelengths wavelengths of the samples in nm, in ascending order
+     * @param values values of the samples
+     * @param size number of samples
+     * @param resampled resampled spectrum (SYNTHETIC_N_WAVELENGTHS)
+     */
+    void synthetic_resample_spectrum(const int* wavelengths, const float* values, size_t size, float* resampled);
+
+    /**
+     * Gaussian model of the camera spectral sensitivities.
+     *
+     * @param peaks wavelength of the peak of each channel in nm (R, G, B)
+     * @param widths standard deviation of each channel in nm (R, G, B)
+     * @param sensitivities sensitivities of the channels, channel by
+     *        channel (3 * SYNTHETIC_N_WAVELENGTHS)
+     */
+    void synthetic_gaussian_sensitivities(const float* peaks, const float* widths, float* sensitivities);
+
+    /**
+     * Computes the camera RGB values of the Macbeth patches and of the
+     * background lit by the illuminant. Values are scaled so that the
+     * brightest channel of the white patch reaches options->exposure.
+     *
+     * @param options generation options
+     * @param illuminant illuminant SPD (SYNTHETIC_N_WAVELENGTHS) or NULL for
+     *        an equal energy illuminant
+     * @param sensitivities camera sensitivities (3 * SYNTHETIC_N_WAVELENGTHS)
+     * @param patches_rgb RGB values of the patches (3 * SYNTHETIC_N_PATCHES)
+     * @param background_rgb RGB value of the background (3)
+     */
+    void synthetic_chart_colors(
+      const SyntheticOptions* options,
+      const float*            illuminant,
+      const float*            sensitivities,
+      float*                  patches_rgb,
+      float*                  background_rgb);
+
+    /**
+     * Gives the areas of the patches in the generated mosaic, with the same
+     * layout as gen-colorchart-image. Areas are inset from the patch edges
+     * so that they only cover pixels demosaiced from a single patch.
+     *
+     * @param width width of the mosaic
+     * @param height height of the mosaic
+     * @param boxes areas of the patches (SYNTHETIC_N_PATCHES)
+     */
+    void synthetic_chart_boxes(size_t width, size_t height, Box* boxes);
+
+    /**
+     * Renders the chart in a Bayer mosaic with Poisson-Gaussian noise:
+     * the noise of a pixel has a variance shot_noise * v + read_noise^2.
+     * The noise only depends on the seed and on the pixel position so the
+     * result does not depend on the number of threads.
+     *
+     * @param options generation options
+     * @param patches_rgb RGB values of the patches (3 * SYNTHETIC_N_PATCHES)
+     * @param background_rgb RGB value of the background (3)
+     * @param bayered_pixels mosaic to render (width * height)
+     */
+    void synthetic_render_mosaic(
+      const SyntheticOptions* options, const float* patches_rgb, const float* background_rgb, float* bayered_pixels);
+
+    /**
+     * Writes a mosaic as a RAW capture readable by read_raw_file: a .txt
+     * metadata file and a .dat file with the same base name.
+     *
+     * @param filename filename of the metadata file (.txt)
+     * @param bayered_pixels mosaic to write (width * height)
+     * @param options options the mosaic was generated with
+     *
+     * @returns 0 if sucessfull
+     */
+    int synthetic_write_raw(const char* filename, const float* bayered_pixels, const SyntheticOptions* options);
+
+#ifdef __cplusplus
+}
+#endif   // __cplusplus
+
+#endif   // SYNTHETIC_H_
@@ -0,0 +1,419 @@
+#include <patches.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Bins of the histogram of each channel: the exponent and the highest
+// mantissa bits of a float, 256 bins per stop over the 16 stops up to the
+// stop of the clipping level
+#define PATCH_HISTOGRAM_MANTISSA_BITS 8
+#define PATCH_HISTOGRAM_BINS          (16 << PATCH_HISTOGRAM_MANTISSA_BITS)
+
+// Calls f(pixel) on each pixel of the image inside an area. Only the
+// bounding box of the area is scanned
+template<typename F>
+static void for_each_pixel(const float* image, size_t width, size_t height, const Box& b, F f)
+{
+    const float min_x = std::min(std::min(b.a.x, b.b.x), std::min(b.c.x, b.d.x));
+    const float max_x = std::max(std::max(b.a.x, b.b.x), std::max(b.c.x, b.d.x));
+    const float min_y = std::min(std::min(b.a.y, b.b.y), std::min(b.c.y, b.d.y));
+    const float max_y = std::max(std::max(b.a.y, b.b.y), std::max(b.c.y, b.d.y));
+
+    const int x_start = std::max(0, (int)std::floor(min_x));
+    const int x_end   = std::min((int)width - 1, (int)std::ceil(max_x));
+    const int y_start = std::max(0, (int)std::floor(min_y));
+    const int y_end   = std::min((int)height - 1, (int)std::ceil(max_y));
+
+    for (int y = y_start; y <= y_end; y++) {
+        for (int x = x_start; x <= x_end; x++) {
+            const Point currentPixel = {(float)x, (float)y};
+
+            if (isInBox(&currentPixel, &b)) {
+                f(&image[3 * (y * width + x)]);
+            }
+        }
+    }
+}
+
+
+// Histogram of a channel keeping the sum of the values of each bin, so that
+// the pixels of whole bins are summed exactly. Bins are read from the bits
+// of the values rather than with a logarithm
+class ChannelHistogram
+{
+  public:
+    explicit ChannelHistogram(float clip_level)
+      : _count(PATCH_HISTOGRAM_BINS, 0)
+      , _sum(PATCH_HISTOGRAM_BINS, 0.)
+      , _key_min(getKey(clip_level) + (1 << PATCH_HISTOGRAM_MANTISSA_BITS) - PATCH_HISTOGRAM_BINS)
+    {}
+
+    void add(float value)
+    {
+        // The first bin takes everything below the range, including zero and
+        // negative values, the last one everything above
+        int bin = 0;
+
+        if (value > 0.f) {
+            bin = std::max(0, std::min(PATCH_HISTOGRAM_BINS - 1, getKey(value) - _key_min));
+        }
+
+        _count[bin]++;
+        _sum[bin] += value;
+    }
+
+    // Mean of the pixels of rank [first, last)
+    double getRangeMean(double first, double last) const
+    {
+        double sum = 0., rank = 0.;
+
+        for (int bin = 0; bin < PATCH_HISTOGRAM_BINS && rank < last; bin++) {
+            if (_count[bin] == 0) continue;
+
+            // Part of the bin in the range, at the bin mean
+            const double start = std::max(rank, first);
+            const double end   = std::min(rank + _count[bin], last);
+
+            if (end > start) {
+                sum += (end - start) * _sum[bin] / _count[bin];
+            }
+
+            rank += _count[bin];
+        }
+
+        return (last > first) ? sum / (last - first) : 0.;
+    }
+
+    // Value of the given rank, interpolated inside its bin
+    double getQuantile(double rank) const
+    {
+        double below = 0.;
+
+        for (int bin = 0; bin < PATCH_HISTOGRAM_BINS; bin++) {
+            if (_count[bin] == 0) continue;
+
+            if (below + _count[bin] > rank) {
+                // No edges for the first and last bins, open ended
+                if (bin == 0 || bin == PATCH_HISTOGRAM_BINS - 1) {
+                    return _sum[bin] / _count[bin];
+                }
+
+                const double lower = getValue(_key_min + bin);
+                const double upper = getValue(_key_min + bin + 1);
+
+                return lower + (upper - lower) * (rank - below + .5) / _count[bin];
+            }
+
+            below += _count[bin];
+        }
+
+        return 0.;
+    }
+
+  private:
+    // Monotonic in the value for positive floats
+    static int getKey(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        return (int)(bits >> (23 - PATCH_HISTOGRAM_MANTISSA_BITS));
+    }
+
+    // Lower edge of the bin of a key
+    static float getValue(int key)
+    {
+        const uint32_t bits = (uint32_t)key << (23 - PATCH_HISTOGRAM_MANTISSA_BITS);
+
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+
+        return value;
+    }
+
+    std::vector<uint32_t> _count;
+    std::vector<double>   _sum;
+    int                   _key_min;
+};
+
+
+extern "C"
+{
+    int load_boxfile(const char* filename, Box** areas, size_t* size)
+    {
+        FILE* fin = fopen(filename, "r");
+
+        if (fin == NULL) {
+            fprintf(stderr, "Cannot open file %s\n", filename);
+            return -1;
+        }
+
+        Box* read_boxes = NULL;
+        *size           = 0;
+
+        while (!feof(fin)) {
+            (*size)++;
+            Box* read_boxes_temp = (Box*)realloc(read_boxes, (*size) * sizeof(Box));
+
+            if (read_boxes_temp == NULL) {
+                fprintf(stderr, "Memory allocation error\n");
+                fclose(fin);
+                free(read_boxes);
+                return -1;
+            }
+
+            read_boxes = read_boxes_temp;
+
+            int r = fscanf(
+              fin,
+              "%f,%f;%f,%f;%f,%f;%f,%f;\n",
+              &(read_boxes[*size - 1].a.x),
+              &(read_boxes[*size - 1].a.y),
+              &(read_boxes[*size - 1].b.x),
+              &(read_boxes[*size - 1].b.y),
+              &(read_boxes[*size - 1].c.x),
+              &(read_boxes[*size - 1].c.y),
+              &(read_boxes[*size - 1].d.x),
+              &(read_boxes[*size - 1].d.y));
+
+            if (r == 0) {
+                fprintf(stderr, "Error while reading file %s\n", filename);
+                fclose(fin);
+                free(read_boxes);
+                return -1;
+            }
+        }
+
+        fclose(fin);
+
+        *areas = read_boxes;
+
+        return 0;
+    }
+
+
+    int save_boxfile(const char* filename, const Box* areas, size_t size)
+    {
+        FILE* fout = fopen(filename, "w");
+
+        if (fout == NULL) {
+            fprintf(stderr, "Cannot open file %s\n", filename);
+            return -1;
+        }
+
+        for (size_t i = 0; i < size; i++) {
+            fprintf(
+              fout,
+              "%g, %g; %g, %g; %g, %g; %g, %g; \n",
+              areas[i].a.x,
+              areas[i].a.y,
+              areas[i].b.x,
+              areas[i].b.y,
+              areas[i].c.x,
+              areas[i].c.y,
+              areas[i].d.x,
+              areas[i].d.y);
+        }
+
+        fclose(fout);
+
+        return 0;
+    }
+
+
+    int isInTriangle(const Point* p, const Point* p0, const Point* p1, const Point* p2)
+    {
+        const float as_x = p->x - p0->x;
+        const float as_y = p->y - p0->y;
+        const float s_ab = (p1->x - p0->x) * as_y - (p1->y - p0->y) * as_x > 0;
+
+        if (((p2->x - p0->x) * as_y - (p2->y - p0->y) * as_x > 0) == s_ab) return 0;
+        if (((p2->x - p1->x) * (p->y - p1->y) - (p2->y - p1->y) * (p->x - p1->x) > 0) != s_ab) return 0;
+
+        return 1;
+    }
+
+
+    int isInBox(const Point* p, const Box* b)
+    {
+        if (isInTriangle(p, &b->a, &b->b, &b->c) != 0 || isInTriangle(p, &b->a, &b->c, &b->d) != 0) {
+            return 1;
+        }
+
+        return 0;
+    }
+
+
+    void average_patches(
+      const float* image, size_t width, size_t height, const Box* areas, size_t n_areas, float* patches_avg)
+    {
+        #pragma omp parallel for schedule(dynamic)
+        for (int patch = 0; patch < (int)n_areas; patch++) {
+            double sum[3]   = {0, 0, 0};
+            size_t n_pixels = 0;
+
+            for_each_pixel(image, width, height, areas[patch], [&](const float* pixel) {
+                for (int c = 0; c < 3; c++) {
+                    sum[c] += pixel[c];
+                }
+
+                n_pixels++;
+            });
+
+            for (int c = 0; c < 3; c++) {
+                patches_avg[3 * patch + c] = (n_pixels > 0) ? (float)(sum[c] / (double)n_pixels) : 0.f;
+            }
+        }
+    }
+
+
+    void patch_statistics(
+      const float*     image,
+      size_t           width,
+      size_t           height,
+      const Box*       areas,
+      size_t           n_areas,
+      float            clip_level,
+      float            trim,
+      PatchStatistics* statistics)
+    {
+        trim = std::max(0.f, std::min(trim, .499f));
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int patch = 0; patch < (int)n_areas; patch++) {
+            std::vector<ChannelHistogram> histograms(3, ChannelHistogram(clip_level));
+
+            double mean[3]   = {0, 0, 0};
+            double m2[3]     = {0, 0, 0};
+            size_t n_pixels  = 0;
+            size_t n_clipped = 0;
+
+            for_each_pixel(image, width, height, areas[patch], [&](const float* pixel) {
+                n_pixels++;
+
+                const double inv_n   = 1. / (double)n_pixels;
+                bool         clipped = false;
+
+                for (int c = 0; c < 3; c++) {
+                    const double delta = pixel[c] - mean[c];
+                    mean[c] += delta * inv_n;
+                    m2[c] += delta * (pixel[c] - mean[c]);
+
+                    histograms[c].add(pixel[c]);
+                    clipped = clipped || pixel[c] >= clip_level;
+                }
+
+                if (clipped) n_clipped++;
+            });
+
+            PatchStatistics& s = statistics[patch];
+
+            s.n_pixels  = n_pixels;
+            s.n_clipped = n_clipped;
+
+            // Ranks are counted from the start of the histogram
+            const double first = std::floor(trim * n_pixels);
+            const double last  = n_pixels - first;
+
+            for (int c = 0; c < 3; c++) {
+                s.mean[c]         = (float)mean[c];
+                s.variance[c]     = (n_pixels > 1) ? (float)(m2[c] / (double)(n_pixels - 1)) : 0.f;
+                s.trimmed_mean[c] = (float)histograms[c].getRangeMean(first, last);
+                s.median[c]       = (n_pixels > 0) ? (float)histograms[c].getQuantile(.5 * (n_pixels - 1)) : 0.f;
+            }
+        }
+    }
+
+
+    int save_patch_statistics(const char* filename, const PatchStatistics* statistics, size_t size)
+    {
+        FILE* fout = fopen(filename, "w");
+
+        if (fout == NULL) {
+            fprintf(stderr, "Cannot open file %s\n", filename);
+            return -1;
+        }
+
+        for (size_t i = 0; i < size; i++) {
+            const PatchStatistics& s = statistics[i];
+
+            fprintf(fout, "%zu,%zu", s.n_pixels, s.n_clipped);
+
+            const float* values[4] = {s.mean, s.variance, s.trimmed_mean, s.median};
+
+            for (const float* v: values) {
+                fprintf(fout, ",%g,%g,%g", v[0], v[1], v[2]);
+            }
+
+            fprintf(fout, "\n");
+        }
+
+        fclose(fout);
+
+        return 0;
+    }
+
+
+    int load_patch_statistics(const char* filename, PatchStatistics** statistics, size_t* size)
+    {
+        FILE* fin = fopen(filename, "r");
+
+        if (fin == NULL) {
+            fprintf(stderr, "Cannot open file %s\n", filename);
+            return -1;
+        }
+
+        std::vector<PatchStatistics> read_statistics;
+
+        for (;;) {
+            PatchStatistics s;
+
+            int r = fscanf(
+              fin,
+              "%zu,%zu,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f\n",
+              &s.n_pixels,
+              &s.n_clipped,
+              &s.mean[0],
+              &s.mean[1],
+              &s.mean[2],
+              &s.variance[0],
+              &s.variance[1],
+              &s.variance[2],
+              &s.trimmed_mean[0],
+              &s.trimmed_mean[1],
+              &s.trimmed_mean[2],
+              &s.median[0],
+              &s.median[1],
+              &s.median[2]);
+
+            if (r == EOF) break;
+
+            if (r != 14) {
+                fprintf(stderr, "Error while reading file %s\n", filename);
+                fclose(fin);
+                return -1;
+            }
+
+            read_statistics.push_back(s);
+        }
+
+        fclose(fin);
+
+        *size       = read_statistics.size();
+        *statistics = (PatchStatistics*)malloc(*size * sizeof(PatchStatistics));
+
+        if (*statistics == NULL && *size > 0) {
+            fprintf(stderr, "Memory allocation error\n");
+            return -1;
+        }
+
+        std::copy(read_statistics.begin(), read_statistics.end(), *statistics);
+
+        return 0;
+    }
+}
@@ -0,0 +1,339 @@
+#include <stacking.h>
+#include <image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Reads a single channel frame whatever its format
+static int read_frame(const char* filename, size_t bit_depth, float** pixels, size_t* width, size_t* height)
+{
+    const size_t len = strlen(filename);
+
+    if (strcmp(filename + len - 3, "txt") == 0 || strcmp(filename + len - 3, "TXT") == 0) {
+        uint32_t filters;
+        return read_raw_file(filename, pixels, width, height, &filters);
+    }
+
+    if (strcmp(filename + len - 3, "dat") == 0 || strcmp(filename + len - 3, "DAT") == 0) {
+        return read_dat(filename, pixels, width, height, bit_depth);
+    }
+
+    float* pg = NULL;
+    float* pb = NULL;
+
+    int err = read_image_rgb(filename, pixels, &pg, &pb, width, height);
+
+    free(pg);
+    free(pb);
+
+    return err;
+}
+
+
+// Reads a frame and checks it has the expected size. The first frame, read
+// to get the size of the master, is used once instead of being read again.
+static int read_frame_checked(
+  const char** filenames,
+  size_t       idx,
+  size_t       bit_depth,
+  size_t       width,
+  size_t       height,
+  float**      first_frame,
+  float**      pixels)
+{
+    if (idx == 0 && *first_frame != NULL) {
+        *pixels      = *first_frame;
+        *first_frame = NULL;
+        return 0;
+    }
+
+    const char* filename = filenames[idx];
+    size_t      frame_width, frame_height;
+
+    *pixels = NULL;
+
+    int err = read_frame(filename, bit_depth, pixels, &frame_width, &frame_height);
+
+    if (err != 0) {
+        std::cerr << "Could not read frame " << filename << std::endl;
+        return err;
+    }
+
+    if (frame_width != width || frame_height != height) {
+        std::cerr << "Frame " << filename << " does not match the size of the first frame" << std::endl;
+        free(*pixels);
+        *pixels = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int stack_mean(
+  const char**           filenames,
+  size_t                 n_files,
+  const StackingOptions* options,
+  float*                 master,
+  size_t                 width,
+  size_t                 height,
+  float**                first_frame)
+{
+    std::vector<double> sum(width * height, 0.);
+
+    for (size_t f = 0; f < n_files; f++) {
+        float* frame = NULL;
+        int    err   = read_frame_checked(filenames, f, options->bit_depth, width, height, first_frame, &frame);
+
+        if (err != 0) {
+            return err;
+        }
+
+        #pragma omp parallel for
+        for (int y = 0; y < (int)height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                sum[y * width + x] += frame[y * width + x];
+            }
+        }
+
+        free(frame);
+    }
+
+    #pragma omp parallel for
+    for (int y = 0; y < (int)height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            master[y * width + x] = (float)(sum[y * width + x] / (double)n_files);
+        }
+    }
+
+    return 0;
+}
+
+
+static int stack_sigma_clipped_mean(
+  const char**           filenames,
+  size_t                 n_files,
+  const StackingOptions* options,
+  float*                 master,
+  size_t                 width,
+  size_t                 height,
+  float**                first_frame)
+{
+    const size_t n_elems = width * height;
+
+    // First pass: Welford's running mean and variance
+    std::vector<double> mean(n_elems, 0.);
+    std::vector<double> m2(n_elems, 0.);
+
+    for (size_t f = 0; f < n_files; f++) {
+        float* frame = NULL;
+        int    err   = read_frame_checked(filenames, f, options->bit_depth, width, height, first_frame, &frame);
+
+        if (err != 0) {
+            return err;
+        }
+
+        const double n = (double)(f + 1);
+
+        #pragma omp parallel for
+        for (int y = 0; y < (int)height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                const size_t i     = y * width + x;
+                const double delta = frame[i] - mean[i];
+
+                mean[i] += delta / n;
+                m2[i] += delta * (frame[i] - mean[i]);
+            }
+        }
+
+        free(frame);
+    }
+
+    // Acceptance interval of each pixel, m2 becomes the half width
+    #pragma omp parallel for
+    for (int y = 0; y < (int)height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            const size_t i = y * width + x;
+            m2[i]          = options->sigma * std::sqrt(m2[i] / (double)n_files);
+        }
+    }
+
+    // Second pass: average of the samples within the interval
+    std::vector<double>   sum(n_elems, 0.);
+    std::vector<uint32_t> count(n_elems, 0);
+
+    for (size_t f = 0; f < n_files; f++) {
+        float* frame = NULL;
+        int    err   = read_frame_checked(filenames, f, options->bit_depth, width, height, first_frame, &frame);
+
+        if (err != 0) {
+            return err;
+        }
+
+        #pragma omp parallel for
+        for (int y = 0; y < (int)height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                const size_t i        = y * width + x;
+                const bool   accepted = std::abs(frame[i] - mean[i]) <= m2[i];
+
+                sum[i] += accepted ? frame[i] : 0.;
+                count[i] += accepted ? 1 : 0;
+            }
+        }
+
+        free(frame);
+    }
+
+    #pragma omp parallel for
+    for (int y = 0; y < (int)height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            const size_t i = y * width + x;
+            master[i]      = (float)((count[i] > 0) ? sum[i] / (double)count[i] : mean[i]);
+        }
+    }
+
+    return 0;
+}
+
+
+static int stack_median(
+  const char**           filenames,
+  size_t                 n_files,
+  const StackingOptions* options,
+  float*                 master,
+  size_t                 width,
+  size_t                 height,
+  float**                first_frame)
+{
+    // Samples of a band are stored pixel by pixel: samples[(row * width + x) * n_files + frame]
+    const size_t row_bytes = width * n_files * sizeof(float);
+    const size_t band_rows = std::min(height, std::max((size_t)1, options->memory_budget / row_bytes));
+
+    std::vector<float> samples(band_rows * width * n_files);
+
+    for (size_t band_start = 0; band_start < height; band_start += band_rows) {
+        const size_t band_end = std::min(height, band_start + band_rows);
+
+        for (size_t f = 0; f < n_files; f++) {
+            float* frame = NULL;
+            int    err   = read_frame_checked(filenames, f, options->bit_depth, width, height, first_frame, &frame);
+
+            if (err != 0) {
+                return err;
+            }
+
+            #pragma omp parallel for
+            for (int y = (int)band_start; y < (int)band_end; y++) {
+                float* band_row = &samples[(y - band_start) * width * n_files];
+
+                for (size_t x = 0; x < width; x++) {
+                    band_row[x * n_files + f] = frame[y * width + x];
+                }
+            }
+
+            free(frame);
+        }
+
+        #pragma omp parallel for
+        for (int y = (int)band_start; y < (int)band_end; y++) {
+            for (size_t x = 0; x < width; x++) {
+                float* s    = &samples[((y - band_start) * width + x) * n_files];
+                float* half = s + n_files / 2;
+
+                std::nth_element(s, half, s + n_files);
+
+                if (n_files % 2 == 0) {
+                    // Average of the two middle samples: the lower one is the max of the lower half
+                    const float lower     = *std::max_element(s, half);
+                    master[y * width + x] = .5f * (lower + *half);
+                } else {
+                    master[y * width + x] = *half;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+extern "C"
+{
+    void stacking_default_options(StackingOptions* options)
+    {
+        options->method        = STACK_MEAN;
+        options->sigma         = 3.f;
+        options->bit_depth     = 16;
+        options->memory_budget = (size_t)1024 * 1024 * 1024;
+    }
+
+
+    int stacking_method_from_name(const char* name, StackingMethod* method)
+    {
+        if (strcmp(name, "MEAN") == 0) {
+            *method = STACK_MEAN;
+        } else if (strcmp(name, "SIGMA_CLIP") == 0) {
+            *method = STACK_SIGMA_CLIPPED_MEAN;
+        } else if (strcmp(name, "MEDIAN") == 0) {
+            *method = STACK_MEDIAN;
+        } else {
+            return -1;
+        }
+
+        return 0;
+    }
+
+
+    int stack_frames(
+      const char**           filenames,
+      size_t                 n_files,
+      const StackingOptions* options,
+      float**                master,
+      size_t*                width,
+      size_t*                height)
+    {
+        if (n_files == 0) {
+            std::cerr << "No frame to stack" << std::endl;
+            return -1;
+        }
+
+        // The first frame gives the size of the master frame
+        float* frame = NULL;
+        int    err   = read_frame(filenames[0], options->bit_depth, &frame, width, height);
+
+        if (err != 0) {
+            std::cerr << "Could not read frame " << filenames[0] << std::endl;
+            return err;
+        }
+
+        *master = (float*)calloc((*width) * (*height), sizeof(float));
+
+        switch (options->method) {
+            case STACK_MEAN:
+                err = stack_mean(filenames, n_files, options, *master, *width, *height, &frame);
+                break;
+
+            case STACK_SIGMA_CLIPPED_MEAN:
+                err = stack_sigma_clipped_mean(filenames, n_files, options, *master, *width, *height, &frame);
+                break;
+
+            case STACK_MEDIAN:
+                err = stack_median(filenames, n_files, options, *master, *width, *height, &frame);
+                break;
+        }
+
+        free(frame);
+
+        if (err != 0) {
+            free(*master);
+            *master = NULL;
+        }
+
+        return err;
+    }
+}
@@ -0,0 +1,284 @@
+#include <synthetic.h>
+#include <imageraw.h>
+
+#include <macbeth-data.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Layout of the chart, same as gen-colorchart-image: 6x4 patches separated
+// by a gap of SPACING patch size, with a gap of SPACING / 2 between patches
+#define CHART_COLUMNS 6
+#define CHART_ROWS    4
+#define SPACING       .1f
+
+// Margin between the areas given by synthetic_chart_boxes and the patch
+// edges in patch size, keeps the pixels interpolated across edges out
+#define BOX_MARGIN .1f
+
+// Index of the white patch in macbeth_patches
+#define WHITE_PATCH 18
+
+// Start and end of a patch along one axis in patch units
+static void patch_span(int idx, int n, float* start, float* end)
+{
+    *start = (float)idx + ((idx == 0) ? SPACING : SPACING / 2.f);
+    *end   = (float)idx + 1.f - ((idx == n - 1) ? SPACING : SPACING / 2.f);
+}
+
+
+// Gives, for each position along one axis, the patch index or -1 if the
+// position is in a gap
+static void patch_lookup(size_t size, int n, std::vector<int>& lookup)
+{
+    lookup.resize(size);
+
+    for (size_t i = 0; i < size; i++) {
+        const float u   = (float)n * (float)i / (float)size;
+        const int   idx = std::min((int)u, n - 1);
+
+        float start, end;
+        patch_span(idx, n, &start, &end);
+
+        lookup[i] = (u > start && u < end) ? idx : -1;
+    }
+}
+
+
+// Counter based generator: the output only depends on the seed and on the
+// counter so any pixel can be generated independently
+static inline uint64_t hash64(uint64_t seed, uint64_t counter)
+{
+    uint64_t z = seed + counter * 0x9E3779B97F4A7C15ull;
+    z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z          = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+
+// Two independent standard normal samples (Box-Muller)
+static inline void gaussian_pair(uint64_t seed, uint64_t counter, float* n0, float* n1)
+{
+    const uint64_t h  = hash64(seed, counter);
+    const float    u1 = (float)((h >> 40) + 1) * (1.f / 16777216.f);   // (0, 1]
+    const float    u2 = (float)(h & 0xFFFFFF) * (1.f / 16777216.f);    // [0, 1)
+    const float    r  = std::sqrt(-2.f * std::log(u1));
+
+    *n0 = r * std::cos(6.2831853f * u2);
+    *n1 = r * std::sin(6.2831853f * u2);
+}
+
+
+extern "C"
+{
+    void synthetic_default_options(SyntheticOptions* options)
+    {
+        options->width      = 1200;
+        options->height     = 800;
+        options->filters    = 0x94949494;   // RGGB
+        options->bit_depth  = 12;
+        options->exposure   = .8f;
+        options->background = .05f;
+        options->shot_noise = 1e-4f;
+        options->read_noise = 1e-3f;
+        options->seed       = 0;
+    }
+
+
+    void synthetic_resample_spectrum(const int* wavelengths, const float* values, size_t size, float* resampled)
+    {
+        for (size_t i = 0; i < SYNTHETIC_N_WAVELENGTHS; i++) {
+            const int wl = macbeth_wavelengths[i];
+
+            if (size == 0) {
+                resampled[i] = 0.f;
+            } else if (wl <= wavelengths[0]) {
+                resampled[i] = values[0];
+            } else if (wl >= wavelengths[size - 1]) {
+                resampled[i] = values[size - 1];
+            } else {
+                const size_t j = std::upper_bound(wavelengths, wavelengths + size, wl) - wavelengths;
+                const float  t = (float)(wl - wavelengths[j - 1]) / (float)(wavelengths[j] - wavelengths[j - 1]);
+
+                resampled[i] = values[j - 1] + t * (values[j] - values[j - 1]);
+            }
+        }
+    }
+
+
+    void synthetic_gaussian_sensitivities(const float* peaks, const float* widths, float* sensitivities)
+    {
+        for (int c = 0; c < 3; c++) {
+            for (size_t i = 0; i < SYNTHETIC_N_WAVELENGTHS; i++) {
+                const float d = ((float)macbeth_wavelengths[i] - peaks[c]) / widths[c];
+
+                sensitivities[c * SYNTHETIC_N_WAVELENGTHS + i] = std::exp(-.5f * d * d);
+            }
+        }
+    }
+
+
+    void synthetic_chart_colors(
+      const SyntheticOptions* options,
+      const float*            illuminant,
+      const float*            sensitivities,
+      float*                  patches_rgb,
+      float*                  background_rgb)
+    {
+        for (int p = 0; p <= SYNTHETIC_N_PATCHES; p++) {
+            float* rgb = (p < SYNTHETIC_N_PATCHES) ? &patches_rgb[3 * p] : background_rgb;
+
+            for (int c = 0; c < 3; c++) {
+                float sum = 0.f;
+
+                for (size_t i = 0; i < SYNTHETIC_N_WAVELENGTHS; i++) {
+                    const float reflectance = (p < SYNTHETIC_N_PATCHES) ? macbeth_patches[p][i] : options->background;
+                    const float light       = (illuminant != NULL) ? illuminant[i] : 1.f;
+
+                    sum += reflectance * light * sensitivities[c * SYNTHETIC_N_WAVELENGTHS + i];
+                }
+
+                rgb[c] = sum;
+            }
+        }
+
+        const float* white     = &patches_rgb[3 * WHITE_PATCH];
+        const float  white_max = std::max(white[0], std::max(white[1], white[2]));
+        const float  scale     = (white_max > 0) ? options->exposure / white_max : 0.f;
+
+        for (int i = 0; i < 3 * SYNTHETIC_N_PATCHES; i++) {
+            patches_rgb[i] *= scale;
+        }
+
+        for (int c = 0; c < 3; c++) {
+            background_rgb[c] *= scale;
+        }
+    }
+
+
+    void synthetic_chart_boxes(size_t width, size_t height, Box* boxes)
+    {
+        const float patch_width  = (float)width / (float)CHART_COLUMNS;
+        const float patch_height = (float)height / (float)CHART_ROWS;
+
+        for (int row = 0; row < CHART_ROWS; row++) {
+            for (int col = 0; col < CHART_COLUMNS; col++) {
+                float x0, x1, y0, y1;
+                patch_span(col, CHART_COLUMNS, &x0, &x1);
+                patch_span(row, CHART_ROWS, &y0, &y1);
+
+                x0 += BOX_MARGIN;
+                x1 -= BOX_MARGIN;
+                y0 += BOX_MARGIN;
+                y1 -= BOX_MARGIN;
+
+                Box& b = boxes[row * CHART_COLUMNS + col];
+                b.a.x  = x0 * patch_width;
+                b.a.y  = y0 * patch_height;
+                b.b.x  = x1 * patch_width;
+                b.b.y  = y0 * patch_height;
+                b.c.x  = x1 * patch_width;
+                b.c.y  = y1 * patch_height;
+                b.d.x  = x0 * patch_width;
+                b.d.y  = y1 * patch_height;
+            }
+        }
+    }
+
+
+    void synthetic_render_mosaic(
+      const SyntheticOptions* options, const float* patches_rgb, const float* background_rgb, float* bayered_pixels)
+    {
+        const size_t   width     = options->width;
+        const size_t   height    = options->height;
+        const uint32_t filters   = options->filters;
+        const float    read_var  = options->read_noise * options->read_noise;
+        const float    max_value = (options->bit_depth > 0) ? (float)((1 << options->bit_depth) - 1) : 0.f;
+
+        std::vector<int> columns, rows;
+        patch_lookup(width, CHART_COLUMNS, columns);
+        patch_lookup(height, CHART_ROWS, rows);
+
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < (int)height; y++) {
+            float* row_out = &bayered_pixels[y * width];
+
+            // The two colors of the CFA row (G2 is reported as 3)
+            const unsigned int cfa[2] = {filters >> (((y << 1 & 14) + 0) << 1) & 3,
+                                         filters >> (((y << 1 & 14) + 1) << 1) & 3};
+
+            for (size_t x = 0; x < width; x += 2) {
+                float noise[2];
+                gaussian_pair(options->seed, (uint64_t)y * width + x, &noise[0], &noise[1]);
+
+                for (size_t i = 0; i < 2 && x + i < width; i++) {
+                    const int    col   = columns[x + i];
+                    const float* color = (col >= 0 && rows[y] >= 0) ? &patches_rgb[3 * (rows[y] * CHART_COLUMNS + col)]
+                                                                     : background_rgb;
+
+                    const float signal = color[(cfa[i] == 3) ? 1 : cfa[i]];
+                    float       v      = signal + std::sqrt(options->shot_noise * signal + read_var) * noise[i];
+
+                    v = std::min(std::max(v, 0.f), 1.f);
+
+                    if (max_value > 0) {
+                        v = std::floor(v * max_value + .5f) / max_value;
+                    }
+
+                    row_out[x + i] = v;
+                }
+            }
+        }
+    }
+
+
+    int synthetic_write_raw(const char* filename, const float* bayered_pixels, const SyntheticOptions* options)
+    {
+        const size_t len = strlen(filename);
+
+        if (len < 4 || (strcmp(filename + len - 3, "txt") != 0 && strcmp(filename + len - 3, "TXT") != 0)) {
+            std::cerr << "The metadata file shall be a .txt file: " << filename << std::endl;
+            return -1;
+        }
+
+        const std::string path_info(filename);
+        const std::string path_dat = path_info.substr(0, len - 3) + "dat";
+        const size_t      sep      = path_info.find_last_of("/\\");
+        const std::string name_info = (sep == std::string::npos) ? path_info : path_info.substr(sep + 1);
+        const std::string name_dat  = (sep == std::string::npos) ? path_dat : path_dat.substr(sep + 1);
+        const size_t      bit_depth = (options->bit_depth > 0) ? options->bit_depth : 16;
+
+        const char* bayer_pattern = filters_to_bayer_pattern(options->filters);
+
+        if (bayer_pattern == NULL) {
+            std::cerr << "Unsupported CFA pattern" << std::endl;
+            return -1;
+        }
+
+        int err = write_dat(path_dat.c_str(), bayered_pixels, options->width, options->height, bit_depth);
+
+        if (err != 0) {
+            return err;
+        }
+
+        std::vector<char> pattern(bayer_pattern, bayer_pattern + strlen(bayer_pattern) + 1);
+        std::vector<char> image(name_dat.c_str(), name_dat.c_str() + name_dat.size() + 1);
+        std::vector<char> info(name_info.c_str(), name_info.c_str() + name_info.size() + 1);
+
+        RAWMetadata metadata;
+        metadata.ledIdx         = 0;
+        metadata.exposureTime   = 1.f;
+        metadata.aperture       = 1.f;
+        metadata.gain           = 1.f;
+        metadata.bitDepth       = (int)bit_depth;
+        metadata.bayerPattern   = pattern.data();
+        metadata.filename_image = image.data();
+        metadata.filename_info  = info.data();
+
+        return write_raw_metadata(filename, &metadata);
+    }
+}